@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "bpm/audio_buffer.h"
+#include "bpm/mp3_decoder.h"
+
+namespace bpm {
+
+enum class AudioFormat { UNKNOWN, MP3, MP4, WAV };
+
+// Chooses a decoder from a file's leading bytes rather than its name, for
+// files on disk and for uploads already in memory:
+//   WAV  "RIFF" .... "WAVE"
+//   MP4  "ftyp" box at offset 4 (MP4, M4A, MOV)
+//   MP3  ID3v2 tag, or consecutive MPEG audio frames in the first 16 KB
+class AudioDecoder {
+ public:
+  // Bytes of a file that sniff() needs at most.
+  static constexpr std::size_t kSniffBytes = 16 * 1024;
+
+  static AudioFormat sniff(const std::uint8_t *data, std::size_t size);
+  static std::string format_name(AudioFormat format);
+
+  // Decodes without touching the filesystem, except MP4, which ffmpeg has to
+  // read from a file.  Throws for unrecognised data.  `mp3_rate` applies to
+  // MP3 input only.
+  static AudioBuffer decode(const std::uint8_t *data, std::size_t size,
+                            const Mp3Decoder::ReducedRate &mp3_rate = Mp3Decoder::ReducedRate());
+
+  // Reads the first kSniffBytes of `filepath` to pick the decoder, and
+  // reports the format found through `sniffed` before decoding.
+  static AudioBuffer decode_file(const std::string &filepath, AudioFormat *sniffed = nullptr,
+                                 const Mp3Decoder::ReducedRate &mp3_rate = Mp3Decoder::ReducedRate());
+  static AudioFormat sniff_file(const std::string &filepath);
+};
+
+}  // namespace bpm
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bpm/pipeline.h"
+
+namespace bpm {
+
+// Analysis results saved next to a track so click tracks can be re-rendered
+// with other click settings without running the analysis again.
+//
+// Sidecar layout (integers little-endian, "varint" is unsigned LEB128):
+//
+//   "BPMGRID1"                       8-byte magic
+//   u32 version (1)
+//   u32 sample_rate, u64 num_frames  of the decoded input; checked on load
+//   f32 bpm
+//   u8 flags                         bit 0: key present, bit 1: meter present
+//   string key, f32 key_confidence
+//   string time_signature, u32 beats_per_measure, f32 meter_confidence
+//   beats, downbeats                 each a varint count, then varint deltas
+//                                    from the previous sample position
+//
+// Strings are a u16 byte length followed by the bytes.  Most beat deltas
+// take two or three bytes, so a four-minute track's grid is about 2 KB.
+struct BeatGrid {
+  static constexpr std::uint32_t kFormatVersion = 1;
+
+  int sample_rate = 0;
+  std::uint64_t num_frames = 0;
+  float bpm = 0.0f;
+  std::vector<std::size_t> beat_samples;
+  bool has_key = false;
+  std::string key;
+  float key_confidence = 0.0f;
+  bool has_meter = false;
+  std::string time_signature;
+  int beats_per_measure = 0;
+  float meter_confidence = 0.0f;
+  std::vector<std::size_t> downbeat_samples;
+
+  static BeatGrid from_result(const JobResult &result);
+
+  // Both throw std::runtime_error on I/O errors or a malformed file.
+  void save(const std::string &path) const;
+  static BeatGrid load(const std::string &path);
+};
+
+}  // namespace bpm
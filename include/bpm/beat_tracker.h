@@ -1,21 +1,87 @@
 #pragma once
 
 #include <cstddef>
+#include <limits>
 #include <vector>
 
 namespace bpm {
 
+// How the DP searches the predecessor window [t - 2P, t - P/2].
+enum class DpSearch {
+  EXHAUSTIVE,  // score every predecessor
+  PRUNED,      // monotonic-deque window maximum bounds each lag's score;
+               // only the beam of lags near P that can win is scored
+               // (see BeatTracker)
+};
+
 class BeatTracker {
  public:
   struct Result {
     std::vector<std::size_t> beat_samples;
     double score = 0.0;
+    bool abandoned = false;  // track_bounded() only; beats and score are empty
   };
 
+  // PRUNED tracks the maximum of dp over the predecessor window with a
+  // monotonic deque.  Since the transition penalty grows with distance from
+  // one period, only a contiguous beam of lags around P can have a bound
+  // (window maximum minus penalty) above the best score already known; the
+  // rest of the window is not scored.  A chosen predecessor is never more
+  // than `tolerance` below the exhaustive optimum for that frame, and with
+  // tolerance 0 the result is identical to EXHAUSTIVE.
+  explicit BeatTracker(DpSearch search = DpSearch::EXHAUSTIVE, double tolerance = 0.0)
+      : search_(search), tolerance_(tolerance) {}
+
   Result track(const std::vector<float> &onset_strength,
                int period_frames,
                int hop_size,
                float alpha = 680.0f) const;
+
+  // track() with branch-and-bound early termination, for comparing tempo
+  // candidates by score per beat (score / beat count).  At kBoundCheckpoints
+  // evenly spaced frames it checks, from the DP so far and a coarse
+  // backward pass of the same DP, whether the returned path could still
+  // score more than `threshold` per beat.  If not, it gives up and the
+  // result has `abandoned` set.  A result that is not abandoned is
+  // identical to track()'s.  A negative alpha disables the check.
+  Result track_bounded(const std::vector<float> &onset_strength,
+                       int period_frames,
+                       int hop_size,
+                       double threshold,
+                       float alpha = 680.0f) const;
+
+  // Tracks many clips in one call.  `onset_strength` holds the clips'
+  // envelopes back to back; clip i is [offsets[i], offsets[i + 1]) and is
+  // tracked at period_frames[i] exactly as track() would track it alone.
+  // The clips are still tracked one after another; what the batch saves is
+  // the allocation, since the DP tables and penalty buffer are allocated
+  // once for all of them.  A clip with a non-positive period or no frames
+  // gets an empty result.
+  std::vector<Result> track_batch(const std::vector<float> &onset_strength,
+                                  const std::vector<std::size_t> &offsets,
+                                  const std::vector<int> &period_frames,
+                                  int hop_size,
+                                  float alpha = 680.0f) const;
+
+ private:
+  static constexpr int kBoundCheckpoints = 8;
+
+  // DP and backtrace over one envelope, using caller-provided dp / prev
+  // storage of `total_frames` entries.  With a finite `abandon_threshold`
+  // the DP also counts beats per frame and checks the bound described at
+  // track_bounded().
+  Result track_span(const float *onset_strength,
+                    int total_frames,
+                    int period_frames,
+                    int hop_size,
+                    float alpha,
+                    double *dp,
+                    int *prev,
+                    std::vector<double> &penalty_by_lag,
+                    double abandon_threshold = -std::numeric_limits<double>::infinity()) const;
+
+  DpSearch search_;
+  double tolerance_;
 };
 
 }  // namespace bpm
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bpm/pipeline.h"
+
+namespace bpm {
+
+// Batch sink that writes JobResults as a column-chunked table for analytics
+// ingestion.  Rows are buffered into row groups; when a group fills, each
+// column is written as one contiguous chunk and the buffers are cleared, so
+// memory is bounded by one row group regardless of how many jobs are written.
+//
+// File layout (all integers little-endian):
+//
+//   "BPMTBL01"                          8-byte magic
+//   row group 0: column chunk 0 .. column chunk C-1
+//   row group 1: ...
+//   footer
+//   u64 footer offset, "BPMTBL01"       trailer
+//
+// Footer: u32 version (1), u32 column count C, then per column
+// { u8 type, u16 name length, name bytes }, then u32 row group count, then
+// per group { u32 rows, C x { u64 chunk offset, u64 chunk length } }.
+// A reader seeks to the trailer, reads the footer and loads only the column
+// chunks it needs.
+//
+// Column chunk encodings for a group of n rows:
+//   F64       n x f64  (NaN where the value was not measured)
+//   U32       n x u32
+//   STRING    (n + 1) x u32 byte offsets, then UTF-8 bytes
+//   LIST_U64  (n + 1) x u32 element offsets, then u64 elements
+class ColumnarWriter {
+ public:
+  enum class ColumnType : std::uint8_t {
+    F64 = 1,
+    U32 = 2,
+    STRING = 3,
+    LIST_U64 = 4,
+  };
+
+  // Creates (truncates) `path`.  Throws if it cannot be opened.
+  explicit ColumnarWriter(const std::string &path, std::size_t rows_per_group = 1024);
+  ~ColumnarWriter();
+
+  ColumnarWriter(const ColumnarWriter &) = delete;
+  ColumnarWriter &operator=(const ColumnarWriter &) = delete;
+
+  void append(const JobResult &result);
+
+  // Flushes the partial row group and writes the footer.  Called by the
+  // destructor if needed (errors there are swallowed).
+  void close();
+
+  std::size_t rows_written() const { return rows_; }
+
+ private:
+  struct Column {
+    std::string name;
+    ColumnType type;
+    std::vector<unsigned char> values;  // fixed-width values, string bytes or list elements
+    std::vector<std::uint32_t> offsets;  // STRING / LIST_U64 only, starts with 0
+  };
+  struct ChunkRef {
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+  };
+  struct RowGroup {
+    std::uint32_t rows = 0;
+    std::vector<ChunkRef> chunks;
+  };
+
+  void add_column(const char *name, ColumnType type);
+  void put_f64(std::size_t column, double value);
+  void put_u32(std::size_t column, std::uint32_t value);
+  void put_string(std::size_t column, const std::string &value);
+  void put_list(std::size_t column, const std::vector<std::size_t> &values);
+  void flush_group();
+  void write_bytes(const void *data, std::size_t size);
+
+  std::string path_;
+  std::ofstream out_;
+  std::size_t rows_per_group_ = 0;
+  std::size_t pending_rows_ = 0;
+  std::size_t rows_ = 0;
+  std::uint64_t position_ = 0;
+  bool closed_ = false;
+  std::vector<Column> columns_;
+  std::vector<RowGroup> groups_;
+};
+
+}  // namespace bpm
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bpm {
+
+// On-disk cache of per-chunk spectral features, keyed by a hash of the PCM
+// samples each chunk depends on.  Because keys are content hashes, a
+// re-submitted edit of a track only misses on the chunks whose samples
+// changed; everything else is loaded instead of re-transformed.
+//
+// Entries never expire on their own.  prune() bounds the directory's size
+// by deleting the least recently used entries; a hit refreshes an entry's
+// modification time.
+class FeatureCache {
+ public:
+  // Part of every key.  Must be incremented whenever the numerics of a
+  // cached feature change (windowing, FFT, mel or chroma reduction, log
+  // scaling), or entries written by older builds would be loaded as if
+  // they were current.
+  static constexpr int kAnalysisVersion = 2;
+
+  explicit FeatureCache(std::string directory);
+
+  // 128-bit hash of `count` samples, hex encoded, prefixed with `tag`
+  // (which should encode the feature kind and its analysis parameters) and
+  // kAnalysisVersion.
+  static std::string chunk_key(const std::string &tag, const float *samples,
+                               std::size_t count);
+
+  // Content-defined chunking of a frame sequence with `hop` samples between
+  // frame starts.  Returns the end of the chunk that starts at frame
+  // `begin` (of `frames`): a frame whose first `hop` samples hash to an
+  // anchor value starts a new chunk once the current one holds target/2
+  // frames, and no chunk grows past 4 * target frames, so chunks average
+  // about `target` frames.  Because boundaries follow the samples rather than
+  // absolute positions, audio shifted by a whole number of hops (a trimmed
+  // intro, an inserted section) falls back into the chunks cached before
+  // the edit after its first anchor.  `target` must be a power of two.
+  static std::size_t content_chunk_end(const float *samples, std::size_t begin,
+                                       std::size_t frames, std::size_t hop, std::size_t target);
+
+  bool load(const std::string &key, std::vector<float> &values) const;
+  void store(const std::string &key, const std::vector<float> &values) const;
+
+  // Deletes the least recently used entries until the cache holds at most
+  // `max_bytes`, along with temporary files left by interrupted stores.
+  // Returns the number of entries deleted.
+  std::size_t prune(std::uint64_t max_bytes) const;
+
+  std::uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  std::uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+ private:
+  std::string path_for(const std::string &key) const;
+
+  std::string directory_;
+  mutable std::atomic<std::uint64_t> hits_{0};
+  mutable std::atomic<std::uint64_t> misses_{0};
+};
+
+}  // namespace bpm
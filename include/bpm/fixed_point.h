@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bpm {
+
+// Integer-only building blocks for the fixed-point analysis path.
+namespace fixed {
+
+// Float in [-1, 1] to Q15 with rounding and saturation.
+std::int16_t to_q15(float value);
+
+// log2(x) in Q16 (16 fractional bits) using a 64-entry interpolated table.
+// Returns 0 for x == 0.
+std::int32_t log2_q16(std::uint64_t x);
+
+// Real FFT on 32-bit integers.  Computes an N/2-point complex radix-2 FFT
+// with Q30 twiddles and a 1/2 shift per stage, then splits it into the N/2+1
+// bins of the real transform.  Output is scaled by 1/N; inputs may use up to
+// 28 bits of magnitude without overflow.
+class RealFFT {
+ public:
+  explicit RealFFT(int size);
+
+  int size() const { return size_; }
+
+  // `input` holds size() samples; `re`/`im` receive size()/2 + 1 bins.
+  void forward(const std::int32_t *input, std::int32_t *re, std::int32_t *im);
+
+ private:
+  int size_ = 0;
+  int half_ = 0;
+  int stages_ = 0;
+  std::vector<std::int32_t> cos_q30_;  // e^{-2 pi i k / N}, k <= N/2
+  std::vector<std::int32_t> sin_q30_;
+  std::vector<std::uint32_t> bitrev_;
+  std::vector<std::int32_t> work_re_;
+  std::vector<std::int32_t> work_im_;
+};
+
+}  // namespace fixed
+}  // namespace bpm
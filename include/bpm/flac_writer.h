@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "bpm/audio_buffer.h"
+
+namespace bpm {
+
+// Encoder threads, and blocks handed to each thread per batch (a batch
+// is encoded in parallel, then written before the next one starts).
+// 0 picks the defaults: all hardware threads, 16 blocks per thread.
+// The output bytes do not depend on either.
+struct FlacParallelism {
+  unsigned threads = 0;
+  std::size_t blocks_per_thread = 0;
+};
+
+class FlacWriter {
+ public:
+  // Encodes 16-bit FLAC using fixed predictors (orders 0-4) and partitioned
+  // Rice residuals.  Blocks are encoded in parallel, then written in order.
+  static void write(const std::string &filepath, const AudioBuffer &audio,
+                    const FlacParallelism &parallelism = FlacParallelism());
+};
+
+}  // namespace bpm
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bpm/pipeline.h"
+
+namespace bpm {
+
+class Counter;
+class Histogram;
+
+// INTERACTIVE is a user waiting on one track; BULK is library scans and
+// re-analysis, where only throughput matters.
+enum class JobPriority { INTERACTIVE, BULK };
+
+// Runs AnalysisJobs on a fixed set of worker threads with one queue per
+// priority class.  After every step a worker goes back to the scheduler, so
+// a newly submitted interactive job waits for at most one step of each busy
+// worker (a block of MPEG frames, a chunk of STFT frames, one beat-tracking
+// candidate) rather than for whole bulk jobs.  A job that loses its worker
+// keeps everything it has computed and continues from its next step.
+//
+// Classes share workers by stride scheduling: each class accumulates the
+// worker time its steps used divided by its weight, and the next step goes
+// to the waiting class with the least.  With the default weights, bulk jobs
+// still get about a ninth of the workers while interactive work is queued,
+// and all of them otherwise.  A class that was idle starts level with the
+// busiest, so it cannot bank time while it has nothing to run.
+//
+// Within a class jobs are first-in first-out, and a job that yields goes
+// back to the front of its queue: at most one job per worker is in
+// progress, so partially analysed tracks do not pile up in memory.
+class JobScheduler {
+ public:
+  struct Options {
+    unsigned threads = 0;  // 0: one per hardware thread
+    unsigned interactive_weight = 8;
+    unsigned bulk_weight = 1;
+  };
+
+  JobScheduler();
+  explicit JobScheduler(const Options &options);
+  // Finishes every submitted job, then joins the workers.
+  ~JobScheduler();
+
+  JobScheduler(const JobScheduler &) = delete;
+  JobScheduler &operator=(const JobScheduler &) = delete;
+
+  // Queues `job`; `complete` is called on a worker thread with the result,
+  // or with only input_path and `error` set if a step threw anything, as
+  // for AnalysisJob::submit().  If `complete` throws on a result without an
+  // error, it is called once more with `error` set; anything it throws then
+  // is dropped, so a worker never dies.  The result's timings.queue_wait is
+  // the time the job spent waiting for a worker, which is also observed in
+  // bpm_queue_wait_seconds{class=...}.
+  void submit(std::unique_ptr<AnalysisJob> job, JobPriority priority,
+              AnalysisJob::CompletionCallback complete);
+
+  // Blocks until every job submitted so far has completed.
+  void wait_idle();
+
+ private:
+  struct Entry;
+  struct ClassQueue {
+    std::deque<std::unique_ptr<Entry>> jobs;
+    double weight = 1.0;
+    double pass = 0.0;  // weighted worker seconds
+    Histogram *queue_wait = nullptr;
+    Counter *preemptions = nullptr;
+  };
+
+  void worker();
+  // The waiting class with the least weighted time, or -1.
+  int next_class() const;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  ClassQueue classes_[2];
+  double virtual_time_ = 0.0;  // pass of the class picked last
+  std::size_t pending_ = 0;    // submitted and not yet completed
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace bpm
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace bpm {
+
+// Hot inner loops, compiled once per instruction set and selected at startup.
+// Every variant performs the same arithmetic in the same order, so results
+// are bit-identical whichever one runs; only the speed differs.
+namespace kernels {
+
+// BASELINE is the build's default target: SSE2 on x86-64, plain C++ elsewhere.
+enum class CpuLevel { BASELINE, AVX2, AVX512 };
+
+struct KernelTable {
+  CpuLevel level;
+
+  // out[i] = double(in[i] * window[i])
+  void (*window_to_double)(const float *in, const float *window, double *out,
+                           std::size_t n);
+
+  // power[k] = pairs[2k]^2 + pairs[2k+1]^2
+  void (*power_spectrum)(const double *pairs, double *power, std::size_t bins);
+
+  // sum a[i] * b[i], accumulated in 8 fixed interleaved lanes.
+  double (*dot)(const double *a, const float *b, std::size_t n);
+
+  // sum x[i] * x[i - lag] for i in [lag, n), in 8 fixed interleaved lanes.
+  double (*lagged_dot)(const float *x, std::size_t n, std::size_t lag);
+
+  // Beat-tracker DP step: first p in [0, n) maximising
+  // dp[p] + add - penalty[n - 1 - p], if that exceeds `best`.  Returns the
+  // index or -1 and updates `best`.
+  long (*dp_argmax)(const double *dp, const double *penalty, double add,
+                    std::size_t n, double &best);
+
+  // One comb resonator over n frames that lie within one period, so none
+  // reads a slot another writes: y = feedback * delay[i] + input[i] is
+  // stored back to delay[i].  Returns sum y * y in 8 fixed interleaved lanes.
+  double (*comb_block)(float *delay, const float *input, float feedback, std::size_t n);
+
+  // mono[f] = float(sum of the frame's channels in double / channels)
+  void (*downmix)(const float *interleaved, float *mono, std::size_t frames,
+                  std::size_t channels);
+
+  // dst[f * channels + c] += src[f] for every channel.
+  void (*mix_add)(float *dst, const float *src, std::size_t frames,
+                  std::size_t channels);
+
+  // Clamps every sample to [-1, 1].
+  void (*clamp_unit)(float *data, std::size_t n);
+
+  // Clamps to [-1, 1] and truncates x * 32767 to int16.
+  void (*float_to_int16)(const float *in, std::int16_t *out, std::size_t n);
+};
+
+// Kernels for the selected CPU level.  The first call detects the best level
+// the CPU and OS support, unless overridden by set_cpu_level() or the
+// BPM_CPU environment variable (baseline or sse2, avx2, avx512).
+const KernelTable &active();
+
+CpuLevel detected_cpu_level();
+
+// Forces a level, e.g. for testing.  Throws if the CPU cannot run it or the
+// build does not include it.
+void set_cpu_level(CpuLevel level);
+
+std::string cpu_level_name(CpuLevel level);
+CpuLevel parse_cpu_level(const std::string &name);
+
+}  // namespace kernels
+}  // namespace bpm
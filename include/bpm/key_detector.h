@@ -1,12 +1,17 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "bpm/audio_buffer.h"
 
 namespace bpm {
 
+class FeatureCache;
+
 class KeyDetector {
  public:
   struct Result {
@@ -18,7 +23,44 @@ class KeyDetector {
     float correlation = 0.0f;  // Pearson r of winning key
   };
 
-  Result detect(const AudioBuffer &mono_audio, bool verbose = false) const;
+  // With a cache, per-octave chroma sums are loaded/stored per
+  // content-defined chunk of about kCacheChunkFrames analysis frames.
+  Result detect(const AudioBuffer &mono_audio, bool verbose = false,
+                const FeatureCache *cache = nullptr) const;
+
+  // detect() in steps, like OnsetDetector::Session: each advance() adds one
+  // chunk of about kCacheChunkFrames frames to the chroma sums, and finish()
+  // returns what detect() would.  The audio and cache must outlive the
+  // session.
+  class Session {
+   public:
+    explicit Session(const AudioBuffer &mono_audio, const FeatureCache *cache = nullptr);
+    ~Session();
+    Session(Session &&) noexcept;
+    Session &operator=(Session &&) noexcept;
+
+    bool done() const;
+    void advance();
+    Result finish(bool verbose = false);
+
+    // Leading samples covered by the frames analysed so far, and the key
+    // they give on their own, for provisional results.
+    std::size_t samples_done() const;
+    Result preview() const;
+
+    // The per-octave chroma sums so far, for ResumeState, like
+    // OnsetDetector::Session::Snapshot.
+    struct Snapshot {
+      std::size_t next_frame = 0;
+      std::vector<float> octave_chroma;  // octave-major, kChromaBins per octave
+    };
+    Snapshot snapshot() const;
+    void restore(const Snapshot &snapshot);
+
+   private:
+    struct State;
+    std::unique_ptr<State> state_;
+  };
 
  private:
   static constexpr int kChromaBins = 12;
@@ -26,9 +68,10 @@ class KeyDetector {
   static constexpr int kHopSize = 4096;
   static constexpr float kMinFreqHz = 65.4f;    // C2
   static constexpr float kMaxFreqHz = 2093.0f;  // C7
+  static constexpr std::size_t kCacheChunkFrames = 32;
 
-  std::array<float, kChromaBins> compute_chromagram(
-      const AudioBuffer &mono_audio) const;
+  // Correlates a chromagram with all 24 rotated key profiles.
+  static Result classify(const std::array<float, kChromaBins> &chroma, bool verbose);
 
   static float pearson_correlation(
       const std::array<float, kChromaBins> &x,
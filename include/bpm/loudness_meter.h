@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace bpm {
+
+// Integrated loudness (ITU-R BS.1770-4 / EBU R128) and true peak, fed
+// incrementally with interleaved PCM so it can share a traversal with other
+// per-sample work (the pipeline runs it inside the downmix loop).
+class LoudnessMeter {
+ public:
+  struct Result {
+    double integrated_lufs = 0.0;  // -inf if every block is gated out
+    double true_peak_dbtp = 0.0;   // 4x oversampled peak, dB relative to full scale
+    double sample_peak_dbfs = 0.0;
+  };
+
+  LoudnessMeter(int sample_rate, int channels);
+
+  void process(const float *interleaved, std::size_t frames);
+
+  Result result() const;
+
+ private:
+  struct Biquad {
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+  };
+  struct ChannelState {
+    double z1_shelf = 0.0, z2_shelf = 0.0;  // K-weighting stage 1 (transposed DF II)
+    double z1_hp = 0.0, z2_hp = 0.0;        // stage 2
+    std::vector<float> history;             // 2 x kTapsPerPhase, mirrored ring
+    std::size_t pos = 0;
+  };
+
+  static constexpr int kOversample = 4;
+  static constexpr int kTapsPerPhase = 12;
+
+  int channels_ = 0;
+  Biquad shelf_;
+  Biquad highpass_;
+  std::vector<double> channel_weight_;
+  std::vector<ChannelState> state_;
+  std::vector<float> interp_;  // kOversample phases x kTapsPerPhase
+
+  std::size_t step_frames_ = 0;     // 100 ms gating step
+  std::size_t step_filled_ = 0;
+  double step_energy_ = 0.0;
+  std::vector<double> step_energies_;  // mean square per completed 100 ms step
+
+  float sample_peak_ = 0.0f;
+  float true_peak_ = 0.0f;
+};
+
+}  // namespace bpm
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpm {
+
+// Monotonic event count.  Updates are single relaxed atomic adds.
+class Counter {
+ public:
+  void inc(std::uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<std::uint64_t> value_{0};
+};
+
+// Point-in-time value (in-flight jobs, last real-time factor).
+class Gauge {
+ public:
+  void set(double v) { value_.store(v, std::memory_order_relaxed); }
+  void add(double delta);
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0.0};
+};
+
+// Fixed-bucket histogram.  Bucket bounds are set at registration; observe()
+// is lock-free (one bucket increment, one count increment, one CAS on sum).
+class Histogram {
+ public:
+  explicit Histogram(std::vector<double> upper_bounds);
+
+  void observe(double v);
+
+  const std::vector<double> &upper_bounds() const { return bounds_; }
+  std::uint64_t bucket_count(std::size_t i) const;
+  std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> buckets_;
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<double> sum_{0.0};
+};
+
+// Process-wide registry.  Registration takes a lock and returns a reference
+// that stays valid for the life of the process, so hot paths look a metric up
+// once and then only touch atomics.
+class MetricsRegistry {
+ public:
+  static MetricsRegistry &global();
+
+  // `labels` is a pre-formatted Prometheus label set without braces,
+  // e.g. `stage="onset"`.  Empty for unlabelled metrics.
+  Counter &counter(const std::string &name, const std::string &help,
+                   const std::string &labels = "");
+  Gauge &gauge(const std::string &name, const std::string &help,
+               const std::string &labels = "");
+  Histogram &histogram(const std::string &name, const std::string &help,
+                       const std::vector<double> &upper_bounds,
+                       const std::string &labels = "");
+
+  // Prometheus text exposition format (version 0.0.4).
+  std::string render_prometheus() const;
+
+  // Writes the exposition to `path` via a temp file + rename so scrapers
+  // never see a partial file.
+  void write_file(const std::string &path) const;
+
+ private:
+  enum class Kind { COUNTER, GAUGE, HISTOGRAM };
+
+  struct Family {
+    Kind kind = Kind::COUNTER;
+    std::string help;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  Family &family(const std::string &name, const std::string &help, Kind kind);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+// Default latency buckets in seconds (1 ms .. 60 s).
+const std::vector<double> &latency_buckets();
+
+// Periodically dumps the global registry to a file (node-exporter textfile
+// collector style).  A final dump is written on destruction.
+class MetricsFileExporter {
+ public:
+  MetricsFileExporter(std::string path, double interval_sec);
+  ~MetricsFileExporter();
+
+  MetricsFileExporter(const MetricsFileExporter &) = delete;
+  MetricsFileExporter &operator=(const MetricsFileExporter &) = delete;
+
+ private:
+  void loop();
+
+  std::string path_;
+  std::chrono::duration<double> interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace bpm
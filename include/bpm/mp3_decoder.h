@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "bpm/audio_buffer.h"
 
@@ -9,6 +13,55 @@ namespace bpm {
 class Mp3Decoder {
  public:
   static AudioBuffer decode(const std::string &filepath);
+  // Decodes a complete MP3 file held in memory.
+  static AudioBuffer decode(const std::uint8_t *data, std::size_t size);
+
+  // Decoding straight to a fraction of the stream's sample rate, for
+  // analysis that has no use for the top octaves: only the lowest
+  // 32 / divisor subbands go through the synthesis filterbank, which then
+  // runs at the reduced rate, so the samples a resampler would discard are
+  // never computed.  The result is the full decode lowpassed at the new
+  // Nyquist frequency by the subband filters themselves, except that the
+  // top few percent of the new band carry aliasing from the boundary
+  // between the kept and dropped subbands.  With `mono` the
+  // channels are mixed before synthesis, halving it again.  Divisor 1
+  // without `mono` is plain decode().
+  struct ReducedRate {
+    int divisor = 1;  // 1, 2 or 4
+    bool mono = false;
+    // The divisor is halved until the decoded rate is at least this.
+    int min_sample_rate = 0;
+  };
+  static AudioBuffer decode(const std::string &filepath, const ReducedRate &rate);
+  static AudioBuffer decode(const std::uint8_t *data, std::size_t size, const ReducedRate &rate);
+
+  // True if the leading bytes (up to 16 KB are examined) hold an ID3v2 tag
+  // or several consecutive MPEG audio frames, so streams that start
+  // mid-frame are still recognised.
+  static bool probe(const std::uint8_t *data, std::size_t size);
+
+  // Decodes a file a block at a time, for callers that cannot block for a
+  // whole track.  The blocks read() appends add up to what decode(filepath)
+  // returns.  Throws if the file cannot be opened as MP3.
+  class Stream {
+   public:
+    explicit Stream(const std::string &filepath);
+    ~Stream();
+    Stream(Stream &&) noexcept;
+    Stream &operator=(Stream &&) noexcept;
+
+    int sample_rate() const;
+    int channels() const;
+
+    // Appends up to `max_frames` interleaved frames to `samples` and returns
+    // how many were appended; 0 once the stream is exhausted.  Like
+    // decode(), a frame that does not decode ends the stream.
+    std::size_t read(std::vector<float> &samples, std::size_t max_frames);
+
+   private:
+    struct State;
+    std::unique_ptr<State> state_;
+  };
 };
 
 }  // namespace bpm
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include "bpm/audio_buffer.h"
@@ -9,6 +11,9 @@ namespace bpm {
 class Mp4Decoder {
  public:
   static AudioBuffer decode(const std::string &filepath);
+  // ffmpeg needs a seekable input (the moov atom may follow the media
+  // data), so in-memory files are written to a private temporary file.
+  static AudioBuffer decode(const std::uint8_t *data, std::size_t size);
 };
 
 }  // namespace bpm
@@ -1,28 +1,123 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
 #include <vector>
 
 #include "bpm/audio_buffer.h"
 
 namespace bpm {
 
+class FeatureCache;
+
 class OnsetDetector {
  public:
   struct Result {
     std::vector<float> onset_strength;
     int hop_size = 0;
     int fft_size = 0;
+
+    // Sub-band flux envelopes, band-major (structure of arrays): band k is
+    // band_flux[k * onset_strength.size() + frame].  Empty unless the
+    // detector was constructed with band split frequencies.
+    int num_bands = 0;
+    std::vector<float> band_flux;
+
+    const float *band(int k) const {
+      return band_flux.data() + static_cast<std::size_t>(k) * onset_strength.size();
+    }
+
+    // The first `frames` frames, renormalized: what compute() returns for
+    // audio that ends with frame `frames - 1`.
+    Result prefix(std::size_t frames) const;
+  };
+
+  OnsetDetector() = default;
+
+  // Also emit sub-band envelopes.  `band_split_hz` holds ascending split
+  // frequencies; K splits give K+1 bands, each summing the flux of the mel
+  // bands whose centre falls inside it.  E.g. {150, 2000} separates
+  // kick / snare and voice / hi-hat.  Computed in the same frame loop.
+  explicit OnsetDetector(std::vector<float> band_split_hz);
+
+  // With a cache, log-mel frames are loaded/stored per content-defined
+  // chunk of about kCacheChunkFrames frames, keyed by the hash of the
+  // samples they cover.
+  Result compute(const AudioBuffer &mono_audio,
+                 const FeatureCache *cache = nullptr) const;
+
+  // compute() in steps, for callers that interleave many jobs on a few
+  // threads (AnalysisJob).  Each advance() analyses one chunk of about
+  // kCacheChunkFrames frames (at most four times that); finish() runs any
+  // remaining chunks and returns what compute() would.  The detector,
+  // audio and cache must outlive the session.
+  class Session {
+   public:
+    Session(const OnsetDetector &detector, const AudioBuffer &mono_audio,
+            const FeatureCache *cache = nullptr);
+    ~Session();
+    Session(Session &&) noexcept;
+    Session &operator=(Session &&) noexcept;
+
+    bool done() const;
+    void advance();
+    Result finish();
+
+    // Frames analysed so far, and what compute() would return for audio
+    // that ends with frame `frames - 1` (at most frames_done()), for
+    // provisional results while the session runs.
+    std::size_t frames_done() const;
+    Result preview(std::size_t frames) const;
+
+    // The analysis so far, so that a long run can be saved and continued
+    // over the same audio in another process (ResumeState).  Values are as
+    // accumulated; finish() normalizes them.
+    struct Snapshot {
+      std::size_t next_frame = 0;
+      std::vector<float> onset_strength;  // frames [0, next_frame)
+      std::vector<float> band_flux;       // band-major, frames [0, next_frame)
+      std::vector<float> prev_mel;        // log-mel energies of the last frame
+    };
+    Snapshot snapshot() const;
+    // Continues from a snapshot of a session over the same audio and
+    // detector settings.  Throws if its sizes do not fit this session.
+    void restore(const Snapshot &snapshot);
+
+   private:
+    struct State;
+    std::unique_ptr<State> state_;
   };
 
-  Result compute(const AudioBuffer &mono_audio) const;
+  // compute() for many short mono clips at once.  The window, mel filters
+  // and FFT plan are built once per sample rate and the frame buffers once
+  // for the batch, so per-clip setup does not dominate when clips are only
+  // a few seconds long.  Each result equals compute() on that clip alone.
+  std::vector<Result> compute_batch(const std::vector<AudioBuffer> &clips) const;
+
+  // Integer-only variant for targets with slow floating point: Q15 input and
+  // window, fixed-point real FFT, integer power/mel sums and a table-based
+  // log2.  Produces an envelope interchangeable with compute().
+  Result compute_fixed(const AudioBuffer &mono_audio) const;
+
+  // Analysis parameters, shared with streaming front ends
+  // (RealtimeBeatTracker) so they see the same frames.
+  int fft_size() const { return fft_size_; }
+  int hop_size() const { return hop_size_; }
+  int mel_bands() const { return mel_bands_; }
+  std::vector<float> hann_window() const;
+  std::vector<std::vector<float>> mel_filterbank(int sample_rate) const;
 
  private:
+  static constexpr std::size_t kCacheChunkFrames = 256;
+
   int fft_size_ = 2048;
   int hop_size_ = 512;
   int mel_bands_ = 40;
+  std::vector<float> band_split_hz_;
 
-  std::vector<float> hann_window() const;
-  std::vector<std::vector<float>> mel_filterbank(int sample_rate) const;
+  std::vector<float> mel_points() const;
+  // Sub-band index of each mel band; empty when no splits are configured.
+  std::vector<int> band_groups() const;
 };
 
 }  // namespace bpm
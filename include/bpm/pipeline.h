@@ -1,9 +1,34 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "bpm/beat_tracker.h"
+#include "bpm/flac_writer.h"
+#include "bpm/mp3_decoder.h"
+#include "bpm/tempo_estimator.h"
 
 namespace bpm {
 
+// Wall time per stage in seconds; 0 for stages that did not run.
+struct StageTimings {
+  double decode = 0.0;
+  double downmix = 0.0;
+  double key = 0.0;
+  double onset = 0.0;
+  double tempo = 0.0;
+  double beat = 0.0;
+  double meter = 0.0;
+  double render = 0.0;
+  double write = 0.0;
+  // JobScheduler only: time spent queued before and between steps.
+  double queue_wait = 0.0;
+};
+
 struct PipelineOptions {
   float min_bpm = 50.0f;
   float max_bpm = 220.0f;
@@ -14,13 +39,206 @@ struct PipelineOptions {
   bool detect_meter = true;
   bool accent_downbeats = false;
   bool detect_key = true;
+  TempoMethod tempo_method = TempoMethod::AUTOCORRELATION;
+  DpSearch beat_dp_search = DpSearch::EXHAUSTIVE;
+  double beat_dp_tolerance = 0.0;  // max score loss per frame when pruning
+  // Stop tracking tempo candidates once they provably cannot be selected
+  // (BeatTracker::track_bounded); run() only, same selection either way.
+  bool prune_candidates = false;
+  bool measure_loudness = false;  // EBU R128 integrated loudness + true peak
+  bool fixed_point = false;  // integer onset path (OnsetDetector::compute_fixed)
+  // Ascending onset sub-band split frequencies (OnsetDetector's band
+  // envelopes).  When set, meter detection takes its beat accents from the
+  // lowest band, where kick drums mark downbeats, instead of the full
+  // envelope.  Empty keeps the full envelope.
+  std::vector<float> onset_band_split_hz;
+  // MP3 input decoded straight to 1/divisor of its rate, but not below
+  // 22.05 kHz, optionally as mono; analysis and the rendered output then
+  // run at that rate.
+  Mp3Decoder::ReducedRate mp3_rate;
+  std::string output_format = "wav";  // "wav" or "flac"; used for default names
+  FlacParallelism flac_parallelism;  // encoder threads; defaults when 0
+  std::string cache_dir;  // per-chunk STFT feature cache; empty disables it
+  std::string results_shm;  // POSIX shm name of a ResultsRing to publish to
+  unsigned results_shm_slots = 64;  // used only when the ring is created
+  // Audio times (seconds) at which provisional results are reported to the
+  // progress callback; empty disables progressive reporting.
+  std::vector<double> progress_checkpoints_sec;
+  // BeatGrid sidecar written after analysis, for later render() calls;
+  // empty disables it.
+  std::string beat_grid_path;
+  // Partial key and onset analysis saved here at step boundaries every
+  // state_interval_sec of wall time, and picked up by a later run on the
+  // same input (ResumeState); removed when the job completes.  Empty
+  // disables it.
+  std::string state_path;
+  double state_interval_sec = 60.0;
+  // Slow-job capture: a job that takes longer than slow_job_sec from
+  // construction to completion, or longer than a non-zero field of
+  // slow_stage_sec in that stage, writes a SlowJobReport into slow_job_dir.
+  // Zero disables a threshold; an empty directory disables capture.
+  std::string slow_job_dir;
+  double slow_job_sec = 0.0;
+  StageTimings slow_stage_sec;
+  bool slow_job_envelope = false;  // also save the onset envelope
+};
+
+// A provisional (or, with is_final, the final) result for a progress
+// callback.  Provisional values come from the first audio_sec seconds only.
+struct ProgressUpdate {
+  double audio_sec = 0.0;
+  double total_sec = 0.0;
+  bool is_final = false;
+  float bpm = 0.0f;
+  float tempo_confidence = 0.0f;
+  bool has_key = false;
+  std::string key;
+  float key_confidence = 0.0f;
+};
+
+using ProgressCallback = std::function<void(const ProgressUpdate &)>;
+
+// Everything run() determined about one input, for result sinks.
+struct JobResult {
+  std::string input_path;
+  std::string output_path;
+  int sample_rate = 0;
+  std::size_t num_frames = 0;
+  double duration_sec = 0.0;
+  float bpm = 0.0f;
+  std::vector<std::size_t> beat_samples;
+  bool has_key = false;
+  std::string key;  // "C major", "F# minor"
+  float key_confidence = 0.0f;
+  bool has_meter = false;
+  std::string time_signature;  // "4/4"
+  int beats_per_measure = 0;
+  float meter_confidence = 0.0f;
+  std::vector<std::size_t> downbeat_samples;
+  bool has_loudness = false;
+  double integrated_lufs = 0.0;
+  double true_peak_dbtp = 0.0;
+  StageTimings timings;
+  // run_clips(), AnalysisJob::submit() and JobScheduler only: why this
+  // input produced no result.
+  std::string error;
+};
+
+// Where AnalysisJob::submit() runs job steps: an event loop, a thread pool,
+// or anything else that can run a task later.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // May run `task` on any thread.  Called from the submitting thread and
+  // from inside earlier tasks.
+  virtual void post(std::function<void()> task) = 0;
+};
+
+// Pipeline::run() as a sequence of steps, so that many jobs can share a few
+// threads instead of each blocking one.  A step is one of: open the input,
+// decode one block of MPEG frames, downmix, one chunk of chroma or onset
+// frames, tempo, one beat-tracking candidate, meter, render, write.  Most
+// are bounded by the chunk or block size, but some take time in proportion
+// to the whole track: decoding a URL, an in-memory input, reduced-rate MP3
+// or any other format, the fixed-point onset envelope, render and write
+// each run as a single step.  Steps run in run()'s order and print what it
+// prints, so a job stepped to the end returns exactly what run() does.
+class AnalysisJob {
+ public:
+  enum class Stage { OPEN, DECODE, DOWNMIX, KEY, ONSET, TEMPO, BEAT, METER, RENDER, WRITE,
+                     DONE };
+
+  AnalysisJob(const std::string &input_path,
+              const std::string &output_path,
+              const PipelineOptions &options = PipelineOptions(),
+              ProgressCallback progress = nullptr);
+  // An in-memory input, as for run(data, size, ...); `data` must stay valid
+  // until the job is done.
+  AnalysisJob(const std::uint8_t *data,
+              std::size_t size,
+              const std::string &source_name,
+              const std::string &output_path,
+              const PipelineOptions &options = PipelineOptions(),
+              ProgressCallback progress = nullptr);
+  ~AnalysisJob();
+
+  AnalysisJob(const AnalysisJob &) = delete;
+  AnalysisJob &operator=(const AnalysisJob &) = delete;
+
+  // The stage the next step() works on.
+  Stage stage() const;
+  bool done() const { return stage() == Stage::DONE; }
+
+  // The input path or source name the job was created with.
+  const std::string &input_path() const;
+
+  // Runs one step.  Throws what run() would throw, after which the job is
+  // done and has no result.
+  void step();
+
+  // The result, once done() after a successful last step.
+  JobResult take_result();
+
+  // Posts the job's steps to `executor` one at a time, each from the end of
+  // the previous one, so a job never runs on two threads at once and no
+  // thread blocks on it.  `complete` is called from the last step with the
+  // result, or with only input_path and `error` set if a step threw.
+  using CompletionCallback = std::function<void(JobResult)>;
+  static void submit(std::unique_ptr<AnalysisJob> job, Executor &executor,
+                     CompletionCallback complete);
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
 };
 
 class Pipeline {
  public:
-  void run(const std::string &input_path,
-           const std::string &output_path,
-           const PipelineOptions &options = PipelineOptions()) const;
+  // With options.progress_checkpoints_sec and a callback, `progress` gets a
+  // provisional update per checkpoint shorter than the track as the key and
+  // onset analysis, run side by side, pass it, then one final update
+  // matching the returned result.
+  JobResult run(const std::string &input_path,
+                const std::string &output_path,
+                const PipelineOptions &options = PipelineOptions(),
+                const ProgressCallback &progress = nullptr) const;
+
+  // run() for a complete input file already in memory, such as an upload
+  // received over a socket.  The format is sniffed from its leading bytes
+  // and MP3 and WAV are decoded without touching the filesystem.
+  // `source_name` labels the job in results and published records.
+  JobResult run(const std::uint8_t *data,
+                std::size_t size,
+                const std::string &source_name,
+                const std::string &output_path,
+                const PipelineOptions &options = PipelineOptions(),
+                const ProgressCallback &progress = nullptr) const;
+
+  // Re-renders a click track from a BeatGrid sidecar saved by an earlier
+  // run() on the same input: decodes, overlays and writes, with no analysis.
+  // Click settings come from `options` and may differ from the original
+  // run.  Throws if the input no longer decodes to the sample rate and
+  // length the grid was saved for.  The result carries the grid's analysis
+  // and only decode, render and write timings.
+  JobResult render(const std::string &input_path,
+                   const std::string &grid_path,
+                   const std::string &output_path,
+                   const PipelineOptions &options = PipelineOptions()) const;
+
+  // Analysis-only batch path for many short clips (samples, stems, jingles),
+  // where per-job setup would otherwise dominate.  All clips are decoded
+  // first, their onset envelopes come from one OnsetDetector::compute_batch
+  // call, and each round of tempo candidates is passed for every clip to
+  // one BeatTracker::track_batch call, which tracks them in turn over
+  // shared DP tables.  Tempo, key, meter and loudness stay per clip.  BPM,
+  // beats, key and meter equal what run() reports for each clip; the onset
+  // and beat timings are the batch's, split by frame count.  No click track is rendered and nothing is printed beyond
+  // verbose progress.  An input that fails gets a result with `error` set
+  // instead of aborting the batch.  The feature cache, progress
+  // checkpoints, prune_candidates and slow-job reports are not used here.
+  std::vector<JobResult> run_clips(const std::vector<std::string> &input_paths,
+                                   const PipelineOptions &options = PipelineOptions()) const;
 };
 
 }  // namespace bpm
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bpm {
+
+// In-process CPU sampling profiler for short-lived runs that an external
+// profiler cannot practically attach to.  ITIMER_PROF delivers SIGPROF every
+// 1/hz seconds of process CPU time to whichever thread is running; the
+// handler copies that thread's call stack, pipeline stage and job into a
+// slot of a buffer allocated by start(), and touches nothing else.  Stacks
+// are symbolized and aggregated only when written out.
+//
+// When stopped, the only cost left in the pipeline is ProfileStage and
+// ProfileJob storing a pointer or id in a thread-local.
+class SamplingProfiler {
+ public:
+  static constexpr int kMaxDepth = 32;
+
+  // One captured stack; filled in by the signal handler.
+  struct Sample;
+
+  static SamplingProfiler &global();
+
+  // Starts sampling at `hz` samples per CPU second, with room for
+  // `max_samples` stacks; later samples are counted as dropped.  Samples
+  // from an earlier start() are discarded.  Throws if already running or if
+  // the timer cannot be installed.
+  void start(int hz = 499, std::size_t max_samples = std::size_t{1} << 15);
+
+  // Disarms the timer, waits for handlers still writing a sample on other
+  // threads, and restores the previous SIGPROF handler.  Samples are kept
+  // for write_folded().
+  void stop();
+
+  bool running() const { return running_.load(std::memory_order_relaxed); }
+
+  // Interns a job label for ProfileJob.  Returns -1 while stopped, so a
+  // long-running process keeps no labels unless it is being profiled.
+  int register_job(const std::string &label);
+
+  std::size_t samples() const;
+  std::uint64_t dropped() const;
+
+  // Writes folded stacks for flamegraph.pl, inferno or speedscope: one line
+  // per distinct stack, "stage;outermost;...;innermost count", prefixed
+  // with "job;" when `per_job` is set.  Frames are demangled function names
+  // without argument lists; functions without an exported symbol appear as
+  // "module+0xoffset" for addr2line.  Throws on I/O errors.
+  void write_folded(const std::string &path, bool per_job) const;
+
+ private:
+  SamplingProfiler() = default;
+  ~SamplingProfiler();
+
+  std::atomic<bool> running_{false};
+  std::unique_ptr<Sample[]> samples_;
+  std::size_t capacity_ = 0;
+  mutable std::mutex jobs_mutex_;
+  std::vector<std::string> jobs_;
+};
+
+// Attributes samples taken on this thread to `stage`, a string literal such
+// as "onset", until destroyed or end() is called; the previous stage is
+// then restored.
+class ProfileStage {
+ public:
+  explicit ProfileStage(const char *stage);
+  ~ProfileStage() { end(); }
+
+  ProfileStage(const ProfileStage &) = delete;
+  ProfileStage &operator=(const ProfileStage &) = delete;
+
+  void end();
+
+ private:
+  const char *previous_;
+  bool ended_ = false;
+};
+
+// Attributes samples taken on this thread to a job from
+// SamplingProfiler::register_job() until destroyed.
+class ProfileJob {
+ public:
+  explicit ProfileJob(int job);
+  ~ProfileJob();
+
+  ProfileJob(const ProfileJob &) = delete;
+  ProfileJob &operator=(const ProfileJob &) = delete;
+
+ private:
+  int previous_;
+};
+
+}  // namespace bpm
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct rfft_plan_i;
+
+namespace bpm {
+
+// Real FFT that computes only the lowest `bins` outputs, for consumers that
+// ignore the upper band (mel filters stop at 8 kHz, chroma at C7).
+//
+// The frame is decimated in time into M interleaved sub-sequences of length
+// L = N / M, where M is the largest power of two that still leaves
+// L / 2 + 1 >= bins.  Each is transformed with pocketfft, and only the
+// wanted bins are recombined:  X[k] = sum_m W_N^(m k) X_m[k].  That replaces
+// the last log2(M) stages of the full transform with `bins` x M twiddle
+// products.  Splits smaller than kMinDecimation do not pay for the
+// recombination, so those sizes use the plain pocketfft transform (M = 1),
+// and the saving is left to the caller skipping the unused bins' power.
+class PrunedRealFFT {
+ public:
+  static constexpr int kMinDecimation = 4;
+
+  PrunedRealFFT(int size, int bins);
+  ~PrunedRealFFT();
+
+  PrunedRealFFT(const PrunedRealFFT &) = delete;
+  PrunedRealFFT &operator=(const PrunedRealFFT &) = delete;
+
+  int size() const { return size_; }
+  int bins() const { return bins_; }
+  int decimation() const { return decimation_; }
+
+  // In place, unnormalised, pocketfft halfcomplex order:
+  // data = [r0, r1, i1, r2, i2, ...].  Entries up to index 2 * (bins - 1)
+  // are valid; the rest of the frame is scratch.
+  void forward(double *data);
+
+ private:
+  int size_ = 0;
+  int bins_ = 0;
+  int decimation_ = 1;  // M
+  int sub_size_ = 0;    // L
+  rfft_plan_i *plan_ = nullptr;
+  std::vector<double> cos_;  // cos(2 pi j / N), j < N
+  std::vector<double> sin_;
+  std::vector<double> sub_;  // M sub-sequences of L samples
+  std::vector<double> acc_re_;
+  std::vector<double> acc_im_;
+};
+
+}  // namespace bpm
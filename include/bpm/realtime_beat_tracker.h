@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bpm/fixed_point.h"
+#include "bpm/tempo_estimator.h"
+
+namespace bpm {
+
+// Streaming beat tracker for audio-callback hosts.
+//
+// Everything is allocated in the constructor (which may throw).  process()
+// is noexcept and real-time safe: no allocation, locks, I/O or exceptions,
+// and a fixed amount of work per hop (one 2048-point FFT, the mel
+// reduction, one comb-filter bank step, one DP step over at most
+// 1.5 x max period, and a beat search of a few frames), so the worst case
+// for a block is proportional to its length.
+//
+// Beat events and the current tempo are handed to a non-real-time thread
+// wait-free: beats go through a single-producer/single-consumer ring (events
+// are dropped and counted if the consumer falls behind), tempo through an
+// atomic.
+class RealtimeBeatTracker {
+ public:
+  struct Config {
+    int sample_rate = 44100;
+    int channels = 2;
+    float min_bpm = 50.0f;
+    float max_bpm = 220.0f;
+    std::size_t event_capacity = 256;   // rounded up to a power of two
+    float adaptation_sec = 8.0f;        // half-life of tempo and level tracking
+  };
+
+  struct BeatEvent {
+    std::uint64_t sample = 0;  // stream position in frames since construction
+    float bpm = 0.0f;          // tempo at the time of the beat
+    float strength = 0.0f;     // normalised onset strength at the beat
+  };
+
+  explicit RealtimeBeatTracker(const Config &config);
+
+  RealtimeBeatTracker(const RealtimeBeatTracker &) = delete;
+  RealtimeBeatTracker &operator=(const RealtimeBeatTracker &) = delete;
+
+  // Audio thread.  `interleaved` holds `frames` frames of config.channels.
+  void process(const float *interleaved, std::size_t frames) noexcept;
+
+  // Any thread.  0 until a tempo has been established.
+  float current_bpm() const { return bpm_.load(std::memory_order_relaxed); }
+  std::uint64_t dropped_events() const { return dropped_.load(std::memory_order_relaxed); }
+
+  // Consumer thread (one at a time).  Returns false when no event is queued.
+  bool pop_event(BeatEvent &event);
+
+ private:
+  void analyze_frame() noexcept;
+  void update_tempo() noexcept;
+  void track_beats(float onset) noexcept;
+  void push_event(const BeatEvent &event) noexcept;
+
+  Config config_;
+  int fft_size_ = 0;
+  int hop_size_ = 0;
+  float frame_rate_ = 0.0f;
+  int min_lag_ = 1;
+  int max_lag_ = 1;
+
+  // Front end: mono ring of the last fft_size_ samples.
+  std::vector<float> ring_;
+  std::size_t ring_pos_ = 0;
+  std::uint64_t samples_seen_ = 0;
+  std::uint64_t frame_index_ = 0;
+
+  std::vector<float> window_;
+  std::vector<std::int32_t> frame_;
+  std::vector<std::int32_t> re_;
+  std::vector<std::int32_t> im_;
+  fixed::RealFFT fft_;
+  std::vector<int> mel_first_;                // first bin of each mel filter
+  std::vector<std::vector<float>> mel_weights_;
+  std::vector<float> mel_prev_;
+
+  // Onset level normalisation (exponential mean / variance).
+  float level_decay_ = 0.0f;
+  double level_mean_ = 0.0;
+  double level_var_ = 1.0;
+
+  // Tempo.
+  CombFilterBank comb_;
+  std::vector<double> comb_scores_;
+  std::vector<double> tempo_prior_;
+  int period_ = 0;
+
+  // Causal DP: cumulative score history (ring indexed by frame), and the
+  // transition penalty for lags [period/2, 2 * period].
+  std::vector<double> cumulative_;
+  std::vector<float> onset_history_;
+  std::vector<double> penalty_;
+  int penalty_period_ = 0;
+  std::int64_t last_beat_ = -1;
+
+  // Event ring (SPSC).
+  std::vector<BeatEvent> events_;
+  std::size_t event_mask_ = 0;
+  alignas(64) std::atomic<std::size_t> event_head_{0};  // written by producer
+  alignas(64) std::atomic<std::size_t> event_tail_{0};  // written by consumer
+  std::atomic<float> bpm_{0.0f};
+  std::atomic<std::uint64_t> dropped_{0};
+};
+
+}  // namespace bpm
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bpm {
+
+// Fixed-layout analysis result as stored in the shared-memory ring.  Only
+// trivially copyable members, so consumers in other processes (or other
+// languages) can read it in place from the mapping.
+struct ResultRecord {
+  static constexpr std::size_t kMaxBeats = 4096;      // ~18 min at 220 BPM
+  static constexpr std::size_t kMaxDownbeats = 2048;
+  static constexpr std::size_t kSourceBytes = 256;
+  static constexpr std::size_t kLabelBytes = 16;
+
+  std::uint64_t sequence = 0;       // ring sequence number of this record
+  std::uint64_t timestamp_ns = 0;   // publish time, nanoseconds since the epoch
+  char source[kSourceBytes] = {};   // input path or URL, NUL-terminated, truncated
+  char key[kLabelBytes] = {};       // "F# minor"; empty if key detection was off
+  char time_signature[kLabelBytes] = {};  // "4/4"; empty if meter detection was off
+  float bpm = 0.0f;
+  float key_confidence = 0.0f;
+  float meter_confidence = 0.0f;
+  float integrated_lufs = 0.0f;     // valid if has_loudness; -inf for silence
+  float true_peak_dbtp = 0.0f;
+  std::uint32_t has_loudness = 0;
+  std::uint32_t sample_rate = 0;
+  std::uint64_t num_frames = 0;
+  std::uint32_t beats_per_measure = 0;
+  std::uint32_t num_beats = 0;       // entries used in beat_samples
+  std::uint32_t num_downbeats = 0;   // entries used in downbeat_samples
+  std::uint32_t truncated = 0;       // nonzero if beats or downbeats were clipped
+  std::uint64_t beat_samples[kMaxBeats] = {};
+  std::uint64_t downbeat_samples[kMaxDownbeats] = {};
+};
+
+// Publishes ResultRecords into a POSIX shared-memory ring (shm_open name,
+// e.g. "/bpm_results").  The segment is created on first use and reused by
+// later writers with the same layout, so several analysis processes can feed
+// one ring.  Writers claim sequence numbers with one atomic add and publish
+// each slot under a per-slot sequence lock taken with a CAS; they never wait
+// for readers, and wait for another writer only when more than slot_count()
+// publishes are in flight at once.  That wait is bounded: a slot claimed
+// for over a second by a writer that died mid-copy is taken over.
+class ResultsRingWriter {
+ public:
+  ResultsRingWriter(const std::string &name, std::uint32_t slot_count = 64);
+  ~ResultsRingWriter();
+
+  ResultsRingWriter(const ResultsRingWriter &) = delete;
+  ResultsRingWriter &operator=(const ResultsRingWriter &) = delete;
+
+  // Copies `record` into the next slot and returns its sequence number.
+  // The record's `sequence` field is overwritten.  If a later record has
+  // already claimed the slot, nothing is written: readers see the sequence
+  // as lapped.
+  std::uint64_t publish(const ResultRecord &record);
+
+  std::uint32_t slot_count() const;
+
+  // Removes the shared-memory name.  Existing mappings stay valid.
+  static void unlink(const std::string &name);
+
+ private:
+  struct Mapping;
+  std::unique_ptr<Mapping> mapping_;
+};
+
+// Lock-free reader.  Any number of readers may attach; each keeps its own
+// cursor and nothing in the segment is written by readers, so they cannot
+// slow down writers or each other.  A reader that falls more than
+// slot_count() records behind is lapped and must skip ahead.
+class ResultsRingReader {
+ public:
+  enum class Status { OK, NOT_READY, LAPPED };
+
+  explicit ResultsRingReader(const std::string &name);
+  ~ResultsRingReader();
+
+  ResultsRingReader(const ResultsRingReader &) = delete;
+  ResultsRingReader &operator=(const ResultsRingReader &) = delete;
+
+  // Sequence number the next writer will claim.  Records below this are
+  // published or about to be.
+  std::uint64_t head() const;
+
+  // Oldest sequence number still resident in the ring.
+  std::uint64_t oldest() const;
+
+  std::uint32_t slot_count() const;
+
+  // Zero-copy access: returns the in-place record for `sequence` (or null
+  // with `status` set).  The pointer stays readable, but the contents are
+  // only guaranteed consistent if validate(sequence) returns true after the
+  // caller has finished reading them.
+  const ResultRecord *view(std::uint64_t sequence, Status &status) const;
+  bool validate(std::uint64_t sequence) const;
+
+  // Copying convenience wrapper around view()/validate().
+  Status read(std::uint64_t sequence, ResultRecord &out) const;
+
+ private:
+  struct Mapping;
+  std::unique_ptr<Mapping> mapping_;
+};
+
+}  // namespace bpm
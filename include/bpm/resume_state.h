@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "bpm/key_detector.h"
+#include "bpm/onset_detector.h"
+
+namespace bpm {
+
+// Partial analysis of one input, saved periodically by AnalysisJob so that
+// a run killed partway through a very long recording continues from the
+// last save instead of from frame zero.
+//
+// State file layout (integers little-endian):
+//
+//   "BPMSTAT1"                       8-byte magic
+//   u32 version (2)
+//   u32 sample_rate, u64 num_frames  decoder position: the decoded input's
+//                                    rate and length; checked on load
+//   string fingerprint               FeatureCache::chunk_key of the mono mix
+//   string settings                  analysis settings the snapshots depend
+//                                    on (onset path, FFT and hop sizes, mel
+//                                    bands, feature version); checked on load
+//   u8 flags                         bit 0: key section, bit 1: onset section
+//   key:   u64 next_frame, floats octave_chroma
+//   onset: u64 next_frame, floats onset_strength, band_flux, prev_mel
+//
+// Strings are a u16 byte length followed by the bytes; float arrays are a
+// u64 count followed by the raw IEEE values, so a restored session sums
+// exactly what an uninterrupted one would.
+struct ResumeState {
+  static constexpr std::uint32_t kFormatVersion = 2;
+
+  int sample_rate = 0;
+  std::uint64_t num_frames = 0;
+  std::string fingerprint;
+  std::string settings;
+  bool has_key = false;
+  KeyDetector::Session::Snapshot key;
+  bool has_onset = false;
+  OnsetDetector::Session::Snapshot onset;
+
+  // Fingerprint of the audio a state belongs to.
+  static std::string fingerprint_of(const AudioBuffer &mono_audio);
+
+  // Writes a temp file next to `path`, syncs it and renames it over `path`,
+  // so a crash at any point leaves either the previous state or the new
+  // one.  Both throw std::runtime_error on I/O errors or a malformed file.
+  void save(const std::string &path) const;
+  static ResumeState load(const std::string &path);
+};
+
+}  // namespace bpm
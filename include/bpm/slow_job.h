@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bpm/pipeline.h"
+
+namespace bpm {
+
+// The StageTimings field for a stage name ("decode", "downmix", "key",
+// "onset", "tempo", "beat", "meter", "render", "write"), or null.
+double *stage_timing(StageTimings &timings, const std::string &stage);
+
+// Diagnostics bundle for a job that went over one of the slow-job
+// thresholds in PipelineOptions: enough to find the input again, replay it
+// with the same options, and see which stage and which intermediate size
+// the time went into.  Filled in by AnalysisJob.
+struct SlowJobReport {
+  std::vector<std::string> exceeded;  // "job" and/or stage names
+
+  std::string input_path;
+  std::uint64_t input_bytes = 0;  // 0 for URLs
+  std::string header;             // leading input bytes, hex encoded
+  std::string format;             // from the leading bytes
+  std::string fingerprint;        // ResumeState::fingerprint_of the mono mix
+  int sample_rate = 0;
+  int channels = 0;
+  std::size_t num_frames = 0;
+
+  PipelineOptions options;
+  StageTimings timings;
+  double total_sec = 0.0;
+
+  std::size_t onset_frames = 0;
+  int hop_size = 0;
+  int min_lag = 0;  // tempo search range, onset frames
+  int max_lag = 0;
+  std::size_t tempo_candidates = 0;
+  std::size_t tracked_candidates = 0;
+  std::size_t abandoned_candidates = 0;
+  std::size_t beat_count = 0;
+  float bpm = 0.0f;
+  std::vector<float> onset_envelope;  // only with options.slow_job_envelope
+
+  // The thresholds in `options` that `timings` and `total_sec` exceed.
+  static std::vector<std::string> over_thresholds(const PipelineOptions &options,
+                                                  const StageTimings &timings, double total_sec);
+
+  // Writes "name: value" lines to a new slow-<time>-<n>.txt in `directory`,
+  // and a non-empty envelope as raw little-endian float32 to a .onset.f32
+  // file next to it.  Returns the text file's path; throws on I/O errors.
+  std::string write(const std::string &directory) const;
+};
+
+}  // namespace bpm
@@ -1,23 +1,86 @@
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
 namespace bpm {
 
+enum class TempoMethod {
+  AUTOCORRELATION,  // global autocorrelation of the onset envelope
+  COMB_FILTER       // bank of comb-filter resonators (Scheirer 1998)
+};
+
+// Causal bank of comb-filter resonators, one per candidate period in
+// [min_lag, max_lag] frames.  Each resonator computes
+//   y[n] = alpha * y[n - T] + (1 - alpha) * x[n]
+// and accumulates its output energy, which peaks when T matches the beat
+// period.  Fed one onset frame at a time, so it also serves as a streaming
+// tempo tracker.
+class CombFilterBank {
+ public:
+  // `energy_half_life_frames` <= 0 accumulates energy over the whole input;
+  // a positive value makes the energies track recent frames only.
+  CombFilterBank(int min_lag, int max_lag,
+                 float feedback = 0.5f,
+                 float energy_half_life_frames = 0.0f);
+
+  void process(float onset);
+  // A batch of frames.  Without a half-life each resonator takes the batch a
+  // period at a time through the vectorised kernels, summing its energy in
+  // a different order from per-frame calls (equal up to rounding).
+  void process(const std::vector<float> &onsets);
+
+  int min_lag() const { return min_lag_; }
+  int max_lag() const { return max_lag_; }
+  std::size_t frames() const { return frames_; }
+
+  // Periodic power per resonator (output energy minus the aperiodic floor),
+  // indexed by lag - min_lag().
+  std::vector<double> scores() const;
+  // Same, into `out` (max_lag() - min_lag() + 1 entries); does not allocate.
+  void scores(double *out) const;
+
+  // Lag with the highest energy (no tempo prior); 0 before any input.
+  int best_lag() const;
+
+ private:
+  int min_lag_ = 1;
+  int max_lag_ = 1;
+  float feedback_ = 0.5f;
+  float energy_decay_ = 1.0f;
+  std::size_t frames_ = 0;
+  double energy_weight_ = 0.0;
+  double input_energy_ = 0.0;
+
+  // Structure-of-arrays over resonators; delay lines are packed back to back
+  // in `delay_` starting at `offset_[r]`.
+  std::vector<int> period_;
+  std::vector<std::size_t> offset_;
+  std::vector<int> pos_;
+  std::vector<double> energy_;
+  std::vector<float> delay_;
+};
+
 class TempoEstimator {
  public:
   struct Result {
     float bpm = 0.0f;
     int period_frames = 0;
+    float confidence = 0.0f;  // periodicity at the chosen lag / envelope energy, in [0, 1]
     std::vector<int> candidate_periods;
   };
 
+  explicit TempoEstimator(TempoMethod method = TempoMethod::AUTOCORRELATION);
+
   Result estimate(const std::vector<float> &onset_strength,
                   int sample_rate,
                   int hop_size,
                   float min_bpm = 50.0f,
                   float max_bpm = 220.0f,
                   bool verbose = false) const;
+
+ private:
+  TempoMethod method_ = TempoMethod::AUTOCORRELATION;
 };
 
 }  // namespace bpm
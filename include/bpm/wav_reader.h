@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include "bpm/audio_buffer.h"
@@ -9,6 +11,8 @@ namespace bpm {
 class WavReader {
  public:
   static AudioBuffer read(const std::string &filepath);
+  // Parses a complete 16-bit PCM WAV file held in memory.
+  static AudioBuffer read(const std::uint8_t *data, std::size_t size);
 };
 
 }  // namespace bpm
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+
+#include "bpm/beat_tracker.h"
+#include "bpm/flac_writer.h"
+#include "bpm/kernels.h"
+
+namespace bpm {
+
+struct PipelineOptions;
+
+// Per-machine tuning measured by autotune() and saved as a small text file,
+// so nodes of different classes each run their fastest configuration
+// without hand-tuning.  Every setting it covers is result-preserving:
+// kernel variants are bit-identical, the pruned DP runs at tolerance 0 and
+// FLAC bytes do not depend on the thread layout.
+//
+// File format (one key=value per line, '#' starts a comment):
+//
+//   version=1
+//   machine=avx512x16          detected CPU level and hardware threads
+//   fft_size=2048              analysis sizes the timings were taken at
+//   hop_size=512
+//   sample_rate=44100          informational
+//   kernels=avx2
+//   beat_dp=pruned             exhaustive | pruned
+//   flac_threads=4
+//   flac_blocks_per_thread=16
+//
+// A file of another version, from another machine or for other analysis
+// sizes is stale and load() rejects it; callers then keep the defaults.
+struct Wisdom {
+  static constexpr int kFormatVersion = 1;
+
+  kernels::CpuLevel cpu_level = kernels::CpuLevel::BASELINE;
+  DpSearch beat_dp_search = DpSearch::EXHAUSTIVE;
+  FlacParallelism flac_parallelism;
+
+  std::string machine;
+  int fft_size = 0;
+  int hop_size = 0;
+  int sample_rate = 0;
+
+  // The built-in configuration for this machine: detected kernels,
+  // exhaustive DP, default encoder threads.
+  static Wisdom defaults();
+
+  // Fingerprint of this machine, as stored in `machine`.
+  static std::string machine_fingerprint();
+
+  // Reads `path` into `wisdom`.  Returns false and explains why in `reason`
+  // if the file is missing, malformed or stale; `wisdom` is then unchanged.
+  static bool load(const std::string &path, Wisdom &wisdom, std::string &reason);
+
+  // Throws on write failure.
+  void save(const std::string &path) const;
+
+  // Times every usable kernel level, both DP searches and a grid of FLAC
+  // thread layouts on a synthetic `duration_sec` track at `sample_rate`,
+  // keeping the fastest of each (minimum over a few repetitions).
+  // `scratch_path` is used for the FLAC encodes and removed afterwards.
+  static Wisdom autotune(const std::string &scratch_path, int sample_rate = 44100,
+                         double duration_sec = 30.0, bool verbose = false);
+
+  // Selects the kernel level and copies the other settings into `options`.
+  void apply(PipelineOptions &options, bool set_kernels = true, bool set_dp = true) const;
+};
+
+}  // namespace bpm
@@ -2,9 +2,12 @@
 import argparse
 import os
 import re
+import bisect
 import shutil
+import struct
 import subprocess
 import sys
+import tempfile
 
 
 ROOT_DIR = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
@@ -45,6 +48,29 @@ def parse_args() -> argparse.Namespace:
         action="store_true",
         help="Do not build before running tests",
     )
+    parser.add_argument(
+        "--compare-fixed-point",
+        action="store_true",
+        help="Also run each input with --fixed-point and compare it to the float path",
+    )
+    parser.add_argument(
+        "--fixed-point-bpm-pct",
+        type=float,
+        default=1.0,
+        help="Max BPM difference between the two paths in percent (default: 1.0)",
+    )
+    parser.add_argument(
+        "--fixed-point-beat-ms",
+        type=float,
+        default=50.0,
+        help="Max distance from a float beat to the nearest fixed-point beat (default: 50)",
+    )
+    parser.add_argument(
+        "--fixed-point-beat-pct",
+        type=float,
+        default=90.0,
+        help="Min percent of float beats within that distance (default: 90)",
+    )
     parser.add_argument(
         "--tolerance-pct",
         type=float,
@@ -160,6 +186,88 @@ def run_detect(
     return True, ""
 
 
+def read_beat_grid(path: str) -> tuple[int, float, list[int]]:
+    """Returns sample rate, BPM and beat positions from a --save-grid file
+    (layout in include/bpm/beat_grid.h)."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"BPMGRID1":
+        raise ValueError(f"not a beat grid: {path}")
+    pos = 12
+    (sample_rate,) = struct.unpack_from("<I", data, pos)
+    pos += 12
+    (bpm,) = struct.unpack_from("<f", data, pos)
+    pos += 5
+
+    def skip_string(pos: int) -> int:
+        (length,) = struct.unpack_from("<H", data, pos)
+        return pos + 2 + length
+
+    def varint(pos: int) -> tuple[int, int]:
+        value = shift = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if byte < 0x80:
+                return value, pos
+
+    pos = skip_string(pos) + 4
+    pos = skip_string(pos) + 8
+    count, pos = varint(pos)
+    beats = []
+    sample = 0
+    for _ in range(count):
+        delta, pos = varint(pos)
+        sample += delta
+        beats.append(sample)
+    return sample_rate, bpm, beats
+
+
+def compare_fixed_point(
+    bpm_detect: str, input_arg: str, label: str, args: argparse.Namespace
+) -> tuple[bool, str]:
+    """Runs the float and --fixed-point paths on one input and bounds their
+    BPM difference and how far the fixed-point beats sit from the float ones."""
+    grids = {}
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, extra in (("float", []), ("fixed", ["--fixed-point"])):
+            grid = os.path.join(tmp, f"{name}.grid")
+            result = run_cmd([bpm_detect, *extra, "--save-grid", grid, "-o", "/dev/null", input_arg])
+            if result.returncode != 0:
+                return False, f"FAILED: bpm_detect {name} path error for {label}\n{result.stderr.strip()}"
+            grids[name] = read_beat_grid(grid)
+
+    sample_rate, float_bpm, float_beats = grids["float"]
+    _, fixed_bpm, fixed_beats = grids["fixed"]
+    if not float_beats or not fixed_beats:
+        return False, f"FAILED: {label} fixed-point comparison found no beats"
+
+    bpm_pct = abs(fixed_bpm - float_bpm) / float_bpm * 100.0
+    max_distance = args.fixed_point_beat_ms / 1000.0 * sample_rate
+    close = 0
+    for beat in float_beats:
+        i = bisect.bisect_left(fixed_beats, beat)
+        nearest = min(abs(fixed_beats[j] - beat) for j in (i - 1, i) if 0 <= j < len(fixed_beats))
+        if nearest <= max_distance:
+            close += 1
+    close_pct = close / len(float_beats) * 100.0
+
+    print(
+        f"Fixed point: {fixed_bpm:.3f} BPM | Float: {float_bpm:.3f} BPM | "
+        f"Difference: {bpm_pct:.2f}% (max {args.fixed_point_bpm_pct:.2f}%) | "
+        f"Beats within {args.fixed_point_beat_ms:.0f} ms: {close_pct:.1f}% "
+        f"(min {args.fixed_point_beat_pct:.1f}%)"
+    )
+
+    if bpm_pct > args.fixed_point_bpm_pct:
+        return False, f"FAILED: {label} fixed-point BPM differs from the float path"
+    if close_pct < args.fixed_point_beat_pct:
+        return False, f"FAILED: {label} fixed-point beats differ from the float path"
+    return True, ""
+
+
 def main() -> int:
     args = parse_args()
 
@@ -179,19 +287,28 @@ def main() -> int:
 
     if args.include_offline or args.offline_only:
         print("==> Offline MP3 test")
-        ok, msg = run_detect(
-            BPM_DETECT,
-            os.path.join(ROOT_DIR, "test_samples", "Foals - My Number (Official Audio).mp3"),
-            128.0,
-            "Foals - My Number (local MP3)",
-            args.tolerance_pct,
-            expected_ts="4/4",
+        offline_path = os.path.join(
+            ROOT_DIR, "test_samples", "Foals - My Number (Official Audio).mp3"
         )
-        if ok:
-            pass_count += 1
-        else:
-            print(msg, file=sys.stderr)
-            fail_count += 1
+        offline_label = "Foals - My Number (local MP3)"
+        checks = [
+            run_detect(
+                BPM_DETECT,
+                offline_path,
+                128.0,
+                offline_label,
+                args.tolerance_pct,
+                expected_ts="4/4",
+            )
+        ]
+        if args.compare_fixed_point:
+            checks.append(compare_fixed_point(BPM_DETECT, offline_path, offline_label, args))
+        for ok, msg in checks:
+            if ok:
+                pass_count += 1
+            else:
+                print(msg, file=sys.stderr)
+                fail_count += 1
 
     run_yt = not args.offline_only
     if run_yt:
@@ -225,16 +342,21 @@ def main() -> int:
                 expected_ts = match.group("ts")  # None if not present
                 expected_key = match.group("key")  # None if not present
 
-                ok, msg = run_detect(
-                    BPM_DETECT, url, expected, label, args.tolerance_pct,
-                    expected_ts=expected_ts,
-                    expected_key=expected_key,
-                )
-                if ok:
-                    pass_count += 1
-                else:
-                    print(msg, file=sys.stderr)
-                    fail_count += 1
+                checks = [
+                    run_detect(
+                        BPM_DETECT, url, expected, label, args.tolerance_pct,
+                        expected_ts=expected_ts,
+                        expected_key=expected_key,
+                    )
+                ]
+                if args.compare_fixed_point:
+                    checks.append(compare_fixed_point(BPM_DETECT, url, label, args))
+                for ok, msg in checks:
+                    if ok:
+                        pass_count += 1
+                    else:
+                        print(msg, file=sys.stderr)
+                        fail_count += 1
     else:
         print("SKIP: YouTube tests disabled. Run on a machine with network access.")
 
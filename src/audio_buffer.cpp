@@ -2,6 +2,8 @@
 
 #include <algorithm>
 
+#include "bpm/kernels.h"
+
 namespace bpm {
 
 AudioBuffer::AudioBuffer(std::vector<float> data, int rate, int ch)
@@ -28,14 +30,8 @@ AudioBuffer AudioBuffer::to_mono() const {
 
   std::size_t frames = num_frames();
   std::vector<float> mono(frames, 0.0f);
-  for (std::size_t frame = 0; frame < frames; ++frame) {
-    double sum = 0.0;
-    std::size_t base = frame * static_cast<std::size_t>(channels);
-    for (int ch = 0; ch < channels; ++ch) {
-      sum += samples[base + static_cast<std::size_t>(ch)];
-    }
-    mono[frame] = static_cast<float>(sum / static_cast<double>(channels));
-  }
+  kernels::active().downmix(samples.data(), mono.data(), frames,
+                            static_cast<std::size_t>(channels));
 
   return AudioBuffer(std::move(mono), sample_rate, 1);
 }
@@ -0,0 +1,91 @@
+#include "bpm/audio_decoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "bpm/mp3_decoder.h"
+#include "bpm/mp4_decoder.h"
+#include "bpm/wav_reader.h"
+
+namespace bpm {
+namespace {
+
+const char *kSupported = "\nSupported formats: MP3, MP4/M4A, 16-bit PCM WAV, YouTube URL";
+
+}  // namespace
+
+AudioFormat AudioDecoder::sniff(const std::uint8_t *data, std::size_t size) {
+  if (!data) {
+    return AudioFormat::UNKNOWN;
+  }
+  if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WAVE", 4) == 0) {
+    return AudioFormat::WAV;
+  }
+  if (size >= 8 && std::memcmp(data + 4, "ftyp", 4) == 0) {
+    return AudioFormat::MP4;
+  }
+  if (Mp3Decoder::probe(data, std::min(size, kSniffBytes))) {
+    return AudioFormat::MP3;
+  }
+  return AudioFormat::UNKNOWN;
+}
+
+std::string AudioDecoder::format_name(AudioFormat format) {
+  switch (format) {
+    case AudioFormat::MP3:
+      return "mp3";
+    case AudioFormat::MP4:
+      return "mp4";
+    case AudioFormat::WAV:
+      return "wav";
+    default:
+      return "unknown";
+  }
+}
+
+AudioBuffer AudioDecoder::decode(const std::uint8_t *data, std::size_t size,
+                                 const Mp3Decoder::ReducedRate &mp3_rate) {
+  switch (sniff(data, size)) {
+    case AudioFormat::MP3:
+      return Mp3Decoder::decode(data, size, mp3_rate);
+    case AudioFormat::MP4:
+      return Mp4Decoder::decode(data, size);
+    case AudioFormat::WAV:
+      return WavReader::read(data, size);
+    default:
+      throw std::runtime_error(std::string("Unsupported audio data.") + kSupported);
+  }
+}
+
+AudioFormat AudioDecoder::sniff_file(const std::string &filepath) {
+  std::ifstream in(filepath, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Failed to open input: " + filepath);
+  }
+  std::vector<std::uint8_t> head(kSniffBytes);
+  in.read(reinterpret_cast<char *>(head.data()), static_cast<std::streamsize>(head.size()));
+  return sniff(head.data(), static_cast<std::size_t>(in.gcount()));
+}
+
+AudioBuffer AudioDecoder::decode_file(const std::string &filepath, AudioFormat *sniffed,
+                                      const Mp3Decoder::ReducedRate &mp3_rate) {
+  AudioFormat format = sniff_file(filepath);
+  if (sniffed) {
+    *sniffed = format;
+  }
+  switch (format) {
+    case AudioFormat::MP3:
+      return Mp3Decoder::decode(filepath, mp3_rate);
+    case AudioFormat::MP4:
+      return Mp4Decoder::decode(filepath);
+    case AudioFormat::WAV:
+      return WavReader::read(filepath);
+    default:
+      throw std::runtime_error("Unsupported file format: " + filepath + kSupported);
+  }
+}
+
+}  // namespace bpm
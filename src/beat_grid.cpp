@@ -0,0 +1,205 @@
+#include "bpm/beat_grid.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace bpm {
+namespace {
+
+constexpr char kMagic[8] = {'B', 'P', 'M', 'G', 'R', 'I', 'D', '1'};
+constexpr std::uint8_t kHasKey = 1;
+constexpr std::uint8_t kHasMeter = 2;
+
+void append_le(std::vector<unsigned char> &out, std::uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<unsigned char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void append_f32(std::vector<unsigned char> &out, float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  append_le(out, bits, 4);
+}
+
+void append_varint(std::vector<unsigned char> &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<unsigned char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+void append_string(std::vector<unsigned char> &out, const std::string &value) {
+  if (value.size() > 0xFFFF) {
+    throw std::runtime_error("Beat grid label too long.");
+  }
+  append_le(out, value.size(), 2);
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+// Sample positions are ascending, so deltas stay small.
+void append_positions(std::vector<unsigned char> &out, const std::vector<std::size_t> &positions) {
+  append_varint(out, positions.size());
+  std::uint64_t previous = 0;
+  for (std::size_t position : positions) {
+    if (position < previous) {
+      throw std::runtime_error("Beat grid positions must be ascending.");
+    }
+    append_varint(out, position - previous);
+    previous = position;
+  }
+}
+
+class Reader {
+ public:
+  Reader(const std::vector<unsigned char> &data, const std::string &path)
+      : data_(data), path_(path) {}
+
+  const unsigned char *take(std::size_t count) {
+    if (data_.size() - pos_ < count) {
+      throw std::runtime_error("Truncated beat grid: " + path_);
+    }
+    const unsigned char *p = data_.data() + pos_;
+    pos_ += count;
+    return p;
+  }
+
+  std::uint64_t le(int bytes) {
+    const unsigned char *p = take(static_cast<std::size_t>(bytes));
+    std::uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+      value |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  float f32() {
+    std::uint32_t bits = static_cast<std::uint32_t>(le(4));
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::uint64_t varint() {
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      std::uint8_t byte = *take(1);
+      value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::runtime_error("Malformed beat grid: " + path_);
+  }
+
+  std::string string() {
+    std::size_t size = static_cast<std::size_t>(le(2));
+    const unsigned char *p = take(size);
+    return std::string(reinterpret_cast<const char *>(p), size);
+  }
+
+  std::vector<std::size_t> positions() {
+    std::uint64_t count = varint();
+    // Every entry takes at least one byte, which bounds a corrupt count.
+    if (count > data_.size() - pos_) {
+      throw std::runtime_error("Malformed beat grid: " + path_);
+    }
+    std::vector<std::size_t> out(static_cast<std::size_t>(count));
+    std::uint64_t position = 0;
+    for (std::size_t i = 0; i < out.size(); ++i) {
+      position += varint();
+      out[i] = static_cast<std::size_t>(position);
+    }
+    return out;
+  }
+
+ private:
+  const std::vector<unsigned char> &data_;
+  const std::string &path_;
+  std::size_t pos_ = 0;
+};
+
+}  // namespace
+
+BeatGrid BeatGrid::from_result(const JobResult &result) {
+  BeatGrid grid;
+  grid.sample_rate = result.sample_rate;
+  grid.num_frames = result.num_frames;
+  grid.bpm = result.bpm;
+  grid.beat_samples = result.beat_samples;
+  grid.has_key = result.has_key;
+  grid.key = result.key;
+  grid.key_confidence = result.key_confidence;
+  grid.has_meter = result.has_meter;
+  grid.time_signature = result.time_signature;
+  grid.beats_per_measure = result.beats_per_measure;
+  grid.meter_confidence = result.meter_confidence;
+  grid.downbeat_samples = result.downbeat_samples;
+  return grid;
+}
+
+void BeatGrid::save(const std::string &path) const {
+  std::vector<unsigned char> out(kMagic, kMagic + sizeof(kMagic));
+  append_le(out, kFormatVersion, 4);
+  append_le(out, static_cast<std::uint32_t>(sample_rate), 4);
+  append_le(out, num_frames, 8);
+  append_f32(out, bpm);
+  out.push_back(static_cast<unsigned char>((has_key ? kHasKey : 0) | (has_meter ? kHasMeter : 0)));
+  append_string(out, key);
+  append_f32(out, key_confidence);
+  append_string(out, time_signature);
+  append_le(out, static_cast<std::uint32_t>(beats_per_measure), 4);
+  append_f32(out, meter_confidence);
+  append_positions(out, beat_samples);
+  append_positions(out, downbeat_samples);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw std::runtime_error("Failed to open beat grid for writing: " + path);
+  }
+  file.write(reinterpret_cast<const char *>(out.data()), static_cast<std::streamsize>(out.size()));
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Failed to write beat grid: " + path);
+  }
+}
+
+BeatGrid BeatGrid::load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Failed to open beat grid: " + path);
+  }
+  std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+
+  Reader in(data, path);
+  if (std::memcmp(in.take(sizeof(kMagic)), kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("Not a beat grid file: " + path);
+  }
+  std::uint32_t version = static_cast<std::uint32_t>(in.le(4));
+  if (version != kFormatVersion) {
+    throw std::runtime_error("Unsupported beat grid version " + std::to_string(version) + ": " +
+                             path);
+  }
+
+  BeatGrid grid;
+  grid.sample_rate = static_cast<int>(in.le(4));
+  grid.num_frames = in.le(8);
+  grid.bpm = in.f32();
+  std::uint8_t flags = *in.take(1);
+  grid.has_key = (flags & kHasKey) != 0;
+  grid.has_meter = (flags & kHasMeter) != 0;
+  grid.key = in.string();
+  grid.key_confidence = in.f32();
+  grid.time_signature = in.string();
+  grid.beats_per_measure = static_cast<int>(in.le(4));
+  grid.meter_confidence = in.f32();
+  grid.beat_samples = in.positions();
+  grid.downbeat_samples = in.positions();
+  return grid;
+}
+
+}  // namespace bpm
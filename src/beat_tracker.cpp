@@ -2,49 +2,324 @@
 
 #include <algorithm>
 #include <cmath>
+#include <deque>
 #include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "bpm/kernels.h"
 
 namespace bpm {
+namespace {
+
+// Branch and bound for BeatTracker::track_bounded().  A path scores more
+// than `threshold` per beat exactly when the sum over its beats of
+// (onset - penalty - threshold) is positive, so at a checkpoint t the track
+// is hopeless once no path through the DP so far can make that sum
+// positive.  The path the backtrace returns either
+//   - has a last beat p <= t, worth dp[p] - threshold * count[p], and a next
+//     beat x > t, worth at most `remaining` from there on, or
+//   - restarts (takes no predecessor) at some x > t.  Lag P is always
+//     scanned and costs nothing, so that needs dp[x - P] <= 0, which
+//     dp[x] >= dp[x - P] + onset[x] rules out up to some first frame.
+class CandidateBound {
+ public:
+  CandidateBound(const float *onset_strength, int total_frames, int period_frames, int min_lag,
+                 int max_lag, int search_start, const std::vector<double> &penalty_by_lag,
+                 double threshold)
+      : onset_(onset_strength), total_frames_(total_frames), period_(period_frames),
+        min_lag_(min_lag), max_lag_(max_lag), search_start_(search_start),
+        resolution_(std::max(1, min_lag / 3)), penalty_(penalty_by_lag), threshold_(threshold),
+        count_(static_cast<std::size_t>(total_frames)) {
+    compute_remaining();
+    best_after_ = remaining_;
+    for (std::size_t node = best_after_.size() - 1; node-- > 0;) {
+      best_after_[node] = std::max(best_after_[node], best_after_[node + 1]);
+    }
+  }
+
+  void record(int t, int best_prev) {
+    count_[static_cast<std::size_t>(t)] =
+        best_prev >= 0 ? count_[static_cast<std::size_t>(best_prev)] + 1 : 1;
+  }
+
+  bool hopeless(int t, const double *dp) {
+    // Past max_lag every later lag is in range; before search_start the
+    // path still has beats after t.
+    if (t < max_lag_ || t >= search_start_) {
+      return false;
+    }
+    // Slack for rounding: the caller divides the DP's own sums.
+    const double slack = 1e-6;
+    int base = t + 1 - max_lag_;
+    double best_so_far = -std::numeric_limits<double>::infinity();
+    for (int p = base; p <= t; ++p) {
+      best_so_far = std::max(best_so_far, dp[static_cast<std::size_t>(p)] -
+                                              threshold_ * count_[static_cast<std::size_t>(p)]);
+    }
+    int last = std::min(total_frames_ - 1, t + max_lag_);
+    for (int x = t + 1; x <= last; ++x) {
+      double rest = remaining_[static_cast<std::size_t>(x / resolution_)];
+      if (best_so_far + rest <= -slack) {
+        continue;  // even without a penalty
+      }
+      for (int p = std::max(base, x - max_lag_); p <= std::min(t, x - min_lag_); ++p) {
+        double link = dp[static_cast<std::size_t>(p)] -
+                      threshold_ * count_[static_cast<std::size_t>(p)] -
+                      penalty_[static_cast<std::size_t>(x - p)];
+        if (link + rest > -slack) {
+          return false;
+        }
+      }
+    }
+
+    floor_.resize(static_cast<std::size_t>(total_frames_ - t - 1));
+    for (int x = t + 1; x < total_frames_; ++x) {
+      double before = x - period_ <= t ? dp[static_cast<std::size_t>(x - period_)]
+                                       : floor_[static_cast<std::size_t>(x - period_ - t - 1)];
+      // Slack for dp[x - P] + onset[x] rounding back to onset[x].
+      if (before <= 1e-9 * (1.0 + std::abs(onset_[x]))) {
+        return best_after_[static_cast<std::size_t>(x / resolution_)] <= -slack;
+      }
+      floor_[static_cast<std::size_t>(x - t - 1)] = before + onset_[x];
+    }
+    return true;
+  }
+
+ private:
+  // The same DP run backwards over nodes of `resolution_` frames, each
+  // scoring its best frame, with the smallest penalty any lag between two
+  // nodes could have: per node, an upper bound on the sum from a beat in
+  // the node to a path end in [search_start, total_frames), or -inf if no
+  // end is in reach.
+  void compute_remaining() {
+    int nodes = (total_frames_ + resolution_ - 1) / resolution_;
+    int min_step = min_lag_ / resolution_;
+    int max_step = (max_lag_ + resolution_ - 1) / resolution_;
+    std::vector<double> step_penalty(static_cast<std::size_t>(max_step + 1),
+                                     std::numeric_limits<double>::infinity());
+    for (int lag = min_lag_; lag <= max_lag_; ++lag) {
+      // A lag spans floor(lag / r) or ceil(lag / r) nodes.
+      for (int step : {lag / resolution_, (lag + resolution_ - 1) / resolution_}) {
+        double &penalty = step_penalty[static_cast<std::size_t>(step)];
+        penalty = std::min(penalty, penalty_[static_cast<std::size_t>(lag)]);
+      }
+    }
+
+    const double none = -std::numeric_limits<double>::infinity();
+    remaining_.assign(static_cast<std::size_t>(nodes), none);
+    for (int node = nodes - 1; node >= 0; --node) {
+      int first = node * resolution_;
+      int last = std::min(total_frames_, first + resolution_);
+      double best_next = last > search_start_ ? 0.0 : none;
+      for (int step = min_step; step <= max_step && node + step < nodes; ++step) {
+        best_next = std::max(best_next, remaining_[static_cast<std::size_t>(node + step)] -
+                                            step_penalty[static_cast<std::size_t>(step)]);
+      }
+      if (best_next > none) {
+        double onset = *std::max_element(onset_ + first, onset_ + last);
+        remaining_[static_cast<std::size_t>(node)] = onset - threshold_ + best_next;
+      }
+    }
+  }
+
+  const float *onset_;
+  int total_frames_;
+  int period_;
+  int min_lag_;
+  int max_lag_;
+  int search_start_;
+  int resolution_;
+  const std::vector<double> &penalty_;
+  double threshold_;
+  std::vector<int> count_;         // beats on the path ending at each frame
+  std::vector<double> remaining_;  // per node
+  std::vector<double> best_after_;  // max of remaining_ from each node on
+  std::vector<double> floor_;  // lower bounds on dp after the checkpoint
+};
+
+}  // namespace
 
 BeatTracker::Result BeatTracker::track(const std::vector<float> &onset_strength,
                                        int period_frames,
                                        int hop_size,
                                        float alpha) const {
-  Result result;
   if (period_frames <= 0 || hop_size <= 0 || onset_strength.empty()) {
-    return result;
+    return Result{};
+  }
+  std::vector<double> dp(onset_strength.size());
+  std::vector<int> prev(onset_strength.size());
+  std::vector<double> penalty_by_lag;
+  return track_span(onset_strength.data(), static_cast<int>(onset_strength.size()), period_frames,
+                    hop_size, alpha, dp.data(), prev.data(), penalty_by_lag);
+}
+
+BeatTracker::Result BeatTracker::track_bounded(const std::vector<float> &onset_strength,
+                                               int period_frames,
+                                               int hop_size,
+                                               double threshold,
+                                               float alpha) const {
+  if (period_frames <= 0 || hop_size <= 0 || onset_strength.empty()) {
+    return Result{};
+  }
+  std::vector<double> dp(onset_strength.size());
+  std::vector<int> prev(onset_strength.size());
+  std::vector<double> penalty_by_lag;
+  return track_span(onset_strength.data(), static_cast<int>(onset_strength.size()), period_frames,
+                    hop_size, alpha, dp.data(), prev.data(), penalty_by_lag,
+                    alpha >= 0.0f ? threshold : -std::numeric_limits<double>::infinity());
+}
+
+std::vector<BeatTracker::Result> BeatTracker::track_batch(const std::vector<float> &onset_strength,
+                                                          const std::vector<std::size_t> &offsets,
+                                                          const std::vector<int> &period_frames,
+                                                          int hop_size,
+                                                          float alpha) const {
+  if (offsets.empty() || offsets.back() != onset_strength.size() ||
+      period_frames.size() + 1 != offsets.size()) {
+    throw std::runtime_error("BeatTracker batch offsets do not match the envelope.");
+  }
+  std::vector<Result> results(period_frames.size());
+  std::vector<double> dp(onset_strength.size());
+  std::vector<int> prev(onset_strength.size());
+  std::vector<double> penalty_by_lag;
+  for (std::size_t clip = 0; clip < period_frames.size(); ++clip) {
+    std::size_t begin = offsets[clip];
+    std::size_t end = offsets[clip + 1];
+    if (end < begin) {
+      throw std::runtime_error("BeatTracker batch offsets must be ascending.");
+    }
+    if (period_frames[clip] <= 0 || hop_size <= 0 || end == begin) {
+      continue;
+    }
+    results[clip] = track_span(onset_strength.data() + begin, static_cast<int>(end - begin),
+                               period_frames[clip], hop_size, alpha, dp.data() + begin,
+                               prev.data() + begin, penalty_by_lag);
   }
+  return results;
+}
 
-  int total_frames = static_cast<int>(onset_strength.size());
+BeatTracker::Result BeatTracker::track_span(const float *onset_strength,
+                                            int total_frames,
+                                            int period_frames,
+                                            int hop_size,
+                                            float alpha,
+                                            double *dp,
+                                            int *prev,
+                                            std::vector<double> &penalty_by_lag,
+                                            double abandon_threshold) const {
+  Result result;
   int min_lag = std::max(1, static_cast<int>(std::round(period_frames * 0.5f)));
   int max_lag = std::max(min_lag + 1, static_cast<int>(std::round(period_frames * 2.0f)));
 
-  std::vector<double> dp(static_cast<std::size_t>(total_frames), -std::numeric_limits<double>::infinity());
-  std::vector<int> prev(static_cast<std::size_t>(total_frames), -1);
+  std::fill(dp, dp + total_frames, -std::numeric_limits<double>::infinity());
+  std::fill(prev, prev + total_frames, -1);
+
+  // The transition penalty depends only on the lag.  Lags below min_lag
+  // occur for the first frames (p clamps to 0); lag 0 gives +inf.
+  penalty_by_lag.resize(static_cast<std::size_t>(max_lag + 1));
+  for (int lag = 0; lag <= max_lag; ++lag) {
+    double log_ratio = std::log(static_cast<double>(lag) / static_cast<double>(period_frames));
+    penalty_by_lag[static_cast<std::size_t>(lag)] = alpha * (log_ratio * log_ratio);
+  }
+  const kernels::KernelTable &k = kernels::active();
+
+  bool pruned = search_ == DpSearch::PRUNED;
+  std::deque<int> window_max;  // frames in the window, dp strictly decreasing
+  int pushed = -1;             // last frame offered to window_max
+
+  int search_start = static_cast<int>(total_frames * 0.9f);
+  search_start = std::max(0, std::min(search_start, total_frames - 1));
+
+  std::unique_ptr<CandidateBound> bound;
+  int checkpoint = 1;
+  if (abandon_threshold > -std::numeric_limits<double>::infinity()) {
+    bound = std::make_unique<CandidateBound>(onset_strength, total_frames, period_frames, min_lag,
+                                             max_lag, search_start, penalty_by_lag,
+                                             abandon_threshold);
+  }
 
   for (int t = 0; t < total_frames; ++t) {
-    double best_score = onset_strength[static_cast<std::size_t>(t)];
+    double best_score = onset_strength[t];
     int best_prev = -1;
 
     int start = std::max(0, t - max_lag);
     int end = std::max(0, t - min_lag);
-    for (int p = start; p <= end; ++p) {
-      int lag = t - p;
-      double log_ratio = std::log(static_cast<double>(lag) / static_cast<double>(period_frames));
-      double penalty = alpha * (log_ratio * log_ratio);
-      double score = dp[static_cast<std::size_t>(p)] + onset_strength[static_cast<std::size_t>(t)] - penalty;
-      if (score > best_score) {
-        best_score = score;
-        best_prev = p;
+    double add = static_cast<double>(onset_strength[t]);
+    if (!pruned) {
+      // Scores dp[p] + onset[t] - penalty(t - p) for p in [start, end]; the
+      // penalty slice is reversed relative to p, starting at lag t - end.
+      long best = k.dp_argmax(dp + start, penalty_by_lag.data() + (t - end), add,
+                              static_cast<std::size_t>(end - start + 1), best_score);
+      if (best >= 0) {
+        best_prev = start + static_cast<int>(best);
+      }
+    } else {
+      while (pushed < end && pushed + 1 < t) {
+        ++pushed;
+        while (!window_max.empty() &&
+               dp[static_cast<std::size_t>(window_max.back())] <= dp[static_cast<std::size_t>(pushed)]) {
+          window_max.pop_back();
+        }
+        window_max.push_back(pushed);
+      }
+      while (!window_max.empty() && window_max.front() < start) {
+        window_max.pop_front();
+      }
+
+      // The predecessor one period back is a score the optimum must reach.
+      int seed = t - period_frames;
+      int min_reach = t - end;   // shortest lag in the window
+      int max_reach = t - start;  // longest
+      if (window_max.empty() || seed < start || seed > end) {
+        long best = k.dp_argmax(dp + start, penalty_by_lag.data() + (t - end), add,
+                                static_cast<std::size_t>(end - start + 1), best_score);
+        if (best >= 0) {
+          best_prev = start + static_cast<int>(best);
+        }
+      } else {
+        double floor = std::max(best_score, dp[static_cast<std::size_t>(seed)] + add -
+                                                penalty_by_lag[static_cast<std::size_t>(period_frames)]);
+        double ceiling = dp[static_cast<std::size_t>(window_max.front())] + add;
+        auto can_win = [&](int lag) {
+          return ceiling - penalty_by_lag[static_cast<std::size_t>(lag)] >= floor + tolerance_;
+        };
+        // The penalty is monotonic on either side of P, so the lags that can
+        // still win form one interval around it.
+        int lag_lo = period_frames;
+        int lag_hi = period_frames;
+        while (lag_lo > min_reach && can_win(lag_lo - 1)) {
+          --lag_lo;
+        }
+        while (lag_hi < max_reach && can_win(lag_hi + 1)) {
+          ++lag_hi;
+        }
+        // Scanned in frame order with the same kernel, so ties resolve to
+        // the earliest frame as in the exhaustive scan.
+        long best = k.dp_argmax(dp + (t - lag_hi), penalty_by_lag.data() + lag_lo, add,
+                                static_cast<std::size_t>(lag_hi - lag_lo + 1), best_score);
+        if (best >= 0) {
+          best_prev = t - lag_hi + static_cast<int>(best);
+        }
       }
     }
 
     dp[static_cast<std::size_t>(t)] = best_score;
     prev[static_cast<std::size_t>(t)] = best_prev;
+
+    if (bound) {
+      bound->record(t, best_prev);
+      if (checkpoint < kBoundCheckpoints &&
+          t == static_cast<int>(static_cast<long long>(total_frames) * checkpoint / kBoundCheckpoints)) {
+        ++checkpoint;
+        if (bound->hopeless(t, dp)) {
+          result.abandoned = true;
+          return result;
+        }
+      }
+    }
   }
 
-  int search_start = static_cast<int>(total_frames * 0.9f);
-  search_start = std::max(0, std::min(search_start, total_frames - 1));
   int best_end = search_start;
   double best_score = dp[static_cast<std::size_t>(search_start)];
   for (int t = search_start; t < total_frames; ++t) {
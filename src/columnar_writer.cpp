@@ -0,0 +1,240 @@
+#include "bpm/columnar_writer.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace bpm {
+namespace {
+
+constexpr char kMagic[8] = {'B', 'P', 'M', 'T', 'B', 'L', '0', '1'};
+constexpr std::uint32_t kFormatVersion = 1;
+
+// Column order; the footer records it, so readers look columns up by name.
+enum Col : std::size_t {
+  PATH,
+  DURATION_SEC,
+  SAMPLE_RATE,
+  BPM,
+  TIME_SIGNATURE,
+  BEATS_PER_MEASURE,
+  METER_CONFIDENCE,
+  KEY,
+  KEY_CONFIDENCE,
+  INTEGRATED_LUFS,
+  TRUE_PEAK_DBTP,
+  DECODE_SEC,
+  DOWNMIX_SEC,
+  KEY_SEC,
+  ONSET_SEC,
+  TEMPO_SEC,
+  BEAT_SEC,
+  METER_SEC,
+  RENDER_SEC,
+  WRITE_SEC,
+  BEATS,
+  DOWNBEATS,
+};
+
+void append_le(std::vector<unsigned char> &out, std::uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<unsigned char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+std::uint64_t f64_bits(double value) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+double or_nan(bool present, double value) {
+  return present ? value : std::numeric_limits<double>::quiet_NaN();
+}
+
+}  // namespace
+
+ColumnarWriter::ColumnarWriter(const std::string &path, std::size_t rows_per_group)
+    : path_(path), out_(path, std::ios::binary | std::ios::trunc),
+      rows_per_group_(rows_per_group) {
+  if (!out_) {
+    throw std::runtime_error("Failed to open columnar output: " + path);
+  }
+  if (rows_per_group_ == 0) {
+    throw std::runtime_error("Columnar row group size must be at least 1.");
+  }
+
+  add_column("path", ColumnType::STRING);
+  add_column("duration_sec", ColumnType::F64);
+  add_column("sample_rate", ColumnType::U32);
+  add_column("bpm", ColumnType::F64);
+  add_column("time_signature", ColumnType::STRING);
+  add_column("beats_per_measure", ColumnType::U32);
+  add_column("meter_confidence", ColumnType::F64);
+  add_column("key", ColumnType::STRING);
+  add_column("key_confidence", ColumnType::F64);
+  add_column("integrated_lufs", ColumnType::F64);
+  add_column("true_peak_dbtp", ColumnType::F64);
+  add_column("decode_sec", ColumnType::F64);
+  add_column("downmix_sec", ColumnType::F64);
+  add_column("key_sec", ColumnType::F64);
+  add_column("onset_sec", ColumnType::F64);
+  add_column("tempo_sec", ColumnType::F64);
+  add_column("beat_sec", ColumnType::F64);
+  add_column("meter_sec", ColumnType::F64);
+  add_column("render_sec", ColumnType::F64);
+  add_column("write_sec", ColumnType::F64);
+  add_column("beats", ColumnType::LIST_U64);
+  add_column("downbeats", ColumnType::LIST_U64);
+
+  write_bytes(kMagic, sizeof(kMagic));
+}
+
+ColumnarWriter::~ColumnarWriter() {
+  if (!closed_) {
+    try {
+      close();
+    } catch (...) {
+      // Destructors must not throw; call close() to see write errors.
+    }
+  }
+}
+
+void ColumnarWriter::add_column(const char *name, ColumnType type) {
+  Column column;
+  column.name = name;
+  column.type = type;
+  if (type == ColumnType::STRING || type == ColumnType::LIST_U64) {
+    column.offsets.push_back(0);
+  }
+  columns_.push_back(std::move(column));
+}
+
+void ColumnarWriter::put_f64(std::size_t column, double value) {
+  append_le(columns_[column].values, f64_bits(value), 8);
+}
+
+void ColumnarWriter::put_u32(std::size_t column, std::uint32_t value) {
+  append_le(columns_[column].values, value, 4);
+}
+
+void ColumnarWriter::put_string(std::size_t column, const std::string &value) {
+  Column &c = columns_[column];
+  c.values.insert(c.values.end(), value.begin(), value.end());
+  c.offsets.push_back(static_cast<std::uint32_t>(c.values.size()));
+}
+
+void ColumnarWriter::put_list(std::size_t column, const std::vector<std::size_t> &values) {
+  Column &c = columns_[column];
+  for (std::size_t v : values) {
+    append_le(c.values, static_cast<std::uint64_t>(v), 8);
+  }
+  c.offsets.push_back(static_cast<std::uint32_t>(c.values.size() / 8));
+}
+
+void ColumnarWriter::append(const JobResult &result) {
+  if (closed_) {
+    throw std::runtime_error("Columnar output already closed: " + path_);
+  }
+  put_string(PATH, result.input_path);
+  put_f64(DURATION_SEC, result.duration_sec);
+  put_u32(SAMPLE_RATE, static_cast<std::uint32_t>(result.sample_rate));
+  put_f64(BPM, result.bpm);
+  put_string(TIME_SIGNATURE, result.time_signature);
+  put_u32(BEATS_PER_MEASURE, static_cast<std::uint32_t>(result.beats_per_measure));
+  put_f64(METER_CONFIDENCE, or_nan(result.has_meter, result.meter_confidence));
+  put_string(KEY, result.key);
+  put_f64(KEY_CONFIDENCE, or_nan(result.has_key, result.key_confidence));
+  put_f64(INTEGRATED_LUFS, or_nan(result.has_loudness, result.integrated_lufs));
+  put_f64(TRUE_PEAK_DBTP, or_nan(result.has_loudness, result.true_peak_dbtp));
+  const StageTimings &t = result.timings;
+  put_f64(DECODE_SEC, t.decode);
+  put_f64(DOWNMIX_SEC, t.downmix);
+  put_f64(KEY_SEC, t.key);
+  put_f64(ONSET_SEC, t.onset);
+  put_f64(TEMPO_SEC, t.tempo);
+  put_f64(BEAT_SEC, t.beat);
+  put_f64(METER_SEC, t.meter);
+  put_f64(RENDER_SEC, t.render);
+  put_f64(WRITE_SEC, t.write);
+  put_list(BEATS, result.beat_samples);
+  put_list(DOWNBEATS, result.downbeat_samples);
+
+  ++rows_;
+  if (++pending_rows_ == rows_per_group_) {
+    flush_group();
+  }
+}
+
+void ColumnarWriter::flush_group() {
+  if (pending_rows_ == 0) {
+    return;
+  }
+  RowGroup group;
+  group.rows = static_cast<std::uint32_t>(pending_rows_);
+  std::vector<unsigned char> offsets;
+  for (Column &column : columns_) {
+    ChunkRef chunk;
+    chunk.offset = position_;
+    if (!column.offsets.empty()) {
+      offsets.clear();
+      for (std::uint32_t o : column.offsets) {
+        append_le(offsets, o, 4);
+      }
+      write_bytes(offsets.data(), offsets.size());
+      column.offsets.assign(1, 0);
+    }
+    write_bytes(column.values.data(), column.values.size());
+    column.values.clear();
+    chunk.length = position_ - chunk.offset;
+    group.chunks.push_back(chunk);
+  }
+  groups_.push_back(std::move(group));
+  pending_rows_ = 0;
+}
+
+void ColumnarWriter::close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  flush_group();
+
+  std::vector<unsigned char> footer;
+  append_le(footer, kFormatVersion, 4);
+  append_le(footer, columns_.size(), 4);
+  for (const Column &column : columns_) {
+    footer.push_back(static_cast<unsigned char>(column.type));
+    append_le(footer, column.name.size(), 2);
+    footer.insert(footer.end(), column.name.begin(), column.name.end());
+  }
+  append_le(footer, groups_.size(), 4);
+  for (const RowGroup &group : groups_) {
+    append_le(footer, group.rows, 4);
+    for (const ChunkRef &chunk : group.chunks) {
+      append_le(footer, chunk.offset, 8);
+      append_le(footer, chunk.length, 8);
+    }
+  }
+  std::uint64_t footer_offset = position_;
+  write_bytes(footer.data(), footer.size());
+  footer.clear();
+  append_le(footer, footer_offset, 8);
+  write_bytes(footer.data(), footer.size());
+  write_bytes(kMagic, sizeof(kMagic));
+
+  out_.close();
+  if (!out_) {
+    throw std::runtime_error("Failed to write columnar output: " + path_);
+  }
+}
+
+void ColumnarWriter::write_bytes(const void *data, std::size_t size) {
+  out_.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+  if (!out_) {
+    throw std::runtime_error("Failed to write columnar output: " + path_);
+  }
+  position_ += size;
+}
+
+}  // namespace bpm
@@ -0,0 +1,200 @@
+#include "bpm/feature_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace bpm {
+namespace {
+
+constexpr char kMagic[4] = {'B', 'P', 'M', 'C'};
+constexpr std::uint32_t kFormatVersion = 1;
+
+// A temporary file this old belongs to a store that will not finish.
+constexpr auto kStaleTempAge = std::chrono::minutes(10);
+
+std::uint64_t mix(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+void append_hex(std::string &out, std::uint64_t value) {
+  static const char kDigits[] = "0123456789abcdef";
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    out += kDigits[(value >> shift) & 0xF];
+  }
+}
+
+}  // namespace
+
+FeatureCache::FeatureCache(std::string directory) : directory_(std::move(directory)) {
+  std::error_code ec;
+  std::filesystem::create_directories(directory_, ec);
+  if (ec) {
+    throw std::runtime_error("Failed to create feature cache directory: " + directory_);
+  }
+}
+
+std::string FeatureCache::chunk_key(const std::string &tag, const float *samples,
+                                    std::size_t count) {
+  // Two independently seeded multiply-xorshift lanes over the raw sample
+  // bits.  Not cryptographic; collisions are negligible at 128 bits.
+  std::uint64_t a = 0x9e3779b97f4a7c15ULL ^ count;
+  std::uint64_t b = 0xc2b2ae3d27d4eb4fULL + count;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &samples[i], sizeof(bits));
+    a = (a ^ bits) * 0x100000001b3ULL;
+    a = (a << 23) | (a >> 41);
+    b = (b + bits) * 0xff51afd7ed558ccdULL;
+    b ^= b >> 29;
+  }
+  std::string key = tag;
+  key += "_v" + std::to_string(kAnalysisVersion) + "_";
+  append_hex(key, mix(a ^ (b << 1)));
+  append_hex(key, mix(b ^ (a >> 1)));
+  return key;
+}
+
+std::size_t FeatureCache::content_chunk_end(const float *samples, std::size_t begin,
+                                            std::size_t frames, std::size_t hop,
+                                            std::size_t target) {
+  std::size_t min_frames = std::max<std::size_t>(1, target / 2);
+  std::size_t max_end = std::min(frames, begin + 4 * target);
+  std::uint64_t anchor_mask = min_frames - 1;
+  for (std::size_t frame = begin + min_frames; frame < max_end; ++frame) {
+    const float *first = samples + frame * hop;
+    std::uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (std::size_t i = 0; i < hop; ++i) {
+      std::uint32_t bits;
+      std::memcpy(&bits, &first[i], sizeof(bits));
+      h = (h ^ bits) * 0x100000001b3ULL;
+    }
+    if ((mix(h) & anchor_mask) == 0) {
+      return frame;
+    }
+  }
+  return max_end;
+}
+
+std::string FeatureCache::path_for(const std::string &key) const {
+  return directory_ + "/" + key + ".bin";
+}
+
+bool FeatureCache::load(const std::string &key, std::vector<float> &values) const {
+  std::ifstream in(path_for(key), std::ios::binary);
+  if (!in) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  char magic[4];
+  std::uint32_t version = 0;
+  std::uint64_t count = 0;
+  in.read(magic, 4);
+  in.read(reinterpret_cast<char *>(&version), sizeof(version));
+  in.read(reinterpret_cast<char *>(&count), sizeof(count));
+  if (!in || std::memcmp(magic, kMagic, 4) != 0 || version != kFormatVersion ||
+      count > (static_cast<std::uint64_t>(1) << 32)) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  values.resize(static_cast<std::size_t>(count));
+  in.read(reinterpret_cast<char *>(values.data()),
+          static_cast<std::streamsize>(count * sizeof(float)));
+  if (!in) {
+    values.clear();
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  // Marks the entry as recently used for prune().
+  std::error_code ec;
+  std::filesystem::last_write_time(path_for(key), std::filesystem::file_time_type::clock::now(),
+                                   ec);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void FeatureCache::store(const std::string &key, const std::vector<float> &values) const {
+  // Write-then-rename so concurrent readers never see a partial entry.
+  // Failures are ignored: the cache is an optimisation, not a dependency.
+  std::string path = path_for(key);
+  std::string temp_path = path + ".tmp";
+  {
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out) {
+      return;
+    }
+    std::uint64_t count = values.size();
+    out.write(kMagic, 4);
+    out.write(reinterpret_cast<const char *>(&kFormatVersion), sizeof(kFormatVersion));
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char *>(values.data()),
+              static_cast<std::streamsize>(values.size() * sizeof(float)));
+    if (!out) {
+      out.close();
+      std::remove(temp_path.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+  }
+}
+
+std::size_t FeatureCache::prune(std::uint64_t max_bytes) const {
+  namespace fs = std::filesystem;
+  struct Entry {
+    fs::file_time_type used;
+    std::uint64_t bytes;
+    fs::path path;
+  };
+  std::vector<Entry> entries;
+  std::uint64_t total = 0;
+  auto now = fs::file_time_type::clock::now();
+  std::error_code ec;
+  for (fs::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code entry_ec;
+    if (!it->is_regular_file(entry_ec)) {
+      continue;
+    }
+    fs::file_time_type used = it->last_write_time(entry_ec);
+    std::uint64_t bytes = it->file_size(entry_ec);
+    if (entry_ec) {
+      continue;
+    }
+    std::string extension = it->path().extension().string();
+    if (extension == ".tmp") {
+      if (now - used > kStaleTempAge) {
+        fs::remove(it->path(), entry_ec);
+      }
+    } else if (extension == ".bin") {
+      entries.push_back({used, bytes, it->path()});
+      total += bytes;
+    }
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  std::size_t removed = 0;
+  for (const Entry &entry : entries) {
+    if (total <= max_bytes) {
+      break;
+    }
+    std::error_code remove_ec;
+    if (fs::remove(entry.path, remove_ec)) {
+      ++removed;
+    }
+    total -= entry.bytes;
+  }
+  return removed;
+}
+
+}  // namespace bpm
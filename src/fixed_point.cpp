@@ -0,0 +1,165 @@
+#include "bpm/fixed_point.h"
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+namespace bpm {
+namespace fixed {
+namespace {
+
+constexpr int kLogTableBits = 6;
+constexpr int kTwiddleShift = 30;
+
+// log2(1 + i / 64) in Q16 for i = 0..64.  Built once; lookups are integer.
+const std::array<std::int32_t, (1 << kLogTableBits) + 1> &log2_table() {
+  static const auto table = [] {
+    std::array<std::int32_t, (1 << kLogTableBits) + 1> t{};
+    for (int i = 0; i <= (1 << kLogTableBits); ++i) {
+      double frac = static_cast<double>(i) / static_cast<double>(1 << kLogTableBits);
+      t[static_cast<std::size_t>(i)] =
+          static_cast<std::int32_t>(std::lround(std::log2(1.0 + frac) * 65536.0));
+    }
+    return t;
+  }();
+  return table;
+}
+
+int highest_bit(std::uint64_t x) {
+  int bit = 0;
+  for (int shift = 32; shift > 0; shift >>= 1) {
+    if (x >> shift) {
+      x >>= shift;
+      bit += shift;
+    }
+  }
+  return bit;
+}
+
+std::int32_t round_shift(std::int64_t value, int shift) {
+  return static_cast<std::int32_t>((value + (static_cast<std::int64_t>(1) << (shift - 1))) >> shift);
+}
+
+}  // namespace
+
+std::int16_t to_q15(float value) {
+  float scaled = std::round(value * 32768.0f);
+  if (scaled > 32767.0f) {
+    return 32767;
+  }
+  if (scaled < -32768.0f) {
+    return -32768;
+  }
+  return static_cast<std::int16_t>(scaled);
+}
+
+std::int32_t log2_q16(std::uint64_t x) {
+  if (x == 0) {
+    return 0;
+  }
+  int exponent = highest_bit(x);
+  // Normalize the mantissa to 1.xxx with 32 fractional bits.
+  std::uint64_t mantissa = (exponent >= 32) ? (x >> (exponent - 32)) : (x << (32 - exponent));
+  std::uint32_t frac = static_cast<std::uint32_t>(mantissa & 0xFFFFFFFFu);
+  std::uint32_t index = frac >> (32 - kLogTableBits);
+  std::uint32_t rem = (frac >> (32 - kLogTableBits - 16)) & 0xFFFFu;  // Q16 within the slot
+  const auto &table = log2_table();
+  std::int32_t lo = table[index];
+  std::int32_t hi = table[index + 1];
+  std::int32_t interp = lo + static_cast<std::int32_t>((static_cast<std::int64_t>(hi - lo) * rem) >> 16);
+  return (exponent << 16) + interp;
+}
+
+RealFFT::RealFFT(int size) : size_(size), half_(size / 2) {
+  if (size < 4 || (size & (size - 1)) != 0) {
+    throw std::runtime_error("Fixed-point FFT size must be a power of two >= 4.");
+  }
+  while ((1 << stages_) < half_) {
+    ++stages_;
+  }
+
+  constexpr double kPi = 3.14159265358979323846;
+  const double scale = static_cast<double>(1 << kTwiddleShift);
+  cos_q30_.resize(static_cast<std::size_t>(half_ + 1));
+  sin_q30_.resize(static_cast<std::size_t>(half_ + 1));
+  for (int k = 0; k <= half_; ++k) {
+    double angle = -2.0 * kPi * static_cast<double>(k) / static_cast<double>(size_);
+    cos_q30_[static_cast<std::size_t>(k)] = static_cast<std::int32_t>(std::lround(std::cos(angle) * scale));
+    sin_q30_[static_cast<std::size_t>(k)] = static_cast<std::int32_t>(std::lround(std::sin(angle) * scale));
+  }
+
+  bitrev_.resize(static_cast<std::size_t>(half_));
+  for (int i = 0; i < half_; ++i) {
+    std::uint32_t r = 0;
+    for (int b = 0; b < stages_; ++b) {
+      if (i & (1 << b)) {
+        r |= 1u << (stages_ - 1 - b);
+      }
+    }
+    bitrev_[static_cast<std::size_t>(i)] = r;
+  }
+
+  work_re_.resize(static_cast<std::size_t>(half_));
+  work_im_.resize(static_cast<std::size_t>(half_));
+}
+
+void RealFFT::forward(const std::int32_t *input, std::int32_t *re, std::int32_t *im) {
+  // Pack even/odd samples as one complex sequence, bit-reversed.
+  for (int i = 0; i < half_; ++i) {
+    std::size_t dst = bitrev_[static_cast<std::size_t>(i)];
+    work_re_[dst] = input[2 * i];
+    work_im_[dst] = input[2 * i + 1];
+  }
+
+  // Radix-2 DIT butterflies with a 1/2 shift per stage.
+  for (int len = 2; len <= half_; len <<= 1) {
+    int half_len = len / 2;
+    int stride = size_ / len;
+    for (int start = 0; start < half_; start += len) {
+      for (int j = 0; j < half_len; ++j) {
+        std::size_t a = static_cast<std::size_t>(start + j);
+        std::size_t b = a + static_cast<std::size_t>(half_len);
+        std::int64_t wr = cos_q30_[static_cast<std::size_t>(j * stride)];
+        std::int64_t wi = sin_q30_[static_cast<std::size_t>(j * stride)];
+        std::int64_t br = work_re_[b];
+        std::int64_t bi = work_im_[b];
+        std::int64_t tr = (br * wr - bi * wi) >> kTwiddleShift;
+        std::int64_t ti = (br * wi + bi * wr) >> kTwiddleShift;
+        std::int64_t ar = work_re_[a];
+        std::int64_t ai = work_im_[a];
+        work_re_[a] = round_shift(ar + tr, 1);
+        work_im_[a] = round_shift(ai + ti, 1);
+        work_re_[b] = round_shift(ar - tr, 1);
+        work_im_[b] = round_shift(ai - ti, 1);
+      }
+    }
+  }
+
+  // Split the half-length spectrum Z into the real spectrum X:
+  //   X[k] = (Z[k] + conj(Z[M-k])) / 2 + W^k (Z[k] - conj(Z[M-k])) / 2i
+  // with an extra 1/2 so the overall scale is 1/N.
+  for (int k = 0; k <= half_; ++k) {
+    std::size_t ik = static_cast<std::size_t>(k % half_);
+    std::size_t im_k = static_cast<std::size_t>((half_ - k) % half_);
+    std::int64_t zr = work_re_[ik];
+    std::int64_t zi = work_im_[ik];
+    std::int64_t mr = work_re_[im_k];
+    std::int64_t mi = work_im_[im_k];
+
+    std::int64_t er = zr + mr;
+    std::int64_t ei = zi - mi;
+    std::int64_t or_ = zi + mi;
+    std::int64_t oi = mr - zr;
+
+    std::int64_t wr = cos_q30_[static_cast<std::size_t>(k)];
+    std::int64_t wi = sin_q30_[static_cast<std::size_t>(k)];
+    std::int64_t tr = (or_ * wr - oi * wi) >> kTwiddleShift;
+    std::int64_t ti = (or_ * wi + oi * wr) >> kTwiddleShift;
+
+    re[k] = round_shift(er + tr, 2);
+    im[k] = round_shift(ei + ti, 2);
+  }
+}
+
+}  // namespace fixed
+}  // namespace bpm
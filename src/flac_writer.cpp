@@ -0,0 +1,471 @@
+#include "bpm/flac_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bpm/kernels.h"
+
+namespace bpm {
+namespace {
+
+constexpr int kBlockSize = 4096;
+constexpr int kMaxFixedOrder = 4;
+constexpr int kMaxPartitionOrder = 8;
+constexpr int kMaxRiceParam = 14;  // 15 is the escape code
+constexpr int kBitsPerSample = 16;
+constexpr std::size_t kBlocksPerThreadBatch = 16;
+
+// MSB-first bit packer used for frame headers and subframes.
+class BitWriter {
+ public:
+  void write(std::uint32_t value, int bits) {
+    if (bits <= 0) {
+      return;
+    }
+    std::uint64_t mask = (static_cast<std::uint64_t>(1) << bits) - 1;
+    acc_ = (acc_ << bits) | (value & mask);
+    acc_bits_ += bits;
+    while (acc_bits_ >= 8) {
+      acc_bits_ -= 8;
+      bytes_.push_back(static_cast<std::uint8_t>(acc_ >> acc_bits_));
+    }
+  }
+
+  void write_signed(std::int32_t value, int bits) {
+    write(static_cast<std::uint32_t>(value), bits);
+  }
+
+  void write_rice(std::int32_t value, int param) {
+    // Zigzag fold so small magnitudes of either sign get short codes.
+    std::uint32_t folded = (static_cast<std::uint32_t>(value) << 1) ^
+                           static_cast<std::uint32_t>(value >> 31);
+    std::uint32_t quotient = folded >> param;
+    while (quotient >= 31) {
+      write(0, 31);
+      quotient -= 31;
+    }
+    write(1, static_cast<int>(quotient) + 1);
+    write(folded, param);
+  }
+
+  void align() {
+    if (acc_bits_ > 0) {
+      write(0, 8 - acc_bits_);
+    }
+  }
+
+  std::vector<std::uint8_t> &bytes() { return bytes_; }
+
+ private:
+  std::vector<std::uint8_t> bytes_;
+  std::uint64_t acc_ = 0;
+  int acc_bits_ = 0;
+};
+
+std::uint8_t crc8(const std::uint8_t *data, std::size_t size) {
+  std::uint8_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b) {
+      crc = static_cast<std::uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1));
+    }
+  }
+  return crc;
+}
+
+const std::array<std::uint16_t, 256> &crc16_table() {
+  static const std::array<std::uint16_t, 256> table = [] {
+    std::array<std::uint16_t, 256> t{};
+    for (int i = 0; i < 256; ++i) {
+      std::uint16_t crc = static_cast<std::uint16_t>(i << 8);
+      for (int b = 0; b < 8; ++b) {
+        crc = static_cast<std::uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1));
+      }
+      t[static_cast<std::size_t>(i)] = crc;
+    }
+    return t;
+  }();
+  return table;
+}
+
+std::uint16_t crc16(const std::uint8_t *data, std::size_t size) {
+  const auto &table = crc16_table();
+  std::uint16_t crc = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc = static_cast<std::uint16_t>((crc << 8) ^ table[((crc >> 8) ^ data[i]) & 0xFF]);
+  }
+  return crc;
+}
+
+// Fixed polynomial predictor residual (FLAC orders 0-4).
+std::vector<std::int32_t> fixed_residual(const std::vector<std::int32_t> &x, int order) {
+  std::size_t n = x.size();
+  std::vector<std::int32_t> res(n > static_cast<std::size_t>(order) ? n - static_cast<std::size_t>(order) : 0);
+  for (std::size_t i = static_cast<std::size_t>(order); i < n; ++i) {
+    std::int32_t r = 0;
+    switch (order) {
+      case 0: r = x[i]; break;
+      case 1: r = x[i] - x[i - 1]; break;
+      case 2: r = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+      case 3: r = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+      case 4: r = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+    }
+    res[i - static_cast<std::size_t>(order)] = r;
+  }
+  return res;
+}
+
+struct RicePlan {
+  int partition_order = 0;
+  std::vector<int> params;
+  std::uint64_t bits = 0;
+};
+
+// Choose the partition order and per-partition Rice parameters that minimise
+// the estimated residual size.  Partition sums are computed once at the finest
+// order and merged pairwise for coarser orders.
+RicePlan plan_rice(const std::vector<std::int32_t> &residual, int block_size, int order) {
+  int max_order = 0;
+  while (max_order < kMaxPartitionOrder &&
+         (block_size % (1 << (max_order + 1))) == 0 &&
+         (block_size >> (max_order + 1)) > order) {
+    ++max_order;
+  }
+
+  std::vector<std::uint64_t> sums(static_cast<std::size_t>(1) << max_order, 0);
+  std::vector<std::uint32_t> counts(sums.size(), 0);
+  std::size_t part_len = static_cast<std::size_t>(block_size >> max_order);
+  for (std::size_t i = 0; i < residual.size(); ++i) {
+    std::size_t sample = i + static_cast<std::size_t>(order);
+    std::size_t part = sample / part_len;
+    std::int32_t v = residual[i];
+    sums[part] += (static_cast<std::uint32_t>(v) << 1) ^ static_cast<std::uint32_t>(v >> 31);
+    counts[part] += 1;
+  }
+
+  RicePlan best;
+  best.bits = ~static_cast<std::uint64_t>(0);
+  for (int p = max_order; p >= 0; --p) {
+    RicePlan plan;
+    plan.partition_order = p;
+    plan.bits = 2 + 4;  // coding method + partition order
+    for (std::size_t part = 0; part < sums.size(); ++part) {
+      std::uint64_t sum = sums[part];
+      std::uint64_t n = counts[part];
+      int best_k = 0;
+      std::uint64_t best_bits = ~static_cast<std::uint64_t>(0);
+      for (int k = 0; k <= kMaxRiceParam; ++k) {
+        std::uint64_t bits = n * static_cast<std::uint64_t>(k + 1) + (sum >> k);
+        if (bits < best_bits) {
+          best_bits = bits;
+          best_k = k;
+        }
+      }
+      plan.params.push_back(best_k);
+      plan.bits += 4 + best_bits;
+    }
+    if (plan.bits < best.bits) {
+      best = std::move(plan);
+    }
+    if (p > 0) {
+      for (std::size_t part = 0; part < sums.size() / 2; ++part) {
+        sums[part] = sums[2 * part] + sums[2 * part + 1];
+        counts[part] = counts[2 * part] + counts[2 * part + 1];
+      }
+      sums.resize(sums.size() / 2);
+      counts.resize(counts.size() / 2);
+    }
+  }
+  return best;
+}
+
+struct Subframe {
+  enum class Type { CONSTANT, VERBATIM, FIXED } type = Type::VERBATIM;
+  int bps = kBitsPerSample;
+  int order = 0;
+  RicePlan rice;
+  std::vector<std::int32_t> residual;
+  std::uint64_t bits = 0;
+};
+
+Subframe plan_subframe(const std::vector<std::int32_t> &x, int bps) {
+  int block_size = static_cast<int>(x.size());
+  Subframe sub;
+  sub.bps = bps;
+
+  if (std::all_of(x.begin(), x.end(), [&](std::int32_t v) { return v == x.front(); })) {
+    sub.type = Subframe::Type::CONSTANT;
+    sub.bits = 8 + static_cast<std::uint64_t>(bps);
+    return sub;
+  }
+
+  sub.type = Subframe::Type::VERBATIM;
+  sub.bits = 8 + static_cast<std::uint64_t>(block_size) * static_cast<std::uint64_t>(bps);
+
+  int max_order = std::min(kMaxFixedOrder, block_size - 1);
+  for (int order = 0; order <= max_order; ++order) {
+    std::vector<std::int32_t> residual = fixed_residual(x, order);
+    RicePlan rice = plan_rice(residual, block_size, order);
+    std::uint64_t bits = 8 + static_cast<std::uint64_t>(order * bps) + rice.bits;
+    if (bits < sub.bits) {
+      sub.type = Subframe::Type::FIXED;
+      sub.order = order;
+      sub.rice = std::move(rice);
+      sub.residual = std::move(residual);
+      sub.bits = bits;
+    }
+  }
+  return sub;
+}
+
+void emit_subframe(BitWriter &bw, const Subframe &sub, const std::vector<std::int32_t> &x) {
+  switch (sub.type) {
+    case Subframe::Type::CONSTANT:
+      bw.write(0x00, 8);
+      bw.write_signed(x.front(), sub.bps);
+      return;
+    case Subframe::Type::VERBATIM:
+      bw.write(0x02, 8);
+      for (std::int32_t v : x) {
+        bw.write_signed(v, sub.bps);
+      }
+      return;
+    case Subframe::Type::FIXED:
+      break;
+  }
+
+  bw.write(static_cast<std::uint32_t>((0x08 | sub.order) << 1), 8);
+  for (int i = 0; i < sub.order; ++i) {
+    bw.write_signed(x[static_cast<std::size_t>(i)], sub.bps);
+  }
+
+  bw.write(0, 2);  // Rice coding with 4-bit parameters
+  bw.write(static_cast<std::uint32_t>(sub.rice.partition_order), 4);
+  std::size_t partitions = static_cast<std::size_t>(1) << sub.rice.partition_order;
+  std::size_t part_len = x.size() >> sub.rice.partition_order;
+  std::size_t r = 0;
+  for (std::size_t part = 0; part < partitions; ++part) {
+    int param = sub.rice.params[part];
+    bw.write(static_cast<std::uint32_t>(param), 4);
+    std::size_t count = (part == 0) ? part_len - static_cast<std::size_t>(sub.order) : part_len;
+    for (std::size_t i = 0; i < count; ++i) {
+      bw.write_rice(sub.residual[r++], param);
+    }
+  }
+}
+
+void write_utf8_number(BitWriter &bw, std::uint32_t value) {
+  if (value < 0x80) {
+    bw.write(value, 8);
+    return;
+  }
+  int extra = (value < 0x800) ? 1 : (value < 0x10000) ? 2 : (value < 0x200000) ? 3
+            : (value < 0x4000000) ? 4 : 5;
+  std::uint32_t lead_mask = (0xFF00u >> (extra + 1)) & 0xFFu;
+  bw.write(lead_mask | (value >> (6 * extra)), 8);
+  for (int i = extra - 1; i >= 0; --i) {
+    bw.write(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+  }
+}
+
+std::vector<std::uint8_t> encode_frame(const AudioBuffer &audio,
+                                       std::size_t frame_number,
+                                       std::size_t start_frame,
+                                       int block_size) {
+  int channels = audio.channels;
+  std::vector<std::vector<std::int32_t>> pcm(static_cast<std::size_t>(channels),
+                                             std::vector<std::int32_t>(static_cast<std::size_t>(block_size)));
+  std::vector<std::int16_t> interleaved(static_cast<std::size_t>(block_size * channels));
+  kernels::active().float_to_int16(
+      audio.samples.data() + start_frame * static_cast<std::size_t>(channels),
+      interleaved.data(), interleaved.size());
+  for (int i = 0; i < block_size; ++i) {
+    for (int ch = 0; ch < channels; ++ch) {
+      pcm[static_cast<std::size_t>(ch)][static_cast<std::size_t>(i)] =
+          interleaved[static_cast<std::size_t>(i * channels + ch)];
+    }
+  }
+
+  // Channel assignment: 0-7 independent, 8 left/side, 9 side/right, 10 mid/side.
+  std::uint32_t assignment = static_cast<std::uint32_t>(channels - 1);
+  std::vector<std::vector<std::int32_t>> signals;
+  std::vector<Subframe> subframes;
+
+  if (channels == 2) {
+    const auto &left = pcm[0];
+    const auto &right = pcm[1];
+    std::vector<std::int32_t> mid(left.size());
+    std::vector<std::int32_t> side(left.size());
+    for (std::size_t i = 0; i < left.size(); ++i) {
+      mid[i] = (left[i] + right[i]) >> 1;
+      side[i] = left[i] - right[i];
+    }
+    Subframe l = plan_subframe(left, kBitsPerSample);
+    Subframe r = plan_subframe(right, kBitsPerSample);
+    Subframe m = plan_subframe(mid, kBitsPerSample);
+    Subframe s = plan_subframe(side, kBitsPerSample + 1);
+
+    std::uint64_t costs[4] = {l.bits + r.bits, l.bits + s.bits, s.bits + r.bits, m.bits + s.bits};
+    int choice = static_cast<int>(std::min_element(costs, costs + 4) - costs);
+    switch (choice) {
+      case 0:
+        signals = {left, right};
+        subframes.push_back(std::move(l));
+        subframes.push_back(std::move(r));
+        break;
+      case 1:
+        assignment = 8;
+        signals = {left, side};
+        subframes.push_back(std::move(l));
+        subframes.push_back(std::move(s));
+        break;
+      case 2:
+        assignment = 9;
+        signals = {side, right};
+        subframes.push_back(std::move(s));
+        subframes.push_back(std::move(r));
+        break;
+      default:
+        assignment = 10;
+        signals = {mid, side};
+        subframes.push_back(std::move(m));
+        subframes.push_back(std::move(s));
+        break;
+    }
+  } else {
+    for (const auto &x : pcm) {
+      subframes.push_back(plan_subframe(x, kBitsPerSample));
+    }
+    signals = std::move(pcm);
+  }
+
+  BitWriter bw;
+  bw.write(0xFFF8, 16);  // sync code, fixed-blocksize stream
+  bw.write(0x7, 4);      // block size: 16-bit value at end of header
+  bw.write(0x0, 4);      // sample rate: from STREAMINFO
+  bw.write(assignment, 4);
+  bw.write(0x4, 3);      // 16 bits per sample
+  bw.write(0, 1);
+  write_utf8_number(bw, static_cast<std::uint32_t>(frame_number));
+  bw.write(static_cast<std::uint32_t>(block_size - 1), 16);
+  bw.write(crc8(bw.bytes().data(), bw.bytes().size()), 8);
+
+  for (std::size_t ch = 0; ch < subframes.size(); ++ch) {
+    emit_subframe(bw, subframes[ch], signals[ch]);
+  }
+  bw.align();
+  std::uint16_t crc = crc16(bw.bytes().data(), bw.bytes().size());
+  bw.write(crc, 16);
+  return std::move(bw.bytes());
+}
+
+void write_streaminfo(std::ofstream &out,
+                      const AudioBuffer &audio,
+                      std::uint32_t min_frame_bytes,
+                      std::uint32_t max_frame_bytes) {
+  BitWriter bw;
+  bw.write(1, 1);   // last metadata block
+  bw.write(0, 7);   // STREAMINFO
+  bw.write(34, 24);
+  bw.write(kBlockSize, 16);
+  bw.write(kBlockSize, 16);
+  bw.write(min_frame_bytes, 24);
+  bw.write(max_frame_bytes, 24);
+  bw.write(static_cast<std::uint32_t>(audio.sample_rate), 20);
+  bw.write(static_cast<std::uint32_t>(audio.channels - 1), 3);
+  bw.write(kBitsPerSample - 1, 5);
+  std::uint64_t total = audio.num_frames();
+  bw.write(static_cast<std::uint32_t>(total >> 32) & 0xF, 4);
+  bw.write(static_cast<std::uint32_t>(total & 0xFFFFFFFFu), 32);
+  for (int i = 0; i < 16; ++i) {
+    bw.write(0, 8);  // MD5 signature not computed
+  }
+  out.write(reinterpret_cast<const char *>(bw.bytes().data()),
+            static_cast<std::streamsize>(bw.bytes().size()));
+}
+
+}  // namespace
+
+void FlacWriter::write(const std::string &filepath, const AudioBuffer &audio,
+                       const FlacParallelism &parallelism) {
+  if (audio.sample_rate <= 0 || audio.sample_rate >= (1 << 20) ||
+      audio.channels <= 0 || audio.channels > 8) {
+    throw std::runtime_error("Invalid audio buffer for FLAC output.");
+  }
+
+  std::ofstream out(filepath, std::ios::binary);
+  if (!out) {
+    throw std::runtime_error("Failed to open output FLAC: " + filepath);
+  }
+
+  std::size_t total_frames = audio.num_frames();
+  std::size_t num_blocks = (total_frames + kBlockSize - 1) / kBlockSize;
+
+  // STREAMINFO is rewritten once the frame size range is known.
+  out.write("fLaC", 4);
+  std::streampos streaminfo_pos = out.tellp();
+  write_streaminfo(out, audio, 0, 0);
+
+  unsigned hw = parallelism.threads > 0 ? parallelism.threads : std::thread::hardware_concurrency();
+  std::size_t num_threads = std::max<std::size_t>(1, std::min<std::size_t>(hw, num_blocks));
+  std::size_t blocks_per_thread = parallelism.blocks_per_thread > 0 ? parallelism.blocks_per_thread
+                                                                    : kBlocksPerThreadBatch;
+  std::size_t batch = num_threads * blocks_per_thread;
+
+  std::uint32_t min_frame_bytes = 0xFFFFFF;
+  std::uint32_t max_frame_bytes = 0;
+  std::vector<std::vector<std::uint8_t>> encoded;
+
+  for (std::size_t batch_start = 0; batch_start < num_blocks; batch_start += batch) {
+    std::size_t batch_end = std::min(num_blocks, batch_start + batch);
+    encoded.assign(batch_end - batch_start, {});
+
+    std::atomic<std::size_t> next{batch_start};
+    auto worker = [&]() {
+      for (;;) {
+        std::size_t block = next.fetch_add(1);
+        if (block >= batch_end) {
+          break;
+        }
+        std::size_t start = block * kBlockSize;
+        int size = static_cast<int>(std::min<std::size_t>(kBlockSize, total_frames - start));
+        encoded[block - batch_start] = encode_frame(audio, block, start, size);
+      }
+    };
+
+    std::size_t workers = std::min(num_threads, batch_end - batch_start);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 1; t < workers; ++t) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    for (const auto &frame : encoded) {
+      std::uint32_t bytes = static_cast<std::uint32_t>(frame.size());
+      min_frame_bytes = std::min(min_frame_bytes, bytes);
+      max_frame_bytes = std::max(max_frame_bytes, bytes);
+      out.write(reinterpret_cast<const char *>(frame.data()),
+                static_cast<std::streamsize>(frame.size()));
+    }
+  }
+
+  if (num_blocks > 0) {
+    out.seekp(streaminfo_pos);
+    write_streaminfo(out, audio, min_frame_bytes, max_frame_bytes);
+  }
+
+  if (!out) {
+    throw std::runtime_error("Failed while writing FLAC: " + filepath);
+  }
+}
+
+}  // namespace bpm
@@ -0,0 +1,202 @@
+#include "bpm/job_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <string>
+#include <utility>
+
+#include "bpm/metrics.h"
+
+namespace bpm {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char *class_label(int c) {
+  return c == static_cast<int>(JobPriority::INTERACTIVE) ? "class=\"interactive\""
+                                                          : "class=\"bulk\"";
+}
+
+double seconds_between(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+// A callback that throws must not take the worker down with it.  If it
+// throws on a result it is called once more with `error` set; a second
+// throw is dropped.
+void complete_job(const AnalysisJob::CompletionCallback &complete, JobResult result) {
+  std::string input_path = result.input_path;
+  bool had_error = !result.error.empty();
+  std::string error;
+  try {
+    complete(std::move(result));
+    return;
+  } catch (const std::exception &ex) {
+    error = ex.what();
+  } catch (...) {
+    error = "Unknown error completing " + input_path;
+  }
+  if (had_error) {
+    return;
+  }
+  JobResult failed;
+  failed.input_path = input_path;
+  failed.error = "Completion callback failed: " + error;
+  try {
+    complete(std::move(failed));
+  } catch (...) {
+  }
+}
+
+}  // namespace
+
+struct JobScheduler::Entry {
+  std::unique_ptr<AnalysisJob> job;
+  AnalysisJob::CompletionCallback complete;
+  int priority = 0;
+  Clock::time_point queued_at;
+  double waited = 0.0;
+};
+
+JobScheduler::JobScheduler() : JobScheduler(Options()) {}
+
+JobScheduler::JobScheduler(const Options &options) {
+  auto &registry = MetricsRegistry::global();
+  for (int c = 0; c < 2; ++c) {
+    classes_[c].queue_wait = &registry.histogram(
+        "bpm_queue_wait_seconds",
+        "Time analysis jobs spent queued for a scheduler worker.",
+        latency_buckets(), class_label(c));
+    classes_[c].preemptions = &registry.counter(
+        "bpm_job_preemptions_total",
+        "Job steps after which the worker switched to the other priority class.",
+        class_label(c));
+  }
+  classes_[static_cast<int>(JobPriority::INTERACTIVE)].weight =
+      std::max(options.interactive_weight, 1u);
+  classes_[static_cast<int>(JobPriority::BULK)].weight = std::max(options.bulk_weight, 1u);
+
+  unsigned threads = options.threads;
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads_.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    threads_.emplace_back(&JobScheduler::worker, this);
+  }
+}
+
+JobScheduler::~JobScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void JobScheduler::submit(std::unique_ptr<AnalysisJob> job, JobPriority priority,
+                          AnalysisJob::CompletionCallback complete) {
+  auto entry = std::make_unique<Entry>();
+  entry->job = std::move(job);
+  entry->complete = std::move(complete);
+  entry->priority = static_cast<int>(priority);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ClassQueue &queue = classes_[entry->priority];
+    if (queue.jobs.empty()) {
+      queue.pass = std::max(queue.pass, virtual_time_);
+    }
+    entry->queued_at = Clock::now();
+    queue.jobs.push_back(std::move(entry));
+    ++pending_;
+  }
+  work_cv_.notify_one();
+}
+
+void JobScheduler::wait_idle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+int JobScheduler::next_class() const {
+  int best = -1;
+  for (int c = 0; c < 2; ++c) {
+    if (!classes_[c].jobs.empty() && (best < 0 || classes_[c].pass < classes_[best].pass)) {
+      best = c;
+    }
+  }
+  return best;
+}
+
+void JobScheduler::worker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    int c = next_class();
+    if (c < 0) {
+      if (stop_) {
+        return;
+      }
+      work_cv_.wait(lock);
+      continue;
+    }
+    ClassQueue &queue = classes_[c];
+    std::unique_ptr<Entry> entry = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    virtual_time_ = queue.pass;
+    lock.unlock();
+
+    Clock::time_point start = Clock::now();
+    entry->waited += seconds_between(entry->queued_at, start);
+    JobResult result;
+    std::string error;
+    bool failed = false;
+    bool finished = false;
+    try {
+      entry->job->step();
+      if (entry->job->done()) {
+        result = entry->job->take_result();
+        finished = true;
+      }
+    } catch (const std::exception &ex) {
+      error = ex.what();
+      failed = true;
+    } catch (...) {
+      error = "Unknown error analyzing " + entry->job->input_path();
+      failed = true;
+    }
+    Clock::time_point end = Clock::now();
+
+    if (failed || finished) {
+      if (failed) {
+        result = JobResult();
+        result.input_path = entry->job->input_path();
+        result.error = error;
+      }
+      result.timings.queue_wait = entry->waited;
+      queue.queue_wait->observe(entry->waited);
+      entry->job.reset();
+      complete_job(entry->complete, std::move(result));
+      lock.lock();
+      queue.pass += seconds_between(start, end) / queue.weight;
+      if (--pending_ == 0) {
+        idle_cv_.notify_all();
+      }
+      continue;
+    }
+
+    lock.lock();
+    queue.pass += seconds_between(start, end) / queue.weight;
+    entry->queued_at = end;
+    queue.jobs.push_front(std::move(entry));
+    if (next_class() != c) {
+      queue.preemptions->inc();
+    }
+  }
+}
+
+}  // namespace bpm
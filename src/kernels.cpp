@@ -0,0 +1,125 @@
+#include "bpm/kernels.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace bpm {
+namespace kernels {
+
+namespace baseline {
+const KernelTable &table();
+}
+#if defined(BPM_KERNELS_X86)
+namespace avx2 {
+const KernelTable &table();
+}
+namespace avx512 {
+const KernelTable &table();
+}
+#endif
+
+namespace {
+
+bool cpu_supports(CpuLevel level) {
+  switch (level) {
+    case CpuLevel::BASELINE:
+      return true;
+#if defined(BPM_KERNELS_X86)
+    // __builtin_cpu_supports also checks that the OS saves the wider
+    // register state (XGETBV), not just the CPUID bits.
+    case CpuLevel::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case CpuLevel::AVX512:
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+             __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+#endif
+    default:
+      return false;
+  }
+}
+
+const KernelTable &table_for(CpuLevel level) {
+  switch (level) {
+#if defined(BPM_KERNELS_X86)
+    case CpuLevel::AVX2:
+      return avx2::table();
+    case CpuLevel::AVX512:
+      return avx512::table();
+#endif
+    default:
+      return baseline::table();
+  }
+}
+
+const KernelTable *initial_table() {
+  CpuLevel level = detected_cpu_level();
+  if (const char *env = std::getenv("BPM_CPU")) {
+    // An unusable override falls back to detection rather than failing
+    // every analysis in the process.
+    try {
+      CpuLevel requested = parse_cpu_level(env);
+      if (cpu_supports(requested)) {
+        level = requested;
+      }
+    } catch (const std::exception &) {
+    }
+  }
+  return &table_for(level);
+}
+
+std::atomic<const KernelTable *> &current() {
+  static std::atomic<const KernelTable *> table{initial_table()};
+  return table;
+}
+
+}  // namespace
+
+const KernelTable &active() {
+  return *current().load(std::memory_order_acquire);
+}
+
+CpuLevel detected_cpu_level() {
+  if (cpu_supports(CpuLevel::AVX512)) {
+    return CpuLevel::AVX512;
+  }
+  if (cpu_supports(CpuLevel::AVX2)) {
+    return CpuLevel::AVX2;
+  }
+  return CpuLevel::BASELINE;
+}
+
+void set_cpu_level(CpuLevel level) {
+  if (!cpu_supports(level)) {
+    throw std::runtime_error("CPU level not supported on this machine: " +
+                             cpu_level_name(level));
+  }
+  current().store(&table_for(level), std::memory_order_release);
+}
+
+std::string cpu_level_name(CpuLevel level) {
+  switch (level) {
+    case CpuLevel::AVX2:
+      return "avx2";
+    case CpuLevel::AVX512:
+      return "avx512";
+    default:
+      return "baseline";
+  }
+}
+
+CpuLevel parse_cpu_level(const std::string &name) {
+  if (name == "baseline" || name == "sse2") {
+    return CpuLevel::BASELINE;
+  }
+  if (name == "avx2") {
+    return CpuLevel::AVX2;
+  }
+  if (name == "avx512") {
+    return CpuLevel::AVX512;
+  }
+  throw std::runtime_error("Unknown CPU level: " + name + " (expected baseline, avx2 or avx512)");
+}
+
+}  // namespace kernels
+}  // namespace bpm
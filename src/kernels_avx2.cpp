@@ -0,0 +1,3 @@
+#define BPM_KERNEL_NAMESPACE avx2
+#define BPM_KERNEL_LEVEL CpuLevel::AVX2
+#include "kernels_impl.h"
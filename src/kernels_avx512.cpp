@@ -0,0 +1,3 @@
+#define BPM_KERNEL_NAMESPACE avx512
+#define BPM_KERNEL_LEVEL CpuLevel::AVX512
+#include "kernels_impl.h"
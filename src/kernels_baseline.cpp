@@ -0,0 +1,3 @@
+#define BPM_KERNEL_NAMESPACE baseline
+#define BPM_KERNEL_LEVEL CpuLevel::BASELINE
+#include "kernels_impl.h"
@@ -0,0 +1,204 @@
+// Kernel bodies shared by every instruction-set variant.  Each
+// kernels_<isa>.cpp defines BPM_KERNEL_NAMESPACE and includes this file, and
+// CMake compiles it with that ISA's flags so the loops below are
+// auto-vectorised for it.
+//
+// Keep this file free of standard-library calls and other inline functions:
+// an inline function instantiated here would be built with the variant's
+// flags and could be picked by the linker for callers on older CPUs.
+// Floating-point contraction is disabled for these files, so every variant
+// rounds identically.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bpm/kernels.h"
+
+#if !defined(BPM_KERNEL_NAMESPACE) || !defined(BPM_KERNEL_LEVEL)
+#error "Define BPM_KERNEL_NAMESPACE and BPM_KERNEL_LEVEL before including kernels_impl.h"
+#endif
+
+namespace bpm {
+namespace kernels {
+namespace BPM_KERNEL_NAMESPACE {
+namespace {
+
+constexpr std::size_t kLanes = 8;
+
+void window_to_double(const float *in, const float *window, double *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<double>(in[i] * window[i]);
+  }
+}
+
+void power_spectrum(const double *pairs, double *power, std::size_t bins) {
+  for (std::size_t k = 0; k < bins; ++k) {
+    double re = pairs[2 * k];
+    double im = pairs[2 * k + 1];
+    power[k] = re * re + im * im;
+  }
+}
+
+double combine(const double *acc) {
+  return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+double dot(const double *a, const float *b, std::size_t n) {
+  double acc[kLanes] = {};
+  std::size_t blocks = n / kLanes * kLanes;
+  for (std::size_t i = 0; i < blocks; i += kLanes) {
+    for (std::size_t j = 0; j < kLanes; ++j) {
+      acc[j] += a[i + j] * static_cast<double>(b[i + j]);
+    }
+  }
+  for (std::size_t i = blocks; i < n; ++i) {
+    acc[i - blocks] += a[i] * static_cast<double>(b[i]);
+  }
+  return combine(acc);
+}
+
+double lagged_dot(const float *x, std::size_t n, std::size_t lag) {
+  if (lag >= n) {
+    return 0.0;
+  }
+  const float *head = x + lag;
+  std::size_t count = n - lag;
+  double acc[kLanes] = {};
+  std::size_t blocks = count / kLanes * kLanes;
+  for (std::size_t i = 0; i < blocks; i += kLanes) {
+    for (std::size_t j = 0; j < kLanes; ++j) {
+      acc[j] += static_cast<double>(head[i + j]) * static_cast<double>(x[i + j]);
+    }
+  }
+  for (std::size_t i = blocks; i < count; ++i) {
+    acc[i - blocks] += static_cast<double>(head[i]) * static_cast<double>(x[i]);
+  }
+  return combine(acc);
+}
+
+long dp_argmax(const double *dp, const double *penalty, double add, std::size_t n,
+               double &best) {
+  // Per-lane maxima with first-index tie breaking, then a merge that keeps
+  // the earliest index among equal scores: the same answer as a sequential
+  // scan with a strict comparison.
+  double lane_best[kLanes];
+  long lane_index[kLanes];
+  for (std::size_t j = 0; j < kLanes; ++j) {
+    lane_best[j] = best;
+    lane_index[j] = -1;
+  }
+  std::size_t blocks = n / kLanes * kLanes;
+  for (std::size_t i = 0; i < blocks; i += kLanes) {
+    for (std::size_t j = 0; j < kLanes; ++j) {
+      double score = dp[i + j] + add - penalty[n - 1 - (i + j)];
+      bool better = score > lane_best[j];
+      lane_best[j] = better ? score : lane_best[j];
+      lane_index[j] = better ? static_cast<long>(i + j) : lane_index[j];
+    }
+  }
+  for (std::size_t i = blocks; i < n; ++i) {
+    std::size_t j = i - blocks;
+    double score = dp[i] + add - penalty[n - 1 - i];
+    if (score > lane_best[j]) {
+      lane_best[j] = score;
+      lane_index[j] = static_cast<long>(i);
+    }
+  }
+  long index = -1;
+  for (std::size_t j = 0; j < kLanes; ++j) {
+    if (lane_index[j] < 0) {
+      continue;
+    }
+    if (index < 0 || lane_best[j] > best ||
+        (lane_best[j] == best && lane_index[j] < index)) {
+      best = lane_best[j];
+      index = lane_index[j];
+    }
+  }
+  return index;
+}
+
+double comb_block(float *delay, const float *input, float feedback, std::size_t n) {
+  double acc[kLanes] = {};
+  std::size_t blocks = n / kLanes * kLanes;
+  for (std::size_t i = 0; i < blocks; i += kLanes) {
+    for (std::size_t j = 0; j < kLanes; ++j) {
+      float y = feedback * delay[i + j] + input[i + j];
+      delay[i + j] = y;
+      acc[j] += static_cast<double>(y) * y;
+    }
+  }
+  for (std::size_t i = blocks; i < n; ++i) {
+    float y = feedback * delay[i] + input[i];
+    delay[i] = y;
+    acc[i - blocks] += static_cast<double>(y) * y;
+  }
+  return combine(acc);
+}
+
+void downmix(const float *interleaved, float *mono, std::size_t frames, std::size_t channels) {
+  double scale = static_cast<double>(channels);
+  if (channels == 2) {
+    for (std::size_t f = 0; f < frames; ++f) {
+      double sum = 0.0;
+      sum += interleaved[2 * f];
+      sum += interleaved[2 * f + 1];
+      mono[f] = static_cast<float>(sum / scale);
+    }
+    return;
+  }
+  for (std::size_t f = 0; f < frames; ++f) {
+    double sum = 0.0;
+    for (std::size_t c = 0; c < channels; ++c) {
+      sum += interleaved[f * channels + c];
+    }
+    mono[f] = static_cast<float>(sum / scale);
+  }
+}
+
+void mix_add(float *dst, const float *src, std::size_t frames, std::size_t channels) {
+  if (channels == 2) {
+    for (std::size_t f = 0; f < frames; ++f) {
+      dst[2 * f] += src[f];
+      dst[2 * f + 1] += src[f];
+    }
+    return;
+  }
+  for (std::size_t f = 0; f < frames; ++f) {
+    for (std::size_t c = 0; c < channels; ++c) {
+      dst[f * channels + c] += src[f];
+    }
+  }
+}
+
+float clamp1(float x) {
+  // Same comparisons, hence same NaN handling, as
+  // std::max(-1.0f, std::min(1.0f, x)).
+  float upper = (x < 1.0f) ? x : 1.0f;
+  return (-1.0f < upper) ? upper : -1.0f;
+}
+
+void clamp_unit(float *data, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    data[i] = clamp1(data[i]);
+  }
+}
+
+void float_to_int16(const float *in, std::int16_t *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<std::int16_t>(clamp1(in[i]) * 32767.0f);
+  }
+}
+
+}  // namespace
+
+const KernelTable &table() {
+  static const KernelTable kTable = {
+      BPM_KERNEL_LEVEL, window_to_double, power_spectrum, dot, lagged_dot,
+      dp_argmax, comb_block, downmix, mix_add, clamp_unit, float_to_int16};
+  return kTable;
+}
+
+}  // namespace BPM_KERNEL_NAMESPACE
+}  // namespace kernels
+}  // namespace bpm
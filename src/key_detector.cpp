@@ -4,13 +4,15 @@
 #include <array>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
-extern "C" {
-#include "pocketfft.h"
-}
+#include "bpm/feature_cache.h"
+#include "bpm/kernels.h"
+#include "bpm/pruned_fft.h"
 
 namespace bpm {
 namespace {
@@ -40,36 +42,191 @@ constexpr float kC0Hz = 16.3516f;
 
 }  // namespace
 
-std::array<float, KeyDetector::kChromaBins>
-KeyDetector::compute_chromagram(const AudioBuffer &mono_audio) const {
-  std::array<float, kChromaBins> chroma = {};
+// Everything the chromagram keeps between chunks.
+struct KeyDetector::Session::State {
+  explicit State(const AudioBuffer &mono_audio, const FeatureCache *cache)
+      : audio(mono_audio), cache(cache) {
+    if (audio.samples.size() < static_cast<std::size_t>(kFFTSize)) {
+      return;
+    }
 
-  if (mono_audio.samples.size() < static_cast<std::size_t>(kFFTSize)) {
-    return chroma;
+    // Hann window.
+    constexpr float kPi = 3.14159265358979323846f;
+    window.resize(static_cast<std::size_t>(kFFTSize));
+    float denom = static_cast<float>(kFFTSize - 1);
+    for (int i = 0; i < kFFTSize; ++i) {
+      window[static_cast<std::size_t>(i)] =
+          0.5f - 0.5f * std::cos(2.0f * kPi * static_cast<float>(i) / denom);
+    }
+
+    // Pre-compute interpolated bin-to-chroma mapping with octave index.
+    // Each bin distributes energy between the two nearest pitch classes
+    // proportionally to distance, avoiding systematic bias at low frequencies
+    // where FFT bin spacing exceeds semitone spacing.
+    int num_bins = kFFTSize / 2 + 1;
+    float sr = static_cast<float>(audio.sample_rate);
+
+    // Determine octave range.
+    float min_pitch = 12.0f * std::log2(kMinFreqHz / kC0Hz);
+    int min_octave = static_cast<int>(std::floor(min_pitch / 12.0f));
+    float max_pitch = 12.0f * std::log2(kMaxFreqHz / kC0Hz);
+    int max_octave = static_cast<int>(std::floor(max_pitch / 12.0f));
+    n_octaves = max_octave - min_octave + 1;
+
+    bin_map.resize(static_cast<std::size_t>(num_bins));
+    for (int k = 1; k < num_bins; ++k) {
+      float freq = static_cast<float>(k) * sr / static_cast<float>(kFFTSize);
+      if (freq < kMinFreqHz || freq > kMaxFreqHz) {
+        continue;
+      }
+      float pitch = 12.0f * std::log2(freq / kC0Hz);
+      float pitch_floor = std::floor(pitch);
+      float frac = pitch - pitch_floor;
+      int pc_lo = static_cast<int>(pitch_floor) % 12;
+      if (pc_lo < 0) {
+        pc_lo += 12;
+      }
+      int pc_hi = (pc_lo + 1) % 12;
+      int octave = static_cast<int>(std::floor(pitch / 12.0f)) - min_octave;
+      octave = std::max(0, std::min(octave, n_octaves - 1));
+
+      auto &m = bin_map[static_cast<std::size_t>(k)];
+      m.chroma_lo = pc_lo;
+      m.chroma_hi = pc_hi;
+      m.weight_hi = frac;
+      m.octave = octave;
+    }
+
+    // Per-octave chroma accumulators.
+    octave_chroma.resize(static_cast<std::size_t>(n_octaves));
+    for (auto &oc : octave_chroma) {
+      oc = {};
+    }
+
+    // Only bins up to C7 are used.  Bin k reads halfcomplex entries 2k and
+    // 2k + 1, so the transform supplies one bin beyond the last mapped one.
+    last_bin = 1;
+    for (int k = 1; k < num_bins; ++k) {
+      if (bin_map[static_cast<std::size_t>(k)].chroma_lo >= 0) {
+        last_bin = k;
+      }
+    }
+    last_bin = std::min(last_bin, kFFTSize / 2 - 1);
+    fft = std::make_unique<PrunedRealFFT>(kFFTSize, last_bin + 2);
+
+    num_frames =
+        1 + (audio.samples.size() - static_cast<std::size_t>(kFFTSize)) /
+                static_cast<std::size_t>(kHopSize);
+    frame.resize(static_cast<std::size_t>(kFFTSize));
+    // Changes to these numerics need a new FeatureCache::kAnalysisVersion.
+    cache_tag = "chroma" + std::to_string(audio.sample_rate) + "_" +
+                std::to_string(kFFTSize) + "_" + std::to_string(kHopSize);
   }
 
-  // Hann window.
-  constexpr float kPi = 3.14159265358979323846f;
-  std::vector<float> window(static_cast<std::size_t>(kFFTSize));
-  float denom = static_cast<float>(kFFTSize - 1);
-  for (int i = 0; i < kFFTSize; ++i) {
-    window[static_cast<std::size_t>(i)] =
-        0.5f - 0.5f * std::cos(2.0f * kPi * static_cast<float>(i) / denom);
+  // Frames are accumulated per content-defined chunk of about
+  // kCacheChunkFrames (FeatureCache::content_chunk_end).  Frames do not
+  // overlap (hop == FFT size), so a chunk's per-octave sums depend only on
+  // its own samples and can be cached under their hash.  Chunk sums are
+  // always added into the totals the same way, so cached and uncached runs
+  // give identical chroma.
+  void add_chunk() {
+    std::size_t chunk_begin = next_frame;
+    std::size_t chunk_end = FeatureCache::content_chunk_end(
+        audio.samples.data(), chunk_begin, num_frames, static_cast<std::size_t>(kHopSize),
+        kCacheChunkFrames);
+    std::size_t chunk_values = static_cast<std::size_t>(n_octaves * kChromaBins);
+
+    std::string key;
+    bool cached = false;
+    if (cache) {
+      std::size_t sample_begin = chunk_begin * static_cast<std::size_t>(kHopSize);
+      std::size_t sample_end = (chunk_end - 1) * static_cast<std::size_t>(kHopSize) +
+                               static_cast<std::size_t>(kFFTSize);
+      key = FeatureCache::chunk_key(cache_tag, audio.samples.data() + sample_begin,
+                                    sample_end - sample_begin);
+      cached = cache->load(key, chunk_chroma) && chunk_chroma.size() == chunk_values;
+    }
+
+    if (!cached) {
+      chunk_chroma.assign(chunk_values, 0.0f);
+      for (std::size_t fi = chunk_begin; fi < chunk_end; ++fi) {
+        std::size_t offset = fi * static_cast<std::size_t>(kHopSize);
+
+        // Apply Hann window.
+        kernels::active().window_to_double(audio.samples.data() + offset, window.data(),
+                                           frame.data(), static_cast<std::size_t>(kFFTSize));
+
+        fft->forward(frame.data());
+
+        // pocketfft halfcomplex format:
+        //   frame[0] = DC (real), frame[1] = Nyquist (real)
+        //   bin k (1..N/2-1): real = frame[2k], imag = frame[2k+1]
+
+        // Interior bins: magnitude = sqrt(re^2 + im^2), interpolated across
+        // the two nearest pitch classes, accumulated per octave.
+        for (int k = 1; k <= last_bin; ++k) {
+          const auto &m = bin_map[static_cast<std::size_t>(k)];
+          if (m.chroma_lo < 0) {
+            continue;
+          }
+          double re = frame[static_cast<std::size_t>(2 * k)];
+          double im = frame[static_cast<std::size_t>(2 * k + 1)];
+          float power = static_cast<float>(re * re + im * im);
+          float *oc = chunk_chroma.data() + static_cast<std::size_t>(m.octave * kChromaBins);
+          oc[m.chroma_lo] += power * (1.0f - m.weight_hi);
+          oc[m.chroma_hi] += power * m.weight_hi;
+        }
+      }
+      if (cache) {
+        cache->store(key, chunk_chroma);
+      }
+    }
+
+    for (int oct = 0; oct < n_octaves; ++oct) {
+      auto &oc = octave_chroma[static_cast<std::size_t>(oct)];
+      for (int i = 0; i < kChromaBins; ++i) {
+        oc[static_cast<std::size_t>(i)] +=
+            chunk_chroma[static_cast<std::size_t>(oct * kChromaBins + i)];
+      }
+    }
+    next_frame = chunk_end;
   }
 
-  // Pre-compute interpolated bin-to-chroma mapping with octave index.
-  // Each bin distributes energy between the two nearest pitch classes
-  // proportionally to distance, avoiding systematic bias at low frequencies
-  // where FFT bin spacing exceeds semitone spacing.
-  int num_bins = kFFTSize / 2 + 1;
-  float sr = static_cast<float>(mono_audio.sample_rate);
+  std::array<float, kChromaBins> chromagram() const {
+    std::array<float, kChromaBins> chroma = {};
+
+    // Normalize each octave independently, then average.
+    // This prevents harmonics in upper octaves from dominating the chroma.
+    int contributing_octaves = 0;
+    for (int oct = 0; oct < n_octaves; ++oct) {
+      auto oc = octave_chroma[static_cast<std::size_t>(oct)];
+      float total = 0.0f;
+      for (float v : oc) {
+        total += v;
+      }
+      if (total < 1e-12f) {
+        continue;
+      }
+      for (float &v : oc) {
+        v /= total;
+      }
+      for (int i = 0; i < kChromaBins; ++i) {
+        chroma[static_cast<std::size_t>(i)] +=
+            oc[static_cast<std::size_t>(i)];
+      }
+      ++contributing_octaves;
+    }
 
-  // Determine octave range.
-  float min_pitch = 12.0f * std::log2(kMinFreqHz / kC0Hz);
-  int min_octave = static_cast<int>(std::floor(min_pitch / 12.0f));
-  float max_pitch = 12.0f * std::log2(kMaxFreqHz / kC0Hz);
-  int max_octave = static_cast<int>(std::floor(max_pitch / 12.0f));
-  int n_octaves = max_octave - min_octave + 1;
+    // Average across octaves.
+    if (contributing_octaves > 0) {
+      float scale = 1.0f / static_cast<float>(contributing_octaves);
+      for (float &v : chroma) {
+        v *= scale;
+      }
+    }
+
+    return chroma;
+  }
 
   struct BinMapping {
     int chroma_lo = -1;
@@ -77,118 +234,92 @@ KeyDetector::compute_chromagram(const AudioBuffer &mono_audio) const {
     float weight_hi = 0.0f;
     int octave = -1;  // 0-based index into per-octave chroma
   };
-  std::vector<BinMapping> bin_map(static_cast<std::size_t>(num_bins));
 
-  for (int k = 1; k < num_bins; ++k) {
-    float freq = static_cast<float>(k) * sr / static_cast<float>(kFFTSize);
-    if (freq < kMinFreqHz || freq > kMaxFreqHz) {
-      continue;
-    }
-    float pitch = 12.0f * std::log2(freq / kC0Hz);
-    float pitch_floor = std::floor(pitch);
-    float frac = pitch - pitch_floor;
-    int pc_lo = static_cast<int>(pitch_floor) % 12;
-    if (pc_lo < 0) {
-      pc_lo += 12;
-    }
-    int pc_hi = (pc_lo + 1) % 12;
-    int octave = static_cast<int>(std::floor(pitch / 12.0f)) - min_octave;
-    octave = std::max(0, std::min(octave, n_octaves - 1));
-
-    auto &m = bin_map[static_cast<std::size_t>(k)];
-    m.chroma_lo = pc_lo;
-    m.chroma_hi = pc_hi;
-    m.weight_hi = frac;
-    m.octave = octave;
-  }
-
-  // Per-octave chroma accumulators.
-  std::vector<std::array<float, kChromaBins>> octave_chroma(
-      static_cast<std::size_t>(n_octaves));
-  for (auto &oc : octave_chroma) {
-    oc = {};
+  const AudioBuffer &audio;
+  const FeatureCache *cache;
+  std::vector<float> window;
+  int n_octaves = 0;
+  std::vector<BinMapping> bin_map;
+  std::vector<std::array<float, kChromaBins>> octave_chroma;
+  int last_bin = 1;
+  std::unique_ptr<PrunedRealFFT> fft;
+  std::size_t num_frames = 0;
+  std::size_t next_frame = 0;
+  std::vector<double> frame;
+  std::string cache_tag;
+  std::vector<float> chunk_chroma;
+};
+
+KeyDetector::Session::Session(const AudioBuffer &mono_audio, const FeatureCache *cache) {
+  if (mono_audio.channels != 1) {
+    throw std::runtime_error("KeyDetector expects mono audio.");
   }
-
-  // Create FFT plan.
-  rfft_plan plan = make_rfft_plan(static_cast<std::size_t>(kFFTSize));
-  if (!plan) {
-    throw std::runtime_error("Failed to create FFT plan for key detection.");
+  if (mono_audio.sample_rate <= 0) {
+    throw std::runtime_error("KeyDetector invalid sample rate.");
   }
+  state_ = std::make_unique<State>(mono_audio, cache);
+}
 
-  std::size_t num_frames =
-      1 + (mono_audio.samples.size() - static_cast<std::size_t>(kFFTSize)) /
-              static_cast<std::size_t>(kHopSize);
-
-  std::vector<double> frame(static_cast<std::size_t>(kFFTSize));
-
-  for (std::size_t fi = 0; fi < num_frames; ++fi) {
-    std::size_t offset = fi * static_cast<std::size_t>(kHopSize);
-
-    // Apply Hann window.
-    for (int i = 0; i < kFFTSize; ++i) {
-      frame[static_cast<std::size_t>(i)] = static_cast<double>(
-          mono_audio.samples[offset + static_cast<std::size_t>(i)] *
-          window[static_cast<std::size_t>(i)]);
-    }
+KeyDetector::Session::~Session() = default;
+KeyDetector::Session::Session(Session &&) noexcept = default;
+KeyDetector::Session &KeyDetector::Session::operator=(Session &&) noexcept = default;
 
-    if (rfft_forward(plan, frame.data(), 1.0) != 0) {
-      destroy_rfft_plan(plan);
-      throw std::runtime_error("FFT execution failed in key detection.");
-    }
+bool KeyDetector::Session::done() const {
+  return !state_ || state_->next_frame >= state_->num_frames;
+}
 
-    // pocketfft halfcomplex format:
-    //   frame[0] = DC (real), frame[1] = Nyquist (real)
-    //   bin k (1..N/2-1): real = frame[2k], imag = frame[2k+1]
+void KeyDetector::Session::advance() {
+  if (!done()) {
+    state_->add_chunk();
+  }
+}
 
-    // Interior bins: magnitude = sqrt(re^2 + im^2), interpolated across
-    // the two nearest pitch classes, accumulated per octave.
-    for (int k = 1; k < kFFTSize / 2; ++k) {
-      const auto &m = bin_map[static_cast<std::size_t>(k)];
-      if (m.chroma_lo < 0) {
-        continue;
-      }
-      double re = frame[static_cast<std::size_t>(2 * k)];
-      double im = frame[static_cast<std::size_t>(2 * k + 1)];
-      float power = static_cast<float>(re * re + im * im);
-      auto &oc = octave_chroma[static_cast<std::size_t>(m.octave)];
-      oc[static_cast<std::size_t>(m.chroma_lo)] += power * (1.0f - m.weight_hi);
-      oc[static_cast<std::size_t>(m.chroma_hi)] += power * m.weight_hi;
-    }
+KeyDetector::Result KeyDetector::Session::finish(bool verbose) {
+  while (!done()) {
+    advance();
+  }
+  if (!state_) {
+    throw std::runtime_error("KeyDetector session already finished.");
   }
+  auto chroma = state_->chromagram();
+  state_.reset();
+  return classify(chroma, verbose);
+}
 
-  destroy_rfft_plan(plan);
+std::size_t KeyDetector::Session::samples_done() const {
+  return state_ ? state_->next_frame * static_cast<std::size_t>(kHopSize) : 0;
+}
 
-  // Normalize each octave independently, then average.
-  // This prevents harmonics in upper octaves from dominating the chroma.
-  int contributing_octaves = 0;
-  for (int oct = 0; oct < n_octaves; ++oct) {
-    auto &oc = octave_chroma[static_cast<std::size_t>(oct)];
-    float total = 0.0f;
-    for (float v : oc) {
-      total += v;
-    }
-    if (total < 1e-12f) {
-      continue;
-    }
-    for (float &v : oc) {
-      v /= total;
-    }
-    for (int i = 0; i < kChromaBins; ++i) {
-      chroma[static_cast<std::size_t>(i)] +=
-          oc[static_cast<std::size_t>(i)];
-    }
-    ++contributing_octaves;
+KeyDetector::Result KeyDetector::Session::preview() const {
+  if (!state_) {
+    throw std::runtime_error("KeyDetector session already finished.");
   }
+  return classify(state_->chromagram(), false);
+}
 
-  // Average across octaves.
-  if (contributing_octaves > 0) {
-    float scale = 1.0f / static_cast<float>(contributing_octaves);
-    for (float &v : chroma) {
-      v *= scale;
-    }
+KeyDetector::Session::Snapshot KeyDetector::Session::snapshot() const {
+  Snapshot snapshot;
+  if (!state_) {
+    return snapshot;
+  }
+  snapshot.next_frame = state_->next_frame;
+  for (const auto &oc : state_->octave_chroma) {
+    snapshot.octave_chroma.insert(snapshot.octave_chroma.end(), oc.begin(), oc.end());
   }
+  return snapshot;
+}
 
-  return chroma;
+void KeyDetector::Session::restore(const Snapshot &snapshot) {
+  if (!state_ || snapshot.next_frame > state_->num_frames ||
+      snapshot.octave_chroma.size() != state_->octave_chroma.size() * kChromaBins) {
+    throw std::runtime_error("Key snapshot does not match the audio.");
+  }
+  state_->next_frame = snapshot.next_frame;
+  for (std::size_t oct = 0; oct < state_->octave_chroma.size(); ++oct) {
+    std::copy(snapshot.octave_chroma.begin() + static_cast<std::ptrdiff_t>(oct * kChromaBins),
+              snapshot.octave_chroma.begin() + static_cast<std::ptrdiff_t>((oct + 1) * kChromaBins),
+              state_->octave_chroma[oct].begin());
+  }
 }
 
 float KeyDetector::pearson_correlation(
@@ -219,16 +350,13 @@ float KeyDetector::pearson_correlation(
 }
 
 KeyDetector::Result KeyDetector::detect(const AudioBuffer &mono_audio,
-                                        bool verbose) const {
-  if (mono_audio.channels != 1) {
-    throw std::runtime_error("KeyDetector expects mono audio.");
-  }
-  if (mono_audio.sample_rate <= 0) {
-    throw std::runtime_error("KeyDetector invalid sample rate.");
-  }
-
-  auto chroma = compute_chromagram(mono_audio);
+                                        bool verbose,
+                                        const FeatureCache *cache) const {
+  return Session(mono_audio, cache).finish(verbose);
+}
 
+KeyDetector::Result KeyDetector::classify(const std::array<float, kChromaBins> &chroma,
+                                          bool verbose) {
   if (verbose) {
     std::cout << "Chroma distribution:";
     for (int i = 0; i < kChromaBins; ++i) {
@@ -0,0 +1,187 @@
+#include "bpm/loudness_meter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace bpm {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+double energy_to_lufs(double energy) {
+  return -0.691 + 10.0 * std::log10(energy);
+}
+
+double amplitude_to_db(float amplitude) {
+  if (amplitude <= 0.0f) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  return 20.0 * std::log10(static_cast<double>(amplitude));
+}
+
+}  // namespace
+
+LoudnessMeter::LoudnessMeter(int sample_rate, int channels) : channels_(channels) {
+  if (sample_rate <= 0 || channels <= 0) {
+    throw std::runtime_error("LoudnessMeter invalid sample rate or channel count.");
+  }
+  double rate = static_cast<double>(sample_rate);
+
+  // K-weighting (BS.1770-4 Annex 1), derived for any rate from the analog
+  // prototypes so 44.1 kHz and 22.05 kHz inputs are handled exactly.
+  {
+    double f0 = 1681.974450955533;
+    double gain_db = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(kPi * f0 / rate);
+    double vh = std::pow(10.0, gain_db / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf_.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf_.b1 = 2.0 * (k * k - vh) / a0;
+    shelf_.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf_.a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf_.a2 = (1.0 - k / q + k * k) / a0;
+  }
+  {
+    double f0 = 38.13547087602444;
+    double q = 0.5003270373238773;
+    double k = std::tan(kPi * f0 / rate);
+    double a0 = 1.0 + k / q + k * k;
+    highpass_.b0 = 1.0;
+    highpass_.b1 = -2.0;
+    highpass_.b2 = 1.0;
+    highpass_.a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass_.a2 = (1.0 - k / q + k * k) / a0;
+  }
+
+  // Channel weights: 1.0 for front channels; for 5.1 the LFE is excluded
+  // and the surrounds get +1.5 dB.
+  channel_weight_.assign(static_cast<std::size_t>(channels), 1.0);
+  if (channels == 6) {
+    channel_weight_[3] = 0.0;
+    channel_weight_[4] = 1.41;
+    channel_weight_[5] = 1.41;
+  }
+
+  state_.resize(static_cast<std::size_t>(channels));
+  for (auto &st : state_) {
+    st.history.assign(2 * kTapsPerPhase, 0.0f);
+  }
+
+  // 4x polyphase interpolator: Hann-windowed sinc, 12 taps per phase, each
+  // phase normalised to unity DC gain.  Phase p estimates the signal p/4 of
+  // a sample after the 6th-newest input.
+  interp_.assign(static_cast<std::size_t>(kOversample * kTapsPerPhase), 0.0f);
+  constexpr double kHalfSpan = kTapsPerPhase / 2;
+  for (int p = 0; p < kOversample; ++p) {
+    double taps[kTapsPerPhase];
+    double sum = 0.0;
+    for (int k = 0; k < kTapsPerPhase; ++k) {
+      double d = (kHalfSpan - 1.0) + static_cast<double>(p) / kOversample - static_cast<double>(k);
+      double sinc = (d == 0.0) ? 1.0 : std::sin(kPi * d) / (kPi * d);
+      double window = (std::fabs(d) < kHalfSpan) ? 0.5 + 0.5 * std::cos(kPi * d / kHalfSpan) : 0.0;
+      taps[k] = sinc * window;
+      sum += taps[k];
+    }
+    for (int k = 0; k < kTapsPerPhase; ++k) {
+      interp_[static_cast<std::size_t>(p * kTapsPerPhase + k)] = static_cast<float>(taps[k] / sum);
+    }
+  }
+
+  step_frames_ = static_cast<std::size_t>(std::lround(rate * 0.1));
+}
+
+void LoudnessMeter::process(const float *interleaved, std::size_t frames) {
+  std::size_t channels = static_cast<std::size_t>(channels_);
+  for (std::size_t f = 0; f < frames; ++f) {
+    double frame_energy = 0.0;
+    for (std::size_t ch = 0; ch < channels; ++ch) {
+      float x = interleaved[f * channels + ch];
+      ChannelState &st = state_[ch];
+
+      // K-weighting, transposed direct form II.
+      double in = static_cast<double>(x);
+      double y1 = shelf_.b0 * in + st.z1_shelf;
+      st.z1_shelf = shelf_.b1 * in - shelf_.a1 * y1 + st.z2_shelf;
+      st.z2_shelf = shelf_.b2 * in - shelf_.a2 * y1;
+      double y2 = highpass_.b0 * y1 + st.z1_hp;
+      st.z1_hp = highpass_.b1 * y1 - highpass_.a1 * y2 + st.z2_hp;
+      st.z2_hp = highpass_.b2 * y1 - highpass_.a2 * y2;
+      frame_energy += channel_weight_[ch] * y2 * y2;
+
+      // Peaks.  Phase 0 of the interpolator is the input itself, so only
+      // the three in-between phases are evaluated.
+      float ax = std::fabs(x);
+      sample_peak_ = std::max(sample_peak_, ax);
+      true_peak_ = std::max(true_peak_, ax);
+      st.history[st.pos] = x;
+      st.history[st.pos + kTapsPerPhase] = x;
+      const float *window = st.history.data() + st.pos + 1;
+      for (int p = 1; p < kOversample; ++p) {
+        const float *taps = interp_.data() + p * kTapsPerPhase;
+        float y = 0.0f;
+        for (int k = 0; k < kTapsPerPhase; ++k) {
+          y += window[k] * taps[k];
+        }
+        true_peak_ = std::max(true_peak_, std::fabs(y));
+      }
+      st.pos = (st.pos + 1) % kTapsPerPhase;
+    }
+
+    step_energy_ += frame_energy;
+    if (++step_filled_ == step_frames_) {
+      step_energies_.push_back(step_energy_ / static_cast<double>(step_frames_));
+      step_energy_ = 0.0;
+      step_filled_ = 0;
+    }
+  }
+}
+
+LoudnessMeter::Result LoudnessMeter::result() const {
+  Result result;
+  result.sample_peak_dbfs = amplitude_to_db(sample_peak_);
+  result.true_peak_dbtp = amplitude_to_db(true_peak_);
+
+  // 400 ms gating blocks with 75% overlap = four consecutive 100 ms steps.
+  std::vector<double> blocks;
+  for (std::size_t i = 3; i < step_energies_.size(); ++i) {
+    blocks.push_back((step_energies_[i - 3] + step_energies_[i - 2] +
+                      step_energies_[i - 1] + step_energies_[i]) / 4.0);
+  }
+
+  // Absolute gate at -70 LUFS, then a relative gate 10 LU below the
+  // loudness of the blocks that passed it.
+  double abs_sum = 0.0;
+  std::size_t abs_count = 0;
+  for (double z : blocks) {
+    if (z > 0.0 && energy_to_lufs(z) > -70.0) {
+      abs_sum += z;
+      ++abs_count;
+    }
+  }
+  if (abs_count == 0) {
+    result.integrated_lufs = -std::numeric_limits<double>::infinity();
+    return result;
+  }
+  double relative_gate = energy_to_lufs(abs_sum / static_cast<double>(abs_count)) - 10.0;
+
+  double sum = 0.0;
+  std::size_t count = 0;
+  for (double z : blocks) {
+    if (z > 0.0) {
+      double l = energy_to_lufs(z);
+      if (l > -70.0 && l > relative_gate) {
+        sum += z;
+        ++count;
+      }
+    }
+  }
+  result.integrated_lufs = (count > 0) ? energy_to_lufs(sum / static_cast<double>(count))
+                                       : -std::numeric_limits<double>::infinity();
+  return result;
+}
+
+}  // namespace bpm
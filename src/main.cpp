@@ -1,15 +1,30 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "bpm/columnar_writer.h"
+#include "bpm/feature_cache.h"
+#include "bpm/kernels.h"
+#include "bpm/metrics.h"
 #include "bpm/pipeline.h"
+#include "bpm/profiler.h"
+#include "bpm/slow_job.h"
+#include "bpm/wisdom.h"
 
 namespace {
 
 void print_help() {
-  std::cout << "Usage: bpm_detect [options] <input>\n"
-            << "\nSupported inputs: MP3, MP4, M4A, YouTube URL\n"
+  std::cout << "Usage: bpm_detect [options] <input>...\n"
+            << "\nSupported inputs: MP3, MP4, M4A, 16-bit WAV, YouTube URL\n"
             << "  MP4/M4A require ffmpeg. YouTube requires yt-dlp and ffmpeg.\n\n"
-            << "  -o, --output <path>     Output WAV path (default: <input>_click.wav)\n"
+            << "  -o, --output <path>     Output path, .wav or .flac (default: <input>_click.wav)\n"
+            << "  --format <wav|flac>     Output format for default names (default: wav)\n"
             << "  -v, --verbose           Print detailed info\n"
             << "  --min-bpm <float>       Min BPM (default: 50)\n"
             << "  --max-bpm <float>       Max BPM (default: 220)\n"
@@ -18,6 +33,38 @@ void print_help() {
             << "  --downbeat-freq <float> Downbeat click frequency Hz (default: 1500)\n"
             << "  --accent-downbeats      Use higher-pitched click on downbeats\n"
             << "  --no-key                Disable key signature detection\n"
+            << "  --loudness              Measure integrated loudness and true peak\n"
+            << "  --fixed-point           Use the integer-only onset analysis path\n"
+            << "  --onset-bands <hz,...>  Split onsets into sub-bands; meter uses the lowest band\n"
+            << "  --mp3-rate-divisor <n>  Decode MP3 at 1/n of its rate, n = 1, 2 or 4, not below 22050 Hz\n"
+            << "  --mp3-mono              Decode MP3 straight to mono\n"
+            << "  --tempo-method <name>   Tempo engine: autocorr or comb (default: autocorr)\n"
+            << "  --pruned-dp             Skip beat-tracker predecessors that cannot win\n"
+            << "  --dp-tolerance <score>  Allowed DP score loss per frame (implies --pruned-dp)\n"
+            << "  --prune-candidates      Stop tracking tempo candidates that cannot win\n"
+            << "  --cache-dir <dir>       Cache per-chunk spectral features in <dir>\n"
+            << "  --cache-max-mb <n>      Prune the feature cache to <n> MB after the run\n"
+            << "  --results-shm <name>    Publish results to a shared-memory ring (e.g. /bpm)\n"
+            << "  --progress <s[,s...]>   Print provisional BPM/key after these seconds of audio\n"
+            << "  --results-table <path>  Write each job's results to a columnar table file\n"
+            << "  --row-group-size <n>    Rows buffered per table row group (default: 1024)\n"
+            << "  --save-grid <path>      Save beats, meter and key to a beat grid sidecar\n"
+            << "  --render-from <path>    Render clicks from a saved beat grid, skipping analysis\n"
+            << "  --state-file <path>     Save partial analysis periodically; resume from it\n"
+            << "  --state-interval <s>    Seconds between state file saves (default: 60)\n"
+            << "  --clip-batch <n>        Analyse short clips <n> at a time, without click output\n"
+            << "  --cpu <level>           Force kernel set: baseline, avx2, avx512 (default: auto)\n"
+            << "  --wisdom <path>         Load tuned settings (default: $BPM_WISDOM if set)\n"
+            << "  --autotune <path>       Benchmark this machine, write a wisdom file and exit\n"
+            << "  --metrics-file <path>   Dump Prometheus metrics to file periodically\n"
+            << "  --metrics-interval <s>  Metrics dump interval in seconds (default: 10)\n"
+            << "  --profile <path>        Sample CPU stacks and write them as folded stacks\n"
+            << "  --profile-hz <n>        Profiler samples per CPU second (default: 499)\n"
+            << "  --profile-per-job       Prefix each profiled stack with its input\n"
+            << "  --slow-job-dir <dir>    Write a diagnostics report for each slow job here\n"
+            << "  --slow-job <s>          Report jobs taking longer than this in total\n"
+            << "  --slow-stage <st>=<s>   Report jobs whose stage <st> takes longer (repeatable)\n"
+            << "  --slow-job-envelope     Save the onset envelope with each report\n"
             << "  -h, --help              Show help\n";
 }
 
@@ -39,8 +86,23 @@ int main(int argc, char **argv) {
   }
 
   bpm::PipelineOptions options;
-  std::string input_path;
+  std::vector<std::string> input_paths;
   std::string output_path;
+  std::string metrics_path;
+  std::string table_path;
+  std::size_t row_group_size = 1024;
+  double cache_max_mb = 0.0;
+  std::size_t clip_batch = 0;
+  std::string render_grid_path;
+  std::string wisdom_path;
+  std::string autotune_path;
+  bool cpu_forced = std::getenv("BPM_CPU") != nullptr;
+  bool dp_forced = false;
+  double metrics_interval = 10.0;
+  std::string profile_path;
+  int profile_hz = 499;
+  bool profile_per_job = false;
+  bool slow_job_options = false;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
@@ -104,6 +166,19 @@ int main(int argc, char **argv) {
       options.downbeat_freq = std::stof(value);
       continue;
     }
+    if (arg == "--format") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for output format.\n";
+        return 1;
+      }
+      if (value != "wav" && value != "flac") {
+        std::cerr << "Unsupported output format: " << value << "\n";
+        return 1;
+      }
+      options.output_format = value;
+      continue;
+    }
     if (arg == "--accent-downbeats") {
       options.accent_downbeats = true;
       continue;
@@ -112,32 +187,517 @@ int main(int argc, char **argv) {
       options.detect_key = false;
       continue;
     }
+    if (arg == "--loudness") {
+      options.measure_loudness = true;
+      continue;
+    }
+    if (arg == "--fixed-point") {
+      options.fixed_point = true;
+      continue;
+    }
+    if (arg == "--mp3-rate-divisor") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for MP3 rate divisor.\n";
+        return 1;
+      }
+      options.mp3_rate.divisor = std::stoi(value);
+      if (options.mp3_rate.divisor != 1 && options.mp3_rate.divisor != 2 &&
+          options.mp3_rate.divisor != 4) {
+        std::cerr << "MP3 rate divisor must be 1, 2 or 4.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--mp3-mono") {
+      options.mp3_rate.mono = true;
+      continue;
+    }
+    if (arg == "--pruned-dp") {
+      options.beat_dp_search = bpm::DpSearch::PRUNED;
+      dp_forced = true;
+      continue;
+    }
+    if (arg == "--prune-candidates") {
+      options.prune_candidates = true;
+      continue;
+    }
+    if (arg == "--dp-tolerance") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for DP tolerance.\n";
+        return 1;
+      }
+      options.beat_dp_search = bpm::DpSearch::PRUNED;
+      options.beat_dp_tolerance = std::stod(value);
+      dp_forced = true;
+      continue;
+    }
+    if (arg == "--cache-dir") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for cache directory.\n";
+        return 1;
+      }
+      options.cache_dir = value;
+      continue;
+    }
+    if (arg == "--cache-max-mb") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for cache size limit.\n";
+        return 1;
+      }
+      cache_max_mb = std::stod(value);
+      continue;
+    }
+    if (arg == "--results-shm") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for results ring name.\n";
+        return 1;
+      }
+      if (value.empty() || value[0] != '/') {
+        value = "/" + value;
+      }
+      options.results_shm = value;
+      continue;
+    }
+    if (arg == "--onset-bands") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for onset band splits.\n";
+        return 1;
+      }
+      std::stringstream list(value);
+      std::string item;
+      while (std::getline(list, item, ',')) {
+        if (!item.empty()) {
+          options.onset_band_split_hz.push_back(std::stof(item));
+        }
+      }
+      continue;
+    }
+    if (arg == "--progress") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for progress checkpoints.\n";
+        return 1;
+      }
+      std::stringstream list(value);
+      std::string item;
+      while (std::getline(list, item, ',')) {
+        if (!item.empty()) {
+          options.progress_checkpoints_sec.push_back(std::stod(item));
+        }
+      }
+      continue;
+    }
+    if (arg == "--results-table") {
+      if (!parse_arg(argc, argv, i, table_path)) {
+        std::cerr << "Missing value for results table path.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--row-group-size") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for row group size.\n";
+        return 1;
+      }
+      row_group_size = static_cast<std::size_t>(std::stoul(value));
+      continue;
+    }
+    if (arg == "--save-grid") {
+      if (!parse_arg(argc, argv, i, options.beat_grid_path)) {
+        std::cerr << "Missing value for beat grid path.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--state-file") {
+      if (!parse_arg(argc, argv, i, options.state_path)) {
+        std::cerr << "Missing value for state file path.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--state-interval") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for state interval.\n";
+        return 1;
+      }
+      options.state_interval_sec = std::stod(value);
+      continue;
+    }
+    if (arg == "--render-from") {
+      if (!parse_arg(argc, argv, i, render_grid_path)) {
+        std::cerr << "Missing value for beat grid path.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--clip-batch") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for clip batch size.\n";
+        return 1;
+      }
+      clip_batch = static_cast<std::size_t>(std::stoul(value));
+      if (clip_batch == 0) {
+        std::cerr << "Clip batch size must be at least 1.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--cpu") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for CPU level.\n";
+        return 1;
+      }
+      try {
+        bpm::kernels::set_cpu_level(bpm::kernels::parse_cpu_level(value));
+      } catch (const std::exception &ex) {
+        std::cerr << ex.what() << "\n";
+        return 1;
+      }
+      cpu_forced = true;
+      continue;
+    }
+    if (arg == "--wisdom") {
+      if (!parse_arg(argc, argv, i, wisdom_path)) {
+        std::cerr << "Missing value for wisdom file.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--autotune") {
+      if (!parse_arg(argc, argv, i, autotune_path)) {
+        std::cerr << "Missing value for autotune output.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--tempo-method") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for tempo method.\n";
+        return 1;
+      }
+      if (value == "autocorr") {
+        options.tempo_method = bpm::TempoMethod::AUTOCORRELATION;
+      } else if (value == "comb") {
+        options.tempo_method = bpm::TempoMethod::COMB_FILTER;
+      } else {
+        std::cerr << "Unknown tempo method: " << value << "\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--metrics-file") {
+      if (!parse_arg(argc, argv, i, metrics_path)) {
+        std::cerr << "Missing value for metrics file.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--metrics-interval") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for metrics interval.\n";
+        return 1;
+      }
+      metrics_interval = std::stod(value);
+      continue;
+    }
+    if (arg == "--profile") {
+      if (!parse_arg(argc, argv, i, profile_path)) {
+        std::cerr << "Missing value for profile path.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--profile-hz") {
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for profiler rate.\n";
+        return 1;
+      }
+      profile_hz = std::stoi(value);
+      continue;
+    }
+    if (arg == "--profile-per-job") {
+      profile_per_job = true;
+      continue;
+    }
+    if (arg == "--slow-job-dir") {
+      slow_job_options = true;
+      if (!parse_arg(argc, argv, i, options.slow_job_dir)) {
+        std::cerr << "Missing value for slow job directory.\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--slow-job") {
+      slow_job_options = true;
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for slow job threshold.\n";
+        return 1;
+      }
+      options.slow_job_sec = std::stod(value);
+      continue;
+    }
+    if (arg == "--slow-stage") {
+      slow_job_options = true;
+      std::string value;
+      if (!parse_arg(argc, argv, i, value)) {
+        std::cerr << "Missing value for slow stage threshold.\n";
+        return 1;
+      }
+      auto eq = value.find('=');
+      double *threshold = eq == std::string::npos
+          ? nullptr
+          : bpm::stage_timing(options.slow_stage_sec, value.substr(0, eq));
+      if (!threshold) {
+        std::cerr << "Expected <stage>=<seconds> for --slow-stage: " << value << "\n";
+        return 1;
+      }
+      *threshold = std::stod(value.substr(eq + 1));
+      continue;
+    }
+    if (arg == "--slow-job-envelope") {
+      slow_job_options = true;
+      options.slow_job_envelope = true;
+      continue;
+    }
 
     if (!arg.empty() && arg[0] == '-') {
       std::cerr << "Unknown option: " << arg << "\n";
       return 1;
     }
 
-    input_path = arg;
+    input_paths.push_back(arg);
+  }
+
+  if (!autotune_path.empty()) {
+    try {
+      std::cout << "Autotuning...\n";
+      bpm::Wisdom wisdom = bpm::Wisdom::autotune(autotune_path + ".tmp.flac", 44100, 30.0,
+                                                 options.verbose);
+      wisdom.save(autotune_path);
+      std::cout << "Wisdom: kernels=" << bpm::kernels::cpu_level_name(wisdom.cpu_level)
+                << ", beat_dp=" << (wisdom.beat_dp_search == bpm::DpSearch::PRUNED ? "pruned" : "exhaustive")
+                << ", flac_threads=" << wisdom.flac_parallelism.threads
+                << ", flac_blocks_per_thread=" << wisdom.flac_parallelism.blocks_per_thread << "\n"
+                << "Wrote " << autotune_path << "\n";
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
+  // Tuned settings fill in whatever the command line did not set; a
+  // missing or stale file leaves the defaults.
+  if (wisdom_path.empty()) {
+    if (const char *env = std::getenv("BPM_WISDOM")) {
+      wisdom_path = env;
+    }
+  }
+  if (!wisdom_path.empty()) {
+    bpm::Wisdom wisdom;
+    std::string reason;
+    if (bpm::Wisdom::load(wisdom_path, wisdom, reason)) {
+      try {
+        wisdom.apply(options, !cpu_forced, !dp_forced);
+        if (options.verbose) {
+          std::cout << "Loaded wisdom from " << wisdom_path << "\n";
+        }
+      } catch (const std::exception &ex) {
+        std::cerr << "Ignoring wisdom: " << ex.what() << "\n";
+      }
+    } else if (options.verbose) {
+      std::cout << "Ignoring wisdom: " << reason << "; using defaults.\n";
+    }
   }
 
-  if (input_path.empty()) {
+  if (input_paths.empty()) {
     std::cerr << "No input file provided.\n";
     print_help();
     return 1;
   }
+  if (input_paths.size() > 1 && !output_path.empty()) {
+    std::cerr << "--output cannot be used with more than one input.\n";
+    return 1;
+  }
+  if (clip_batch > 0 && !output_path.empty()) {
+    std::cerr << "--output cannot be used with --clip-batch (no click track is rendered).\n";
+    return 1;
+  }
+  if (input_paths.size() > 1 && (!options.beat_grid_path.empty() || !render_grid_path.empty())) {
+    std::cerr << "--save-grid and --render-from take one input.\n";
+    return 1;
+  }
+  if (input_paths.size() > 1 && !options.state_path.empty()) {
+    std::cerr << "--state-file takes one input.\n";
+    return 1;
+  }
+  if (!options.state_path.empty() && (clip_batch > 0 || !render_grid_path.empty())) {
+    std::cerr << "--state-file cannot be used with --clip-batch or --render-from.\n";
+    return 1;
+  }
+  if (!options.beat_grid_path.empty() && !render_grid_path.empty()) {
+    std::cerr << "--save-grid cannot be used with --render-from.\n";
+    return 1;
+  }
+  if (clip_batch > 0 && (!options.beat_grid_path.empty() || !render_grid_path.empty())) {
+    std::cerr << "--save-grid and --render-from cannot be used with --clip-batch.\n";
+    return 1;
+  }
+  // Pipeline::run_clips() tracks every candidate in full, reports no
+  // progress and writes no slow-job reports.
+  if (clip_batch > 0 && (options.prune_candidates || !options.progress_checkpoints_sec.empty() ||
+                         slow_job_options)) {
+    std::cerr << "--prune-candidates, --progress and --slow-job* options cannot be used with "
+                 "--clip-batch.\n";
+    return 1;
+  }
 
-  if (output_path.empty() && input_path.find("://") == std::string::npos) {
-    output_path = input_path + "_click.wav";
+  // Declared before the try block so the final dump includes failed jobs.
+  std::unique_ptr<bpm::MetricsFileExporter> metrics_exporter;
+  if (!metrics_path.empty()) {
+    metrics_exporter = std::make_unique<bpm::MetricsFileExporter>(metrics_path, metrics_interval);
   }
 
-  try {
-    bpm::Pipeline pipeline;
-    pipeline.run(input_path, output_path, options);
-  } catch (const std::exception &ex) {
-    std::cerr << "Error: " << ex.what() << "\n";
-    return 1;
+  std::unique_ptr<bpm::ColumnarWriter> table;
+  if (!table_path.empty()) {
+    try {
+      table = std::make_unique<bpm::ColumnarWriter>(table_path, row_group_size);
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      return 1;
+    }
+  }
+
+  auto &profiler = bpm::SamplingProfiler::global();
+  if (!profile_path.empty()) {
+    try {
+      profiler.start(profile_hz);
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      return 1;
+    }
+  }
+
+  // Provisional results only; the final values are printed by the pipeline.
+  bpm::ProgressCallback progress = [](const bpm::ProgressUpdate &update) {
+    if (update.is_final) {
+      return;
+    }
+    std::cout << "Provisional (" << update.audio_sec << " s of " << update.total_sec
+              << " s): " << update.bpm << " BPM (confidence " << update.tempo_confidence << ")";
+    if (update.has_key) {
+      std::cout << ", " << update.key << " (confidence " << update.key_confidence << ")";
+    }
+    std::cout << std::endl;
+  };
+
+  // With several inputs, a failed job is reported and the batch continues.
+  int status = 0;
+  bpm::Pipeline pipeline;
+  if (clip_batch > 0) {
+    for (std::size_t begin = 0; begin < input_paths.size(); begin += clip_batch) {
+      std::size_t end = std::min(input_paths.size(), begin + clip_batch);
+      std::vector<std::string> batch(input_paths.begin() + static_cast<std::ptrdiff_t>(begin),
+                                     input_paths.begin() + static_cast<std::ptrdiff_t>(end));
+      try {
+        for (const bpm::JobResult &result : pipeline.run_clips(batch, options)) {
+          if (!result.error.empty()) {
+            std::cerr << "Error: " << result.input_path << ": " << result.error << "\n";
+            status = 1;
+            continue;
+          }
+          std::cout << result.input_path << ": " << result.bpm << " BPM, "
+                    << result.beat_samples.size() << " beats";
+          if (result.has_meter) {
+            std::cout << ", " << result.time_signature;
+          }
+          if (result.has_key) {
+            std::cout << ", " << result.key;
+          }
+          std::cout << "\n";
+          if (table) {
+            table->append(result);
+          }
+        }
+      } catch (const std::exception &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        status = 1;
+      }
+    }
+  } else {
+    for (const std::string &input_path : input_paths) {
+      std::string job_output = output_path;
+      if (job_output.empty() && input_path.find("://") == std::string::npos) {
+        job_output = input_path + "_click." + options.output_format;
+      }
+      try {
+        bpm::JobResult result =
+            render_grid_path.empty()
+                ? pipeline.run(input_path, job_output, options, progress)
+                : pipeline.render(input_path, render_grid_path, job_output, options);
+        if (table) {
+          table->append(result);
+        }
+      } catch (const std::exception &ex) {
+        std::cerr << "Error: " << (input_paths.size() > 1 ? input_path + ": " : "")
+                  << ex.what() << "\n";
+        status = 1;
+      }
+    }
+  }
+
+  if (table) {
+    try {
+      table->close();
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      status = 1;
+    }
+  }
+
+  // After the batch, so this run's entries are the most recently used.
+  if (!options.cache_dir.empty() && cache_max_mb > 0.0) {
+    try {
+      std::size_t removed = bpm::FeatureCache(options.cache_dir)
+                                .prune(static_cast<std::uint64_t>(cache_max_mb * 1024.0 * 1024.0));
+      if (options.verbose) {
+        std::cout << "Feature cache: pruned " << removed << " entries.\n";
+      }
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      status = 1;
+    }
+  }
+
+  if (!profile_path.empty()) {
+    profiler.stop();
+    try {
+      profiler.write_folded(profile_path, profile_per_job);
+      std::cout << "Profile: " << profile_path << " (" << profiler.samples() << " samples";
+      if (profiler.dropped() > 0) {
+        std::cout << ", " << profiler.dropped() << " dropped";
+      }
+      std::cout << ")\n";
+    } catch (const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+      status = 1;
+    }
   }
 
-  return 0;
+  return status;
 }
@@ -0,0 +1,228 @@
+#include "bpm/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace bpm {
+namespace {
+
+void atomic_add(std::atomic<double> &target, double delta) {
+  double current = target.load(std::memory_order_relaxed);
+  while (!target.compare_exchange_weak(current, current + delta,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+std::string with_labels(const std::string &labels, const std::string &extra = "") {
+  if (labels.empty() && extra.empty()) {
+    return "";
+  }
+  if (labels.empty()) {
+    return "{" + extra + "}";
+  }
+  if (extra.empty()) {
+    return "{" + labels + "}";
+  }
+  return "{" + labels + "," + extra + "}";
+}
+
+// The exposition format spells the special values +Inf, -Inf and NaN, where
+// iostreams would print inf and nan.
+std::ostream &write_value(std::ostream &out, double value) {
+  if (std::isnan(value)) {
+    return out << "NaN";
+  }
+  if (std::isinf(value)) {
+    return out << (value > 0 ? "+Inf" : "-Inf");
+  }
+  return out << value;
+}
+
+std::string format_bound(double bound) {
+  std::ostringstream out;
+  write_value(out, bound);
+  return out.str();
+}
+
+}  // namespace
+
+void Gauge::add(double delta) {
+  atomic_add(value_, delta);
+}
+
+Histogram::Histogram(std::vector<double> upper_bounds)
+    : bounds_(std::move(upper_bounds)),
+      buckets_(new std::atomic<std::uint64_t>[bounds_.size() + 1]) {
+  std::sort(bounds_.begin(), bounds_.end());
+  for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::observe(double v) {
+  // Buckets are stored non-cumulatively; the last slot is +Inf.
+  std::size_t idx = static_cast<std::size_t>(
+      std::lower_bound(bounds_.begin(), bounds_.end(), v) - bounds_.begin());
+  buckets_[idx].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  atomic_add(sum_, v);
+}
+
+std::uint64_t Histogram::bucket_count(std::size_t i) const {
+  return buckets_[i].load(std::memory_order_relaxed);
+}
+
+MetricsRegistry &MetricsRegistry::global() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry::Family &MetricsRegistry::family(const std::string &name,
+                                                  const std::string &help,
+                                                  Kind kind) {
+  auto it = families_.find(name);
+  if (it == families_.end()) {
+    Family f;
+    f.kind = kind;
+    f.help = help;
+    it = families_.emplace(name, std::move(f)).first;
+  } else if (it->second.kind != kind) {
+    throw std::runtime_error("Metric registered with conflicting type: " + name);
+  }
+  return it->second;
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help,
+                                  const std::string &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &slot = family(name, help, Kind::COUNTER).counters[labels];
+  if (!slot) {
+    slot = std::make_unique<Counter>();
+  }
+  return *slot;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help,
+                              const std::string &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &slot = family(name, help, Kind::GAUGE).gauges[labels];
+  if (!slot) {
+    slot = std::make_unique<Gauge>();
+  }
+  return *slot;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                                      const std::vector<double> &upper_bounds,
+                                      const std::string &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &slot = family(name, help, Kind::HISTOGRAM).histograms[labels];
+  if (!slot) {
+    slot = std::make_unique<Histogram>(upper_bounds);
+  }
+  return *slot;
+}
+
+std::string MetricsRegistry::render_prometheus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  // Enough digits for gauges and sums to round-trip; the default six would
+  // freeze a long-running process's accumulated seconds.
+  out.precision(17);
+  for (const auto &entry : families_) {
+    const std::string &name = entry.first;
+    const Family &f = entry.second;
+    const char *type = (f.kind == Kind::COUNTER) ? "counter"
+                     : (f.kind == Kind::GAUGE) ? "gauge" : "histogram";
+    out << "# HELP " << name << " " << f.help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+
+    for (const auto &c : f.counters) {
+      out << name << with_labels(c.first) << " " << c.second->value() << "\n";
+    }
+    for (const auto &g : f.gauges) {
+      out << name << with_labels(g.first) << " ";
+      write_value(out, g.second->value()) << "\n";
+    }
+    for (const auto &h : f.histograms) {
+      const Histogram &hist = *h.second;
+      std::uint64_t cumulative = 0;
+      const auto &bounds = hist.upper_bounds();
+      for (std::size_t i = 0; i < bounds.size(); ++i) {
+        cumulative += hist.bucket_count(i);
+        out << name << "_bucket"
+            << with_labels(h.first, "le=\"" + format_bound(bounds[i]) + "\"")
+            << " " << cumulative << "\n";
+      }
+      cumulative += hist.bucket_count(bounds.size());
+      out << name << "_bucket" << with_labels(h.first, "le=\"+Inf\"")
+          << " " << cumulative << "\n";
+      out << name << "_sum" << with_labels(h.first) << " ";
+      write_value(out, hist.sum()) << "\n";
+      out << name << "_count" << with_labels(h.first) << " " << hist.count() << "\n";
+    }
+  }
+  return out.str();
+}
+
+void MetricsRegistry::write_file(const std::string &path) const {
+  std::string text = render_prometheus();
+  std::string temp_path = path + ".tmp";
+  {
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out) {
+      throw std::runtime_error("Failed to open metrics file: " + temp_path);
+    }
+    out << text;
+    if (!out) {
+      throw std::runtime_error("Failed while writing metrics file: " + temp_path);
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    throw std::runtime_error("Failed to move metrics file into place: " + path);
+  }
+}
+
+const std::vector<double> &latency_buckets() {
+  static const std::vector<double> buckets = {
+      0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+      0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0};
+  return buckets;
+}
+
+MetricsFileExporter::MetricsFileExporter(std::string path, double interval_sec)
+    : path_(std::move(path)),
+      interval_(std::max(interval_sec, 0.1)),
+      thread_(&MetricsFileExporter::loop, this) {}
+
+MetricsFileExporter::~MetricsFileExporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  try {
+    MetricsRegistry::global().write_file(path_);
+  } catch (const std::exception &) {
+    // Metrics export must never take the process down.
+  }
+}
+
+void MetricsFileExporter::loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) {
+    try {
+      MetricsRegistry::global().write_file(path_);
+    } catch (const std::exception &) {
+      // Retry on the next tick.
+    }
+  }
+}
+
+}  // namespace bpm
@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <cmath>
 
+#include "bpm/kernels.h"
+
 namespace bpm {
 
 std::vector<float> Metronome::synth_click(int sample_rate,
@@ -45,26 +47,17 @@ void Metronome::overlay(AudioBuffer &audio,
 
   std::size_t frames = audio.num_frames();
   std::size_t channels = static_cast<std::size_t>(audio.channels);
+  const kernels::KernelTable &k = kernels::active();
 
   for (std::size_t beat : beat_samples) {
     if (beat >= frames) {
       continue;
     }
-    for (std::size_t i = 0; i < click.size(); ++i) {
-      std::size_t frame = beat + i;
-      if (frame >= frames) {
-        break;
-      }
-      for (std::size_t ch = 0; ch < channels; ++ch) {
-        std::size_t index = frame * channels + ch;
-        audio.samples[index] += click[i];
-      }
-    }
+    std::size_t length = std::min(click.size(), frames - beat);
+    k.mix_add(audio.samples.data() + beat * channels, click.data(), length, channels);
   }
 
-  for (float &sample : audio.samples) {
-    sample = std::max(-1.0f, std::min(1.0f, sample));
-  }
+  k.clamp_unit(audio.samples.data(), audio.samples.size());
 }
 
 void Metronome::overlay(AudioBuffer &audio,
@@ -88,6 +81,7 @@ void Metronome::overlay(AudioBuffer &audio,
 
   std::size_t frames = audio.num_frames();
   std::size_t channels = static_cast<std::size_t>(audio.channels);
+  const kernels::KernelTable &k = kernels::active();
 
   // Two-pointer scan: both lists are sorted by sample position.
   std::size_t d = 0;
@@ -104,21 +98,11 @@ void Metronome::overlay(AudioBuffer &audio,
 
     const std::vector<float> &click = is_downbeat ? db_click : normal_click;
 
-    for (std::size_t i = 0; i < click.size(); ++i) {
-      std::size_t frame = beat + i;
-      if (frame >= frames) {
-        break;
-      }
-      for (std::size_t ch = 0; ch < channels; ++ch) {
-        std::size_t index = frame * channels + ch;
-        audio.samples[index] += click[i];
-      }
-    }
+    std::size_t length = std::min(click.size(), frames - beat);
+    k.mix_add(audio.samples.data() + beat * channels, click.data(), length, channels);
   }
 
-  for (float &sample : audio.samples) {
-    sample = std::max(-1.0f, std::min(1.0f, sample));
-  }
+  k.clamp_unit(audio.samples.data(), audio.samples.size());
 }
 
 }  // namespace bpm
@@ -6,13 +6,450 @@
 
 #include "bpm/mp3_decoder.h"
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <stdexcept>
 #include <vector>
 
 namespace bpm {
 
+namespace {
+
+// Takes ownership of info.buffer.
+AudioBuffer to_audio_buffer(mp3dec_file_info_t &info, const std::string &source) {
+  if (info.samples <= 0 || info.hz <= 0 || info.channels <= 0 || !info.buffer) {
+    if (info.buffer) {
+      std::free(info.buffer);
+    }
+    throw std::runtime_error("Decoded MP3 contained no samples: " + source);
+  }
+
+  std::vector<float> samples(info.buffer, info.buffer + info.samples);
+  std::free(info.buffer);
+
+  return AudioBuffer(std::move(samples), info.hz, info.channels);
+}
+
+// The 512-tap prototype window of the polyphase synthesis filterbank, as
+// minimp3 applies it (PCM scaling included).  Rather than carry a second
+// copy of the ISO table, it is recovered from mp3d_synth_granule() itself:
+// the impulse response of subband k is D[n] * cos((16 + n % 64)(2k + 1)pi/64),
+// so a least-squares fit over the 32 subbands gives D[n] to float precision.
+// Taps whose cosines all vanish never reach the output and stay 0.
+const std::vector<float> &synthesis_window() {
+  static const std::vector<float> window = [] {
+    constexpr double kPi = 3.14159265358979323846;
+    std::vector<float> grbuf(2 * 576), pcm(2 * 576), lins((18 + 15) * 64);
+    std::vector<std::vector<float>> impulse(32, std::vector<float>(512));
+    for (int k = 0; k < 32; ++k) {
+      float qmf_state[15 * 2 * 32] = {};
+      std::fill(grbuf.begin(), grbuf.end(), 0.0f);
+      grbuf[static_cast<std::size_t>(k * 18)] = 1.0f;
+      mp3d_synth_granule(qmf_state, grbuf.data(), 18, 2, pcm.data(), lins.data());
+      for (int n = 0; n < 512; ++n) {
+        impulse[static_cast<std::size_t>(k)][static_cast<std::size_t>(n)] =
+            pcm[static_cast<std::size_t>(2 * n)];
+      }
+    }
+    std::vector<float> d(512, 0.0f);
+    for (int n = 0; n < 512; ++n) {
+      double num = 0.0, den = 0.0;
+      for (int k = 0; k < 32; ++k) {
+        double c = std::cos((16 + n % 64) * (2 * k + 1) * kPi / 64.0);
+        num += impulse[static_cast<std::size_t>(k)][static_cast<std::size_t>(n)] * c;
+        den += c * c;
+      }
+      if (den > 1e-9) {
+        d[static_cast<std::size_t>(n)] = static_cast<float>(num / den);
+      }
+    }
+    return d;
+  }();
+  return window;
+}
+
+// Polyphase synthesis of only the lowest M = 32 / divisor subbands, at
+// 1 / divisor of the stream rate.  With the upper subbands zero, every
+// divisor-th output sample of the full 32-band filterbank is exactly an
+// M-band filterbank whose matrixing uses cos((M/2 + i)(2k + 1)pi/(2M)) and
+// whose window is the full window taken at every divisor-th tap, so the
+// result is the full decode's lower band, decimated, without ever
+// computing the samples in between.
+class ReducedSynthesis {
+ public:
+  explicit ReducedSynthesis(int divisor) : bands_(32 / divisor) {
+    constexpr double kPi = 3.14159265358979323846;
+    const std::vector<float> &full = synthesis_window();
+    std::size_t m = static_cast<std::size_t>(bands_);
+    window_.resize(16 * m);
+    for (std::size_t n = 0; n < window_.size(); ++n) {
+      window_[n] = full[n * static_cast<std::size_t>(divisor)];
+    }
+    cosines_.resize(m * m);
+    for (std::size_t k = 0; k < m; ++k) {
+      for (std::size_t p = 0; p < m; ++p) {
+        cosines_[k * m + p] = static_cast<float>(
+            std::cos(static_cast<double>(p * (2 * k + 1)) * kPi / static_cast<double>(2 * m)));
+      }
+    }
+    for (auto &fifo : fifo_) {
+      fifo.assign(16 * 2 * m, 0.0f);
+    }
+  }
+
+  int bands() const { return bands_; }
+
+  // Back to silence, as after mp3dec_init().
+  void reset() {
+    for (auto &fifo : fifo_) {
+      std::fill(fifo.begin(), fifo.end(), 0.0f);
+    }
+    newest_ = 0;
+  }
+
+  // Synthesizes `slots` samples of each subband of `nch` channels, laid out
+  // as minimp3 leaves them (channel c, band k, slot t at c*576 + k*18 + t),
+  // and appends slots * bands() frames to `out`: one channel when `mix` is
+  // set, nch otherwise.  Mixing the subbands is mixing the output, since
+  // the synthesis is linear.
+  void run(const float *grbuf, int slots, int nch, bool mix, std::vector<float> &out) {
+    std::size_t m = static_cast<std::size_t>(bands_);
+    int out_channels = mix ? 1 : nch;
+    std::size_t stride = static_cast<std::size_t>(out_channels);
+    std::size_t base = out.size();
+    out.resize(base + static_cast<std::size_t>(slots) * m * stride);
+    float subband[32];
+    float matrixed[32];
+    float pcm[32];
+    for (int t = 0; t < slots; ++t) {
+      newest_ = (newest_ + 15) % 16;
+      for (int c = 0; c < out_channels; ++c) {
+        const float *in = grbuf + c * 576 + t;
+        if (mix && nch == 2) {
+          for (std::size_t k = 0; k < m; ++k) {
+            subband[k] = 0.5f * (in[k * 18] + in[576 + k * 18]);
+          }
+        } else {
+          for (std::size_t k = 0; k < m; ++k) {
+            subband[k] = in[k * 18];
+          }
+        }
+        // Accumulated a subband at a time so that the inner loop has no
+        // serial dependency and vectorizes.
+        std::fill(matrixed, matrixed + m, 0.0f);
+        for (std::size_t k = 0; k < m; ++k) {
+          const float *column = cosines_.data() + k * m;
+          float x = subband[k];
+          for (std::size_t p = 0; p < m; ++p) {
+            matrixed[p] += column[p] * x;
+          }
+        }
+
+        // V[i] = cos((M/2 + i)(2k + 1)pi/(2M)) . S unfolds from the M
+        // products above by the symmetries of the cosine about M and 2M.
+        std::vector<float> &fifo = fifo_[c];
+        float *v = fifo.data() + static_cast<std::size_t>(newest_) * 2 * m;
+        for (std::size_t i = 0; i < 2 * m; ++i) {
+          std::size_t p = i + m / 2;
+          if (p < m) {
+            v[i] = matrixed[p];
+          } else if (p == m) {
+            v[i] = 0.0f;
+          } else if (p <= 2 * m) {
+            v[i] = -matrixed[2 * m - p];
+          } else {
+            v[i] = -matrixed[p - 2 * m];
+          }
+        }
+
+        std::fill(pcm, pcm + m, 0.0f);
+        for (std::size_t i = 0; i < 16; ++i) {
+          const float *w = window_.data() + i * m;
+          const float *older = fifo.data() +
+                               ((static_cast<std::size_t>(newest_) + i) % 16) * 2 * m +
+                               (i & 1) * m;
+          for (std::size_t j = 0; j < m; ++j) {
+            pcm[j] += w[j] * older[j];
+          }
+        }
+        float *dst = out.data() + base + (static_cast<std::size_t>(t) * m) * stride +
+                     static_cast<std::size_t>(c);
+        for (std::size_t j = 0; j < m; ++j) {
+          dst[j * stride] = pcm[j];
+        }
+      }
+    }
+  }
+
+ private:
+  int bands_;
+  std::vector<float> window_;   // 16 * bands_ taps
+  std::vector<float> cosines_;  // bands_ x bands_ matrixing, by subband
+  std::vector<float> fifo_[2];  // per channel, the last 16 V vectors
+  int newest_ = 0;
+};
+
+// L3_decode() with the antialias butterflies and the IMDCT stopped after
+// the lowest `bands` subbands, since the rest are never synthesized.  The
+// butterflies across the boundary still run: they feed the top band kept.
+void l3_decode_low_bands(mp3dec_t *h, mp3dec_scratch_t *s, L3_gr_info_t *gr_info, int nch,
+                         int bands) {
+  // L3_imdct_gr()'s long-block windows: normal/start, then stop.
+  static const float kMdctWindow[2][18] = {
+      {0.99904822f, 0.99144486f, 0.97629601f, 0.95371695f, 0.92387953f, 0.88701083f,
+       0.84339145f, 0.79335334f, 0.73727734f, 0.04361938f, 0.13052619f, 0.21643961f,
+       0.30070580f, 0.38268343f, 0.46174861f, 0.53729961f, 0.60876143f, 0.67559021f},
+      {1, 1, 1, 1, 1, 1, 0.99144486f, 0.92387953f, 0.79335334f, 0, 0, 0, 0, 0, 0, 0.13052619f,
+       0.38268343f, 0.60876143f}};
+
+  for (int ch = 0; ch < nch; ++ch) {
+    int layer3gr_limit = s->bs.pos + gr_info[ch].part_23_length;
+    L3_decode_scalefactors(h->header, s->ist_pos[ch], &s->bs, gr_info + ch, s->scf, ch);
+    L3_huffman(s->grbuf[ch], &s->bs, gr_info + ch, s->scf, layer3gr_limit);
+  }
+
+  if (HDR_TEST_I_STEREO(h->header)) {
+    L3_intensity_stereo(s->grbuf[0], s->ist_pos[1], gr_info, h->header);
+  } else if (HDR_IS_MS_STEREO(h->header)) {
+    L3_midside_stereo(s->grbuf[0], 576);
+  }
+
+  for (int ch = 0; ch < nch; ++ch, ++gr_info) {
+    int aa_bands = 31;
+    int n_long_bands = (gr_info->mixed_block_flag ? 2 : 0)
+                       << static_cast<int>(HDR_GET_MY_SAMPLE_RATE(h->header) == 2);
+    if (gr_info->n_short_sfb) {
+      aa_bands = n_long_bands - 1;
+      L3_reorder(s->grbuf[ch] + n_long_bands * 18, s->syn[0],
+                 gr_info->sfbtab + gr_info->n_long_sfb);
+    }
+    L3_antialias(s->grbuf[ch], std::min(aa_bands, bands));
+
+    float *grbuf = s->grbuf[ch];
+    float *overlap = h->mdct_overlap[ch];
+    if (n_long_bands) {
+      L3_imdct36(grbuf, overlap, kMdctWindow[0], n_long_bands);
+      grbuf += 18 * n_long_bands;
+      overlap += 9 * n_long_bands;
+    }
+    if (gr_info->block_type == SHORT_BLOCK_TYPE) {
+      L3_imdct_short(grbuf, overlap, bands - n_long_bands);
+    } else {
+      L3_imdct36(grbuf, overlap, kMdctWindow[gr_info->block_type == STOP_BLOCK_TYPE],
+                 bands - n_long_bands);
+    }
+    L3_change_sign(s->grbuf[ch]);
+  }
+}
+
+// mp3dec_decode_frame() with ReducedSynthesis in place of the full
+// filterbank.
+class ReducedFrameDecoder {
+ public:
+  ReducedFrameDecoder(int divisor, bool mono) : synthesis_(divisor), mono_(mono) {
+    mp3dec_init(&dec_);
+  }
+
+  // Returns the frame's samples per channel at the stream rate, 0 if it did
+  // not decode, and appends its reduced-rate frames to `out`.
+  int decode_frame(const std::uint8_t *mp3, int mp3_bytes, mp3dec_frame_info_t *info,
+                   std::vector<float> &out) {
+    int i = 0;
+    int frame_size = 0;
+    if (mp3_bytes > 4 && dec_.header[0] == 0xff && hdr_compare(dec_.header, mp3)) {
+      frame_size = hdr_frame_bytes(mp3, dec_.free_format_bytes) + hdr_padding(mp3);
+      if (frame_size != mp3_bytes &&
+          (frame_size + HDR_SIZE > mp3_bytes || !hdr_compare(mp3, mp3 + frame_size))) {
+        frame_size = 0;
+      }
+    }
+    if (!frame_size) {
+      std::memset(&dec_, 0, sizeof(dec_));
+      synthesis_.reset();
+      i = mp3d_find_frame(mp3, mp3_bytes, &dec_.free_format_bytes, &frame_size);
+      if (!frame_size || i + frame_size > mp3_bytes) {
+        info->frame_bytes = i;
+        return 0;
+      }
+    }
+
+    const std::uint8_t *hdr = mp3 + i;
+    std::memcpy(dec_.header, hdr, HDR_SIZE);
+    info->frame_bytes = i + frame_size;
+    info->frame_offset = i;
+    info->channels = HDR_IS_MONO(hdr) ? 1 : 2;
+    info->hz = hdr_sample_rate_hz(hdr);
+    info->layer = 4 - HDR_GET_LAYER(hdr);
+    info->bitrate_kbps = hdr_bitrate_kbps(hdr);
+
+    bs_t bs_frame[1];
+    bs_init(bs_frame, hdr + HDR_SIZE, frame_size - HDR_SIZE);
+    if (HDR_IS_CRC(hdr)) {
+      get_bits(bs_frame, 16);
+    }
+
+    int success = 1;
+    mp3dec_scratch_t &scratch = scratch_;
+    if (info->layer == 3) {
+      int main_data_begin = L3_read_side_info(bs_frame, scratch.gr_info, hdr);
+      if (main_data_begin < 0 || bs_frame->pos > bs_frame->limit) {
+        mp3dec_init(&dec_);
+        return 0;
+      }
+      success = L3_restore_reservoir(&dec_, bs_frame, &scratch, main_data_begin);
+      if (success) {
+        for (int igr = 0; igr < (HDR_TEST_MPEG1(hdr) ? 2 : 1); ++igr) {
+          std::memset(scratch.grbuf[0], 0, 576 * 2 * sizeof(float));
+          l3_decode_low_bands(&dec_, &scratch, scratch.gr_info + igr * info->channels,
+                              info->channels, synthesis_.bands());
+          synthesis_.run(scratch.grbuf[0], 18, info->channels, mono_, out);
+        }
+      }
+      L3_save_reservoir(&dec_, &scratch);
+    } else {
+      L12_scale_info sci[1];
+      L12_read_scale_info(hdr, bs_frame, sci);
+      std::memset(scratch.grbuf[0], 0, 576 * 2 * sizeof(float));
+      for (int igr = 0, slot = 0; igr < 3; ++igr) {
+        if (12 == (slot += L12_dequantize_granule(scratch.grbuf[0] + slot, bs_frame, sci,
+                                                  info->layer | 1))) {
+          slot = 0;
+          L12_apply_scf_384(sci, sci->scf + igr, scratch.grbuf[0]);
+          synthesis_.run(scratch.grbuf[0], 12, info->channels, mono_, out);
+          std::memset(scratch.grbuf[0], 0, 576 * 2 * sizeof(float));
+        }
+        if (bs_frame->pos > bs_frame->limit) {
+          mp3dec_init(&dec_);
+          return 0;
+        }
+      }
+    }
+    return success * hdr_frame_samples(dec_.header);
+  }
+
+ private:
+  mp3dec_t dec_;
+  mp3dec_scratch_t scratch_;
+  ReducedSynthesis synthesis_;
+  bool mono_;
+};
+
+// mp3dec_load_buf() over ReducedFrameDecoder.  The encoder delay and
+// padding from a LAME/Xing tag are trimmed at the reduced rate, rounded to
+// the nearest reduced frame.  Falls back to mp3dec_load_buf() itself when
+// the stream rate leaves nothing to reduce.
+AudioBuffer decode_reduced(const std::uint8_t *data, std::size_t size,
+                           const Mp3Decoder::ReducedRate &rate, const std::string &source) {
+  int divisor = rate.divisor;
+  if (divisor != 1 && divisor != 2 && divisor != 4) {
+    throw std::runtime_error("MP3 rate divisor must be 1, 2 or 4, got " +
+                             std::to_string(divisor) + ".");
+  }
+  const std::uint8_t *buf = data;
+  std::size_t buf_size = size;
+  mp3dec_skip_id3(&buf, &buf_size);
+
+  // The first frame fixes the stream's format and may be a VBR tag.
+  mp3dec_frame_info_t first = {};
+  std::uint64_t skip = 0;      // stream-rate frames
+  std::uint64_t detected = 0;  // stream-rate frames after skip and padding
+  for (;;) {
+    int free_format_bytes = 0;
+    int frame_size = 0;
+    int i = mp3d_find_frame(buf, static_cast<int>(std::min<std::size_t>(buf_size, INT_MAX)),
+                            &free_format_bytes, &frame_size);
+    buf += i;
+    buf_size -= static_cast<std::size_t>(i);
+    if (i && !frame_size) {
+      continue;
+    }
+    if (!frame_size) {
+      throw std::runtime_error("Decoded MP3 contained no samples: " + source);
+    }
+    first.channels = HDR_IS_MONO(buf) ? 1 : 2;
+    first.hz = hdr_sample_rate_hz(buf);
+    first.layer = 4 - HDR_GET_LAYER(buf);
+    if (first.layer != 3) {
+      break;
+    }
+    std::uint32_t frames = 0;
+    int delay = 0;
+    int padding = 0;
+    int tag = mp3dec_check_vbrtag(buf, frame_size, &frames, &delay, &padding);
+    if (tag > 0) {
+      skip = static_cast<std::uint64_t>(std::max(delay, 0));
+      detected = static_cast<std::uint64_t>(hdr_frame_samples(buf)) * frames;
+      detected = detected >= skip ? detected - skip : detected;
+      if (padding > 0 && detected >= static_cast<std::uint64_t>(padding)) {
+        detected -= static_cast<std::uint64_t>(padding);
+      }
+      if (!detected) {
+        throw std::runtime_error("Decoded MP3 contained no samples: " + source);
+      }
+    }
+    if (tag) {
+      buf += frame_size;
+      buf_size -= static_cast<std::size_t>(frame_size);
+    }
+    break;
+  }
+
+  while (divisor > 1 && first.hz / divisor < rate.min_sample_rate) {
+    divisor /= 2;
+  }
+  if (divisor == 1 && !rate.mono) {
+    mp3dec_t dec;
+    mp3dec_file_info_t info;
+    std::memset(&info, 0, sizeof(info));
+    if (mp3dec_load_buf(&dec, data, size, &info, nullptr, nullptr) != 0) {
+      throw std::runtime_error("Failed to decode MP3: " + source);
+    }
+    return to_audio_buffer(info, source);
+  }
+
+  int channels = rate.mono ? 1 : first.channels;
+  ReducedFrameDecoder decoder(divisor, rate.mono);
+  std::vector<float> samples;
+  mp3dec_frame_info_t info = {};
+  do {
+    std::size_t before = samples.size();
+    int frame_samples = decoder.decode_frame(
+        buf, static_cast<int>(std::min<std::size_t>(buf_size, INT_MAX)), &info, samples);
+    buf += info.frame_bytes;
+    buf_size -= static_cast<std::size_t>(info.frame_bytes);
+    if (!frame_samples) {
+      samples.resize(before);
+    } else if (info.hz != first.hz || info.layer != first.layer ||
+               info.channels != first.channels) {
+      // Like the stream decoder, stop at the first change of format and
+      // keep what was decoded before it.
+      samples.resize(before);
+      break;
+    }
+  } while (info.frame_bytes);
+
+  std::size_t stride = static_cast<std::size_t>(channels);
+  std::size_t d = static_cast<std::size_t>(divisor);
+  std::size_t begin = std::min(static_cast<std::size_t>((skip + d / 2) / d),
+                               samples.size() / stride);
+  std::size_t end = samples.size() / stride;
+  if (detected) {
+    end = std::min(end, static_cast<std::size_t>((skip + detected + d / 2) / d));
+  }
+  if (end <= begin) {
+    throw std::runtime_error("Decoded MP3 contained no samples: " + source);
+  }
+  std::vector<float> trimmed(samples.begin() + static_cast<std::ptrdiff_t>(begin * stride),
+                             samples.begin() + static_cast<std::ptrdiff_t>(end * stride));
+  return AudioBuffer(std::move(trimmed), first.hz / divisor, channels);
+}
+
+}  // namespace
+
 AudioBuffer Mp3Decoder::decode(const std::string &filepath) {
   mp3dec_t dec;
   mp3dec_file_info_t info;
@@ -21,18 +458,77 @@ AudioBuffer Mp3Decoder::decode(const std::string &filepath) {
   if (mp3dec_load(&dec, filepath.c_str(), &info, nullptr, nullptr) != 0) {
     throw std::runtime_error("Failed to decode MP3: " + filepath);
   }
+  return to_audio_buffer(info, filepath);
+}
 
-  if (info.samples <= 0 || info.hz <= 0 || info.channels <= 0 || !info.buffer) {
-    if (info.buffer) {
-      std::free(info.buffer);
-    }
-    throw std::runtime_error("Decoded MP3 contained no samples: " + filepath);
+AudioBuffer Mp3Decoder::decode(const std::uint8_t *data, std::size_t size) {
+  mp3dec_t dec;
+  mp3dec_file_info_t info;
+  std::memset(&info, 0, sizeof(info));
+
+  if (mp3dec_load_buf(&dec, data, size, &info, nullptr, nullptr) != 0) {
+    throw std::runtime_error("Failed to decode MP3 from memory.");
   }
+  return to_audio_buffer(info, "<memory>");
+}
 
-  std::vector<float> samples(info.buffer, info.buffer + info.samples);
-  std::free(info.buffer);
+AudioBuffer Mp3Decoder::decode(const std::string &filepath, const ReducedRate &rate) {
+  mp3dec_map_info_t map;
+  if (mp3dec_open_file(filepath.c_str(), &map) != 0) {
+    throw std::runtime_error("Failed to decode MP3: " + filepath);
+  }
+  try {
+    AudioBuffer audio = decode_reduced(map.buffer, map.size, rate, filepath);
+    mp3dec_close_file(&map);
+    return audio;
+  } catch (...) {
+    mp3dec_close_file(&map);
+    throw;
+  }
+}
 
-  return AudioBuffer(std::move(samples), info.hz, info.channels);
+AudioBuffer Mp3Decoder::decode(const std::uint8_t *data, std::size_t size,
+                               const ReducedRate &rate) {
+  return decode_reduced(data, size, rate, "<memory>");
+}
+
+struct Mp3Decoder::Stream::State {
+  mp3dec_ex_t dec = {};
+
+  ~State() { mp3dec_ex_close(&dec); }
+};
+
+Mp3Decoder::Stream::Stream(const std::string &filepath) : state_(std::make_unique<State>()) {
+  // Without the index scan, opening reads only the first frame.
+  if (mp3dec_ex_open(&state_->dec, filepath.c_str(), MP3D_DO_NOT_SCAN) != 0 ||
+      state_->dec.info.hz <= 0 || state_->dec.info.channels <= 0) {
+    throw std::runtime_error("Failed to decode MP3: " + filepath);
+  }
+}
+
+Mp3Decoder::Stream::~Stream() = default;
+Mp3Decoder::Stream::Stream(Stream &&) noexcept = default;
+Mp3Decoder::Stream &Mp3Decoder::Stream::operator=(Stream &&) noexcept = default;
+
+int Mp3Decoder::Stream::sample_rate() const {
+  return state_->dec.info.hz;
+}
+
+int Mp3Decoder::Stream::channels() const {
+  return state_->dec.info.channels;
+}
+
+std::size_t Mp3Decoder::Stream::read(std::vector<float> &samples, std::size_t max_frames) {
+  std::size_t channels = static_cast<std::size_t>(state_->dec.info.channels);
+  std::size_t begin = samples.size();
+  samples.resize(begin + max_frames * channels);
+  std::size_t read = mp3dec_ex_read(&state_->dec, samples.data() + begin, max_frames * channels);
+  samples.resize(begin + read);
+  return read / channels;
+}
+
+bool Mp3Decoder::probe(const std::uint8_t *data, std::size_t size) {
+  return data != nullptr && mp3dec_detect_buf(data, size) == 0;
 }
 
 }  // namespace bpm
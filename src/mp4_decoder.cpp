@@ -4,6 +4,9 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
 
 #include "bpm/wav_reader.h"
 
@@ -29,4 +32,39 @@ AudioBuffer Mp4Decoder::decode(const std::string &filepath) {
   return audio;
 }
 
+AudioBuffer Mp4Decoder::decode(const std::uint8_t *data, std::size_t size) {
+  // ffmpeg needs a seekable file, so the input is staged in $TMPDIR.
+  const char *temp_dir = std::getenv("TMPDIR");
+  std::string pattern = std::string(temp_dir && *temp_dir ? temp_dir : "/tmp") + "/bpm_mp4_XXXXXX";
+  std::vector<char> path_buffer(pattern.begin(), pattern.end());
+  path_buffer.push_back('\0');
+  char *temp_path = path_buffer.data();
+  int fd = mkstemp(temp_path);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to create temporary file for MP4 input.");
+  }
+  std::size_t written = 0;
+  while (written < size) {
+    ssize_t n = ::write(fd, data + written, size - written);
+    if (n <= 0) {
+      break;
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  ::close(fd);
+  if (written < size) {
+    std::remove(temp_path);
+    throw std::runtime_error("Failed to write temporary file for MP4 input.");
+  }
+
+  try {
+    AudioBuffer audio = decode(std::string(temp_path));
+    std::remove(temp_path);
+    return audio;
+  } catch (...) {
+    std::remove(temp_path);
+    throw;
+  }
+}
+
 }  // namespace bpm
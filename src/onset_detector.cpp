@@ -2,12 +2,17 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <numeric>
 #include <stdexcept>
+#include <string>
 
-extern "C" {
-#include "pocketfft.h"
-}
+#include "bpm/feature_cache.h"
+#include "bpm/fixed_point.h"
+#include "bpm/kernels.h"
+#include "bpm/pruned_fft.h"
 
 namespace bpm {
 namespace {
@@ -20,8 +25,163 @@ float mel_to_hz(float mel) {
   return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
 }
 
+// Zero mean, unit variance.
+void normalize(std::vector<float> &onset_strength) {
+  if (onset_strength.empty()) {
+    return;
+  }
+  float mean = std::accumulate(onset_strength.begin(), onset_strength.end(), 0.0f) /
+               static_cast<float>(onset_strength.size());
+  float variance = 0.0f;
+  for (float value : onset_strength) {
+    float diff = value - mean;
+    variance += diff * diff;
+  }
+  variance /= static_cast<float>(onset_strength.size());
+  float stddev = std::sqrt(variance);
+  if (stddev > 1e-6f) {
+    for (float &value : onset_strength) {
+      value = (value - mean) / stddev;
+    }
+  }
+}
+
+// Zero mean, unit variance for each band of a band-major envelope array.
+void normalize_bands(std::vector<float> &band_flux, int num_bands, std::size_t frames) {
+  std::vector<float> band(frames);
+  for (int k = 0; k < num_bands; ++k) {
+    float *data = band_flux.data() + static_cast<std::size_t>(k) * frames;
+    std::copy(data, data + frames, band.begin());
+    normalize(band);
+    std::copy(band.begin(), band.end(), data);
+  }
+}
+
+// The first `frames` frames of an envelope whose bands lie `stride` frames
+// apart, normalized as finish() does.
+OnsetDetector::Result envelope_prefix(const float *onset_strength, const float *band_flux,
+                                      int num_bands, std::size_t stride, std::size_t frames,
+                                      int hop_size, int fft_size) {
+  OnsetDetector::Result result;
+  result.onset_strength.assign(onset_strength, onset_strength + frames);
+  result.hop_size = hop_size;
+  result.fft_size = fft_size;
+  result.num_bands = num_bands;
+  result.band_flux.reserve(static_cast<std::size_t>(num_bands) * frames);
+  for (int band = 0; band < num_bands; ++band) {
+    const float *first = band_flux + static_cast<std::size_t>(band) * stride;
+    result.band_flux.insert(result.band_flux.end(), first, first + frames);
+  }
+  normalize(result.onset_strength);
+  normalize_bands(result.band_flux, num_bands, frames);
+  return result;
+}
+
+// Window, transform, power spectrum and log-mel reduction for one frame,
+// with everything that depends only on the sample rate set up once.
+class MelFrontEnd {
+ public:
+  MelFrontEnd(const OnsetDetector &detector, int sample_rate)
+      : fft_size_(detector.fft_size()),
+        window_(detector.hann_window()),
+        mel_filters_(detector.mel_filterbank(sample_rate)),
+        spectrum_bins_(last_weighted_bin(mel_filters_, fft_size_) + 1),
+        full_spectrum_(spectrum_bins_ > fft_size_ / 2),
+        // Power bin b reads halfcomplex entries 2b and 2b + 1, so the
+        // transform must supply one bin more than the spectrum uses.
+        fft_(fft_size_, full_spectrum_ ? fft_size_ / 2 + 1 : spectrum_bins_ + 1),
+        frame_(static_cast<std::size_t>(fft_size_)),
+        power_spectrum_(static_cast<std::size_t>(fft_size_ / 2 + 1), 0.0) {
+    if (fft_size_ % 2 != 0) {
+      throw std::runtime_error("OnsetDetector requires an even FFT size.");
+    }
+  }
+
+  // `samples` holds fft_size samples; writes one value per mel band.
+  void analyze(const float *samples, float *mel_energy) {
+    const kernels::KernelTable &k = kernels::active();
+    k.window_to_double(samples, window_.data(), frame_.data(),
+                       static_cast<std::size_t>(fft_size_));
+
+    fft_.forward(frame_.data());
+
+    power_spectrum_[0] = frame_[0] * frame_[0];
+    if (full_spectrum_) {
+      power_spectrum_[static_cast<std::size_t>(fft_size_ / 2)] = frame_[1] * frame_[1];
+      k.power_spectrum(frame_.data() + 2, power_spectrum_.data() + 1,
+                       static_cast<std::size_t>(fft_size_ / 2 - 1));
+    } else {
+      k.power_spectrum(frame_.data() + 2, power_spectrum_.data() + 1,
+                       static_cast<std::size_t>(spectrum_bins_ - 1));
+    }
+
+    // Weights beyond spectrum_bins_ are zero, so the shorter dot product
+    // gives the same sum.
+    for (std::size_t band = 0; band < mel_filters_.size(); ++band) {
+      double sum = k.dot(power_spectrum_.data(), mel_filters_[band].data(),
+                         static_cast<std::size_t>(spectrum_bins_));
+      mel_energy[band] = static_cast<float>(std::log10(sum + 1e-10));
+    }
+  }
+
+ private:
+  // Bins above the last non-zero mel weight (8 kHz) are neither transformed
+  // nor squared.
+  static int last_weighted_bin(const std::vector<std::vector<float>> &filters, int fft_size) {
+    int last = 0;
+    for (const auto &filter : filters) {
+      for (int bin = fft_size / 2; bin > last; --bin) {
+        if (filter[static_cast<std::size_t>(bin)] != 0.0f) {
+          last = bin;
+          break;
+        }
+      }
+    }
+    return last;
+  }
+
+  int fft_size_;
+  std::vector<float> window_;
+  std::vector<std::vector<float>> mel_filters_;
+  int spectrum_bins_;
+  bool full_spectrum_;
+  PrunedRealFFT fft_;
+  std::vector<double> frame_;
+  std::vector<double> power_spectrum_;
+};
+
+// Half-wave rectified mel flux for frames [first, last) of an envelope of
+// `total` frames; `mel` holds those frames' log-mel energies, frame-major.
+// `prev_mel` carries the previous frame across calls.
+void accumulate_flux(const float *mel, std::size_t first, std::size_t last, std::size_t total,
+                     std::size_t bands, const std::vector<int> &groups, int num_bands,
+                     std::vector<float> &prev_mel, float *onset_strength, float *band_flux) {
+  for (std::size_t frame_idx = first; frame_idx < last; ++frame_idx) {
+    const float *mel_energy = mel + (frame_idx - first) * bands;
+    float flux = 0.0f;
+    for (std::size_t band = 0; band < bands; ++band) {
+      float diff = mel_energy[band] - prev_mel[band];
+      if (diff > 0.0f) {
+        flux += diff;
+        if (num_bands > 0) {
+          band_flux[static_cast<std::size_t>(groups[band]) * total + frame_idx] += diff;
+        }
+      }
+    }
+    onset_strength[frame_idx] = flux;
+    std::copy(mel_energy, mel_energy + bands, prev_mel.begin());
+  }
+}
+
 }  // namespace
 
+OnsetDetector::OnsetDetector(std::vector<float> band_split_hz)
+    : band_split_hz_(std::move(band_split_hz)) {
+  if (!std::is_sorted(band_split_hz_.begin(), band_split_hz_.end())) {
+    throw std::runtime_error("OnsetDetector band splits must be ascending.");
+  }
+}
+
 std::vector<float> OnsetDetector::hann_window() const {
   std::vector<float> window(static_cast<std::size_t>(fft_size_));
   constexpr float kPi = 3.14159265358979323846f;
@@ -32,7 +192,7 @@ std::vector<float> OnsetDetector::hann_window() const {
   return window;
 }
 
-std::vector<std::vector<float>> OnsetDetector::mel_filterbank(int sample_rate) const {
+std::vector<float> OnsetDetector::mel_points() const {
   float low_mel = hz_to_mel(30.0f);
   float high_mel = hz_to_mel(8000.0f);
   std::vector<float> mel_points(static_cast<std::size_t>(mel_bands_ + 2));
@@ -40,6 +200,26 @@ std::vector<std::vector<float>> OnsetDetector::mel_filterbank(int sample_rate) c
     float t = static_cast<float>(i) / static_cast<float>(mel_bands_ + 1);
     mel_points[static_cast<std::size_t>(i)] = low_mel + t * (high_mel - low_mel);
   }
+  return mel_points;
+}
+
+std::vector<int> OnsetDetector::band_groups() const {
+  if (band_split_hz_.empty()) {
+    return {};
+  }
+  auto points = mel_points();
+  std::vector<int> groups(static_cast<std::size_t>(mel_bands_));
+  for (int band = 0; band < mel_bands_; ++band) {
+    float center_hz = mel_to_hz(points[static_cast<std::size_t>(band + 1)]);
+    groups[static_cast<std::size_t>(band)] = static_cast<int>(
+        std::upper_bound(band_split_hz_.begin(), band_split_hz_.end(), center_hz) -
+        band_split_hz_.begin());
+  }
+  return groups;
+}
+
+std::vector<std::vector<float>> OnsetDetector::mel_filterbank(int sample_rate) const {
+  std::vector<float> mel_points = this->mel_points();
 
   std::vector<int> bin_points(static_cast<std::size_t>(mel_bands_ + 2));
   for (int i = 0; i < mel_bands_ + 2; ++i) {
@@ -77,104 +257,386 @@ std::vector<std::vector<float>> OnsetDetector::mel_filterbank(int sample_rate) c
   return filters;
 }
 
-OnsetDetector::Result OnsetDetector::compute(const AudioBuffer &mono_audio) const {
+// Everything compute() keeps between chunks.  Frames are processed in
+// content-defined chunks of about kCacheChunkFrames, whose boundaries follow
+// the samples (FeatureCache::content_chunk_end).  With a cache, each chunk's log-mel energies are keyed
+// by a hash of exactly the samples its frames read, so unchanged regions of
+// an edited file are loaded, not recomputed.  Flux is always derived
+// afterwards from the mel energies, which keeps the envelope identical
+// whether a chunk was cached or not.
+struct OnsetDetector::Session::State {
+  State(const OnsetDetector &detector, const AudioBuffer &mono_audio, const FeatureCache *cache)
+      : detector(detector), audio(mono_audio), cache(cache),
+        bands(static_cast<std::size_t>(detector.mel_bands_)),
+        prev_mel(bands, 0.0f),
+        groups(detector.band_groups()),
+        front_end(detector, mono_audio.sample_rate) {
+    std::size_t fft_size = static_cast<std::size_t>(detector.fft_size_);
+    if (audio.samples.size() >= fft_size) {
+      frames = 1 + (audio.samples.size() - fft_size) / static_cast<std::size_t>(detector.hop_size_);
+    }
+    onset_strength.assign(frames, 0.0f);
+    num_bands = groups.empty() ? 0 : static_cast<int>(detector.band_split_hz_.size()) + 1;
+    band_flux.assign(static_cast<std::size_t>(num_bands) * frames, 0.0f);
+    // Changes to these numerics need a new FeatureCache::kAnalysisVersion.
+    cache_tag = "mel" + std::to_string(audio.sample_rate) + "_" +
+                std::to_string(detector.fft_size_) + "_" + std::to_string(detector.hop_size_) +
+                "_" + std::to_string(detector.mel_bands_);
+  }
+
+  const OnsetDetector &detector;
+  const AudioBuffer &audio;
+  const FeatureCache *cache;
+  std::size_t bands;
+  std::size_t frames = 0;
+  std::size_t next_frame = 0;
+  std::vector<float> onset_strength;
+  std::vector<float> prev_mel;
+  std::vector<int> groups;
+  int num_bands = 0;
+  std::vector<float> band_flux;
+  MelFrontEnd front_end;
+  std::string cache_tag;
+  std::vector<float> mel_chunk;
+};
+
+OnsetDetector::Session::Session(const OnsetDetector &detector, const AudioBuffer &mono_audio,
+                                const FeatureCache *cache) {
   if (mono_audio.channels != 1) {
     throw std::runtime_error("OnsetDetector expects mono audio.");
   }
   if (mono_audio.sample_rate <= 0) {
     throw std::runtime_error("OnsetDetector invalid sample rate.");
   }
-  if (mono_audio.samples.empty()) {
+  if (!mono_audio.samples.empty()) {
+    state_ = std::make_unique<State>(detector, mono_audio, cache);
+  }
+}
+
+OnsetDetector::Session::~Session() = default;
+OnsetDetector::Session::Session(Session &&) noexcept = default;
+OnsetDetector::Session &OnsetDetector::Session::operator=(Session &&) noexcept = default;
+
+bool OnsetDetector::Session::done() const {
+  return !state_ || state_->next_frame >= state_->frames;
+}
+
+void OnsetDetector::Session::advance() {
+  if (done()) {
+    return;
+  }
+  State &s = *state_;
+  int hop_size = s.detector.hop_size_;
+  std::size_t chunk_begin = s.next_frame;
+  std::size_t chunk_end = FeatureCache::content_chunk_end(
+      s.audio.samples.data(), chunk_begin, s.frames, static_cast<std::size_t>(hop_size),
+      kCacheChunkFrames);
+  std::size_t chunk_frames = chunk_end - chunk_begin;
+
+  std::string key;
+  bool cached = false;
+  if (s.cache) {
+    std::size_t sample_begin = chunk_begin * static_cast<std::size_t>(hop_size);
+    std::size_t sample_end = (chunk_end - 1) * static_cast<std::size_t>(hop_size) +
+                             static_cast<std::size_t>(s.detector.fft_size_);
+    key = FeatureCache::chunk_key(s.cache_tag, s.audio.samples.data() + sample_begin,
+                                  sample_end - sample_begin);
+    cached = s.cache->load(key, s.mel_chunk) && s.mel_chunk.size() == chunk_frames * s.bands;
+  }
+
+  if (!cached) {
+    s.mel_chunk.assign(chunk_frames * s.bands, 0.0f);
+    for (std::size_t frame_idx = chunk_begin; frame_idx < chunk_end; ++frame_idx) {
+      std::size_t offset = frame_idx * static_cast<std::size_t>(hop_size);
+      s.front_end.analyze(s.audio.samples.data() + offset,
+                          s.mel_chunk.data() + (frame_idx - chunk_begin) * s.bands);
+    }
+    if (s.cache) {
+      s.cache->store(key, s.mel_chunk);
+    }
+  }
+
+  accumulate_flux(s.mel_chunk.data(), chunk_begin, chunk_end, s.frames, s.bands, s.groups,
+                  s.num_bands, s.prev_mel, s.onset_strength.data(), s.band_flux.data());
+  s.next_frame = chunk_end;
+}
+
+OnsetDetector::Result OnsetDetector::Session::finish() {
+  while (!done()) {
+    advance();
+  }
+  if (!state_) {
     return Result{};
   }
+  State &s = *state_;
+  normalize(s.onset_strength);
+  normalize_bands(s.band_flux, s.num_bands, s.frames);
 
-  std::vector<float> window = hann_window();
-  auto mel_filters = mel_filterbank(mono_audio.sample_rate);
+  Result result;
+  result.onset_strength = std::move(s.onset_strength);
+  result.hop_size = s.detector.hop_size_;
+  result.fft_size = s.detector.fft_size_;
+  result.num_bands = s.num_bands;
+  result.band_flux = std::move(s.band_flux);
+  state_.reset();
+  return result;
+}
 
-  std::size_t frames = 0;
-  if (mono_audio.samples.size() >= static_cast<std::size_t>(fft_size_)) {
-    frames = 1 + (mono_audio.samples.size() - static_cast<std::size_t>(fft_size_)) / static_cast<std::size_t>(hop_size_);
+std::size_t OnsetDetector::Session::frames_done() const {
+  return state_ ? state_->next_frame : 0;
+}
+
+OnsetDetector::Result OnsetDetector::Session::preview(std::size_t frames) const {
+  if (!state_) {
+    return Result{};
   }
+  const State &s = *state_;
+  frames = std::min(frames, s.next_frame);
+  return envelope_prefix(s.onset_strength.data(), s.band_flux.data(), s.num_bands, s.frames,
+                         frames, s.detector.hop_size_, s.detector.fft_size_);
+}
 
-  std::vector<float> onset_strength(frames, 0.0f);
-  std::vector<float> prev_mel(static_cast<std::size_t>(mel_bands_), 0.0f);
+OnsetDetector::Session::Snapshot OnsetDetector::Session::snapshot() const {
+  Snapshot snapshot;
+  if (!state_) {
+    return snapshot;
+  }
+  const State &s = *state_;
+  snapshot.next_frame = s.next_frame;
+  snapshot.onset_strength.assign(s.onset_strength.begin(),
+                                 s.onset_strength.begin() + static_cast<std::ptrdiff_t>(s.next_frame));
+  snapshot.band_flux.reserve(static_cast<std::size_t>(s.num_bands) * s.next_frame);
+  for (int band = 0; band < s.num_bands; ++band) {
+    auto first = s.band_flux.begin() + static_cast<std::ptrdiff_t>(band * s.frames);
+    snapshot.band_flux.insert(snapshot.band_flux.end(), first,
+                              first + static_cast<std::ptrdiff_t>(s.next_frame));
+  }
+  snapshot.prev_mel = s.prev_mel;
+  return snapshot;
+}
 
-  if (fft_size_ % 2 != 0) {
-    throw std::runtime_error("OnsetDetector requires an even FFT size.");
+void OnsetDetector::Session::restore(const Snapshot &snapshot) {
+  if (!state_) {
+    if (snapshot.next_frame != 0) {
+      throw std::runtime_error("Onset snapshot does not match the audio.");
+    }
+    return;
+  }
+  State &s = *state_;
+  std::size_t bands = static_cast<std::size_t>(s.num_bands);
+  if (snapshot.next_frame > s.frames ||
+      snapshot.onset_strength.size() != snapshot.next_frame ||
+      snapshot.band_flux.size() != bands * snapshot.next_frame ||
+      snapshot.prev_mel.size() != s.bands) {
+    throw std::runtime_error("Onset snapshot does not match the audio.");
   }
+  s.next_frame = snapshot.next_frame;
+  std::copy(snapshot.onset_strength.begin(), snapshot.onset_strength.end(),
+            s.onset_strength.begin());
+  for (std::size_t band = 0; band < bands; ++band) {
+    auto first = snapshot.band_flux.begin() + static_cast<std::ptrdiff_t>(band * s.next_frame);
+    std::copy(first, first + static_cast<std::ptrdiff_t>(s.next_frame),
+              s.band_flux.begin() + static_cast<std::ptrdiff_t>(band * s.frames));
+  }
+  s.prev_mel = snapshot.prev_mel;
+}
 
-  rfft_plan plan = make_rfft_plan(static_cast<std::size_t>(fft_size_));
-  if (!plan) {
-    throw std::runtime_error("Failed to create FFT plan.");
+// Normalization is affine, so renormalizing a prefix of a normalized
+// envelope gives the normalized prefix of the raw one.
+OnsetDetector::Result OnsetDetector::Result::prefix(std::size_t frames) const {
+  frames = std::min(frames, onset_strength.size());
+  return envelope_prefix(onset_strength.data(), band_flux.data(), num_bands,
+                         onset_strength.size(), frames, hop_size, fft_size);
+}
+
+OnsetDetector::Result OnsetDetector::compute(const AudioBuffer &mono_audio,
+                                             const FeatureCache *cache) const {
+  return Session(*this, mono_audio, cache).finish();
+}
+
+std::vector<OnsetDetector::Result> OnsetDetector::compute_batch(
+    const std::vector<AudioBuffer> &clips) const {
+  for (const AudioBuffer &clip : clips) {
+    if (clip.channels != 1) {
+      throw std::runtime_error("OnsetDetector expects mono audio.");
+    }
+    if (clip.sample_rate <= 0) {
+      throw std::runtime_error("OnsetDetector invalid sample rate.");
+    }
   }
 
-  std::vector<double> frame(fft_size_);
-  std::vector<double> power_spectrum(static_cast<std::size_t>(fft_size_ / 2 + 1), 0.0);
+  std::vector<int> groups = band_groups();
+  int num_bands = groups.empty() ? 0 : static_cast<int>(band_split_hz_.size()) + 1;
+  std::size_t bands = static_cast<std::size_t>(mel_bands_);
+
+  // One front end per sample rate, shared by every clip at that rate, and
+  // one mel buffer sized for the longest clip.
+  std::map<int, std::unique_ptr<MelFrontEnd>> front_ends;
+  std::vector<float> mel;
+  std::vector<float> prev_mel(bands);
+
+  std::vector<Result> results(clips.size());
+  for (std::size_t c = 0; c < clips.size(); ++c) {
+    const AudioBuffer &clip = clips[c];
+    if (clip.samples.empty()) {
+      continue;
+    }
+    std::size_t frames = 0;
+    if (clip.samples.size() >= static_cast<std::size_t>(fft_size_)) {
+      frames = 1 + (clip.samples.size() - static_cast<std::size_t>(fft_size_)) /
+                       static_cast<std::size_t>(hop_size_);
+    }
+
+    auto &front_end = front_ends[clip.sample_rate];
+    if (!front_end) {
+      front_end = std::make_unique<MelFrontEnd>(*this, clip.sample_rate);
+    }
+    if (mel.size() < frames * bands) {
+      mel.resize(frames * bands);
+    }
+    for (std::size_t frame_idx = 0; frame_idx < frames; ++frame_idx) {
+      front_end->analyze(clip.samples.data() + frame_idx * static_cast<std::size_t>(hop_size_),
+                         mel.data() + frame_idx * bands);
+    }
+
+    Result &result = results[c];
+    result.onset_strength.assign(frames, 0.0f);
+    result.band_flux.assign(static_cast<std::size_t>(num_bands) * frames, 0.0f);
+    std::fill(prev_mel.begin(), prev_mel.end(), 0.0f);
+    accumulate_flux(mel.data(), 0, frames, frames, bands, groups, num_bands, prev_mel,
+                    result.onset_strength.data(), result.band_flux.data());
+    normalize(result.onset_strength);
+    normalize_bands(result.band_flux, num_bands, frames);
+    result.hop_size = hop_size_;
+    result.fft_size = fft_size_;
+    result.num_bands = num_bands;
+  }
+  return results;
+}
+
+OnsetDetector::Result OnsetDetector::compute_fixed(const AudioBuffer &mono_audio) const {
+  if (mono_audio.channels != 1) {
+    throw std::runtime_error("OnsetDetector expects mono audio.");
+  }
+  if (mono_audio.sample_rate <= 0) {
+    throw std::runtime_error("OnsetDetector invalid sample rate.");
+  }
+  if (mono_audio.samples.empty()) {
+    return Result{};
+  }
+
+  // Q15 window and Q15 sparse mel filters.  Only setup uses floating point.
+  constexpr int kWindowShift = 3;  // Q15 * Q15 = Q30 -> Q27 frame samples
+  std::vector<float> window_f = hann_window();
+  std::vector<std::int32_t> window(window_f.size());
+  for (std::size_t i = 0; i < window_f.size(); ++i) {
+    window[i] = fixed::to_q15(window_f[i]);
+  }
+
+  struct SparseFilter {
+    int first_bin = 0;
+    std::vector<std::int32_t> weights;
+  };
+  auto mel_filters_f = mel_filterbank(mono_audio.sample_rate);
+  std::vector<SparseFilter> mel_filters(mel_filters_f.size());
+  for (std::size_t band = 0; band < mel_filters_f.size(); ++band) {
+    const auto &f = mel_filters_f[band];
+    int first = 0;
+    int last = -1;
+    for (int bin = 0; bin <= fft_size_ / 2; ++bin) {
+      if (f[static_cast<std::size_t>(bin)] > 0.0f) {
+        if (last < 0) {
+          first = bin;
+        }
+        last = bin;
+      }
+    }
+    mel_filters[band].first_bin = first;
+    for (int bin = first; bin <= last; ++bin) {
+      mel_filters[band].weights.push_back(fixed::to_q15(f[static_cast<std::size_t>(bin)]));
+    }
+  }
+
+  std::vector<std::int16_t> pcm(mono_audio.samples.size());
+  for (std::size_t i = 0; i < pcm.size(); ++i) {
+    pcm[i] = fixed::to_q15(mono_audio.samples[i]);
+  }
+
+  std::size_t frames = 0;
+  if (pcm.size() >= static_cast<std::size_t>(fft_size_)) {
+    frames = 1 + (pcm.size() - static_cast<std::size_t>(fft_size_)) / static_cast<std::size_t>(hop_size_);
+  }
+
+  fixed::RealFFT fft(fft_size_);
+  int bins = fft_size_ / 2 + 1;
+  std::vector<std::int32_t> frame(static_cast<std::size_t>(fft_size_));
+  std::vector<std::int32_t> re(static_cast<std::size_t>(bins));
+  std::vector<std::int32_t> im(static_cast<std::size_t>(bins));
+  std::vector<std::uint64_t> power(static_cast<std::size_t>(bins));
+  std::vector<std::int32_t> mel_log(static_cast<std::size_t>(mel_bands_), 0);
+  std::vector<std::int32_t> prev_mel(static_cast<std::size_t>(mel_bands_), 0);
+  std::vector<float> onset_strength(frames, 0.0f);
+
+  std::vector<int> groups = band_groups();
+  int num_bands = groups.empty() ? 0 : static_cast<int>(band_split_hz_.size()) + 1;
+  std::vector<float> band_flux(static_cast<std::size_t>(num_bands) * frames, 0.0f);
+
+  // Full-scale input reaches ~2^50 power per bin, so drop 16 bits before
+  // the Q15 filter multiply to keep the band sums inside 64 bits.
+  constexpr int kPowerShift = 16;
 
   for (std::size_t frame_idx = 0; frame_idx < frames; ++frame_idx) {
     std::size_t offset = frame_idx * static_cast<std::size_t>(hop_size_);
     for (int i = 0; i < fft_size_; ++i) {
-      float sample = mono_audio.samples[offset + static_cast<std::size_t>(i)];
-      frame[static_cast<std::size_t>(i)] = static_cast<double>(sample * window[static_cast<std::size_t>(i)]);
-    }
-
-    if (rfft_forward(plan, frame.data(), 1.0) != 0) {
-      destroy_rfft_plan(plan);
-      throw std::runtime_error("FFT execution failed.");
+      std::int32_t x = pcm[offset + static_cast<std::size_t>(i)];
+      frame[static_cast<std::size_t>(i)] = (x * window[static_cast<std::size_t>(i)]) >> kWindowShift;
     }
+    fft.forward(frame.data(), re.data(), im.data());
 
-    power_spectrum[0] = frame[0] * frame[0];
-    power_spectrum[static_cast<std::size_t>(fft_size_ / 2)] = frame[1] * frame[1];
-    for (int bin = 1; bin < fft_size_ / 2; ++bin) {
-      double re = frame[static_cast<std::size_t>(2 * bin)];
-      double im = frame[static_cast<std::size_t>(2 * bin + 1)];
-      power_spectrum[static_cast<std::size_t>(bin)] = re * re + im * im;
+    for (int bin = 0; bin < bins; ++bin) {
+      std::int64_t r = re[static_cast<std::size_t>(bin)];
+      std::int64_t i = im[static_cast<std::size_t>(bin)];
+      power[static_cast<std::size_t>(bin)] = static_cast<std::uint64_t>(r * r + i * i) >> kPowerShift;
     }
 
-    std::vector<float> mel_energy(static_cast<std::size_t>(mel_bands_), 0.0f);
+    // Flux is accumulated in log2 Q16 units; the scale difference from the
+    // float path's log10 is removed by normalization.  Band sums carry a
+    // 2^31 scale relative to float power (Q27 input, 1/N FFT, Q15 weights,
+    // >> 16), which is subtracted so the zero-initialised first frame
+    // behaves as in compute().
+    constexpr std::int32_t kLogOffset = 31 << 16;
+    std::int64_t flux = 0;
     for (int band = 0; band < mel_bands_; ++band) {
-      double sum = 0.0;
       const auto &filter = mel_filters[static_cast<std::size_t>(band)];
-      for (int bin = 0; bin <= fft_size_ / 2; ++bin) {
-        sum += power_spectrum[static_cast<std::size_t>(bin)] * filter[static_cast<std::size_t>(bin)];
+      std::uint64_t sum = 1;  // log floor, like the float path's epsilon
+      for (std::size_t w = 0; w < filter.weights.size(); ++w) {
+        sum += power[static_cast<std::size_t>(filter.first_bin) + w] *
+               static_cast<std::uint64_t>(filter.weights[w]);
       }
-      mel_energy[static_cast<std::size_t>(band)] = static_cast<float>(std::log10(sum + 1e-10));
-    }
-
-    float flux = 0.0f;
-    for (int band = 0; band < mel_bands_; ++band) {
-      float diff = mel_energy[static_cast<std::size_t>(band)] - prev_mel[static_cast<std::size_t>(band)];
-      if (diff > 0.0f) {
+      std::int32_t value = fixed::log2_q16(sum) - kLogOffset;
+      std::int32_t diff = value - prev_mel[static_cast<std::size_t>(band)];
+      if (diff > 0) {
         flux += diff;
+        if (num_bands > 0) {
+          band_flux[static_cast<std::size_t>(groups[static_cast<std::size_t>(band)]) * frames +
+                    frame_idx] += static_cast<float>(diff) / 65536.0f;
+        }
       }
+      mel_log[static_cast<std::size_t>(band)] = value;
     }
-    onset_strength[frame_idx] = flux;
-    prev_mel = std::move(mel_energy);
-  }
-
-  if (!onset_strength.empty()) {
-    float mean = std::accumulate(onset_strength.begin(), onset_strength.end(), 0.0f) /
-                 static_cast<float>(onset_strength.size());
-    float variance = 0.0f;
-    for (float value : onset_strength) {
-      float diff = value - mean;
-      variance += diff * diff;
-    }
-    variance /= static_cast<float>(onset_strength.size());
-    float stddev = std::sqrt(variance);
-    if (stddev > 1e-6f) {
-      for (float &value : onset_strength) {
-        value = (value - mean) / stddev;
-      }
-    }
+    onset_strength[frame_idx] = static_cast<float>(flux) / 65536.0f;
+    std::swap(prev_mel, mel_log);
   }
 
-  destroy_rfft_plan(plan);
+  normalize(onset_strength);
+  normalize_bands(band_flux, num_bands, frames);
 
   Result result;
   result.onset_strength = std::move(onset_strength);
   result.hop_size = hop_size_;
   result.fft_size = fft_size_;
+  result.num_bands = num_bands;
+  result.band_flux = std::move(band_flux);
   return result;
 }
 
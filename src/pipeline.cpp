@@ -1,19 +1,39 @@
 #include "bpm/pipeline.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
 
+#include "bpm/audio_decoder.h"
+#include "bpm/beat_grid.h"
 #include "bpm/beat_tracker.h"
+#include "bpm/feature_cache.h"
+#include "bpm/flac_writer.h"
+#include "bpm/kernels.h"
 #include "bpm/key_detector.h"
+#include "bpm/loudness_meter.h"
 #include "bpm/meter_detector.h"
+#include "bpm/metrics.h"
 #include "bpm/metronome.h"
 #include "bpm/mp3_decoder.h"
-#include "bpm/mp4_decoder.h"
 #include "bpm/onset_detector.h"
+#include "bpm/profiler.h"
+#include "bpm/resume_state.h"
+#include "bpm/results_ring.h"
+#include "bpm/slow_job.h"
 #include "bpm/youtube_decoder.h"
 #include "bpm/tempo_estimator.h"
 #include "bpm/wav_writer.h"
@@ -47,145 +67,909 @@ std::string sanitize_filename(const std::string &name) {
   return result;
 }
 
-}  // namespace
-
-void Pipeline::run(const std::string &input_path,
-                   const std::string &output_path,
-                   const PipelineOptions &options) const {
-  AudioBuffer stereo;
-  if (input_path.find("://") != std::string::npos) {
-    stereo = YoutubeDecoder::decode(input_path);
+// Output sink is chosen by extension, mirroring input decoder selection.
+void write_audio(const std::string &path, const AudioBuffer &audio,
+                 const PipelineOptions &options) {
+  if (get_extension(path) == ".flac") {
+    FlacWriter::write(path, audio, options.flac_parallelism);
   } else {
-    std::string ext = get_extension(input_path);
-    if (ext == ".mp3") {
-      stereo = Mp3Decoder::decode(input_path);
-    } else if (ext == ".mp4" || ext == ".m4a") {
-      stereo = Mp4Decoder::decode(input_path);
+    WavWriter::write(path, audio);
+  }
+}
+
+// Records the wall time of one pipeline stage into
+// bpm_stage_seconds{stage="..."} when stop() is called, and tags profiler
+// samples with the stage until then.  Stages that throw
+// are not recorded; the job-level error counter covers them.
+Histogram &stage_histogram(const char *stage) {
+  return MetricsRegistry::global().histogram(
+      "bpm_stage_seconds", "Wall time spent in each pipeline stage.",
+      latency_buckets(), std::string("stage=\"") + stage + "\"");
+}
+
+class StageTimer {
+ public:
+  explicit StageTimer(const char *stage)
+      : histogram_(stage_histogram(stage)), start_(std::chrono::steady_clock::now()),
+        profile_(stage) {}
+
+  double stop() {
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_).count();
+    histogram_.observe(elapsed);
+    profile_.end();
+    return elapsed;
+  }
+
+ private:
+  Histogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+  ProfileStage profile_;
+};
+
+// A stage that runs as several AnalysisJob steps is timed step by step, so
+// that the waits between its steps are not counted, and recorded once when
+// it ends.
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void record_stage(const char *stage, double elapsed) {
+  stage_histogram(stage).observe(elapsed);
+}
+
+// Tracks in-flight jobs and job outcomes for the lifetime of one run().
+class JobMetrics {
+ public:
+  JobMetrics()
+      : in_flight_(MetricsRegistry::global().gauge(
+            "bpm_jobs_in_flight", "Analysis jobs currently running.")),
+        start_(std::chrono::steady_clock::now()),
+        uncaught_(std::uncaught_exceptions()) {
+    in_flight_.add(1.0);
+  }
+
+  ~JobMetrics() {
+    in_flight_.add(-1.0);
+    auto &registry = MetricsRegistry::global();
+    if (failed_ || std::uncaught_exceptions() > uncaught_) {
+      registry.counter("bpm_job_errors_total", "Analysis jobs that failed.").inc();
     } else {
-      throw std::runtime_error("Unsupported file format: " + ext +
-                               "\nSupported formats: .mp3, .mp4, .m4a, YouTube URL");
+      registry.counter("bpm_jobs_completed_total", "Analysis jobs that completed.").inc();
     }
   }
-  if (options.verbose) {
-    std::cout << "Decoded " << stereo.num_frames() << " frames @ " << stereo.sample_rate << " Hz.\n";
+
+  // For failures the destructor cannot see, such as an AnalysisJob whose
+  // exception was caught before the job was destroyed.
+  void fail() { failed_ = true; }
+
+  // Processing time divided by audio duration; < 1 is faster than real time.
+  void record_audio(double audio_sec) {
+    if (audio_sec <= 0.0) {
+      return;
+    }
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_).count();
+    auto &registry = MetricsRegistry::global();
+    registry.histogram("bpm_job_realtime_factor",
+                       "Job wall time divided by audio duration.",
+                       {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0})
+        .observe(elapsed / audio_sec);
+    registry.counter("bpm_audio_milliseconds_total",
+                     "Milliseconds of audio analyzed.")
+        .inc(static_cast<std::uint64_t>(audio_sec * 1000.0));
   }
 
-  AudioBuffer mono = stereo.to_mono();
+ private:
+  Gauge &in_flight_;
+  std::chrono::steady_clock::time_point start_;
+  int uncaught_;
+  bool failed_ = false;
+};
 
-  // Key detection fork — independent of BPM/beat/meter path.
-  KeyDetector::Result key_result;
-  if (options.detect_key) {
-    KeyDetector key_detector;
-    key_result = key_detector.detect(mono, options.verbose);
-    std::cout << "Key: " << key_result.label << "\n";
+// Downmixes block by block and feeds the same blocks to the loudness meter
+// while they are in cache, instead of a second pass over the stereo buffer.
+AudioBuffer downmix_and_meter(const AudioBuffer &audio, LoudnessMeter &meter) {
+  constexpr std::size_t kBlockFrames = 4096;
+  std::size_t frames = audio.num_frames();
+  std::size_t channels = static_cast<std::size_t>(audio.channels);
+  std::vector<float> mono(frames, 0.0f);
+  const kernels::KernelTable &k = kernels::active();
+  for (std::size_t begin = 0; begin < frames; begin += kBlockFrames) {
+    std::size_t n = std::min(kBlockFrames, frames - begin);
+    const float *block = audio.samples.data() + begin * channels;
+    k.downmix(block, mono.data() + begin, n, channels);
+    meter.process(block, n);
   }
+  return AudioBuffer(std::move(mono), audio.sample_rate, 1);
+}
 
-  OnsetDetector onset_detector;
-  auto onset = onset_detector.compute(mono);
-  if (options.verbose) {
-    std::cout << "Computed onset strength with " << onset.onset_strength.size() << " frames.\n";
+// Decodes a URL, a file, or (with `data`) an in-memory file, and counts
+// successes and failures per format.  Files are identified by their leading
+// bytes, not their extension.
+void count_decode(bool is_url, AudioFormat format, bool ok) {
+  std::string label = "format=\"" +
+                      (is_url ? std::string("youtube") : AudioDecoder::format_name(format)) + "\"";
+  auto &registry = MetricsRegistry::global();
+  if (ok) {
+    registry.counter("bpm_decoded_total", "Inputs decoded successfully.", label).inc();
+  } else {
+    registry.counter("bpm_decode_errors_total", "Inputs that failed to decode.", label).inc();
   }
+}
+
+bool is_url_input(const std::string &input_path, const std::uint8_t *data) {
+  return !data && input_path.find("://") != std::string::npos;
+}
 
-  TempoEstimator tempo_estimator;
-  auto tempo = tempo_estimator.estimate(onset.onset_strength,
-                                        mono.sample_rate,
-                                        onset.hop_size,
-                                        options.min_bpm,
-                                        options.max_bpm,
-                                        options.verbose);
-  // Evaluate multiple tempo candidates through the beat tracker and pick the
-  // one with the highest DP score.  This resolves cases where autocorrelation
-  // favours a sub-optimal period (e.g. syncopated tracks).
-  BeatTracker beat_tracker;
-  BeatTracker::Result beats;
-  int best_period = tempo.period_frames;
-  double best_beat_score = -std::numeric_limits<double>::infinity();
-  double primary_norm_score = -std::numeric_limits<double>::infinity();
-  constexpr double kPrimaryMargin = 1.05;
-
-  float primary_bpm = tempo.bpm;
-  for (int candidate : tempo.candidate_periods) {
-    float candidate_bpm = (candidate > 0)
-        ? 60.0f * static_cast<float>(mono.sample_rate) /
-              static_cast<float>(onset.hop_size) / static_cast<float>(candidate)
-        : 0.0f;
-
-    // Only compare candidates within ±30% of the primary estimate to avoid
-    // sub-harmonics (2/3, 3/2, half/double tempo) distorting the comparison.
-    float ratio = candidate_bpm / primary_bpm;
+AudioBuffer decode_input(const std::string &input_path, const std::uint8_t *data,
+                         std::size_t size, const PipelineOptions &options) {
+  // The onset and key frame sizes are fixed in samples and lose tempo and
+  // pitch resolution below 22.05 kHz, so MP3 is never reduced past it.
+  constexpr int kMinAnalysisRate = 22050;
+  Mp3Decoder::ReducedRate mp3_rate = options.mp3_rate;
+  mp3_rate.min_sample_rate = std::max(mp3_rate.min_sample_rate, kMinAnalysisRate);
+  AudioBuffer stereo;
+  bool is_url = is_url_input(input_path, data);
+  AudioFormat format = AudioFormat::UNKNOWN;
+  try {
+    if (is_url) {
+      stereo = YoutubeDecoder::decode(input_path);
+    } else if (data) {
+      format = AudioDecoder::sniff(data, size);
+      stereo = AudioDecoder::decode(data, size, mp3_rate);
+    } else {
+      stereo = AudioDecoder::decode_file(input_path, &format, mp3_rate);
+    }
+  } catch (const std::exception &) {
+    count_decode(is_url, format, false);
+    throw;
+  }
+  count_decode(is_url, format, true);
+  return stereo;
+}
+
+void overlay_clicks(AudioBuffer &audio, const std::vector<std::size_t> &beat_samples,
+                    const std::vector<std::size_t> &downbeat_samples,
+                    const PipelineOptions &options) {
+  Metronome metronome;
+  if (options.accent_downbeats && !downbeat_samples.empty()) {
+    metronome.overlay(audio, beat_samples, downbeat_samples,
+                      options.click_volume, options.click_freq, options.downbeat_freq);
+  } else {
+    metronome.overlay(audio, beat_samples, options.click_volume, options.click_freq);
+  }
+}
+
+// Downmix, with the loudness measurement folded in when requested.
+AudioBuffer downmix_input(const AudioBuffer &stereo, const PipelineOptions &options,
+                          LoudnessMeter::Result &loudness) {
+  if (!options.measure_loudness) {
+    return stereo.to_mono();
+  }
+  LoudnessMeter meter(stereo.sample_rate, stereo.channels);
+  AudioBuffer mono = downmix_and_meter(stereo, meter);
+  loudness = meter.result();
+  return mono;
+}
+
+float period_bpm(int period_frames, int sample_rate, int hop_size) {
+  return (period_frames > 0)
+      ? 60.0f * static_cast<float>(sample_rate) /
+            static_cast<float>(hop_size) / static_cast<float>(period_frames)
+      : 0.0f;
+}
+
+// Evaluates tempo candidates through the beat tracker and keeps the one with
+// the highest DP score.  This resolves cases where autocorrelation favours a
+// sub-optimal period (e.g. syncopated tracks).  Candidates are offered in
+// TempoEstimator order; the beat tracking itself is left to the caller so
+// that it can be batched across clips.
+class CandidateSelector {
+ public:
+  CandidateSelector(const TempoEstimator::Result &tempo, int sample_rate, int hop_size,
+                    bool verbose)
+      : tempo_(tempo), sample_rate_(sample_rate), hop_size_(hop_size), verbose_(verbose),
+        best_period_(tempo.period_frames) {}
+
+  // Only candidates within ±30% of the primary estimate are compared, to
+  // avoid sub-harmonics (2/3, 3/2, half/double tempo) distorting the
+  // comparison.
+  bool wants(int candidate) const {
+    float candidate_bpm = period_bpm(candidate, sample_rate_, hop_size_);
+    float ratio = candidate_bpm / tempo_.bpm;
     if (ratio < 0.7f || ratio > 1.3f) {
-      if (options.verbose) {
+      if (verbose_) {
         std::cout << "  Candidate period=" << candidate
                   << " (" << candidate_bpm << " BPM) — skipped (outside ±30%)\n";
       }
-      continue;
+      return false;
     }
+    return true;
+  }
 
-    auto candidate_beats = beat_tracker.track(onset.onset_strength,
-                                              candidate,
-                                              onset.hop_size);
+  void offer(int candidate, BeatTracker::Result &&candidate_beats) {
     // Normalize by beat count so faster tempos (more beats) don't
     // accumulate an unfairly higher total score.
     double norm_score = candidate_beats.beat_samples.empty()
         ? 0.0
         : candidate_beats.score / static_cast<double>(candidate_beats.beat_samples.size());
-    if (options.verbose) {
+    if (verbose_) {
       std::cout << "  Candidate period=" << candidate
-                << " (" << candidate_bpm << " BPM)"
+                << " (" << period_bpm(candidate, sample_rate_, hop_size_) << " BPM)"
                 << " score=" << candidate_beats.score
                 << " beats=" << candidate_beats.beat_samples.size()
                 << " norm=" << norm_score << "\n";
     }
-    if (candidate == tempo.period_frames) {
-      primary_norm_score = norm_score;
-    }
-    // Require non-primary candidates to exceed the primary's score by a
-    // margin — sub-harmonics can achieve slightly inflated per-beat scores
-    // due to wider DP search windows.
-    double threshold = best_beat_score;
-    if (candidate != tempo.period_frames &&
-        primary_norm_score > -std::numeric_limits<double>::infinity()) {
-      threshold = std::max(threshold, primary_norm_score * kPrimaryMargin);
+    double threshold = threshold_for(candidate);
+    if (candidate == tempo_.period_frames) {
+      primary_norm_score_ = norm_score;
     }
     if (norm_score > threshold) {
-      best_beat_score = norm_score;
-      beats = std::move(candidate_beats);
-      best_period = candidate;
+      best_beat_score_ = norm_score;
+      beats_ = std::move(candidate_beats);
+      best_period_ = candidate;
+    }
+  }
+
+  // The normalized score `candidate` has to beat to be selected.  Require
+  // non-primary candidates to exceed the primary's score by a margin —
+  // sub-harmonics can achieve slightly inflated per-beat scores due to
+  // wider DP search windows.
+  double threshold_for(int candidate) const {
+    double threshold = best_beat_score_;
+    if (candidate != tempo_.period_frames &&
+        primary_norm_score_ > -std::numeric_limits<double>::infinity()) {
+      threshold = std::max(threshold, primary_norm_score_ * kPrimaryMargin);
+    }
+    return threshold;
+  }
+
+  // The threshold a bounded track may give up below.  The primary always
+  // runs to the end, since its score sets the margin for later candidates.
+  double abandon_threshold(int candidate) const {
+    if (candidate == tempo_.period_frames) {
+      return -std::numeric_limits<double>::infinity();
+    }
+    return threshold_for(candidate);
+  }
+
+  void abandon(int candidate) const {
+    if (verbose_) {
+      std::cout << "  Candidate period=" << candidate
+                << " (" << period_bpm(candidate, sample_rate_, hop_size_) << " BPM)"
+                << " — abandoned (cannot beat norm=" << abandon_threshold(candidate) << ")\n";
+    }
+  }
+
+  int best_period() const { return best_period_; }
+  BeatTracker::Result &beats() { return beats_; }
+
+  // The refined (parabolic-interpolated) BPM when the primary candidate
+  // won, otherwise recomputed from the winning integer period.
+  float final_bpm() const {
+    if (best_period_ == tempo_.period_frames || best_period_ <= 0) {
+      return tempo_.bpm;
+    }
+    float frame_rate = static_cast<float>(sample_rate_) / static_cast<float>(hop_size_);
+    return 60.0f * frame_rate / static_cast<float>(best_period_);
+  }
+
+ private:
+  static constexpr double kPrimaryMargin = 1.05;
+
+  const TempoEstimator::Result &tempo_;
+  int sample_rate_;
+  int hop_size_;
+  bool verbose_;
+  BeatTracker::Result beats_;
+  int best_period_;
+  double best_beat_score_ = -std::numeric_limits<double>::infinity();
+  double primary_norm_score_ = -std::numeric_limits<double>::infinity();
+};
+
+// Copies the key, meter and loudness analysis into a job result.
+void fill_analysis(JobResult &result, const PipelineOptions &options,
+                   const KeyDetector::Result &key, MeterDetector::Result &meter,
+                   const LoudnessMeter::Result &loudness) {
+  if (options.detect_key) {
+    result.has_key = true;
+    result.key = key.label;
+    result.key_confidence = key.confidence;
+  }
+  if (options.detect_meter) {
+    result.has_meter = true;
+    result.time_signature = time_signature_string(meter.time_signature);
+    result.beats_per_measure = meter.beats_per_measure;
+    result.meter_confidence = meter.confidence;
+    result.downbeat_samples = std::move(meter.downbeat_samples);
+  }
+  if (options.measure_loudness) {
+    result.has_loudness = true;
+    result.integrated_lufs = loudness.integrated_lufs;
+    result.true_peak_dbtp = loudness.true_peak_dbtp;
+  }
+}
+
+void copy_label(char *dest, std::size_t capacity, const std::string &text) {
+  std::size_t n = std::min(text.size(), capacity - 1);
+  std::memcpy(dest, text.data(), n);
+  dest[n] = '\0';
+}
+
+// One writer per ring name for the whole process, shared by every job, so
+// the segment is mapped once rather than per result.  publish() is
+// thread-safe, and the writers live until exit.
+ResultsRingWriter &results_writer(const PipelineOptions &options) {
+  static std::mutex mutex;
+  static std::map<std::string, std::unique_ptr<ResultsRingWriter>> writers;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &writer = writers[options.results_shm];
+  if (!writer) {
+    writer = std::make_unique<ResultsRingWriter>(options.results_shm, options.results_shm_slots);
+  }
+  return *writer;
+}
+
+// Publishes the job's result to a shared-memory ring.  The record is large
+// (beat arrays are fixed-size), so it is built on the heap.
+void publish_result(const PipelineOptions &options,
+                    const std::string &input_path,
+                    int sample_rate,
+                    std::size_t num_frames,
+                    float bpm,
+                    const std::vector<std::size_t> &beat_samples,
+                    const KeyDetector::Result *key,
+                    const MeterDetector::Result *meter,
+                    const LoudnessMeter::Result *loudness) {
+  auto record = std::make_unique<ResultRecord>();
+  record->timestamp_ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+  copy_label(record->source, ResultRecord::kSourceBytes, input_path);
+  record->bpm = bpm;
+  record->sample_rate = static_cast<std::uint32_t>(sample_rate);
+  record->num_frames = num_frames;
+
+  std::size_t n_beats = std::min(beat_samples.size(), ResultRecord::kMaxBeats);
+  for (std::size_t i = 0; i < n_beats; ++i) {
+    record->beat_samples[i] = beat_samples[i];
+  }
+  record->num_beats = static_cast<std::uint32_t>(n_beats);
+  bool truncated = n_beats < beat_samples.size();
+
+  if (key) {
+    copy_label(record->key, ResultRecord::kLabelBytes, key->label);
+    record->key_confidence = key->confidence;
+  }
+  if (meter) {
+    copy_label(record->time_signature, ResultRecord::kLabelBytes,
+               time_signature_string(meter->time_signature));
+    record->meter_confidence = meter->confidence;
+    record->beats_per_measure = static_cast<std::uint32_t>(meter->beats_per_measure);
+    std::size_t n_down = std::min(meter->downbeat_samples.size(), ResultRecord::kMaxDownbeats);
+    for (std::size_t i = 0; i < n_down; ++i) {
+      record->downbeat_samples[i] = meter->downbeat_samples[i];
     }
+    record->num_downbeats = static_cast<std::uint32_t>(n_down);
+    truncated = truncated || n_down < meter->downbeat_samples.size();
+  }
+  record->truncated = truncated ? 1 : 0;
+  if (loudness) {
+    record->integrated_lufs = static_cast<float>(loudness->integrated_lufs);
+    record->true_peak_dbtp = static_cast<float>(loudness->true_peak_dbtp);
+    record->has_loudness = 1;
+  }
+
+  std::uint64_t sequence = results_writer(options).publish(*record);
+  if (options.verbose) {
+    std::cout << "Published result #" << sequence << " to " << options.results_shm << "\n";
+  }
+}
+
+// Provisional result from `onset`, the envelope of the frames that end
+// within the first `seconds` of the track, and `key`, the chroma analysed
+// by then (null when key detection is off).  Only tempo is estimated here;
+// the envelope and chroma come from the running sessions.
+ProgressUpdate provisional_update(const AudioBuffer &mono, double seconds,
+                                  const OnsetDetector::Result &onset,
+                                  const KeyDetector::Result *key,
+                                  const PipelineOptions &options) {
+  std::size_t frames = std::min(
+      mono.num_frames(), static_cast<std::size_t>(seconds * static_cast<double>(mono.sample_rate)));
+
+  ProgressUpdate update;
+  update.audio_sec = static_cast<double>(frames) / static_cast<double>(mono.sample_rate);
+  update.total_sec = mono.duration_sec();
+
+  TempoEstimator tempo_estimator(options.tempo_method);
+  auto tempo = tempo_estimator.estimate(onset.onset_strength, mono.sample_rate, onset.hop_size,
+                                        options.min_bpm, options.max_bpm);
+  update.bpm = tempo.bpm;
+  update.tempo_confidence = tempo.confidence;
+
+  if (key) {
+    update.has_key = true;
+    update.key = key->label;
+    update.key_confidence = key->confidence;
   }
+  return update;
+}
+
+// The settings a ResumeState's snapshots depend on.  The key detector's
+// parameters are fixed and the audio is checked separately.
+std::string state_settings(const PipelineOptions &options, const OnsetDetector &detector) {
+  std::string settings = "v" + std::to_string(FeatureCache::kAnalysisVersion) +
+                         (options.fixed_point ? "_fixed" : "_float") + "_fft" +
+                         std::to_string(detector.fft_size()) + "_hop" +
+                         std::to_string(detector.hop_size()) + "_mel" +
+                         std::to_string(detector.mel_bands());
+  for (float split : options.onset_band_split_hz) {
+    settings += "_split" + std::to_string(split);
+  }
+  return settings;
+}
+
+// The envelope meter detection reads beat accents from: the lowest onset
+// sub-band when the options split the envelope, else the full envelope.
+std::vector<float> meter_accents(const OnsetDetector::Result &onset) {
+  if (onset.num_bands == 0) {
+    return onset.onset_strength;
+  }
+  return std::vector<float>(onset.band(0), onset.band(0) + onset.onset_strength.size());
+}
+
+// Profiler tag for each stage, matching the bpm_stage_seconds labels.
+const char *stage_name(AnalysisJob::Stage stage) {
+  switch (stage) {
+    case AnalysisJob::Stage::OPEN:
+    case AnalysisJob::Stage::DECODE:
+      return "decode";
+    case AnalysisJob::Stage::DOWNMIX:
+      return "downmix";
+    case AnalysisJob::Stage::KEY:
+      return "key";
+    case AnalysisJob::Stage::ONSET:
+      return "onset";
+    case AnalysisJob::Stage::TEMPO:
+      return "tempo";
+    case AnalysisJob::Stage::BEAT:
+      return "beat";
+    case AnalysisJob::Stage::METER:
+      return "meter";
+    case AnalysisJob::Stage::RENDER:
+      return "render";
+    case AnalysisJob::Stage::WRITE:
+      return "write";
+    default:
+      return "other";
+  }
+}
+
+}  // namespace
+
+struct AnalysisJob::State {
+  // MPEG frames per decode step: about 1.7 s of audio at 22.05 kHz.
+  static constexpr std::size_t kDecodeBlockFrames = 32 * 1152;
+
+  State(const std::string &input_path, const std::uint8_t *data, std::size_t size,
+        const std::string &output_path, const PipelineOptions &options,
+        ProgressCallback progress)
+      : input_path(input_path), data(data), size(size), output_path(output_path),
+        options(options), progress(std::move(progress)),
+        metrics(std::make_unique<JobMetrics>()),
+        profile_job(SamplingProfiler::global().register_job(input_path)),
+        onset_detector(options.onset_band_split_hz) {
+    result.input_path = input_path;
+  }
+
+  ~State() {
+    // A job destroyed before its last step did not complete.
+    if (metrics) {
+      metrics->fail();
+    }
+  }
+
+  // Stage functions; each runs one step and moves `stage` on when its
+  // stage is finished.
+  void open();
+  void decode();
+  void downmix();
+  void detect_key();
+  void detect_onsets();
+  void advance_onsets();
+  bool onsets_behind_key() const;
+  void estimate_tempo();
+  void track_candidate();
+  void detect_meter();
+  void render();
+  void write();
+
+  // Provisional results: the key at each checkpoint the chroma has passed,
+  // then an update for each checkpoint both the chroma and the onset
+  // envelope have passed.
+  void note_key_checkpoints();
+  void report_checkpoints();
+  std::size_t checkpoint_samples(std::size_t index) const;
+
+  // ResumeState handling for options.state_path.
+  void load_state();
+  void save_state();
+
+  // Writes a SlowJobReport if the finished job went over a threshold.
+  void report_if_slow();
+
+  std::string input_path;
+  const std::uint8_t *data;  // null for paths and URLs
+  std::size_t size;
+  std::string output_path;
+  PipelineOptions options;
+  ProgressCallback progress;
+  std::unique_ptr<JobMetrics> metrics;
+  int profile_job;
+  std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+  Stage stage = Stage::OPEN;
+  JobResult result;
+
+  std::unique_ptr<Mp3Decoder::Stream> mp3_stream;
+  std::vector<float> decoded;
+  AudioBuffer stereo;
+  AudioBuffer mono;
+  LoudnessMeter::Result loudness;
+  std::unique_ptr<FeatureCache> feature_cache;
+  std::vector<double> checkpoints;
+  std::vector<KeyDetector::Result> checkpoint_keys;
+  std::size_t next_checkpoint = 0;
+  KeyDetector::Result key_result;
+  std::unique_ptr<KeyDetector::Session> key_session;
+  std::unique_ptr<ResumeState> resume;  // loaded state not yet restored
+  std::string fingerprint;
+  std::chrono::steady_clock::time_point last_state_save;
+  KeyDetector::Session::Snapshot key_snapshot;  // chroma sums of a finished key stage
+  OnsetDetector onset_detector;
+  std::unique_ptr<OnsetDetector::Session> onset_session;
+  OnsetDetector::Result onset;
+  TempoEstimator::Result tempo;
+  std::unique_ptr<BeatTracker> beat_tracker;
+  std::unique_ptr<CandidateSelector> selector;
+  std::size_t next_candidate = 0;
+  std::size_t tracked_candidates = 0;
+  std::size_t abandoned_candidates = 0;
+  float final_bpm = 0.0f;
+  MeterDetector::Result meter;
+  std::string actual_output;
+};
 
-  // Use the refined (parabolic-interpolated) BPM when the primary candidate
-  // won, otherwise recompute from the winning integer period.
-  float frame_rate = static_cast<float>(mono.sample_rate) /
-                     static_cast<float>(onset.hop_size);
-  float final_bpm = (best_period == tempo.period_frames)
-      ? tempo.bpm
-      : ((best_period > 0) ? 60.0f * frame_rate / static_cast<float>(best_period) : tempo.bpm);
-  if (best_period != tempo.period_frames && options.verbose) {
+// Files sniffed as MP3 are decoded incrementally; URLs, in-memory inputs,
+// reduced-rate MP3 and other formats are decoded whole by the first DECODE
+// step.
+void AnalysisJob::State::open() {
+  auto start = std::chrono::steady_clock::now();
+  bool reduced = options.mp3_rate.divisor != 1 || options.mp3_rate.mono;
+  if (!data && !reduced && !is_url_input(input_path, data)) {
+    try {
+      if (AudioDecoder::sniff_file(input_path) == AudioFormat::MP3) {
+        mp3_stream = std::make_unique<Mp3Decoder::Stream>(input_path);
+      }
+    } catch (const std::exception &) {
+      count_decode(false, AudioFormat::MP3, false);
+      throw;
+    }
+  }
+  result.timings.decode += seconds_since(start);
+  stage = Stage::DECODE;
+}
+
+void AnalysisJob::State::decode() {
+  auto start = std::chrono::steady_clock::now();
+  if (!mp3_stream) {
+    stereo = decode_input(input_path, data, size, options);
+  } else if (mp3_stream->read(decoded, kDecodeBlockFrames) > 0) {
+    result.timings.decode += seconds_since(start);
+    return;
+  } else if (decoded.empty()) {
+    count_decode(false, AudioFormat::MP3, false);
+    throw std::runtime_error("Decoded MP3 contained no samples: " + input_path);
+  } else {
+    stereo = AudioBuffer(std::move(decoded), mp3_stream->sample_rate(), mp3_stream->channels());
+    mp3_stream.reset();
+    count_decode(false, AudioFormat::MP3, true);
+  }
+  result.timings.decode += seconds_since(start);
+  record_stage("decode", result.timings.decode);
+  if (options.verbose) {
+    std::cout << "Decoded " << stereo.num_frames() << " frames @ " << stereo.sample_rate << " Hz.\n";
+  }
+  stage = Stage::DOWNMIX;
+}
+
+void AnalysisJob::State::downmix() {
+  StageTimer downmix_timer("downmix");
+  mono = downmix_input(stereo, options, loudness);
+  result.timings.downmix = downmix_timer.stop();
+  if (options.measure_loudness) {
+    std::cout << "Loudness: " << loudness.integrated_lufs << " LUFS, true peak: "
+              << loudness.true_peak_dbtp << " dBTP\n";
+  }
+
+  if (!options.cache_dir.empty()) {
+    feature_cache = std::make_unique<FeatureCache>(options.cache_dir);
+  }
+  if (!options.state_path.empty()) {
+    load_state();
+  }
+
+  // Provisional results are reported as the key and onset sessions pass
+  // each checkpoint; checkpoints at or beyond the end of the track are
+  // covered by the final update.
+  if (progress && !options.progress_checkpoints_sec.empty()) {
+    for (double seconds : options.progress_checkpoints_sec) {
+      if (seconds > 0.0 && seconds < mono.duration_sec()) {
+        checkpoints.push_back(seconds);
+      }
+    }
+    std::sort(checkpoints.begin(), checkpoints.end());
+  }
+  stage = Stage::KEY;
+}
+
+std::size_t AnalysisJob::State::checkpoint_samples(std::size_t index) const {
+  return std::min(mono.num_frames(), static_cast<std::size_t>(
+                                         checkpoints[index] * static_cast<double>(mono.sample_rate)));
+}
+
+// Chroma is summed a chunk at a time, so a checkpoint's key covers the
+// chunks up to the first boundary at or past it.
+void AnalysisJob::State::note_key_checkpoints() {
+  while (checkpoint_keys.size() < checkpoints.size() &&
+         (key_session->done() ||
+          key_session->samples_done() >= checkpoint_samples(checkpoint_keys.size()))) {
+    checkpoint_keys.push_back(key_session->preview());
+  }
+}
+
+// The envelope is cut at the checkpoint's last frame, so its tempo is what
+// a run over just that much audio would estimate.  The fixed-point
+// detector has no session and reports every checkpoint once it finishes.
+void AnalysisJob::State::report_checkpoints() {
+  ProfileStage profile_stage("progress");
+  std::size_t fft_size = static_cast<std::size_t>(onset_detector.fft_size());
+  std::size_t hop_size = static_cast<std::size_t>(onset_detector.hop_size());
+  while (next_checkpoint < checkpoints.size()) {
+    if (key_session && checkpoint_keys.size() <= next_checkpoint) {
+      return;
+    }
+    std::size_t samples = checkpoint_samples(next_checkpoint);
+    std::size_t frames = samples >= fft_size ? 1 + (samples - fft_size) / hop_size : 0;
+    if (options.fixed_point ? onset.onset_strength.empty()
+                            : !onset_session || (!onset_session->done() &&
+                                                 onset_session->frames_done() < frames)) {
+      return;
+    }
+    const KeyDetector::Result *key =
+        next_checkpoint < checkpoint_keys.size() ? &checkpoint_keys[next_checkpoint] : nullptr;
+    progress(provisional_update(mono, checkpoints[next_checkpoint],
+                                onset_session ? onset_session->preview(frames)
+                                              : onset.prefix(frames),
+                                key, options));
+    ++next_checkpoint;
+  }
+}
+
+// With checkpoints, a key step that got ahead of the onset envelope hands
+// its turn to the onset session, so the two pass each checkpoint together
+// instead of the onsets starting after the whole key stage.
+bool AnalysisJob::State::onsets_behind_key() const {
+  if (checkpoints.empty() || key_session->done()) {
+    return false;
+  }
+  if (options.fixed_point) {
+    return onset.onset_strength.empty();
+  }
+  if (!onset_session) {
+    return key_session->samples_done() > 0;
+  }
+  std::size_t frames = onset_session->frames_done();
+  std::size_t hop_size = static_cast<std::size_t>(onset_detector.hop_size());
+  std::size_t fft_size = static_cast<std::size_t>(onset_detector.fft_size());
+  std::size_t samples = frames ? (frames - 1) * hop_size + fft_size : 0;
+  return !onset_session->done() && samples < key_session->samples_done();
+}
+
+// Key detection fork — independent of BPM/beat/meter path.
+void AnalysisJob::State::detect_key() {
+  if (!options.detect_key) {
+    stage = Stage::ONSET;
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  if (!key_session) {
+    key_session = std::make_unique<KeyDetector::Session>(mono, feature_cache.get());
+    if (resume && resume->has_key) {
+      try {
+        key_session->restore(resume->key);
+      } catch (const std::exception &ex) {
+        std::cout << "Ignoring saved key state: " << ex.what() << "\n";
+      }
+    }
+  }
+  if (onsets_behind_key()) {
+    result.timings.key += seconds_since(start);
+    advance_onsets();
+    save_state();
+    return;
+  }
+  if (!key_session->done()) {
+    key_session->advance();
+    result.timings.key += seconds_since(start);
+    note_key_checkpoints();
+    report_checkpoints();
+    save_state();
+    return;
+  }
+  note_key_checkpoints();  // a restored session may already be done
+  if (!options.state_path.empty()) {
+    key_snapshot = key_session->snapshot();
+  }
+  key_result = key_session->finish(options.verbose);
+  key_session.reset();
+  result.timings.key += seconds_since(start);
+  record_stage("key", result.timings.key);
+  std::cout << "Key: " << key_result.label << "\n";
+  stage = Stage::ONSET;
+}
+
+// One onset step: the whole fixed-point envelope, or one session chunk.
+// Called by the key stage too while it interleaves the two.
+void AnalysisJob::State::advance_onsets() {
+  auto start = std::chrono::steady_clock::now();
+  if (options.fixed_point) {
+    onset = onset_detector.compute_fixed(mono);
+    result.timings.onset += seconds_since(start);
+    report_checkpoints();
+    return;
+  }
+  if (!onset_session) {
+    onset_session = std::make_unique<OnsetDetector::Session>(onset_detector, mono,
+                                                             feature_cache.get());
+    if (resume && resume->has_onset) {
+      try {
+        onset_session->restore(resume->onset);
+      } catch (const std::exception &ex) {
+        std::cout << "Ignoring saved onset state: " << ex.what() << "\n";
+      }
+    }
+    resume.reset();
+  }
+  if (!onset_session->done()) {
+    onset_session->advance();
+  }
+  result.timings.onset += seconds_since(start);
+  report_checkpoints();
+}
+
+void AnalysisJob::State::detect_onsets() {
+  if (options.fixed_point) {
+    if (onset.onset_strength.empty()) {
+      advance_onsets();
+    }
+  } else {
+    if (!onset_session || !onset_session->done()) {
+      advance_onsets();
+      save_state();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    onset = onset_session->finish();
+    onset_session.reset();
+    result.timings.onset += seconds_since(start);
+  }
+  record_stage("onset", result.timings.onset);
+
+  if (feature_cache) {
+    auto &registry = MetricsRegistry::global();
+    registry.counter("bpm_feature_cache_hits_total",
+                     "Spectral feature chunks loaded from the cache.").inc(feature_cache->hits());
+    registry.counter("bpm_feature_cache_misses_total",
+                     "Spectral feature chunks computed and stored.").inc(feature_cache->misses());
+    if (options.verbose) {
+      std::cout << "Feature cache: " << feature_cache->hits() << " hits, "
+                << feature_cache->misses() << " misses.\n";
+    }
+  }
+  if (options.verbose) {
+    std::cout << "Computed onset strength with " << onset.onset_strength.size() << " frames.\n";
+  }
+  stage = Stage::TEMPO;
+}
+
+void AnalysisJob::State::estimate_tempo() {
+  StageTimer tempo_timer("tempo");
+  TempoEstimator tempo_estimator(options.tempo_method);
+  tempo = tempo_estimator.estimate(onset.onset_strength,
+                                   mono.sample_rate,
+                                   onset.hop_size,
+                                   options.min_bpm,
+                                   options.max_bpm,
+                                   options.verbose);
+  result.timings.tempo = tempo_timer.stop();
+  stage = Stage::BEAT;
+}
+
+// One tempo candidate per step; the last step also reports the winner.
+void AnalysisJob::State::track_candidate() {
+  auto start = std::chrono::steady_clock::now();
+  if (!selector) {
+    beat_tracker = std::make_unique<BeatTracker>(options.beat_dp_search, options.beat_dp_tolerance);
+    selector = std::make_unique<CandidateSelector>(tempo, mono.sample_rate, onset.hop_size,
+                                                   options.verbose);
+  }
+  // Candidates outside the selector's range cost nothing, so they do not
+  // get a step of their own.
+  while (next_candidate < tempo.candidate_periods.size()) {
+    int candidate = tempo.candidate_periods[next_candidate++];
+    if (!selector->wants(candidate)) {
+      continue;
+    }
+    ++tracked_candidates;
+    if (!options.prune_candidates) {
+      selector->offer(candidate, beat_tracker->track(onset.onset_strength, candidate,
+                                                     onset.hop_size));
+    } else {
+      auto candidate_beats = beat_tracker->track_bounded(onset.onset_strength, candidate,
+                                                         onset.hop_size,
+                                                         selector->abandon_threshold(candidate));
+      if (candidate_beats.abandoned) {
+        MetricsRegistry::global().counter(
+            "bpm_tempo_candidates_abandoned_total",
+            "Tempo candidates whose beat tracking stopped early.").inc();
+        selector->abandon(candidate);
+        ++abandoned_candidates;
+      } else {
+        selector->offer(candidate, std::move(candidate_beats));
+      }
+    }
+    if (next_candidate < tempo.candidate_periods.size()) {
+      result.timings.beat += seconds_since(start);
+      return;
+    }
+  }
+  result.timings.beat += seconds_since(start);
+  record_stage("beat", result.timings.beat);
+
+  final_bpm = selector->final_bpm();
+  if (selector->best_period() != tempo.period_frames && options.verbose) {
     std::cout << "Beat-tracker re-estimated tempo: " << tempo.bpm
-              << " BPM -> " << final_bpm << " BPM (period " << best_period << ")\n";
+              << " BPM -> " << final_bpm << " BPM (period " << selector->best_period() << ")\n";
   }
 
   std::cout << "Detected BPM: " << final_bpm << "\n";
-  std::cout << "Beat count: " << beats.beat_samples.size() << "\n";
+  std::cout << "Beat count: " << selector->beats().beat_samples.size() << "\n";
+  stage = Stage::METER;
+}
 
-  // Meter detection.
-  MeterDetector::Result meter;
+void AnalysisJob::State::detect_meter() {
+  const BeatTracker::Result &beats = selector->beats();
   if (options.detect_meter) {
+    StageTimer meter_timer("meter");
     MeterDetector meter_detector;
     meter = meter_detector.detect(beats.beat_samples,
-                                  onset.onset_strength,
+                                  meter_accents(onset),
                                   onset.hop_size,
                                   mono.sample_rate,
                                   final_bpm,
                                   options.verbose);
+    result.timings.meter = meter_timer.stop();
     std::cout << "Time signature: " << time_signature_string(meter.time_signature)
               << "\n";
   }
+  stage = Stage::RENDER;
+}
 
+void AnalysisJob::State::render() {
   // Build output paths.
   int bpm_int = static_cast<int>(std::round(final_bpm));
-  std::string actual_output = output_path;
+  actual_output = output_path;
   std::string raw_output;
 
   if (actual_output.empty() && !stereo.title.empty()) {
@@ -194,28 +978,596 @@ void Pipeline::run(const std::string &input_path,
     if (options.detect_key && !key_result.short_label.empty()) {
       suffix += "_" + key_result.short_label;
     }
-    actual_output = base + "_" + suffix + ".wav";
-    raw_output = base + ".wav";
+    actual_output = base + "_" + suffix + "." + options.output_format;
+    raw_output = base + "." + options.output_format;
   } else if (actual_output.empty()) {
-    actual_output = "output_click.wav";
+    actual_output = "output_click." + options.output_format;
   }
 
   // Save the raw audio (without click track) for YouTube downloads.
   if (!raw_output.empty()) {
-    WavWriter::write(raw_output, stereo);
+    StageTimer raw_write_timer("write");
+    write_audio(raw_output, stereo, options);
+    result.timings.write += raw_write_timer.stop();
     std::cout << "Audio: " << raw_output << "\n";
   }
 
-  Metronome metronome;
-  if (options.accent_downbeats && !meter.downbeat_samples.empty()) {
-    metronome.overlay(stereo, beats.beat_samples, meter.downbeat_samples,
-                      options.click_volume, options.click_freq, options.downbeat_freq);
-  } else {
-    metronome.overlay(stereo, beats.beat_samples, options.click_volume, options.click_freq);
+  StageTimer render_timer("render");
+  overlay_clicks(stereo, selector->beats().beat_samples, meter.downbeat_samples, options);
+  result.timings.render = render_timer.stop();
+  stage = Stage::WRITE;
+}
+
+void AnalysisJob::State::write() {
+  StageTimer write_timer("write");
+  write_audio(actual_output, stereo, options);
+  result.timings.write += write_timer.stop();
+  std::cout << "Output: " << actual_output << "\n";
+
+  metrics->record_audio(stereo.duration_sec());
+
+  result.output_path = actual_output;
+  result.sample_rate = stereo.sample_rate;
+  result.num_frames = stereo.num_frames();
+  result.duration_sec = stereo.duration_sec();
+  result.bpm = final_bpm;
+  result.beat_samples = std::move(selector->beats().beat_samples);
+  fill_analysis(result, options, key_result, meter, loudness);
+
+  if (!options.beat_grid_path.empty()) {
+    BeatGrid::from_result(result).save(options.beat_grid_path);
+    std::cout << "Beat grid: " << options.beat_grid_path << "\n";
+  }
+
+  if (!options.slow_job_dir.empty()) {
+    report_if_slow();
+  }
+
+  // Only once the output and sidecar exist, so a consumer never sees a
+  // result whose click track was not written.
+  if (!options.results_shm.empty()) {
+    publish_result(options, input_path, result.sample_rate, result.num_frames, final_bpm,
+                   result.beat_samples,
+                   options.detect_key ? &key_result : nullptr,
+                   options.detect_meter ? &meter : nullptr,
+                   options.measure_loudness ? &loudness : nullptr);
+  }
+
+  if (progress && !options.progress_checkpoints_sec.empty()) {
+    ProgressUpdate update;
+    update.audio_sec = result.duration_sec;
+    update.total_sec = result.duration_sec;
+    update.is_final = true;
+    update.bpm = result.bpm;
+    update.tempo_confidence = tempo.confidence;
+    update.has_key = result.has_key;
+    update.key = result.key;
+    update.key_confidence = result.key_confidence;
+    progress(update);
+  }
+
+  if (!options.state_path.empty()) {
+    std::remove(options.state_path.c_str());
+  }
+
+  // Audio buffers are released now rather than when the result is taken.
+  stereo = AudioBuffer();
+  mono = AudioBuffer();
+  metrics.reset();
+  stage = Stage::DONE;
+}
+
+// A state file is only trusted for the exact audio and analysis settings it
+// was saved with; one that does not match, or whose snapshots do not fit
+// the sessions, is reported and the analysis starts from frame zero.
+void AnalysisJob::State::load_state() {
+  fingerprint = ResumeState::fingerprint_of(mono);
+  last_state_save = std::chrono::steady_clock::now();
+  // Left by a save that was interrupted before its rename.
+  std::remove((options.state_path + ".tmp").c_str());
+  std::ifstream probe(options.state_path, std::ios::binary);
+  if (!probe) {
+    return;
+  }
+  probe.close();
+  try {
+    auto loaded = std::make_unique<ResumeState>(ResumeState::load(options.state_path));
+    if (loaded->sample_rate != stereo.sample_rate ||
+        loaded->num_frames != stereo.num_frames() || loaded->fingerprint != fingerprint) {
+      std::cout << "Ignoring state file for different audio: " << options.state_path << "\n";
+      return;
+    }
+    if (loaded->settings != state_settings(options, onset_detector)) {
+      std::cout << "Ignoring state file saved with different analysis settings: "
+                << options.state_path << "\n";
+      return;
+    }
+    resume = std::move(loaded);
+  } catch (const std::exception &ex) {
+    std::cout << "Ignoring state file: " << ex.what() << "\n";
+    return;
+  }
+  MetricsRegistry::global()
+      .counter("bpm_state_resumes_total", "Analysis jobs continued from a state file.")
+      .inc();
+  std::cout << "Resuming from state file: " << options.state_path << " (key frame "
+            << (resume->has_key ? resume->key.next_frame : 0) << ", onset frame "
+            << (resume->has_onset ? resume->onset.next_frame : 0) << ")\n";
+}
+
+// Called after each key and onset step; writes at most once per interval.
+void AnalysisJob::State::save_state() {
+  if (options.state_path.empty() ||
+      seconds_since(last_state_save) < options.state_interval_sec) {
+    return;
+  }
+  ResumeState state;
+  state.sample_rate = stereo.sample_rate;
+  state.num_frames = stereo.num_frames();
+  state.fingerprint = fingerprint;
+  state.settings = state_settings(options, onset_detector);
+  if (key_session) {
+    state.has_key = true;
+    state.key = key_session->snapshot();
+  } else if (options.detect_key) {
+    state.has_key = true;
+    state.key = key_snapshot;
+  }
+  if (onset_session) {
+    state.has_onset = true;
+    state.onset = onset_session->snapshot();
+  }
+
+  auto &registry = MetricsRegistry::global();
+  try {
+    state.save(options.state_path);
+    registry.counter("bpm_state_saves_total", "Resume state files written.").inc();
+  } catch (const std::exception &ex) {
+    // A failed save only costs progress if the job is later interrupted.
+    registry.counter("bpm_state_save_errors_total", "Resume state files that failed to write.")
+        .inc();
+    if (options.verbose) {
+      std::cout << ex.what() << "\n";
+    }
+  }
+  last_state_save = std::chrono::steady_clock::now();
+}
+
+void AnalysisJob::State::report_if_slow() {
+  double total_sec = seconds_since(created);
+  std::vector<std::string> exceeded =
+      SlowJobReport::over_thresholds(options, result.timings, total_sec);
+  if (exceeded.empty()) {
+    return;
   }
 
-  WavWriter::write(actual_output, stereo);
+  SlowJobReport report;
+  report.exceeded = std::move(exceeded);
+  report.input_path = input_path;
+  std::vector<std::uint8_t> head;
+  if (data) {
+    report.input_bytes = size;
+    head.assign(data, data + std::min(size, AudioDecoder::kSniffBytes));
+  } else if (!is_url_input(input_path, data)) {
+    std::ifstream in(input_path, std::ios::binary | std::ios::ate);
+    if (in) {
+      report.input_bytes = static_cast<std::uint64_t>(in.tellg());
+      head.resize(static_cast<std::size_t>(
+          std::min<std::uint64_t>(report.input_bytes, AudioDecoder::kSniffBytes)));
+      in.seekg(0);
+      in.read(reinterpret_cast<char *>(head.data()), static_cast<std::streamsize>(head.size()));
+    }
+  }
+  report.format = is_url_input(input_path, data)
+      ? "youtube"
+      : AudioDecoder::format_name(AudioDecoder::sniff(head.data(), head.size()));
+  static const char kHex[] = "0123456789abcdef";
+  for (std::size_t i = 0; i < std::min<std::size_t>(head.size(), 32); ++i) {
+    report.header += kHex[head[i] >> 4];
+    report.header += kHex[head[i] & 0xF];
+  }
+  report.fingerprint = fingerprint.empty() ? ResumeState::fingerprint_of(mono) : fingerprint;
+  report.sample_rate = stereo.sample_rate;
+  report.channels = stereo.channels;
+  report.num_frames = stereo.num_frames();
+
+  report.options = options;
+  report.timings = result.timings;
+  report.total_sec = total_sec;
+
+  // The lag range TempoEstimator searches.
+  report.onset_frames = onset.onset_strength.size();
+  report.hop_size = onset.hop_size;
+  if (onset.hop_size > 0 && onset.onset_strength.size() >= 2) {
+    float frame_rate = static_cast<float>(mono.sample_rate) / static_cast<float>(onset.hop_size);
+    float min_bpm = std::max(options.min_bpm, 1.0f);
+    float max_bpm = std::max(options.max_bpm, min_bpm + 1.0f);
+    report.min_lag = std::max(static_cast<int>(std::ceil(60.0f * frame_rate / max_bpm)), 1);
+    report.max_lag = std::min(static_cast<int>(std::floor(60.0f * frame_rate / min_bpm)),
+                              static_cast<int>(onset.onset_strength.size() - 1));
+  }
+  report.tempo_candidates = tempo.candidate_periods.size();
+  report.tracked_candidates = tracked_candidates;
+  report.abandoned_candidates = abandoned_candidates;
+  report.beat_count = result.beat_samples.size();
+  report.bpm = final_bpm;
+  if (options.slow_job_envelope) {
+    report.onset_envelope = onset.onset_strength;
+  }
+
+  auto &registry = MetricsRegistry::global();
+  registry.counter("bpm_slow_jobs_total", "Jobs over a slow-job threshold.").inc();
+  try {
+    std::cout << "Slow job report: " << report.write(options.slow_job_dir) << "\n";
+  } catch (const std::exception &ex) {
+    // The job itself succeeded; losing its diagnostics must not fail it.
+    registry.counter("bpm_slow_job_report_errors_total",
+                     "Slow job reports that failed to write.").inc();
+    if (options.verbose) {
+      std::cout << ex.what() << "\n";
+    }
+  }
+}
+
+AnalysisJob::AnalysisJob(const std::string &input_path,
+                         const std::string &output_path,
+                         const PipelineOptions &options,
+                         ProgressCallback progress)
+    : state_(std::make_unique<State>(input_path, nullptr, 0, output_path, options,
+                                     std::move(progress))) {}
+
+AnalysisJob::AnalysisJob(const std::uint8_t *data,
+                         std::size_t size,
+                         const std::string &source_name,
+                         const std::string &output_path,
+                         const PipelineOptions &options,
+                         ProgressCallback progress) {
+  if (!data) {
+    throw std::runtime_error("No input data for " + source_name);
+  }
+  state_ = std::make_unique<State>(source_name, data, size, output_path, options,
+                                   std::move(progress));
+}
+
+AnalysisJob::~AnalysisJob() = default;
+
+AnalysisJob::Stage AnalysisJob::stage() const {
+  return state_->stage;
+}
+
+const std::string &AnalysisJob::input_path() const {
+  return state_->input_path;
+}
+
+void AnalysisJob::step() {
+  State &s = *state_;
+  ProfileJob profile_job(s.profile_job);
+  ProfileStage profile_stage(stage_name(s.stage));
+  try {
+    switch (s.stage) {
+      case Stage::OPEN:
+        s.open();
+        break;
+      case Stage::DECODE:
+        s.decode();
+        break;
+      case Stage::DOWNMIX:
+        s.downmix();
+        break;
+      case Stage::KEY:
+        s.detect_key();
+        break;
+      case Stage::ONSET:
+        s.detect_onsets();
+        break;
+      case Stage::TEMPO:
+        s.estimate_tempo();
+        break;
+      case Stage::BEAT:
+        s.track_candidate();
+        break;
+      case Stage::METER:
+        s.detect_meter();
+        break;
+      case Stage::RENDER:
+        s.render();
+        break;
+      case Stage::WRITE:
+        s.write();
+        break;
+      case Stage::DONE:
+        throw std::runtime_error("Analysis job already finished: " + s.input_path);
+    }
+  } catch (...) {
+    if (s.metrics) {
+      s.metrics->fail();
+      s.metrics.reset();
+    }
+    s.stage = Stage::DONE;
+    throw;
+  }
+}
+
+JobResult AnalysisJob::take_result() {
+  if (state_->stage != Stage::DONE) {
+    throw std::runtime_error("Analysis job not finished: " + state_->input_path);
+  }
+  return std::move(state_->result);
+}
+
+void AnalysisJob::submit(std::unique_ptr<AnalysisJob> job, Executor &executor,
+                         CompletionCallback complete) {
+  // Each task runs one step and posts the next, so the job is only ever
+  // referenced from the one task that is queued or running.
+  struct Run {
+    std::shared_ptr<AnalysisJob> job;
+    Executor *executor;
+    CompletionCallback complete;
+
+    void operator()() const {
+      std::string error;
+      try {
+        job->step();
+      } catch (const std::exception &ex) {
+        error = ex.what();
+      } catch (...) {
+        error = "Unknown error analyzing " + job->input_path();
+      }
+      if (!error.empty()) {
+        JobResult failed;
+        failed.input_path = job->input_path();
+        failed.error = std::move(error);
+        complete(std::move(failed));
+        return;
+      }
+      if (job->done()) {
+        complete(job->take_result());
+      } else {
+        executor->post(*this);
+      }
+    }
+  };
+  executor.post(Run{std::shared_ptr<AnalysisJob>(std::move(job)), &executor, std::move(complete)});
+}
+
+JobResult Pipeline::run(const std::string &input_path,
+                        const std::string &output_path,
+                        const PipelineOptions &options,
+                        const ProgressCallback &progress) const {
+  AnalysisJob job(input_path, output_path, options, progress);
+  while (!job.done()) {
+    job.step();
+  }
+  return job.take_result();
+}
+
+JobResult Pipeline::run(const std::uint8_t *data,
+                        std::size_t size,
+                        const std::string &source_name,
+                        const std::string &output_path,
+                        const PipelineOptions &options,
+                        const ProgressCallback &progress) const {
+  AnalysisJob job(data, size, source_name, output_path, options, progress);
+  while (!job.done()) {
+    job.step();
+  }
+  return job.take_result();
+}
+
+JobResult Pipeline::render(const std::string &input_path,
+                           const std::string &grid_path,
+                           const std::string &output_path,
+                           const PipelineOptions &options) const {
+  JobMetrics job_metrics;
+  ProfileJob profile_job(SamplingProfiler::global().register_job(input_path));
+  BeatGrid grid = BeatGrid::load(grid_path);
+  JobResult result;
+  result.input_path = input_path;
+
+  StageTimer decode_timer("decode");
+  AudioBuffer stereo = decode_input(input_path, nullptr, 0, options);
+  result.timings.decode = decode_timer.stop();
+  if (options.verbose) {
+    std::cout << "Decoded " << stereo.num_frames() << " frames @ " << stereo.sample_rate << " Hz.\n";
+  }
+  // Beat positions are sample offsets, so they only fit the same decode.
+  if (grid.sample_rate != stereo.sample_rate || grid.num_frames != stereo.num_frames()) {
+    throw std::runtime_error("Beat grid " + grid_path + " was saved for " +
+                             std::to_string(grid.num_frames) + " frames @ " +
+                             std::to_string(grid.sample_rate) + " Hz, but " + input_path +
+                             " decodes to " + std::to_string(stereo.num_frames()) + " frames @ " +
+                             std::to_string(stereo.sample_rate) + " Hz.");
+  }
+
+  std::cout << "Detected BPM: " << grid.bpm << " (from " << grid_path << ")\n";
+  std::cout << "Beat count: " << grid.beat_samples.size() << "\n";
+
+  std::string actual_output = output_path;
+  if (actual_output.empty() && !stereo.title.empty()) {
+    actual_output = sanitize_filename(stereo.title) + "_" +
+                    std::to_string(static_cast<int>(std::round(grid.bpm))) + "bpm." +
+                    options.output_format;
+  } else if (actual_output.empty()) {
+    actual_output = "output_click." + options.output_format;
+  }
+
+  StageTimer render_timer("render");
+  overlay_clicks(stereo, grid.beat_samples, grid.downbeat_samples, options);
+  result.timings.render = render_timer.stop();
+
+  StageTimer write_timer("write");
+  write_audio(actual_output, stereo, options);
+  result.timings.write = write_timer.stop();
   std::cout << "Output: " << actual_output << "\n";
+
+  job_metrics.record_audio(stereo.duration_sec());
+
+  result.output_path = actual_output;
+  result.sample_rate = stereo.sample_rate;
+  result.num_frames = stereo.num_frames();
+  result.duration_sec = stereo.duration_sec();
+  result.bpm = grid.bpm;
+  result.beat_samples = std::move(grid.beat_samples);
+  result.has_key = grid.has_key;
+  result.key = grid.key;
+  result.key_confidence = grid.key_confidence;
+  result.has_meter = grid.has_meter;
+  result.time_signature = grid.time_signature;
+  result.beats_per_measure = grid.beats_per_measure;
+  result.meter_confidence = grid.meter_confidence;
+  result.downbeat_samples = std::move(grid.downbeat_samples);
+  return result;
+}
+
+std::vector<JobResult> Pipeline::run_clips(const std::vector<std::string> &input_paths,
+                                           const PipelineOptions &options) const {
+  auto &registry = MetricsRegistry::global();
+  std::vector<JobResult> results(input_paths.size());
+
+  // Decode and downmix every clip up front; `clips` indexes the ones that
+  // made it into the batch.
+  std::vector<std::size_t> clips;
+  std::vector<AudioBuffer> mono;
+  std::vector<LoudnessMeter::Result> loudness;
+  for (std::size_t i = 0; i < input_paths.size(); ++i) {
+    JobResult &result = results[i];
+    result.input_path = input_paths[i];
+    try {
+      StageTimer decode_timer("decode");
+      AudioBuffer stereo = decode_input(input_paths[i], nullptr, 0, options);
+      result.timings.decode = decode_timer.stop();
+
+      StageTimer downmix_timer("downmix");
+      LoudnessMeter::Result clip_loudness;
+      AudioBuffer clip = downmix_input(stereo, options, clip_loudness);
+      result.timings.downmix = downmix_timer.stop();
+
+      result.sample_rate = stereo.sample_rate;
+      result.num_frames = stereo.num_frames();
+      result.duration_sec = stereo.duration_sec();
+      clips.push_back(i);
+      mono.push_back(std::move(clip));
+      loudness.push_back(clip_loudness);
+    } catch (const std::exception &ex) {
+      result.error = ex.what();
+      registry.counter("bpm_job_errors_total", "Analysis jobs that failed.").inc();
+    }
+  }
+  if (clips.empty()) {
+    return results;
+  }
+
+  StageTimer onset_timer("onset");
+  OnsetDetector onset_detector(options.onset_band_split_hz);
+  std::vector<OnsetDetector::Result> onsets;
+  if (options.fixed_point) {
+    for (const AudioBuffer &clip : mono) {
+      onsets.push_back(onset_detector.compute_fixed(clip));
+    }
+  } else {
+    onsets = onset_detector.compute_batch(mono);
+  }
+  double onset_sec = onset_timer.stop();
+
+  // Envelopes back to back, for the batched beat tracker.
+  std::vector<float> envelope;
+  std::vector<std::size_t> offsets(1, 0);
+  for (const auto &onset : onsets) {
+    envelope.insert(envelope.end(), onset.onset_strength.begin(), onset.onset_strength.end());
+    offsets.push_back(envelope.size());
+  }
+  if (options.verbose) {
+    std::cout << "Batched " << clips.size() << " clips, " << envelope.size()
+              << " onset frames.\n";
+  }
+
+  TempoEstimator tempo_estimator(options.tempo_method);
+  std::vector<TempoEstimator::Result> tempos;
+  tempos.reserve(clips.size());
+  for (std::size_t c = 0; c < clips.size(); ++c) {
+    StageTimer tempo_timer("tempo");
+    tempos.push_back(tempo_estimator.estimate(onsets[c].onset_strength, mono[c].sample_rate,
+                                              onsets[c].hop_size, options.min_bpm,
+                                              options.max_bpm, options.verbose));
+    results[clips[c]].timings.tempo = tempo_timer.stop();
+  }
+
+  // Candidate r of every clip is tracked in one call, then offered to that
+  // clip's selector, so each clip still sees its candidates in order.
+  StageTimer beat_timer("beat");
+  BeatTracker beat_tracker(options.beat_dp_search, options.beat_dp_tolerance);
+  std::vector<CandidateSelector> selectors;
+  selectors.reserve(clips.size());
+  std::size_t rounds = 0;
+  for (std::size_t c = 0; c < clips.size(); ++c) {
+    selectors.emplace_back(tempos[c], mono[c].sample_rate, onsets[c].hop_size, options.verbose);
+    rounds = std::max(rounds, tempos[c].candidate_periods.size());
+  }
+  std::vector<int> periods(clips.size());
+  for (std::size_t r = 0; r < rounds; ++r) {
+    for (std::size_t c = 0; c < clips.size(); ++c) {
+      const std::vector<int> &candidates = tempos[c].candidate_periods;
+      periods[c] = (r < candidates.size() && selectors[c].wants(candidates[r])) ? candidates[r] : 0;
+    }
+    auto tracked = beat_tracker.track_batch(envelope, offsets, periods, onset_detector.hop_size());
+    for (std::size_t c = 0; c < clips.size(); ++c) {
+      if (periods[c] != 0) {
+        selectors[c].offer(periods[c], std::move(tracked[c]));
+      }
+    }
+  }
+  double beat_sec = beat_timer.stop();
+
+  for (std::size_t c = 0; c < clips.size(); ++c) {
+    JobResult &result = results[clips[c]];
+    const AudioBuffer &clip = mono[c];
+    double share = envelope.empty()
+        ? 1.0 / static_cast<double>(clips.size())
+        : static_cast<double>(offsets[c + 1] - offsets[c]) / static_cast<double>(envelope.size());
+    result.timings.onset = onset_sec * share;
+    result.timings.beat = beat_sec * share;
+    result.bpm = selectors[c].final_bpm();
+    BeatTracker::Result &beats = selectors[c].beats();
+
+    try {
+      KeyDetector::Result key_result;
+      if (options.detect_key) {
+        StageTimer key_timer("key");
+        KeyDetector key_detector;
+        key_result = key_detector.detect(clip, options.verbose);
+        result.timings.key = key_timer.stop();
+      }
+
+      MeterDetector::Result meter;
+      if (options.detect_meter) {
+        StageTimer meter_timer("meter");
+        MeterDetector meter_detector;
+        meter = meter_detector.detect(beats.beat_samples, meter_accents(onsets[c]),
+                                      onsets[c].hop_size, clip.sample_rate, result.bpm,
+                                      options.verbose);
+        result.timings.meter = meter_timer.stop();
+      }
+
+      if (!options.results_shm.empty()) {
+        publish_result(options, result.input_path, result.sample_rate, result.num_frames,
+                       result.bpm, beats.beat_samples,
+                       options.detect_key ? &key_result : nullptr,
+                       options.detect_meter ? &meter : nullptr,
+                       options.measure_loudness ? &loudness[c] : nullptr);
+      }
+
+      result.beat_samples = std::move(beats.beat_samples);
+      fill_analysis(result, options, key_result, meter, loudness[c]);
+    } catch (const std::exception &ex) {
+      result.error = ex.what();
+      registry.counter("bpm_job_errors_total", "Analysis jobs that failed.").inc();
+      continue;
+    }
+    registry.counter("bpm_jobs_completed_total", "Analysis jobs that completed.").inc();
+    registry.counter("bpm_audio_milliseconds_total", "Milliseconds of audio analyzed.")
+        .inc(static_cast<std::uint64_t>(result.duration_sec * 1000.0));
+  }
+  return results;
 }
 
 }  // namespace bpm
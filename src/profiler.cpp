@@ -0,0 +1,299 @@
+#include "bpm/profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <sched.h>
+#include <sys/time.h>
+
+namespace bpm {
+
+struct SamplingProfiler::Sample {
+  std::atomic<bool> ready{false};
+  const char *stage = nullptr;
+  int job = -1;
+  int depth = 0;
+  void *frames[kMaxDepth];
+};
+
+namespace {
+
+// Read by the signal handler, so thread-locals must not be allocated
+// lazily; initial-exec TLS is a fixed offset from the thread pointer.
+#if defined(__GNUC__)
+#define BPM_SIGNAL_SAFE_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define BPM_SIGNAL_SAFE_TLS
+#endif
+
+thread_local const char *t_stage BPM_SIGNAL_SAFE_TLS = nullptr;
+thread_local int t_job BPM_SIGNAL_SAFE_TLS = -1;
+
+// State shared with the handler.  A slot is claimed with one atomic add and
+// published with its `ready` flag, so concurrent samples from several
+// threads never share a slot.
+std::atomic<SamplingProfiler::Sample *> g_samples{nullptr};
+std::atomic<std::size_t> g_capacity{0};
+std::atomic<std::size_t> g_next{0};
+std::atomic<std::uint64_t> g_dropped{0};
+// Handlers between loading g_samples and their last write through it.
+// Counted before the load, so once g_samples is cleared and this reaches
+// zero no handler can still hold the old buffer.  Both sides use
+// sequentially consistent operations for that argument to hold.
+std::atomic<int> g_in_flight{0};
+struct sigaction g_previous_action;
+
+// The handler itself and the kernel's signal trampoline.
+constexpr int kSkipFrames = 2;
+
+void on_sigprof(int) {
+  int saved_errno = errno;
+  g_in_flight.fetch_add(1);
+  SamplingProfiler::Sample *samples = g_samples.load();
+  if (samples) {
+    std::size_t slot = g_next.fetch_add(1, std::memory_order_relaxed);
+    if (slot < g_capacity.load(std::memory_order_relaxed)) {
+      SamplingProfiler::Sample &sample = samples[slot];
+      sample.stage = t_stage;
+      sample.job = t_job;
+      sample.depth = backtrace(sample.frames, SamplingProfiler::kMaxDepth);
+      sample.ready.store(true, std::memory_order_release);
+    } else {
+      g_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  g_in_flight.fetch_sub(1);
+  errno = saved_errno;
+}
+
+// Detaches the buffer from the handler and waits out handlers on other
+// threads that loaded it before it was cleared.
+void detach_samples() {
+  g_samples.store(nullptr);
+  while (g_in_flight.load() != 0) {
+    sched_yield();
+  }
+}
+
+// "bpm::OnsetDetector::compute(bpm::AudioBuffer const&, ...) const" ->
+// "bpm::OnsetDetector::compute"; parentheses inside template arguments
+// are kept.
+std::string strip_arguments(const std::string &name) {
+  int depth = 0;
+  for (std::size_t i = 0; i < name.size(); ++i) {
+    if (name[i] == '<') {
+      ++depth;
+    } else if (name[i] == '>') {
+      --depth;
+    } else if (name[i] == '(' && depth == 0 && i > 0) {
+      return name.substr(0, i);
+    }
+  }
+  return name;
+}
+
+std::string symbolize(void *address) {
+  Dl_info info;
+  if (dladdr(address, &info) == 0) {
+    return "[unknown]";
+  }
+  if (info.dli_sname) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = (status == 0 && demangled) ? demangled : info.dli_sname;
+    std::free(demangled);
+    return strip_arguments(name);
+  }
+  std::string module = info.dli_fname ? info.dli_fname : "[unknown]";
+  std::size_t slash = module.rfind('/');
+  if (slash != std::string::npos) {
+    module = module.substr(slash + 1);
+  }
+  char offset[32];
+  std::snprintf(offset, sizeof(offset), "+0x%zx",
+                static_cast<std::size_t>(static_cast<char *>(address) -
+                                         static_cast<char *>(info.dli_fbase)));
+  return module + offset;
+}
+
+}  // namespace
+
+SamplingProfiler &SamplingProfiler::global() {
+  static SamplingProfiler profiler;
+  return profiler;
+}
+
+// Static destruction at exit must not free the buffer under a handler.
+SamplingProfiler::~SamplingProfiler() {
+  stop();
+}
+
+void SamplingProfiler::start(int hz, std::size_t max_samples) {
+  if (hz <= 0 || hz > 10000) {
+    throw std::runtime_error("Profiler rate must be between 1 and 10000 Hz.");
+  }
+  if (running()) {
+    throw std::runtime_error("Profiler already running.");
+  }
+
+  // The previous buffer is freed only after detach_samples() has waited for
+  // every handler that could still be writing into it.
+  detach_samples();
+  samples_ = std::make_unique<Sample[]>(max_samples);
+  capacity_ = max_samples;
+  g_capacity.store(max_samples, std::memory_order_relaxed);
+  g_next.store(0, std::memory_order_relaxed);
+  g_dropped.store(0, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex_);
+    jobs_.clear();
+  }
+
+  // backtrace() loads the unwinder on first use, which allocates; do that
+  // here rather than in the handler.
+  void *warm_up[4];
+  backtrace(warm_up, 4);
+
+  g_samples.store(samples_.get(), std::memory_order_release);
+
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = on_sigprof;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &g_previous_action) != 0) {
+    detach_samples();
+    throw std::runtime_error("Failed to install SIGPROF handler.");
+  }
+
+  // setitimer() rejects tv_usec of a full second, which 1 Hz would give.
+  long period_usec = 1000000L / hz;
+  itimerval timer;
+  timer.it_interval.tv_sec = period_usec / 1000000;
+  timer.it_interval.tv_usec = period_usec % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    sigaction(SIGPROF, &g_previous_action, nullptr);
+    detach_samples();
+    throw std::runtime_error("Failed to start profiling timer.");
+  }
+  running_.store(true, std::memory_order_relaxed);
+}
+
+void SamplingProfiler::stop() {
+  if (!running()) {
+    return;
+  }
+  itimerval timer;
+  std::memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  // A signal still pending finds no buffer and returns; one already past
+  // the load finishes before stop() does.
+  detach_samples();
+  sigaction(SIGPROF, &g_previous_action, nullptr);
+  running_.store(false, std::memory_order_relaxed);
+}
+
+int SamplingProfiler::register_job(const std::string &label) {
+  if (!running()) {
+    return -1;
+  }
+  // ';' separates frames and a newline ends a stack.
+  std::string frame = label;
+  std::replace(frame.begin(), frame.end(), ';', '_');
+  std::replace(frame.begin(), frame.end(), '\n', '_');
+  std::lock_guard<std::mutex> lock(jobs_mutex_);
+  jobs_.push_back(std::move(frame));
+  return static_cast<int>(jobs_.size() - 1);
+}
+
+std::size_t SamplingProfiler::samples() const {
+  return std::min(g_next.load(std::memory_order_relaxed), capacity_);
+}
+
+std::uint64_t SamplingProfiler::dropped() const {
+  return g_dropped.load(std::memory_order_relaxed);
+}
+
+void SamplingProfiler::write_folded(const std::string &path, bool per_job) const {
+  std::map<void *, std::string> symbols;
+  std::map<std::string, std::uint64_t> stacks;
+  std::vector<std::string> jobs;
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex_);
+    jobs = jobs_;
+  }
+
+  std::size_t count = samples();
+  for (std::size_t i = 0; i < count; ++i) {
+    const Sample &sample = samples_[i];
+    if (!sample.ready.load(std::memory_order_acquire)) {
+      continue;
+    }
+    std::string line;
+    if (per_job) {
+      line = (sample.job >= 0 && static_cast<std::size_t>(sample.job) < jobs.size())
+          ? jobs[static_cast<std::size_t>(sample.job)]
+          : "other";
+      line += ';';
+    }
+    line += sample.stage ? sample.stage : "other";
+    // Frames are innermost first.  Past the interrupted frame they are
+    // return addresses, so look up the call instruction just before them.
+    for (int f = sample.depth - 1; f >= kSkipFrames; --f) {
+      void *address = sample.frames[f];
+      if (f > kSkipFrames) {
+        address = static_cast<char *>(address) - 1;
+      }
+      auto it = symbols.find(address);
+      if (it == symbols.end()) {
+        it = symbols.emplace(address, symbolize(address)).first;
+      }
+      line += ';';
+      line += it->second;
+    }
+    ++stacks[line];
+  }
+
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Failed to open profile for writing: " + path);
+  }
+  for (const auto &entry : stacks) {
+    out << entry.first << ' ' << entry.second << '\n';
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed to write profile: " + path);
+  }
+}
+
+ProfileStage::ProfileStage(const char *stage) : previous_(t_stage) {
+  t_stage = stage;
+}
+
+void ProfileStage::end() {
+  if (!ended_) {
+    t_stage = previous_;
+    ended_ = true;
+  }
+}
+
+ProfileJob::ProfileJob(int job) : previous_(t_job) {
+  t_job = job;
+}
+
+ProfileJob::~ProfileJob() {
+  t_job = previous_;
+}
+
+}  // namespace bpm
@@ -0,0 +1,108 @@
+#include "bpm/pruned_fft.h"
+
+#include <cmath>
+#include <stdexcept>
+
+extern "C" {
+#include "pocketfft.h"
+}
+
+namespace bpm {
+
+PrunedRealFFT::PrunedRealFFT(int size, int bins) : size_(size), bins_(bins) {
+  if (size < 2 || (size & (size - 1)) != 0) {
+    throw std::runtime_error("PrunedRealFFT size must be a power of two.");
+  }
+  if (bins < 1 || bins > size / 2 + 1) {
+    throw std::runtime_error("PrunedRealFFT bin count out of range.");
+  }
+  while (size / (2 * decimation_) >= 2 && size / (4 * decimation_) + 1 >= bins) {
+    decimation_ *= 2;
+  }
+  // Recombining costs about as much as one butterfly stage, so splitting
+  // only pays once at least two stages are skipped.
+  if (decimation_ < kMinDecimation) {
+    decimation_ = 1;
+  }
+  sub_size_ = size / decimation_;
+
+  plan_ = make_rfft_plan(static_cast<std::size_t>(sub_size_));
+  if (!plan_) {
+    throw std::runtime_error("Failed to create FFT plan.");
+  }
+  if (decimation_ > 1) {
+    constexpr double kPi = 3.14159265358979323846;
+    cos_.resize(static_cast<std::size_t>(size));
+    sin_.resize(static_cast<std::size_t>(size));
+    for (int j = 0; j < size; ++j) {
+      double angle = 2.0 * kPi * static_cast<double>(j) / static_cast<double>(size);
+      cos_[static_cast<std::size_t>(j)] = std::cos(angle);
+      sin_[static_cast<std::size_t>(j)] = std::sin(angle);
+    }
+    sub_.resize(static_cast<std::size_t>(size));
+    acc_re_.resize(static_cast<std::size_t>(bins));
+    acc_im_.resize(static_cast<std::size_t>(bins));
+  }
+}
+
+PrunedRealFFT::~PrunedRealFFT() {
+  destroy_rfft_plan(plan_);
+}
+
+void PrunedRealFFT::forward(double *data) {
+  if (decimation_ == 1) {
+    if (rfft_forward(plan_, data, 1.0) != 0) {
+      throw std::runtime_error("FFT execution failed.");
+    }
+    return;
+  }
+
+  std::size_t m_count = static_cast<std::size_t>(decimation_);
+  std::size_t l_count = static_cast<std::size_t>(sub_size_);
+  for (std::size_t m = 0; m < m_count; ++m) {
+    double *sub = sub_.data() + m * l_count;
+    for (std::size_t l = 0; l < l_count; ++l) {
+      sub[l] = data[l * m_count + m];
+    }
+    if (rfft_forward(plan_, sub, 1.0) != 0) {
+      throw std::runtime_error("FFT execution failed.");
+    }
+  }
+
+  // X[k] = sum_m e^{-2 pi i m k / N} X_m[k], with X_m[k] read from each
+  // sub-transform's halfcomplex output (k <= L / 2 by construction).  The
+  // sum runs sub-transform by sub-transform so the inner loop is a
+  // contiguous multiply-add over k.
+  std::size_t n = static_cast<std::size_t>(size_);
+  std::size_t bins = static_cast<std::size_t>(bins_);
+  double *acc_re = acc_re_.data();
+  double *acc_im = acc_im_.data();
+  for (std::size_t k = 0; k < bins; ++k) {
+    acc_re[k] = 0.0;
+    acc_im[k] = 0.0;
+  }
+  for (std::size_t m = 0; m < m_count; ++m) {
+    const double *sub = sub_.data() + m * l_count;
+    acc_re[0] += sub[0];
+    std::size_t j = 0;
+    for (std::size_t k = 1; k < bins; ++k) {
+      j += m;
+      if (j >= n) {
+        j -= n;
+      }
+      double sr = sub[2 * k - 1];
+      double si = (2 * k == l_count) ? 0.0 : sub[2 * k];
+      double c = cos_[j];
+      double s = sin_[j];
+      acc_re[k] += sr * c + si * s;
+      acc_im[k] += si * c - sr * s;
+    }
+  }
+  data[0] = acc_re[0];
+  for (std::size_t k = 1; k < bins; ++k) {
+    data[2 * k - 1] = acc_re[k];
+    data[2 * k] = acc_im[k];
+  }
+}
+
+}  // namespace bpm
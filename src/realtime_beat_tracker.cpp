@@ -0,0 +1,292 @@
+#include "bpm/realtime_beat_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "bpm/onset_detector.h"
+
+namespace bpm {
+namespace {
+
+static_assert(std::atomic<float>::is_always_lock_free, "tempo publication must be lock-free");
+static_assert(std::atomic<std::size_t>::is_always_lock_free, "event ring must be lock-free");
+
+constexpr float kAlpha = 680.0f;   // DP tempo-deviation weight, as BeatTracker
+constexpr double kQ27 = 134217728.0;
+
+const RealtimeBeatTracker::Config &validated(const RealtimeBeatTracker::Config &config) {
+  if (config.sample_rate <= 0 || config.channels <= 0) {
+    throw std::runtime_error("RealtimeBeatTracker invalid sample rate or channel count.");
+  }
+  if (config.min_bpm <= 0.0f || config.max_bpm <= config.min_bpm) {
+    throw std::runtime_error("RealtimeBeatTracker invalid BPM range.");
+  }
+  if (config.event_capacity == 0 || config.adaptation_sec <= 0.0f) {
+    throw std::runtime_error("RealtimeBeatTracker invalid event capacity or adaptation time.");
+  }
+  return config;
+}
+
+float frame_rate_for(const RealtimeBeatTracker::Config &config) {
+  return static_cast<float>(config.sample_rate) /
+         static_cast<float>(OnsetDetector().hop_size());
+}
+
+}  // namespace
+
+RealtimeBeatTracker::RealtimeBeatTracker(const Config &config)
+    : config_(validated(config)),
+      fft_size_(OnsetDetector().fft_size()),
+      hop_size_(OnsetDetector().hop_size()),
+      frame_rate_(frame_rate_for(config)),
+      min_lag_(std::max(1, static_cast<int>(std::ceil(60.0f * frame_rate_ / config.max_bpm)))),
+      max_lag_(std::max(min_lag_ + 1,
+                        static_cast<int>(std::floor(60.0f * frame_rate_ / config.min_bpm)))),
+      fft_(fft_size_),
+      comb_(min_lag_, max_lag_, 0.5f, config.adaptation_sec * frame_rate_) {
+  OnsetDetector onset;
+  ring_.assign(static_cast<std::size_t>(fft_size_), 0.0f);
+  window_ = onset.hann_window();
+  frame_.assign(static_cast<std::size_t>(fft_size_), 0);
+  re_.assign(static_cast<std::size_t>(fft_size_ / 2 + 1), 0);
+  im_.assign(static_cast<std::size_t>(fft_size_ / 2 + 1), 0);
+
+  // Same mel filters as the batch detector, stored sparsely.
+  auto filters = onset.mel_filterbank(config_.sample_rate);
+  mel_first_.resize(filters.size());
+  mel_weights_.resize(filters.size());
+  for (std::size_t band = 0; band < filters.size(); ++band) {
+    const auto &f = filters[band];
+    int first = -1;
+    int last = -1;
+    for (int bin = 0; bin <= fft_size_ / 2; ++bin) {
+      if (f[static_cast<std::size_t>(bin)] > 0.0f) {
+        if (first < 0) {
+          first = bin;
+        }
+        last = bin;
+      }
+    }
+    mel_first_[band] = std::max(first, 0);
+    for (int bin = first; first >= 0 && bin <= last; ++bin) {
+      mel_weights_[band].push_back(f[static_cast<std::size_t>(bin)]);
+    }
+  }
+  mel_prev_.assign(filters.size(), 0.0f);
+
+  level_decay_ = std::pow(0.5f, 1.0f / (config_.adaptation_sec * frame_rate_));
+
+  std::size_t lags = static_cast<std::size_t>(max_lag_ - min_lag_ + 1);
+  comb_scores_.assign(lags, 0.0);
+  tempo_prior_.resize(lags);
+  for (std::size_t i = 0; i < lags; ++i) {
+    // Log-Gaussian prior around 120 BPM, one octave wide, as TempoEstimator.
+    double bpm = 60.0 * frame_rate_ / static_cast<double>(min_lag_ + static_cast<int>(i));
+    double log_ratio = std::log2(bpm / 120.0);
+    tempo_prior_[i] = std::exp(-0.5 * log_ratio * log_ratio);
+  }
+
+  std::size_t history = static_cast<std::size_t>(2 * max_lag_ + 2);
+  cumulative_.assign(history, 0.0);
+  onset_history_.assign(history, 0.0f);
+  penalty_.assign(static_cast<std::size_t>(2 * max_lag_ + 1), 0.0);
+
+  std::size_t capacity = 1;
+  while (capacity < config_.event_capacity) {
+    capacity <<= 1;
+  }
+  events_.resize(capacity);
+  event_mask_ = capacity - 1;
+}
+
+void RealtimeBeatTracker::process(const float *interleaved, std::size_t frames) noexcept {
+  std::size_t channels = static_cast<std::size_t>(config_.channels);
+  float scale = 1.0f / static_cast<float>(channels);
+  std::size_t fft = static_cast<std::size_t>(fft_size_);
+  std::size_t hop = static_cast<std::size_t>(hop_size_);
+  for (std::size_t f = 0; f < frames; ++f) {
+    float sum = 0.0f;
+    for (std::size_t ch = 0; ch < channels; ++ch) {
+      sum += interleaved[f * channels + ch];
+    }
+    ring_[ring_pos_] = sum * scale;
+    ring_pos_ = (ring_pos_ + 1 == fft) ? 0 : ring_pos_ + 1;
+    ++samples_seen_;
+    // Frame k covers samples [k * hop, k * hop + fft), as in OnsetDetector.
+    if (samples_seen_ >= fft && (samples_seen_ - fft) % hop == 0) {
+      analyze_frame();
+    }
+  }
+}
+
+void RealtimeBeatTracker::analyze_frame() noexcept {
+  // Window the ring (oldest sample at ring_pos_) into Q27 for the
+  // allocation-free fixed-point FFT.
+  std::size_t fft = static_cast<std::size_t>(fft_size_);
+  for (std::size_t i = 0; i < fft; ++i) {
+    std::size_t idx = ring_pos_ + i;
+    if (idx >= fft) {
+      idx -= fft;
+    }
+    double x = static_cast<double>(ring_[idx] * window_[i]) * kQ27;
+    x = std::max(-kQ27, std::min(kQ27, x));
+    frame_[i] = static_cast<std::int32_t>(x);
+  }
+  fft_.forward(frame_.data(), re_.data(), im_.data());
+
+  // Back to the float path's power scale (unnormalised FFT of [-1, 1]
+  // input), so the log floor behaves the same.
+  double power_scale = (static_cast<double>(fft_size_) / kQ27) *
+                       (static_cast<double>(fft_size_) / kQ27);
+  float flux = 0.0f;
+  for (std::size_t band = 0; band < mel_weights_.size(); ++band) {
+    const auto &weights = mel_weights_[band];
+    std::size_t first = static_cast<std::size_t>(mel_first_[band]);
+    double sum = 0.0;
+    for (std::size_t w = 0; w < weights.size(); ++w) {
+      double r = re_[first + w];
+      double m = im_[first + w];
+      sum += (r * r + m * m) * power_scale * weights[w];
+    }
+    float value = static_cast<float>(std::log10(sum + 1e-10));
+    float diff = value - mel_prev_[band];
+    if (diff > 0.0f) {
+      flux += diff;
+    }
+    mel_prev_[band] = value;
+  }
+  if (frame_index_ == 0) {
+    flux = 0.0f;  // no previous frame to difference against
+  }
+
+  // Running normalisation to roughly zero mean, unit variance.  Until the
+  // horizon is reached this is a plain running average.
+  double n = static_cast<double>(frame_index_ + 1);
+  double decay = std::min(static_cast<double>(level_decay_), 1.0 - 1.0 / n);
+  double delta = flux - level_mean_;
+  level_mean_ += (1.0 - decay) * delta;
+  level_var_ = decay * level_var_ + (1.0 - decay) * delta * delta;
+  float onset = static_cast<float>((flux - level_mean_) / std::sqrt(level_var_ + 1e-12));
+
+  comb_.process(onset);
+  update_tempo();
+  track_beats(onset);
+  ++frame_index_;
+}
+
+void RealtimeBeatTracker::update_tempo() noexcept {
+  // Wait for half an adaptation period (and at least two of the longest
+  // beat periods) before trusting the bank.
+  std::size_t warmup = static_cast<std::size_t>(
+      std::max(2.0f * static_cast<float>(max_lag_), 0.5f * config_.adaptation_sec * frame_rate_));
+  if (comb_.frames() < warmup) {
+    return;
+  }
+  comb_.scores(comb_scores_.data());
+  double best = -std::numeric_limits<double>::infinity();
+  int best_lag = 0;
+  for (std::size_t i = 0; i < comb_scores_.size(); ++i) {
+    double score = comb_scores_[i] * tempo_prior_[i];
+    if (score > best) {
+      best = score;
+      best_lag = min_lag_ + static_cast<int>(i);
+    }
+  }
+  if (best_lag > 0 && best > 0.0) {
+    period_ = best_lag;
+    bpm_.store(60.0f * frame_rate_ / static_cast<float>(period_), std::memory_order_relaxed);
+  }
+}
+
+void RealtimeBeatTracker::track_beats(float onset) noexcept {
+  std::int64_t t = static_cast<std::int64_t>(frame_index_);
+  std::int64_t history = static_cast<std::int64_t>(cumulative_.size());
+  auto slot = [history](std::int64_t frame) {
+    return static_cast<std::size_t>(frame % history);
+  };
+  onset_history_[slot(t)] = onset;
+  if (period_ <= 0) {
+    cumulative_[slot(t)] = onset;
+    return;
+  }
+
+  int lo = std::max(1, static_cast<int>(std::lround(period_ * 0.5)));
+  int hi = 2 * period_;
+  if (penalty_period_ != period_) {
+    for (int lag = lo; lag <= hi; ++lag) {
+      double log_ratio = std::log(static_cast<double>(lag) / static_cast<double>(period_));
+      penalty_[static_cast<std::size_t>(lag)] = kAlpha * (log_ratio * log_ratio);
+    }
+    penalty_period_ = period_;
+  }
+
+  // Causal half of the BeatTracker DP: best predecessor within
+  // [period / 2, 2 * period] frames.
+  double best = 0.0;
+  bool found = false;
+  for (int lag = lo; lag <= hi && lag <= t; ++lag) {
+    double score = cumulative_[slot(t - lag)] - penalty_[static_cast<std::size_t>(lag)];
+    if (!found || score > best) {
+      best = score;
+      found = true;
+    }
+  }
+  cumulative_[slot(t)] = onset + (found ? best : 0.0);
+
+  // Beats are confirmed `w` frames after their expected position, picking
+  // the best cumulative score within +-w of it; the first beat is the best
+  // frame of the last period.
+  std::int64_t w = std::max(1, period_ / 8);
+  std::int64_t search_lo = 0;
+  std::int64_t search_hi = -1;
+  if (last_beat_ < 0) {
+    search_lo = std::max<std::int64_t>(0, t - period_ + 1);
+    search_hi = t;
+  } else if (t >= last_beat_ + period_ + w) {
+    std::int64_t expected = std::min(last_beat_ + period_, t - w);
+    search_lo = std::max(last_beat_ + 1, expected - w);
+    search_hi = expected + w;
+  }
+  if (search_hi < search_lo) {
+    return;
+  }
+  std::int64_t beat = search_lo;
+  for (std::int64_t f = search_lo + 1; f <= search_hi; ++f) {
+    if (cumulative_[slot(f)] > cumulative_[slot(beat)]) {
+      beat = f;
+    }
+  }
+  last_beat_ = beat;
+
+  BeatEvent event;
+  event.sample = static_cast<std::uint64_t>(beat) * static_cast<std::uint64_t>(hop_size_);
+  event.bpm = bpm_.load(std::memory_order_relaxed);
+  event.strength = onset_history_[slot(beat)];
+  push_event(event);
+}
+
+void RealtimeBeatTracker::push_event(const BeatEvent &event) noexcept {
+  std::size_t head = event_head_.load(std::memory_order_relaxed);
+  std::size_t tail = event_tail_.load(std::memory_order_acquire);
+  if (head - tail > event_mask_) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  events_[head & event_mask_] = event;
+  event_head_.store(head + 1, std::memory_order_release);
+}
+
+bool RealtimeBeatTracker::pop_event(BeatEvent &event) {
+  std::size_t tail = event_tail_.load(std::memory_order_relaxed);
+  std::size_t head = event_head_.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  event = events_[tail & event_mask_];
+  event_tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+}  // namespace bpm
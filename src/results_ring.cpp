@@ -0,0 +1,316 @@
+#include "bpm/results_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+namespace bpm {
+namespace {
+
+constexpr std::uint32_t kMagic = 0x474E5242;  // "BRNG"
+constexpr std::uint32_t kLayoutVersion = 2;
+
+// A claim held this long belongs to a writer that died or stalled mid-copy.
+// The next writer for the slot takes it over, so that one lost process
+// cannot block every later publish to that slot.
+constexpr auto kStalledClaim = std::chrono::seconds(1);
+
+static_assert(std::is_trivially_copyable<ResultRecord>::value,
+              "ResultRecord must be trivially copyable");
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "shared-memory ring needs lock-free 64-bit atomics");
+
+// Segment layout: one header cache line, then slot_count slots.  Each slot
+// carries a sequence word: 2n+1 while record n is being written, 2n+2 once it
+// is published.  0 means the slot has never been written.
+struct RingHeader {
+  std::atomic<std::uint32_t> magic;  // stored last by the creating process
+  std::uint32_t version;
+  std::uint32_t slot_count;
+  std::uint32_t record_size;
+  alignas(64) std::atomic<std::uint64_t> head;  // next sequence to claim
+};
+
+struct alignas(64) RingSlot {
+  std::atomic<std::uint64_t> seq;
+  ResultRecord record;
+};
+
+std::size_t segment_size(std::uint32_t slot_count) {
+  return sizeof(RingHeader) + static_cast<std::size_t>(slot_count) * sizeof(RingSlot);
+}
+
+RingSlot *slots_of(void *base) {
+  return reinterpret_cast<RingSlot *>(static_cast<char *>(base) + sizeof(RingHeader));
+}
+
+std::string errno_message() {
+  return std::strerror(errno);
+}
+
+// Waits for a concurrently creating process to size and initialise the
+// segment.  Returns false on timeout.
+bool wait_for_header(int fd, void *&base, std::size_t &size) {
+  for (int attempt = 0; attempt < 1000; ++attempt) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(RingHeader)) {
+      if (!base) {
+        size = static_cast<std::size_t>(st.st_size);
+        base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+          base = nullptr;
+          return false;
+        }
+      }
+      auto *header = static_cast<RingHeader *>(base);
+      if (header->magic.load(std::memory_order_acquire) == kMagic) {
+        return true;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+void check_layout(const RingHeader &header, const std::string &name, std::size_t size) {
+  if (header.version != kLayoutVersion || header.record_size != sizeof(ResultRecord) ||
+      header.slot_count == 0 || size < segment_size(header.slot_count)) {
+    throw std::runtime_error("Shared-memory results ring has an incompatible layout: " + name);
+  }
+}
+
+}  // namespace
+
+struct ResultsRingWriter::Mapping {
+  void *base = nullptr;
+  std::size_t size = 0;
+  RingHeader *header = nullptr;
+  RingSlot *slots = nullptr;
+};
+
+struct ResultsRingReader::Mapping {
+  void *base = nullptr;
+  std::size_t size = 0;
+  const RingHeader *header = nullptr;
+  const RingSlot *slots = nullptr;
+};
+
+ResultsRingWriter::ResultsRingWriter(const std::string &name, std::uint32_t slot_count)
+    : mapping_(std::make_unique<Mapping>()) {
+  if (slot_count == 0) {
+    throw std::runtime_error("Results ring needs at least one slot.");
+  }
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  bool created = fd >= 0;
+  if (!created && errno == EEXIST) {
+    fd = shm_open(name.c_str(), O_RDWR, 0);
+  }
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open shared memory " + name + ": " + errno_message());
+  }
+
+  if (created) {
+    std::size_t size = segment_size(slot_count);
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      std::string message = errno_message();
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("Failed to size shared memory " + name + ": " + message);
+    }
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      shm_unlink(name.c_str());
+      throw std::runtime_error("Failed to map shared memory " + name + ": " + errno_message());
+    }
+    // ftruncate zero-fills, which is the initial state of every atomic.
+    auto *header = static_cast<RingHeader *>(base);
+    header->version = kLayoutVersion;
+    header->slot_count = slot_count;
+    header->record_size = static_cast<std::uint32_t>(sizeof(ResultRecord));
+    header->magic.store(kMagic, std::memory_order_release);
+    mapping_->base = base;
+    mapping_->size = size;
+  } else {
+    // Another writer owns the layout; adopt its slot count.
+    void *probe = nullptr;
+    std::size_t probe_size = 0;
+    if (!wait_for_header(fd, probe, probe_size)) {
+      if (probe) {
+        munmap(probe, probe_size);
+      }
+      close(fd);
+      throw std::runtime_error("Shared memory " + name + " is not a results ring.");
+    }
+    munmap(probe, probe_size);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      std::string message = errno_message();
+      close(fd);
+      throw std::runtime_error("Failed to stat shared memory " + name + ": " + message);
+    }
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      throw std::runtime_error("Failed to map shared memory " + name + ": " + errno_message());
+    }
+    mapping_->base = base;
+    mapping_->size = size;
+    try {
+      check_layout(*static_cast<RingHeader *>(base), name, size);
+    } catch (...) {
+      munmap(base, size);
+      throw;
+    }
+  }
+
+  mapping_->header = static_cast<RingHeader *>(mapping_->base);
+  mapping_->slots = slots_of(mapping_->base);
+}
+
+ResultsRingWriter::~ResultsRingWriter() {
+  if (mapping_ && mapping_->base) {
+    munmap(mapping_->base, mapping_->size);
+  }
+}
+
+std::uint64_t ResultsRingWriter::publish(const ResultRecord &record) {
+  RingHeader &header = *mapping_->header;
+  std::uint64_t n = header.head.fetch_add(1, std::memory_order_relaxed);
+  RingSlot &slot = mapping_->slots[n % header.slot_count];
+
+  // Sequence lock: claim the slot by moving its word from an even (idle)
+  // value to 2n+1, copy, then publish.  Writers n and n + slot_count share
+  // a slot, so the claim must be a CAS: a plain store would let both copy
+  // at once and publish a torn record that readers validate.  An earlier
+  // writer still copying is waited for, for at most kStalledClaim, and then
+  // its claim is taken over.  Once a later record holds the slot, this one
+  // is already lapped and is dropped.
+  std::uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  for (;;) {
+    if (seq > 2 * n) {
+      return n;
+    }
+    if ((seq & 1) == 0 || std::chrono::steady_clock::now() >= deadline) {
+      if (slot.seq.compare_exchange_weak(seq, 2 * n + 1, std::memory_order_acquire,
+                                         std::memory_order_relaxed)) {
+        break;
+      }
+      continue;
+    }
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      deadline = std::chrono::steady_clock::now() + kStalledClaim;
+    }
+    std::this_thread::yield();
+    seq = slot.seq.load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&slot.record, &record, sizeof(ResultRecord));
+  slot.record.sequence = n;
+  // Fails only if this writer stalled past kStalledClaim and lost the slot;
+  // the record is then dropped, and readers see it as lapped.
+  std::uint64_t claimed = 2 * n + 1;
+  slot.seq.compare_exchange_strong(claimed, 2 * n + 2, std::memory_order_release,
+                                   std::memory_order_relaxed);
+  return n;
+}
+
+std::uint32_t ResultsRingWriter::slot_count() const {
+  return mapping_->header->slot_count;
+}
+
+void ResultsRingWriter::unlink(const std::string &name) {
+  shm_unlink(name.c_str());
+}
+
+ResultsRingReader::ResultsRingReader(const std::string &name)
+    : mapping_(std::make_unique<Mapping>()) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open shared memory " + name + ": " + errno_message());
+  }
+  void *base = nullptr;
+  std::size_t size = 0;
+  bool ready = wait_for_header(fd, base, size);
+  close(fd);
+  if (!ready) {
+    if (base) {
+      munmap(base, size);
+    }
+    throw std::runtime_error("Shared memory " + name + " is not a results ring.");
+  }
+  try {
+    check_layout(*static_cast<RingHeader *>(base), name, size);
+  } catch (...) {
+    munmap(base, size);
+    throw;
+  }
+  mapping_->base = base;
+  mapping_->size = size;
+  mapping_->header = static_cast<const RingHeader *>(base);
+  mapping_->slots = slots_of(base);
+}
+
+ResultsRingReader::~ResultsRingReader() {
+  if (mapping_ && mapping_->base) {
+    munmap(mapping_->base, mapping_->size);
+  }
+}
+
+std::uint64_t ResultsRingReader::head() const {
+  return mapping_->header->head.load(std::memory_order_acquire);
+}
+
+std::uint64_t ResultsRingReader::oldest() const {
+  std::uint64_t h = head();
+  std::uint64_t count = mapping_->header->slot_count;
+  return h > count ? h - count : 0;
+}
+
+std::uint32_t ResultsRingReader::slot_count() const {
+  return mapping_->header->slot_count;
+}
+
+const ResultRecord *ResultsRingReader::view(std::uint64_t sequence, Status &status) const {
+  const RingSlot &slot = mapping_->slots[sequence % mapping_->header->slot_count];
+  std::uint64_t expected = 2 * sequence + 2;
+  std::uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq == expected) {
+    status = Status::OK;
+    return &slot.record;
+  }
+  // Anything newer than `expected` means a later record reused the slot.
+  status = (seq > expected) ? Status::LAPPED : Status::NOT_READY;
+  return nullptr;
+}
+
+bool ResultsRingReader::validate(std::uint64_t sequence) const {
+  const RingSlot &slot = mapping_->slots[sequence % mapping_->header->slot_count];
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == 2 * sequence + 2;
+}
+
+ResultsRingReader::Status ResultsRingReader::read(std::uint64_t sequence,
+                                                  ResultRecord &out) const {
+  Status status;
+  const ResultRecord *record = view(sequence, status);
+  if (!record) {
+    return status;
+  }
+  std::memcpy(&out, record, sizeof(ResultRecord));
+  return validate(sequence) ? Status::OK : Status::LAPPED;
+}
+
+}  // namespace bpm
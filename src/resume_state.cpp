@@ -0,0 +1,195 @@
+#include "bpm/resume_state.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include "bpm/feature_cache.h"
+
+namespace bpm {
+namespace {
+
+constexpr char kMagic[8] = {'B', 'P', 'M', 'S', 'T', 'A', 'T', '1'};
+constexpr std::uint8_t kHasKey = 1;
+constexpr std::uint8_t kHasOnset = 2;
+
+void append_le(std::vector<unsigned char> &out, std::uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<unsigned char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void append_string(std::vector<unsigned char> &out, const std::string &value) {
+  if (value.size() > 0xFFFF) {
+    throw std::runtime_error("Resume state label too long.");
+  }
+  append_le(out, value.size(), 2);
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+void append_floats(std::vector<unsigned char> &out, const std::vector<float> &values) {
+  append_le(out, values.size(), 8);
+  for (float value : values) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    append_le(out, bits, 4);
+  }
+}
+
+class Reader {
+ public:
+  Reader(const std::vector<unsigned char> &data, const std::string &path)
+      : data_(data), path_(path) {}
+
+  const unsigned char *take(std::size_t count) {
+    if (data_.size() - pos_ < count) {
+      throw std::runtime_error("Truncated resume state: " + path_);
+    }
+    const unsigned char *p = data_.data() + pos_;
+    pos_ += count;
+    return p;
+  }
+
+  std::uint64_t le(int bytes) {
+    const unsigned char *p = take(static_cast<std::size_t>(bytes));
+    std::uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+      value |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  std::string string() {
+    std::size_t size = static_cast<std::size_t>(le(2));
+    const unsigned char *p = take(size);
+    return std::string(reinterpret_cast<const char *>(p), size);
+  }
+
+  std::vector<float> floats() {
+    std::uint64_t count = le(8);
+    if (count > (data_.size() - pos_) / 4) {
+      throw std::runtime_error("Malformed resume state: " + path_);
+    }
+    std::vector<float> values(static_cast<std::size_t>(count));
+    for (float &value : values) {
+      std::uint32_t bits = static_cast<std::uint32_t>(le(4));
+      std::memcpy(&value, &bits, sizeof(value));
+    }
+    return values;
+  }
+
+ private:
+  const std::vector<unsigned char> &data_;
+  const std::string &path_;
+  std::size_t pos_ = 0;
+};
+
+void write_all(int fd, const std::vector<unsigned char> &data, const std::string &path) {
+  std::size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Failed to write resume state: " + path);
+    }
+    written += static_cast<std::size_t>(n);
+  }
+}
+
+}  // namespace
+
+std::string ResumeState::fingerprint_of(const AudioBuffer &mono_audio) {
+  return FeatureCache::chunk_key("state", mono_audio.samples.data(), mono_audio.samples.size());
+}
+
+void ResumeState::save(const std::string &path) const {
+  std::vector<unsigned char> out(kMagic, kMagic + sizeof(kMagic));
+  append_le(out, kFormatVersion, 4);
+  append_le(out, static_cast<std::uint32_t>(sample_rate), 4);
+  append_le(out, num_frames, 8);
+  append_string(out, fingerprint);
+  append_string(out, settings);
+  out.push_back(static_cast<unsigned char>((has_key ? kHasKey : 0) | (has_onset ? kHasOnset : 0)));
+  if (has_key) {
+    append_le(out, key.next_frame, 8);
+    append_floats(out, key.octave_chroma);
+  }
+  if (has_onset) {
+    append_le(out, onset.next_frame, 8);
+    append_floats(out, onset.onset_strength);
+    append_floats(out, onset.band_flux);
+    append_floats(out, onset.prev_mel);
+  }
+
+  // The rename only replaces the previous state once the new one has been
+  // synced, so a machine lost mid-write still leaves a usable file.
+  std::string temp_path = path + ".tmp";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open resume state for writing: " + temp_path);
+  }
+  try {
+    write_all(fd, out, temp_path);
+    if (::fsync(fd) != 0) {
+      throw std::runtime_error("Failed to sync resume state: " + temp_path);
+    }
+  } catch (...) {
+    ::close(fd);
+    std::remove(temp_path.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    throw std::runtime_error("Failed to move resume state into place: " + path);
+  }
+}
+
+ResumeState ResumeState::load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Failed to open resume state: " + path);
+  }
+  std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+
+  Reader in(data, path);
+  if (std::memcmp(in.take(sizeof(kMagic)), kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("Not a resume state file: " + path);
+  }
+  std::uint32_t version = static_cast<std::uint32_t>(in.le(4));
+  if (version != kFormatVersion) {
+    throw std::runtime_error("Unsupported resume state version " + std::to_string(version) +
+                             ": " + path);
+  }
+
+  ResumeState state;
+  state.sample_rate = static_cast<int>(in.le(4));
+  state.num_frames = in.le(8);
+  state.fingerprint = in.string();
+  state.settings = in.string();
+  std::uint8_t flags = *in.take(1);
+  state.has_key = (flags & kHasKey) != 0;
+  state.has_onset = (flags & kHasOnset) != 0;
+  if (state.has_key) {
+    state.key.next_frame = static_cast<std::size_t>(in.le(8));
+    state.key.octave_chroma = in.floats();
+  }
+  if (state.has_onset) {
+    state.onset.next_frame = static_cast<std::size_t>(in.le(8));
+    state.onset.onset_strength = in.floats();
+    state.onset.band_flux = in.floats();
+    state.onset.prev_mel = in.floats();
+  }
+  return state;
+}
+
+}  // namespace bpm
@@ -0,0 +1,158 @@
+#include "bpm/slow_job.h"
+
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace bpm {
+namespace {
+
+struct StageField {
+  const char *name;
+  double StageTimings::*field;
+};
+
+constexpr StageField kStages[] = {
+    {"decode", &StageTimings::decode}, {"downmix", &StageTimings::downmix},
+    {"key", &StageTimings::key},       {"onset", &StageTimings::onset},
+    {"tempo", &StageTimings::tempo},   {"beat", &StageTimings::beat},
+    {"meter", &StageTimings::meter},   {"render", &StageTimings::render},
+    {"write", &StageTimings::write},
+};
+
+const char *tempo_method_name(TempoMethod method) {
+  return method == TempoMethod::COMB_FILTER ? "comb" : "autocorr";
+}
+
+const char *dp_search_name(DpSearch search) {
+  return search == DpSearch::PRUNED ? "pruned" : "exhaustive";
+}
+
+void write_options(std::ostream &out, const PipelineOptions &o) {
+  out << "min_bpm: " << o.min_bpm << "\n"
+      << "max_bpm: " << o.max_bpm << "\n"
+      << "tempo_method: " << tempo_method_name(o.tempo_method) << "\n"
+      << "beat_dp_search: " << dp_search_name(o.beat_dp_search) << "\n"
+      << "beat_dp_tolerance: " << o.beat_dp_tolerance << "\n"
+      << "prune_candidates: " << o.prune_candidates << "\n"
+      << "detect_key: " << o.detect_key << "\n"
+      << "detect_meter: " << o.detect_meter << "\n"
+      << "measure_loudness: " << o.measure_loudness << "\n"
+      << "fixed_point: " << o.fixed_point << "\n"
+      << "mp3_rate_divisor: " << o.mp3_rate.divisor << "\n"
+      << "mp3_mono: " << o.mp3_rate.mono << "\n"
+      << "accent_downbeats: " << o.accent_downbeats << "\n"
+      << "click_volume: " << o.click_volume << "\n"
+      << "click_freq: " << o.click_freq << "\n"
+      << "downbeat_freq: " << o.downbeat_freq << "\n"
+      << "output_format: " << o.output_format << "\n"
+      << "flac_threads: " << o.flac_parallelism.threads << "\n"
+      << "cache_dir: " << o.cache_dir << "\n"
+      << "progress_checkpoints: " << o.progress_checkpoints_sec.size() << "\n"
+      << "state_path: " << o.state_path << "\n";
+}
+
+}  // namespace
+
+double *stage_timing(StageTimings &timings, const std::string &stage) {
+  for (const StageField &s : kStages) {
+    if (stage == s.name) {
+      return &(timings.*s.field);
+    }
+  }
+  return nullptr;
+}
+
+std::vector<std::string> SlowJobReport::over_thresholds(const PipelineOptions &options,
+                                                        const StageTimings &timings,
+                                                        double total_sec) {
+  std::vector<std::string> exceeded;
+  if (options.slow_job_sec > 0.0 && total_sec > options.slow_job_sec) {
+    exceeded.push_back("job");
+  }
+  for (const StageField &s : kStages) {
+    double threshold = options.slow_stage_sec.*s.field;
+    if (threshold > 0.0 && timings.*s.field > threshold) {
+      exceeded.push_back(s.name);
+    }
+  }
+  return exceeded;
+}
+
+std::string SlowJobReport::write(const std::string &directory) const {
+  // Unique across the jobs of this process and, through the pid, across
+  // processes sharing the directory.
+  static std::atomic<unsigned> sequence{0};
+  std::string base = directory + "/slow-" + std::to_string(std::time(nullptr)) + "-" +
+                     std::to_string(::getpid()) + "-" + std::to_string(sequence++);
+  std::string path = base + ".txt";
+  std::string envelope_path = base + ".onset.f32";
+
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Failed to open slow job report for writing: " + path);
+  }
+  out << "exceeded:";
+  for (const std::string &name : exceeded) {
+    out << ' ' << name;
+  }
+  out << "\n";
+
+  out << "\n# input\n"
+      << "input_path: " << input_path << "\n"
+      << "input_bytes: " << input_bytes << "\n"
+      << "header: " << header << "\n"
+      << "format: " << format << "\n"
+      << "fingerprint: " << fingerprint << "\n"
+      << "sample_rate: " << sample_rate << "\n"
+      << "channels: " << channels << "\n"
+      << "num_frames: " << num_frames << "\n";
+
+  out << "\n# options\n" << std::boolalpha;
+  write_options(out, options);
+
+  out << "\n# seconds\n"
+      << "total: " << total_sec << "\n";
+  for (const StageField &s : kStages) {
+    out << s.name << ": " << timings.*s.field << "\n";
+  }
+
+  out << "\n# sizes\n"
+      << "onset_frames: " << onset_frames << "\n"
+      << "hop_size: " << hop_size << "\n"
+      << "lag_range: " << min_lag << " " << max_lag << "\n"
+      << "tempo_candidates: " << tempo_candidates << "\n"
+      << "tracked_candidates: " << tracked_candidates << "\n"
+      << "abandoned_candidates: " << abandoned_candidates << "\n"
+      << "beat_count: " << beat_count << "\n"
+      << "bpm: " << bpm << "\n";
+  if (!onset_envelope.empty()) {
+    out << "onset_envelope: " << envelope_path << "\n";
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed to write slow job report: " + path);
+  }
+
+  if (!onset_envelope.empty()) {
+    std::ofstream env(envelope_path, std::ios::binary | std::ios::trunc);
+    for (float value : onset_envelope) {
+      std::uint32_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      unsigned char bytes[4] = {
+          static_cast<unsigned char>(bits), static_cast<unsigned char>(bits >> 8),
+          static_cast<unsigned char>(bits >> 16), static_cast<unsigned char>(bits >> 24)};
+      env.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+    }
+    env.close();
+    if (!env) {
+      throw std::runtime_error("Failed to write onset envelope: " + envelope_path);
+    }
+  }
+  return path;
+}
+
+}  // namespace bpm
@@ -6,6 +6,8 @@
 #include <limits>
 #include <stdexcept>
 
+#include "bpm/kernels.h"
+
 namespace bpm {
 namespace {
 
@@ -42,6 +44,115 @@ double parabolic_interpolate(const std::vector<double> &data, int peak, int lo,
 
 }  // namespace
 
+CombFilterBank::CombFilterBank(int min_lag, int max_lag,
+                               float feedback,
+                               float energy_half_life_frames)
+    : min_lag_(std::max(1, min_lag)),
+      max_lag_(std::max(std::max(1, min_lag), max_lag)),
+      feedback_(feedback) {
+  if (energy_half_life_frames > 0.0f) {
+    energy_decay_ = std::pow(0.5f, 1.0f / energy_half_life_frames);
+  }
+  std::size_t count = static_cast<std::size_t>(max_lag_ - min_lag_ + 1);
+  period_.resize(count);
+  offset_.resize(count);
+  pos_.assign(count, 0);
+  energy_.assign(count, 0.0);
+  std::size_t total = 0;
+  for (std::size_t r = 0; r < count; ++r) {
+    period_[r] = min_lag_ + static_cast<int>(r);
+    offset_[r] = total;
+    total += static_cast<std::size_t>(period_[r]);
+  }
+  delay_.assign(total, 0.0f);
+}
+
+void CombFilterBank::process(float onset) {
+  float input = (1.0f - feedback_) * onset;
+  double decay = energy_decay_;
+  std::size_t count = period_.size();
+  for (std::size_t r = 0; r < count; ++r) {
+    float &slot = delay_[offset_[r] + static_cast<std::size_t>(pos_[r])];
+    float y = feedback_ * slot + input;
+    slot = y;
+    energy_[r] = decay * energy_[r] + static_cast<double>(y) * y;
+    pos_[r] = (pos_[r] + 1 == period_[r]) ? 0 : pos_[r] + 1;
+  }
+  input_energy_ = decay * input_energy_ + static_cast<double>(onset) * onset;
+  energy_weight_ = decay * energy_weight_ + 1.0;
+  ++frames_;
+}
+
+void CombFilterBank::process(const std::vector<float> &onsets) {
+  if (energy_decay_ != 1.0f) {
+    for (float onset : onsets) {
+      process(onset);
+    }
+    return;
+  }
+  // Frames less than one period apart do not depend on each other, so each
+  // resonator runs over the batch a period at a time, in contiguous runs of
+  // its delay line that the kernel vectorises.  Vectorising across
+  // resonators instead would gather and scatter, since every resonator's
+  // delay line wraps at a different position.
+  std::vector<float> input(onsets.size());
+  for (std::size_t i = 0; i < onsets.size(); ++i) {
+    input[i] = (1.0f - feedback_) * onsets[i];
+  }
+  const kernels::KernelTable &k = kernels::active();
+  for (std::size_t r = 0; r < period_.size(); ++r) {
+    std::size_t period = static_cast<std::size_t>(period_[r]);
+    std::size_t pos = static_cast<std::size_t>(pos_[r]);
+    float *delay = delay_.data() + offset_[r];
+    for (std::size_t f = 0; f < input.size();) {
+      std::size_t n = std::min(period - pos, input.size() - f);
+      energy_[r] += k.comb_block(delay + pos, input.data() + f, feedback_, n);
+      f += n;
+      pos = (pos + n == period) ? 0 : pos + n;
+    }
+    pos_[r] = static_cast<int>(pos);
+  }
+  for (float onset : onsets) {
+    input_energy_ += static_cast<double>(onset) * onset;
+    energy_weight_ += 1.0;
+  }
+  frames_ += onsets.size();
+}
+
+std::vector<double> CombFilterBank::scores() const {
+  std::vector<double> result(energy_.size(), 0.0);
+  scores(result.data());
+  return result;
+}
+
+void CombFilterBank::scores(double *out) const {
+  if (energy_weight_ <= 0.0) {
+    std::fill(out, out + energy_.size(), 0.0);
+    return;
+  }
+  // Every resonator passes aperiodic input with power gain
+  // (1 - a) / (1 + a).  Subtracting that floor and rescaling leaves roughly
+  // the power of the component periodic in T, which is what the
+  // autocorrelation engine measures, so both share the same thresholds.
+  double a = feedback_;
+  double floor_gain = (1.0 - a) / (1.0 + a);
+  double input_power = input_energy_ / energy_weight_;
+  for (std::size_t r = 0; r < energy_.size(); ++r) {
+    double power = energy_[r] / energy_weight_;
+    out[r] = (power - floor_gain * input_power) / (1.0 - floor_gain);
+  }
+}
+
+int CombFilterBank::best_lag() const {
+  if (frames_ == 0) {
+    return 0;
+  }
+  auto it = std::max_element(energy_.begin(), energy_.end());
+  return min_lag_ + static_cast<int>(it - energy_.begin());
+}
+
+TempoEstimator::TempoEstimator(TempoMethod method) : method_(method) {}
+
 TempoEstimator::Result TempoEstimator::estimate(const std::vector<float> &onset_strength,
                                                 int sample_rate,
                                                 int hop_size,
@@ -68,15 +179,26 @@ TempoEstimator::Result TempoEstimator::estimate(const std::vector<float> &onset_
     return Result{};
   }
 
-  // Compute normalized autocorrelation for each candidate lag.
+  // Periodicity score for each candidate lag.  Both engines produce a
+  // second-order (energy-like) score, so the prior, octave correction and
+  // candidate selection below are shared.
   std::vector<double> autocorr(static_cast<std::size_t>(max_lag + 1), 0.0);
-  for (int lag = min_lag; lag <= max_lag; ++lag) {
-    double sum = 0.0;
-    std::size_t count = onset_strength.size() - static_cast<std::size_t>(lag);
-    for (std::size_t i = static_cast<std::size_t>(lag); i < onset_strength.size(); ++i) {
-      sum += static_cast<double>(onset_strength[i]) * onset_strength[i - static_cast<std::size_t>(lag)];
+  if (method_ == TempoMethod::COMB_FILTER) {
+    CombFilterBank bank(min_lag, max_lag);
+    bank.process(onset_strength);
+    std::vector<double> scores = bank.scores();
+    for (int lag = min_lag; lag <= max_lag; ++lag) {
+      autocorr[static_cast<std::size_t>(lag)] = scores[static_cast<std::size_t>(lag - min_lag)];
+    }
+  } else {
+    // Normalized autocorrelation.
+    const kernels::KernelTable &k = kernels::active();
+    for (int lag = min_lag; lag <= max_lag; ++lag) {
+      std::size_t count = onset_strength.size() - static_cast<std::size_t>(lag);
+      double sum = k.lagged_dot(onset_strength.data(), onset_strength.size(),
+                                static_cast<std::size_t>(lag));
+      autocorr[static_cast<std::size_t>(lag)] = (count > 0) ? sum / static_cast<double>(count) : 0.0;
     }
-    autocorr[static_cast<std::size_t>(lag)] = (count > 0) ? sum / static_cast<double>(count) : 0.0;
   }
 
   // Apply log-Gaussian tempo prior and find best lag.
@@ -197,6 +319,14 @@ TempoEstimator::Result TempoEstimator::estimate(const std::vector<float> &onset_
   Result result;
   result.period_frames = best_lag;
   result.bpm = bpm_from_lag_f(refined_lag, frame_rate);
+  // Periodicity at the chosen lag relative to the envelope's energy: the
+  // autocorrelation coefficient, or its comb-filter equivalent.
+  double energy = kernels::active().lagged_dot(onset_strength.data(), onset_strength.size(), 0) /
+                  static_cast<double>(onset_strength.size());
+  if (energy > 0.0) {
+    result.confidence = static_cast<float>(std::min(
+        1.0, std::max(0.0, autocorr[static_cast<std::size_t>(best_lag)] / energy)));
+  }
 
   // Collect top candidate periods (distinct peaks separated by >= 3 lags).
   {
@@ -1,38 +1,73 @@
 #include "bpm/wav_reader.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <iterator>
 #include <stdexcept>
 #include <vector>
 
 namespace bpm {
 namespace {
 
-std::uint16_t read_u16(std::ifstream &in) {
-  std::uint8_t buf[2];
-  in.read(reinterpret_cast<char *>(buf), 2);
-  return static_cast<std::uint16_t>(buf[0]) |
-         (static_cast<std::uint16_t>(buf[1]) << 8);
-}
+// Little-endian cursor over an in-memory WAV file.
+class ByteReader {
+ public:
+  ByteReader(const std::uint8_t *data, std::size_t size) : data_(data), size_(size) {}
 
-std::uint32_t read_u32(std::ifstream &in) {
-  std::uint8_t buf[4];
-  in.read(reinterpret_cast<char *>(buf), 4);
-  return static_cast<std::uint32_t>(buf[0]) |
-         (static_cast<std::uint32_t>(buf[1]) << 8) |
-         (static_cast<std::uint32_t>(buf[2]) << 16) |
-         (static_cast<std::uint32_t>(buf[3]) << 24);
-}
+  std::size_t remaining() const { return size_ - pos_; }
+  const std::uint8_t *current() const { return data_ + pos_; }
+
+  void need(std::size_t count) const {
+    if (remaining() < count) {
+      throw std::runtime_error("WAV parse error: unexpected end of data.");
+    }
+  }
 
-void expect_tag(std::ifstream &in, const char *expected) {
-  char tag[4];
-  in.read(tag, 4);
-  if (std::memcmp(tag, expected, 4) != 0) {
-    throw std::runtime_error(
-        std::string("WAV parse error: expected '") + expected + "' tag.");
+  std::uint16_t read_u16() {
+    need(2);
+    const std::uint8_t *buf = current();
+    pos_ += 2;
+    return static_cast<std::uint16_t>(buf[0]) |
+           (static_cast<std::uint16_t>(buf[1]) << 8);
   }
-}
+
+  std::uint32_t read_u32() {
+    need(4);
+    const std::uint8_t *buf = current();
+    pos_ += 4;
+    return static_cast<std::uint32_t>(buf[0]) |
+           (static_cast<std::uint32_t>(buf[1]) << 8) |
+           (static_cast<std::uint32_t>(buf[2]) << 16) |
+           (static_cast<std::uint32_t>(buf[3]) << 24);
+  }
+
+  bool read_tag(char tag[4]) {
+    if (remaining() < 4) {
+      return false;
+    }
+    std::memcpy(tag, current(), 4);
+    pos_ += 4;
+    return true;
+  }
+
+  void expect_tag(const char *expected) {
+    char tag[4];
+    if (!read_tag(tag) || std::memcmp(tag, expected, 4) != 0) {
+      throw std::runtime_error(
+          std::string("WAV parse error: expected '") + expected + "' tag.");
+    }
+  }
+
+  // Clamped to the end of the data.
+  void skip(std::size_t count) { pos_ += std::min(count, remaining()); }
+
+ private:
+  const std::uint8_t *data_;
+  std::size_t size_;
+  std::size_t pos_ = 0;
+};
 
 }  // namespace
 
@@ -41,25 +76,35 @@ AudioBuffer WavReader::read(const std::string &filepath) {
   if (!in) {
     throw std::runtime_error("Failed to open WAV file: " + filepath);
   }
+  std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(in)),
+                                  std::istreambuf_iterator<char>());
+  if (in.bad()) {
+    throw std::runtime_error("Failed reading WAV file: " + filepath);
+  }
+  return read(bytes.data(), bytes.size());
+}
+
+AudioBuffer WavReader::read(const std::uint8_t *data, std::size_t size) {
+  ByteReader in(data, size);
 
   // RIFF header.
-  expect_tag(in, "RIFF");
-  read_u32(in);  // chunk size (ignored)
-  expect_tag(in, "WAVE");
+  in.expect_tag("RIFF");
+  in.read_u32();  // chunk size (ignored)
+  in.expect_tag("WAVE");
 
   // fmt sub-chunk.
-  expect_tag(in, "fmt ");
-  std::uint32_t fmt_size = read_u32(in);
-  std::uint16_t audio_format = read_u16(in);
-  std::uint16_t channels = read_u16(in);
-  std::uint32_t sample_rate = read_u32(in);
-  read_u32(in);  // byte rate (ignored)
-  read_u16(in);  // block align (ignored)
-  std::uint16_t bits_per_sample = read_u16(in);
+  in.expect_tag("fmt ");
+  std::uint32_t fmt_size = in.read_u32();
+  std::uint16_t audio_format = in.read_u16();
+  std::uint16_t channels = in.read_u16();
+  std::uint32_t sample_rate = in.read_u32();
+  in.read_u32();  // byte rate (ignored)
+  in.read_u16();  // block align (ignored)
+  std::uint16_t bits_per_sample = in.read_u16();
 
   // Skip any extra fmt bytes.
   if (fmt_size > 16) {
-    in.seekg(static_cast<std::streamoff>(fmt_size - 16), std::ios::cur);
+    in.skip(fmt_size - 16);
   }
 
   if (audio_format != 1) {
@@ -70,33 +115,29 @@ AudioBuffer WavReader::read(const std::string &filepath) {
   }
 
   // Find the data sub-chunk (skip any non-data chunks like LIST/INFO).
-  char chunk_id[4];
+  char chunk_id[4] = {0, 0, 0, 0};
   std::uint32_t data_size = 0;
-  while (in.read(chunk_id, 4)) {
-    data_size = read_u32(in);
+  while (in.read_tag(chunk_id)) {
+    data_size = in.read_u32();
     if (std::memcmp(chunk_id, "data", 4) == 0) {
       break;
     }
     // Skip unknown chunk.
-    in.seekg(static_cast<std::streamoff>(data_size), std::ios::cur);
+    in.skip(data_size);
   }
 
   if (std::memcmp(chunk_id, "data", 4) != 0) {
     throw std::runtime_error("WAV file has no data chunk.");
   }
+  in.need(data_size);
 
   std::uint32_t num_samples = data_size / sizeof(std::int16_t);
-  std::vector<std::int16_t> raw(num_samples);
-  in.read(reinterpret_cast<char *>(raw.data()),
-          static_cast<std::streamsize>(data_size));
-
-  if (!in) {
-    throw std::runtime_error("Failed reading WAV sample data: " + filepath);
-  }
-
+  const std::uint8_t *raw = in.current();
   std::vector<float> samples(num_samples);
   for (std::uint32_t i = 0; i < num_samples; ++i) {
-    samples[i] = static_cast<float>(raw[i]) / 32768.0f;
+    std::int16_t value = static_cast<std::int16_t>(
+        static_cast<std::uint16_t>(raw[2 * i]) | (static_cast<std::uint16_t>(raw[2 * i + 1]) << 8));
+    samples[i] = static_cast<float>(value) / 32768.0f;
   }
 
   return AudioBuffer(std::move(samples), static_cast<int>(sample_rate),
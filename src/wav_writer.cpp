@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <fstream>
 #include <stdexcept>
+#include <vector>
+
+#include "bpm/kernels.h"
 
 namespace bpm {
 namespace {
@@ -54,10 +57,20 @@ void WavWriter::write(const std::string &filepath, const AudioBuffer &audio) {
   out.write("data", 4);
   write_u32(out, data_bytes);
 
-  for (float sample : audio.samples) {
-    float clamped = std::max(-1.0f, std::min(1.0f, sample));
-    std::int16_t value = static_cast<std::int16_t>(clamped * 32767.0f);
-    write_u16(out, static_cast<std::uint16_t>(value));
+  // Convert and serialise in blocks rather than one put() per byte.
+  constexpr std::size_t kBlock = 8192;
+  std::vector<std::int16_t> pcm(kBlock);
+  std::vector<char> bytes(kBlock * 2);
+  const kernels::KernelTable &k = kernels::active();
+  for (std::size_t begin = 0; begin < audio.samples.size(); begin += kBlock) {
+    std::size_t n = std::min(kBlock, audio.samples.size() - begin);
+    k.float_to_int16(audio.samples.data() + begin, pcm.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      std::uint16_t value = static_cast<std::uint16_t>(pcm[i]);
+      bytes[2 * i] = static_cast<char>(value & 0xFF);
+      bytes[2 * i + 1] = static_cast<char>((value >> 8) & 0xFF);
+    }
+    out.write(bytes.data(), static_cast<std::streamsize>(n * 2));
   }
 
   if (!out) {
@@ -0,0 +1,293 @@
+#include "bpm/wisdom.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "bpm/audio_buffer.h"
+#include "bpm/onset_detector.h"
+#include "bpm/pipeline.h"
+#include "bpm/tempo_estimator.h"
+
+namespace bpm {
+namespace {
+
+constexpr int kRepetitions = 3;
+
+// Clicks at 120 BPM over low-level noise: enough onsets for the tempo and
+// beat stages to do their normal amount of work.
+AudioBuffer synthetic_track(int sample_rate, double duration_sec) {
+  constexpr double kPi = 3.14159265358979323846;
+  std::size_t frames = static_cast<std::size_t>(duration_sec * sample_rate);
+  std::size_t beat = static_cast<std::size_t>(sample_rate / 2);
+  std::size_t click = static_cast<std::size_t>(sample_rate / 50);
+  std::vector<float> samples(frames * 2);
+  std::uint32_t state = 12345;
+  for (std::size_t f = 0; f < frames; ++f) {
+    state = state * 1664525u + 1013904223u;
+    float noise = (static_cast<float>(state >> 8) / 16777216.0f - 0.5f) * 0.05f;
+    std::size_t phase = f % beat;
+    float tone = 0.0f;
+    if (phase < click) {
+      double t = static_cast<double>(phase) / sample_rate;
+      tone = static_cast<float>(0.6 * std::sin(2.0 * kPi * 1000.0 * t) *
+                                (1.0 - static_cast<double>(phase) / click));
+    }
+    samples[2 * f] = tone + noise;
+    samples[2 * f + 1] = tone - noise;
+  }
+  return AudioBuffer(std::move(samples), sample_rate, 2);
+}
+
+// Fastest of kRepetitions runs, in seconds.
+template <typename Fn>
+double time_best(Fn &&fn) {
+  double best = std::numeric_limits<double>::infinity();
+  for (int rep = 0; rep < kRepetitions; ++rep) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+std::string trim(const std::string &text) {
+  std::size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  std::size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+}  // namespace
+
+Wisdom Wisdom::defaults() {
+  Wisdom wisdom;
+  wisdom.cpu_level = kernels::detected_cpu_level();
+  wisdom.machine = machine_fingerprint();
+  OnsetDetector onset;
+  wisdom.fft_size = onset.fft_size();
+  wisdom.hop_size = onset.hop_size();
+  return wisdom;
+}
+
+std::string Wisdom::machine_fingerprint() {
+  return kernels::cpu_level_name(kernels::detected_cpu_level()) + "x" +
+         std::to_string(std::thread::hardware_concurrency());
+}
+
+bool Wisdom::load(const std::string &path, Wisdom &wisdom, std::string &reason) {
+  std::ifstream in(path);
+  if (!in) {
+    reason = "no wisdom file at " + path;
+    return false;
+  }
+
+  Wisdom loaded;
+  int version = 0;
+  std::string line;
+  try {
+    while (std::getline(in, line)) {
+      std::size_t hash = line.find('#');
+      if (hash != std::string::npos) {
+        line.erase(hash);
+      }
+      line = trim(line);
+      if (line.empty()) {
+        continue;
+      }
+      std::size_t eq = line.find('=');
+      if (eq == std::string::npos) {
+        reason = "malformed line in " + path + ": " + line;
+        return false;
+      }
+      std::string key = trim(line.substr(0, eq));
+      std::string value = trim(line.substr(eq + 1));
+      if (key == "version") {
+        version = std::stoi(value);
+      } else if (key == "machine") {
+        loaded.machine = value;
+      } else if (key == "fft_size") {
+        loaded.fft_size = std::stoi(value);
+      } else if (key == "hop_size") {
+        loaded.hop_size = std::stoi(value);
+      } else if (key == "sample_rate") {
+        loaded.sample_rate = std::stoi(value);
+      } else if (key == "kernels") {
+        loaded.cpu_level = kernels::parse_cpu_level(value);
+      } else if (key == "beat_dp") {
+        if (value == "exhaustive") {
+          loaded.beat_dp_search = DpSearch::EXHAUSTIVE;
+        } else if (value == "pruned") {
+          loaded.beat_dp_search = DpSearch::PRUNED;
+        } else {
+          throw std::runtime_error("unknown beat_dp value " + value);
+        }
+      } else if (key == "flac_threads") {
+        loaded.flac_parallelism.threads = static_cast<unsigned>(std::stoul(value));
+      } else if (key == "flac_blocks_per_thread") {
+        loaded.flac_parallelism.blocks_per_thread = static_cast<std::size_t>(std::stoul(value));
+      }
+      // Unknown keys are ignored so that newer files stay readable.
+    }
+  } catch (const std::exception &ex) {
+    reason = "malformed wisdom file " + path + ": " + ex.what();
+    return false;
+  }
+
+  Wisdom current = defaults();
+  if (version != kFormatVersion) {
+    reason = "wisdom file " + path + " has version " + std::to_string(version) +
+             ", expected " + std::to_string(kFormatVersion);
+    return false;
+  }
+  if (loaded.machine != current.machine) {
+    reason = "wisdom file " + path + " was tuned on " + loaded.machine + ", this machine is " +
+             current.machine;
+    return false;
+  }
+  if (loaded.fft_size != current.fft_size || loaded.hop_size != current.hop_size) {
+    reason = "wisdom file " + path + " was tuned for other analysis sizes";
+    return false;
+  }
+  wisdom = loaded;
+  return true;
+}
+
+void Wisdom::save(const std::string &path) const {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Failed to open wisdom file: " + path);
+  }
+  out << "# bpm_detect wisdom, written by --autotune\n"
+      << "version=" << kFormatVersion << "\n"
+      << "machine=" << machine << "\n"
+      << "fft_size=" << fft_size << "\n"
+      << "hop_size=" << hop_size << "\n"
+      << "sample_rate=" << sample_rate << "\n"
+      << "kernels=" << kernels::cpu_level_name(cpu_level) << "\n"
+      << "beat_dp=" << (beat_dp_search == DpSearch::PRUNED ? "pruned" : "exhaustive") << "\n"
+      << "flac_threads=" << flac_parallelism.threads << "\n"
+      << "flac_blocks_per_thread=" << flac_parallelism.blocks_per_thread << "\n";
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed to write wisdom file: " + path);
+  }
+}
+
+Wisdom Wisdom::autotune(const std::string &scratch_path, int sample_rate, double duration_sec,
+                        bool verbose) {
+  Wisdom wisdom = defaults();
+  wisdom.sample_rate = sample_rate;
+  kernels::CpuLevel initial_level = kernels::active().level;
+
+  AudioBuffer stereo = synthetic_track(sample_rate, duration_sec);
+  AudioBuffer mono = stereo.to_mono();
+  OnsetDetector onset_detector;
+  TempoEstimator tempo_estimator;
+
+  // Kernel levels: the onset, tempo and beat stages are where they run.
+  double best_time = std::numeric_limits<double>::infinity();
+  for (kernels::CpuLevel level :
+       {kernels::CpuLevel::BASELINE, kernels::CpuLevel::AVX2, kernels::CpuLevel::AVX512}) {
+    try {
+      kernels::set_cpu_level(level);
+    } catch (const std::exception &) {
+      continue;  // not built or not supported here
+    }
+    double seconds = time_best([&] {
+      auto onset = onset_detector.compute(mono);
+      auto tempo = tempo_estimator.estimate(onset.onset_strength, mono.sample_rate,
+                                            onset.hop_size);
+      BeatTracker().track(onset.onset_strength, tempo.period_frames, onset.hop_size);
+    });
+    if (verbose) {
+      std::cout << "  kernels=" << kernels::cpu_level_name(level) << ": " << seconds << " s\n";
+    }
+    if (seconds < best_time) {
+      best_time = seconds;
+      wisdom.cpu_level = level;
+    }
+  }
+  kernels::set_cpu_level(wisdom.cpu_level);
+
+  // Beat DP search over every tempo candidate, as the pipeline runs it.
+  auto onset = onset_detector.compute(mono);
+  auto tempo = tempo_estimator.estimate(onset.onset_strength, mono.sample_rate, onset.hop_size);
+  best_time = std::numeric_limits<double>::infinity();
+  for (DpSearch search : {DpSearch::EXHAUSTIVE, DpSearch::PRUNED}) {
+    BeatTracker tracker(search);
+    double seconds = time_best([&] {
+      for (int candidate : tempo.candidate_periods) {
+        tracker.track(onset.onset_strength, candidate, onset.hop_size);
+      }
+    });
+    if (verbose) {
+      std::cout << "  beat_dp=" << (search == DpSearch::PRUNED ? "pruned" : "exhaustive")
+                << ": " << seconds << " s\n";
+    }
+    if (seconds < best_time) {
+      best_time = seconds;
+      wisdom.beat_dp_search = search;
+    }
+  }
+
+  // FLAC encoder threads (powers of two up to the hardware count, plus the
+  // count itself) against blocks per thread per batch.
+  unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> thread_counts;
+  for (unsigned t = 1; t < hw; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(hw);
+  best_time = std::numeric_limits<double>::infinity();
+  try {
+    for (unsigned threads : thread_counts) {
+      for (std::size_t blocks : {4, 16, 64}) {
+        FlacParallelism parallelism;
+        parallelism.threads = threads;
+        parallelism.blocks_per_thread = blocks;
+        double seconds = time_best([&] { FlacWriter::write(scratch_path, stereo, parallelism); });
+        if (verbose) {
+          std::cout << "  flac_threads=" << threads << " flac_blocks_per_thread=" << blocks
+                    << ": " << seconds << " s\n";
+        }
+        if (seconds < best_time) {
+          best_time = seconds;
+          wisdom.flac_parallelism = parallelism;
+        }
+      }
+    }
+  } catch (...) {
+    std::remove(scratch_path.c_str());
+    kernels::set_cpu_level(initial_level);
+    throw;
+  }
+  std::remove(scratch_path.c_str());
+
+  kernels::set_cpu_level(initial_level);
+  return wisdom;
+}
+
+void Wisdom::apply(PipelineOptions &options, bool set_kernels, bool set_dp) const {
+  if (set_kernels) {
+    kernels::set_cpu_level(cpu_level);
+  }
+  if (set_dp) {
+    options.beat_dp_search = beat_dp_search;
+    options.beat_dp_tolerance = 0.0;
+  }
+  options.flac_parallelism = flac_parallelism;
+}
+
+}  // namespace bpm
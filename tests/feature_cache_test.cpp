@@ -0,0 +1,96 @@
+// Checks that the feature cache survives a trimmed intro: the onset and key
+// detectors run over a synthetic track with a cache, then over the same
+// track with its head cut by a whole number of key hops.  Content-defined
+// chunks must line up again after the cut, so most chunks of the second
+// run hit, and its results must equal an uncached run.
+
+#include "bpm/feature_cache.h"
+#include "bpm/key_detector.h"
+#include "bpm/onset_detector.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+// Decaying notes over a noise floor, so no two hops are alike.
+bpm::AudioBuffer synth_track(int sample_rate, double seconds) {
+  std::size_t frames = static_cast<std::size_t>(seconds * sample_rate);
+  std::vector<float> samples(frames);
+  const double notes[] = {220.0, 277.18, 329.63, 440.0, 369.99, 293.66};
+  std::size_t note_len = static_cast<std::size_t>(0.25 * sample_rate);
+  unsigned noise = 2463534242u;
+  for (std::size_t i = 0; i < frames; ++i) {
+    double t = static_cast<double>(i % note_len) / sample_rate;
+    double f = notes[(i / note_len) % 6];
+    noise ^= noise << 13;
+    noise ^= noise >> 17;
+    noise ^= noise << 5;
+    double hiss = (static_cast<double>(noise & 0xFFFF) / 65535.0 - 0.5) * 0.05;
+    samples[i] = static_cast<float>(0.6 * std::exp(-t * 6.0) * std::sin(2.0 * M_PI * f * t) + hiss);
+  }
+  return bpm::AudioBuffer(std::move(samples), sample_rate, 1);
+}
+
+bool check_hits(const char *what, const bpm::FeatureCache &cache) {
+  std::uint64_t total = cache.hits() + cache.misses();
+  std::printf("%s: %llu of %llu chunks hit\n", what, static_cast<unsigned long long>(cache.hits()),
+              static_cast<unsigned long long>(total));
+  // Only the chunks up to the first anchor after the cut may miss.
+  if (total == 0 || cache.hits() * 10 < total * 7) {
+    std::fprintf(stderr, "%s: too few cache hits after trimming the intro\n", what);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const char *temp_dir = std::getenv("TMPDIR");
+  std::filesystem::path dir = std::filesystem::path(temp_dir && *temp_dir ? temp_dir : "/tmp") /
+                              ("bpm_feature_cache_test_" + std::to_string(::getpid()));
+  std::filesystem::remove_all(dir);
+
+  const int sample_rate = 22050;
+  bpm::AudioBuffer track = synth_track(sample_rate, 90.0);
+  std::size_t cut = 7 * 4096;  // a whole number of onset and key hops
+  std::vector<float> tail(track.samples.begin() + static_cast<std::ptrdiff_t>(cut),
+                         track.samples.end());
+  bpm::AudioBuffer trimmed(std::move(tail), sample_rate, 1);
+
+  bpm::OnsetDetector onset_detector;
+  bpm::KeyDetector key_detector;
+  {
+    bpm::FeatureCache cache(dir.string());
+    onset_detector.compute(track, &cache);
+    key_detector.detect(track, false, &cache);
+  }
+
+  int failures = 0;
+  bpm::FeatureCache onset_cache(dir.string());
+  auto onset_cached = onset_detector.compute(trimmed, &onset_cache);
+  failures += check_hits("onset", onset_cache) ? 0 : 1;
+  if (onset_cached.onset_strength != onset_detector.compute(trimmed).onset_strength) {
+    std::fprintf(stderr, "onset: cached envelope differs from an uncached run\n");
+    ++failures;
+  }
+
+  bpm::FeatureCache key_cache(dir.string());
+  auto key_cached = key_detector.detect(trimmed, false, &key_cache);
+  failures += check_hits("key", key_cache) ? 0 : 1;
+  auto key_plain = key_detector.detect(trimmed);
+  if (key_cached.label != key_plain.label || key_cached.correlation != key_plain.correlation) {
+    std::fprintf(stderr, "key: cached result differs from an uncached run\n");
+    ++failures;
+  }
+
+  std::filesystem::remove_all(dir);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+// Checks reduced-rate MP3 decoding against the reference it stands in for:
+// every minimp3 conformance vector that decodes in full is also decoded at
+// a half and a quarter of its rate, and compared with the full decode run
+// through a long windowed-sinc lowpass at the new Nyquist frequency and
+// decimated.  Below 0.8 of the new Nyquist the difference must stay 90 dB
+// under the reference.  The top of the band is not checked: the lowest
+// dropped subband's filter overlaps the highest kept one there, and what
+// it would have cancelled aliases.
+
+#include "bpm/mp3_decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr std::size_t kSegment = 1024;
+constexpr double kBandEdge = 0.8;
+constexpr double kMaxDifferenceDb = -90.0;
+
+// Streams with frames that do not decode.  The full decode splices the
+// frames around a bad one together, and the click at the splice reaches
+// far above the new Nyquist; the lowpass removes that part and the reduced
+// decode aliases it, so these differ by design.
+const char *const kSpliced[] = {
+    "l2-nonstandard-test32-size.bit",
+    "l3-nonstandard-compl-sideinfo-bigvalues.bit",
+    "l3-nonstandard-compl-sideinfo-blocktype.bit",
+    "l3-nonstandard-compl-sideinfo-size.bit",
+};
+
+void fft(std::vector<std::complex<double>> &a) {
+  std::size_t n = a.size();
+  for (std::size_t i = 1, j = 0; i < n; ++i) {
+    std::size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(a[i], a[j]);
+    }
+  }
+  for (std::size_t len = 2; len <= n; len <<= 1) {
+    std::complex<double> step = std::polar(1.0, -2.0 * kPi / static_cast<double>(len));
+    for (std::size_t i = 0; i < n; i += len) {
+      std::complex<double> w(1.0);
+      for (std::size_t j = 0; j < len / 2; ++j) {
+        std::complex<double> u = a[i + j];
+        std::complex<double> v = a[i + j + len / 2] * w;
+        a[i + j] = u + v;
+        a[i + j + len / 2] = u - v;
+        w *= step;
+      }
+    }
+  }
+}
+
+// Welch estimate of the power below kBandEdge of Nyquist: Hann-windowed
+// segments of kSegment samples, half overlapped.
+double in_band_power(const std::vector<double> &x) {
+  std::size_t edge = static_cast<std::size_t>(kBandEdge * (kSegment / 2));
+  double power = 0.0;
+  std::vector<std::complex<double>> a(kSegment);
+  for (std::size_t start = 0; start + kSegment <= x.size(); start += kSegment / 2) {
+    for (std::size_t i = 0; i < kSegment; ++i) {
+      double w = 0.5 - 0.5 * std::cos(2.0 * kPi * static_cast<double>(i) / (kSegment - 1));
+      a[i] = x[start + i] * w;
+    }
+    fft(a);
+    for (std::size_t k = 0; k < edge; ++k) {
+      power += std::norm(a[k]);
+    }
+  }
+  return power;
+}
+
+// Difference below the band edge relative to the reference, in dB, worst
+// channel.  `offset` shifts the reference by stream-rate samples: the
+// encoder delay of a LAME/Xing tag is trimmed to the nearest reduced-rate
+// sample, which can move the output by up to half of one.
+double difference_db(const bpm::AudioBuffer &full, const bpm::AudioBuffer &reduced, int divisor,
+                     const std::vector<double> &taps, long offset) {
+  std::size_t channels = static_cast<std::size_t>(full.channels);
+  std::size_t full_frames = full.samples.size() / channels;
+  std::size_t frames = std::min(reduced.samples.size() / channels,
+                                full_frames / static_cast<std::size_t>(divisor));
+  long half = static_cast<long>(taps.size() / 2);
+  double worst = -HUGE_VAL;
+  for (std::size_t c = 0; c < channels; ++c) {
+    std::vector<double> reference(frames), difference(frames);
+    for (std::size_t j = 0; j < frames; ++j) {
+      long center = static_cast<long>(j) * divisor + offset;
+      double acc = 0.0;
+      for (std::size_t t = 0; t < taps.size(); ++t) {
+        long i = center + static_cast<long>(t) - half;
+        if (i >= 0 && static_cast<std::size_t>(i) < full_frames) {
+          acc += taps[t] * full.samples[static_cast<std::size_t>(i) * channels + c];
+        }
+      }
+      reference[j] = acc;
+      difference[j] = reduced.samples[j * channels + c] - acc;
+    }
+    double signal = in_band_power(reference);
+    double error = in_band_power(difference);
+    if (error > 0.0) {
+      worst = std::max(worst, 10.0 * std::log10(error / std::max(signal, 1e-30)));
+    }
+  }
+  return worst;
+}
+
+// 1023-tap Blackman-windowed sinc with its cutoff at the new Nyquist.
+std::vector<double> lowpass(int divisor) {
+  constexpr int kTaps = 1023;
+  double cutoff = 0.5 / divisor;
+  std::vector<double> taps(kTaps);
+  for (int i = 0; i < kTaps; ++i) {
+    int m = i - kTaps / 2;
+    double sinc = m == 0 ? 2.0 * cutoff : std::sin(2.0 * kPi * cutoff * m) / (kPi * m);
+    double phase = 2.0 * kPi * i / (kTaps - 1);
+    taps[static_cast<std::size_t>(i)] =
+        sinc * (0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2.0 * phase));
+  }
+  return taps;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::fprintf(stderr, "usage: mp3_reduced_test <minimp3 vectors directory>\n");
+    return 2;
+  }
+  std::vector<std::filesystem::path> vectors;
+  for (const auto &entry : std::filesystem::directory_iterator(argv[1])) {
+    std::string name = entry.path().filename().string();
+    if (entry.path().extension() != ".bit" ||
+        std::find(std::begin(kSpliced), std::end(kSpliced), name) != std::end(kSpliced)) {
+      continue;
+    }
+    vectors.push_back(entry.path());
+  }
+  std::sort(vectors.begin(), vectors.end());
+
+  const std::vector<double> taps[] = {lowpass(2), lowpass(4)};
+  int checked = 0;
+  int failed = 0;
+  for (const auto &path : vectors) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(in)),
+                                    std::istreambuf_iterator<char>());
+    bpm::AudioBuffer full;
+    try {
+      full = bpm::Mp3Decoder::decode(bytes.data(), bytes.size());
+    } catch (const std::exception &) {
+      // Empty, truncated or format-changing streams: nothing to compare.
+      continue;
+    }
+    for (int divisor : {2, 4}) {
+      bpm::Mp3Decoder::ReducedRate rate;
+      rate.divisor = divisor;
+      bpm::AudioBuffer reduced = bpm::Mp3Decoder::decode(bytes.data(), bytes.size(), rate);
+      if (reduced.sample_rate * divisor != full.sample_rate ||
+          reduced.channels != full.channels || reduced.num_frames() < kSegment) {
+        continue;
+      }
+      const std::vector<double> &filter = taps[divisor == 2 ? 0 : 1];
+      double best = difference_db(full, reduced, divisor, filter, 0);
+      for (long offset = -divisor / 2; offset <= divisor / 2 && best > kMaxDifferenceDb;
+           ++offset) {
+        if (offset != 0) {
+          best = std::min(best, difference_db(full, reduced, divisor, filter, offset));
+        }
+      }
+      ++checked;
+      std::printf("%s /%d: %.1f dB\n", path.filename().c_str(), divisor, best);
+      if (best > kMaxDifferenceDb) {
+        std::fprintf(stderr, "%s /%d: difference %.1f dB is above %.1f dB\n",
+                     path.filename().c_str(), divisor, best, kMaxDifferenceDb);
+        ++failed;
+      }
+    }
+  }
+  if (checked == 0) {
+    std::fprintf(stderr, "no vectors found in %s\n", argv[1]);
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Checks the onset detector's sub-band envelopes: with split frequencies
+// {150, 2000} it must return three bands whose flux adds up, frame by
+// frame, to the full envelope's, and on a synthetic track of alternating
+// kick drums and hi-hats the low band must respond to the kicks and the
+// high band to the hi-hats, each several times more than to the other.
+
+#include "bpm/onset_detector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr int kSampleRate = 44100;
+constexpr double kBeatSec = 0.5;
+
+// A decaying 60 Hz kick on every beat and a burst of differentiated noise,
+// which has most of its energy above 2 kHz, halfway between beats, over a
+// steady noise floor so that quiet mel bands do not swing in log scale.
+bpm::AudioBuffer synth_track(double seconds) {
+  std::size_t frames = static_cast<std::size_t>(seconds * kSampleRate);
+  std::size_t beat = static_cast<std::size_t>(kBeatSec * kSampleRate);
+  std::vector<float> samples(frames);
+  unsigned noise = 2463534242u;
+  double prev = 0.0;
+  for (std::size_t i = 0; i < frames; ++i) {
+    double t = static_cast<double>(i % beat) / kSampleRate;
+    double kick = 0.8 * std::exp(-t * 12.0) * std::sin(2.0 * M_PI * 60.0 * t);
+    noise ^= noise << 13;
+    noise ^= noise >> 17;
+    noise ^= noise << 5;
+    double white = static_cast<double>(noise & 0xFFFF) / 65535.0 - 0.5;
+    double th = t - kBeatSec / 2;
+    double hat = th >= 0.0 ? 0.6 * std::exp(-th * 40.0) * (white - prev) : 0.0;
+    prev = white;
+    samples[i] = static_cast<float>(kick + hat + 0.05 * white);
+  }
+  return bpm::AudioBuffer(std::move(samples), kSampleRate, 1);
+}
+
+}  // namespace
+
+int main() {
+  int failed = 0;
+  bpm::AudioBuffer track = synth_track(8.0);
+
+  if (bpm::OnsetDetector().compute(track).num_bands != 0) {
+    std::fprintf(stderr, "detector without splits returned sub-bands\n");
+    ++failed;
+  }
+
+  const int kBands = 3;
+  bpm::OnsetDetector detector({150.0f, 2000.0f});
+  bpm::OnsetDetector::Session session(detector, track);
+  while (!session.done()) {
+    session.advance();
+  }
+  // The snapshot holds the flux as accumulated, before normalization.
+  bpm::OnsetDetector::Session::Snapshot raw = session.snapshot();
+  std::size_t frames = raw.onset_strength.size();
+  if (raw.band_flux.size() != kBands * frames) {
+    std::fprintf(stderr, "band flux has %zu values, expected %d x %zu\n", raw.band_flux.size(),
+                 kBands, frames);
+    return 1;
+  }
+
+  for (std::size_t f = 0; f < frames; ++f) {
+    double sum = 0.0;
+    for (int k = 0; k < kBands; ++k) {
+      sum += raw.band_flux[static_cast<std::size_t>(k) * frames + f];
+    }
+    double full = raw.onset_strength[f];
+    if (std::fabs(sum - full) > 1e-4 * std::max(1.0, std::fabs(full))) {
+      std::fprintf(stderr, "frame %zu: bands sum to %g, full envelope is %g\n", f, sum, full);
+      ++failed;
+      break;
+    }
+  }
+
+  // Flux per band at each kick and each hi-hat: the frame around its onset
+  // where the full envelope peaks.
+  double kick_flux[kBands] = {}, hat_flux[kBands] = {};
+  std::size_t hop = static_cast<std::size_t>(detector.hop_size());
+  std::size_t half_beat = static_cast<std::size_t>(kBeatSec / 2 * kSampleRate);
+  for (std::size_t onset = 0, n = 0; onset + detector.fft_size() < track.num_frames();
+       onset += half_beat, ++n) {
+    // Frames starting up to a window before the onset see it.
+    std::size_t first = onset / hop > 4 ? onset / hop - 4 : 0;
+    std::size_t peak = first;
+    for (std::size_t f = first; f <= onset / hop + 1 && f < frames; ++f) {
+      if (raw.onset_strength[f] > raw.onset_strength[peak]) {
+        peak = f;
+      }
+    }
+    double *flux = n % 2 == 0 ? kick_flux : hat_flux;
+    for (int k = 0; k < kBands; ++k) {
+      flux[k] += raw.band_flux[static_cast<std::size_t>(k) * frames + peak];
+    }
+  }
+  std::printf("kick flux per band: %.1f %.1f %.1f\n", kick_flux[0], kick_flux[1], kick_flux[2]);
+  std::printf("hi-hat flux per band: %.1f %.1f %.1f\n", hat_flux[0], hat_flux[1], hat_flux[2]);
+  // A kick's low end leaks into the lower mel bands of the middle band in
+  // log scale, so each band is checked against the other drum instead.
+  if (kick_flux[0] <= 4.0 * hat_flux[0]) {
+    std::fprintf(stderr, "low band does not respond to kicks more than to hi-hats\n");
+    ++failed;
+  }
+  if (hat_flux[2] <= 4.0 * kick_flux[2]) {
+    std::fprintf(stderr, "high band does not respond to hi-hats more than to kicks\n");
+    ++failed;
+  }
+
+  bpm::OnsetDetector::Result result = session.finish();
+  if (result.num_bands != kBands || result.band_flux.size() != kBands * frames) {
+    std::fprintf(stderr, "finish() returned %d bands\n", result.num_bands);
+    ++failed;
+  }
+  return failed ? 1 : 0;
+}
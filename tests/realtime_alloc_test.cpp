@@ -0,0 +1,125 @@
+// Checks that RealtimeBeatTracker::process() never allocates: malloc and
+// the global operator new are interposed, and any call made on a thread
+// whose trap is armed (only around process()) is counted as a failure.
+// Several seconds of a click track go through each of several block
+// sizes, long enough for the tempo to lock and beats to be emitted.
+
+#include "bpm/realtime_beat_tracker.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+extern "C" void *__libc_malloc(std::size_t size);
+extern "C" void *__libc_calloc(std::size_t count, std::size_t size);
+extern "C" void *__libc_realloc(void *ptr, std::size_t size);
+
+namespace {
+
+thread_local bool t_armed = false;
+std::atomic<int> g_trapped{0};
+
+void note_allocation() {
+  if (t_armed) {
+    g_trapped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void *allocate(std::size_t size) {
+  note_allocation();
+  void *p = __libc_malloc(size == 0 ? 1 : size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+}  // namespace
+
+extern "C" void *malloc(std::size_t size) {
+  note_allocation();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(std::size_t count, std::size_t size) {
+  note_allocation();
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, std::size_t size) {
+  note_allocation();
+  return __libc_realloc(ptr, size);
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  note_allocation();
+  return __libc_malloc(size == 0 ? 1 : size);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  note_allocation();
+  return __libc_malloc(size == 0 ? 1 : size);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+int main() {
+  constexpr int kSampleRate = 44100;
+  constexpr int kChannels = 2;
+  constexpr double kSeconds = 12.0;
+  constexpr double kBpm = 120.0;
+
+  // Decaying 1 kHz clicks on every beat over low-level noise.
+  std::size_t frames = static_cast<std::size_t>(kSeconds * kSampleRate);
+  std::vector<float> audio(frames * kChannels);
+  std::size_t beat_period = static_cast<std::size_t>(60.0 / kBpm * kSampleRate);
+  unsigned noise = 12345;
+  for (std::size_t i = 0; i < frames; ++i) {
+    double t = static_cast<double>(i % beat_period) / kSampleRate;
+    double click = std::exp(-t * 60.0) * std::sin(2.0 * 3.14159265358979 * 1000.0 * t);
+    noise = noise * 1103515245u + 12345u;
+    double hiss = (static_cast<double>((noise >> 8) & 0xFFFF) / 65535.0 - 0.5) * 0.02;
+    for (int c = 0; c < kChannels; ++c) {
+      audio[i * kChannels + static_cast<std::size_t>(c)] = static_cast<float>(0.8 * click + hiss);
+    }
+  }
+
+  int failures = 0;
+  for (std::size_t block : {32u, 64u, 256u, 441u, 512u, 1024u, 4096u}) {
+    bpm::RealtimeBeatTracker::Config config;
+    config.sample_rate = kSampleRate;
+    config.channels = kChannels;
+    bpm::RealtimeBeatTracker tracker(config);
+
+    std::size_t beats = 0;
+    g_trapped.store(0);
+    for (std::size_t pos = 0; pos < frames; pos += block) {
+      std::size_t n = std::min(block, frames - pos);
+      t_armed = true;
+      tracker.process(audio.data() + pos * kChannels, n);
+      t_armed = false;
+      bpm::RealtimeBeatTracker::BeatEvent event;
+      while (tracker.pop_event(event)) {
+        ++beats;
+      }
+    }
+    int trapped = g_trapped.load();
+    std::printf("block %zu: %d allocations, %zu beats, %.2f BPM\n", block, trapped, beats,
+                static_cast<double>(tracker.current_bpm()));
+    if (trapped != 0) {
+      std::fprintf(stderr, "process() allocated with %zu-frame blocks\n", block);
+      ++failures;
+    }
+    if (beats == 0) {
+      std::fprintf(stderr, "no beats reported with %zu-frame blocks\n", block);
+      ++failures;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
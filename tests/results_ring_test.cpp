@@ -0,0 +1,133 @@
+// Stress check for ResultsRingWriter/Reader: several writers publish into a
+// two-slot ring, so writers n and n + 2 contend for the same slot, while
+// readers copy every resident record.  Every record a reader accepts must be
+// the one its writer produced in full; a torn mix of two records fails the
+// test.
+
+#include "bpm/results_ring.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kWriters = 8;
+constexpr int kReaders = 2;
+constexpr int kPublishesPerWriter = 20000;
+
+// Every field that can be checked carries the same tag.
+void fill(bpm::ResultRecord &record, std::uint64_t tag) {
+  record.num_frames = tag;
+  record.bpm = static_cast<float>(tag % 1000);
+  record.num_beats = static_cast<std::uint32_t>(bpm::ResultRecord::kMaxBeats);
+  record.num_downbeats = static_cast<std::uint32_t>(bpm::ResultRecord::kMaxDownbeats);
+  std::snprintf(record.source, sizeof(record.source), "%llu",
+                static_cast<unsigned long long>(tag));
+  for (auto &beat : record.beat_samples) {
+    beat = tag;
+  }
+  for (auto &downbeat : record.downbeat_samples) {
+    downbeat = tag;
+  }
+}
+
+bool consistent(const bpm::ResultRecord &record) {
+  std::uint64_t tag = record.num_frames;
+  if (record.bpm != static_cast<float>(tag % 1000) ||
+      std::to_string(tag) != record.source) {
+    return false;
+  }
+  for (auto beat : record.beat_samples) {
+    if (beat != tag) {
+      return false;
+    }
+  }
+  for (auto downbeat : record.downbeat_samples) {
+    if (downbeat != tag) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  std::string name = "/bpm_results_ring_test_" + std::to_string(::getpid());
+  bpm::ResultsRingWriter::unlink(name);
+
+  std::vector<std::unique_ptr<bpm::ResultsRingWriter>> writers;
+  for (int w = 0; w < kWriters; ++w) {
+    writers.push_back(std::make_unique<bpm::ResultsRingWriter>(name, 2));
+  }
+  bpm::ResultsRingReader probe(name);
+  if (probe.slot_count() != 2) {
+    std::fprintf(stderr, "expected a two-slot ring, got %u\n", probe.slot_count());
+    bpm::ResultsRingWriter::unlink(name);
+    return 1;
+  }
+
+  std::atomic<bool> writing{true};
+  std::atomic<std::uint64_t> accepted{0};
+  std::atomic<std::uint64_t> torn{0};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaders; ++r) {
+    readers.emplace_back([&] {
+      bpm::ResultsRingReader reader(name);
+      auto record = std::make_unique<bpm::ResultRecord>();
+      while (writing.load()) {
+        std::uint64_t head = reader.head();
+        for (std::uint64_t sequence = reader.oldest(); sequence < head; ++sequence) {
+          if (reader.read(sequence, *record) != bpm::ResultsRingReader::Status::OK) {
+            continue;
+          }
+          if (record->sequence != sequence || !consistent(*record)) {
+            torn.fetch_add(1);
+          } else {
+            accepted.fetch_add(1);
+          }
+        }
+      }
+    });
+  }
+
+  std::vector<std::thread> threads;
+  for (int w = 0; w < kWriters; ++w) {
+    threads.emplace_back([&, w] {
+      auto record = std::make_unique<bpm::ResultRecord>();
+      for (int i = 0; i < kPublishesPerWriter; ++i) {
+        fill(*record, (static_cast<std::uint64_t>(w) << 32) | static_cast<std::uint64_t>(i));
+        writers[static_cast<std::size_t>(w)]->publish(*record);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  writing.store(false);
+  for (auto &thread : readers) {
+    thread.join();
+  }
+  bpm::ResultsRingWriter::unlink(name);
+
+  std::printf("accepted %llu records, %llu torn\n",
+              static_cast<unsigned long long>(accepted.load()),
+              static_cast<unsigned long long>(torn.load()));
+  if (torn.load() != 0) {
+    std::fprintf(stderr, "reader accepted a torn record\n");
+    return 1;
+  }
+  if (accepted.load() == 0) {
+    std::fprintf(stderr, "no record was read\n");
+    return 1;
+  }
+  return 0;
+}